@@ -0,0 +1,170 @@
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "ipc/shm/segment.h"
+
+using namespace ipc;
+
+namespace blob {
+
+// Names a block of an arena, sent in place of the payload
+struct Descriptor {
+    uint64_t offset;     // Of the block from the start of the arena
+    uint64_t length;     // Of the payload
+    uint32_t generation; // Of the allocation, a stale descriptor does not resolve
+    uint32_t epoch;      // Of the arena, descriptors of an arena that has been replaced do not resolve
+};
+
+// Named shared memory arena with a buddy allocator shared by all processes mapping it
+// Blocks are powers of two with a 64-byte header, the free lists are guarded by a robust process-shared mutex
+// The mapping is reference counted, Buffers referring to a block keep it alive after the Node is gone
+class Arena {
+public:
+    static constexpr uint32_t MIN_ORDER = 12; // 4 KiB blocks
+
+    // Create the arena of a kReceiver, an existing one is kept by kReattach so that pending descriptors resolve
+    static Arena* Create(const std::string& name, size_t bytes, HugePages huge_pages, RecoveryPolicy recovery);
+    // Map the arena of a kSender, nullptr if there is none yet
+    static Arena* Open(const std::string& name);
+
+    void Ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void Unref();
+
+    // Allocate a block for size bytes, nullptr if no block is free
+    void* Allocate(size_t size, Descriptor& descriptor);
+    void Free(void* payload);
+    // Bumped by every Free(), read it before an Allocate() that may fail
+    uint32_t FreedSeq() const;
+    // Sleep until a block has been freed since FreedSeq() returned seq, the arena is closed or timeout expires
+    void WaitFreed(uint32_t seq, const struct timespec* timeout);
+    // Payload of a descriptor, nullptr if it does not name a block allocated from this arena
+    void* Resolve(const Descriptor& descriptor);
+
+    // Marks the arena replaced, senders then open the new one
+    void Close();
+    bool Closed() const;
+    size_t MaxBlobSize() const;
+    size_t Bytes() const;
+    size_t PageSize() const { return segment_.PageSize(); }
+
+private:
+    static constexpr uint32_t MAGIC = 0x49504242; // "IPBB"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t NONE = UINT64_MAX;
+    static constexpr size_t ORDERS = 64;
+
+    struct alignas(64) Header {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t epoch;
+        uint32_t max_order;     // The whole arena is one block of this order
+        uint64_t blocks_offset; // From the start of the segment
+        std::atomic<uint32_t> closed;
+
+        // Guarded by mutex
+        pthread_mutex_t mutex;
+        uint32_t generation;
+        uint64_t free_lists[ORDERS]; // Offset of the first free block of every order
+
+        // Senders waiting for room sleep on freed_seq
+        alignas(64) std::atomic<uint32_t> freed_seq;
+        std::atomic<uint32_t> waiters;
+    };
+
+    struct alignas(64) Block {
+        uint32_t used;
+        uint32_t order;
+        uint64_t next; // Free list links while free
+        uint64_t prev;
+        uint64_t length;
+        uint32_t generation;
+    };
+
+    shm::Segment segment_;
+    Header* header_ = nullptr;
+    std::atomic<size_t> refs_ { 1 };
+
+    Arena() = default;
+    bool Init(uint32_t max_order);
+    bool Attach();
+    Block* BlockAt(uint64_t offset) const;
+    // Take the mutex, recovering it from a process that died holding it
+    void Lock();
+    // Free list updates, with the mutex held
+    void Push(uint64_t offset, uint32_t order);
+    void Unlink(uint64_t offset);
+};
+
+// Moves large payloads of the underlying channel out of band
+// Every message carries a trailer telling whether it holds the payload itself or the descriptor of a block
+// A full arena applies the backpressure policy of the Node, kDropOldest waits like kBlock since blocks
+// cannot be evicted. Blocks of messages the transport drops or that are never received are not reclaimed
+// until a receiver creates the arena again
+class BlobChannel final : public Channel {
+public:
+    static constexpr size_t DEFAULT_ARENA_BYTES = 64 * 1024 * 1024;
+
+    BlobChannel(std::shared_ptr<Channel> channel, std::string name, NodeType ntype, key_t key,
+        const ChannelOptions& options);
+    ~BlobChannel();
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override;
+    bool Closed() const override { return channel_->Closed(); }
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override { return channel_->Stats(); }
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    SendResult Flush() override { return channel_->Flush(); }
+
+private:
+    static constexpr uint32_t TRAILER_MAGIC = 0x424C4F42; // "BLOB"
+
+    enum class Kind : uint32_t {
+        kInline, // The payload precedes the trailer
+        kBlob    // A Descriptor precedes the trailer
+    };
+
+    struct Trailer {
+        Kind kind;
+        uint32_t magic;
+    };
+
+    const std::shared_ptr<Channel> channel_;
+    const std::string name_;
+    const std::string arena_name_;
+    const NodeType node_type_;
+    ChannelOptions options_; // Effective options
+
+    // The arena in use, fixed for the kReceiver. Senders open it on their first large Send and again
+    // once the receiver replaced it, under connect_mutex_
+    std::atomic<Arena*> arena_ { nullptr };
+    std::vector<Arena*> retired_; // kSender: replaced arenas, other threads may still be writing into them
+    mutable std::mutex connect_mutex_;
+    std::atomic<size_t> inline_limit_ { 0 }; // Learned from the underlying channel once it reports a limit
+
+    Arena* Connect();
+    // Largest payload sent inline, 0 while the underlying channel does not know its limit
+    size_t InlineLimit();
+    SendResult SendInline(const iovec* iov, size_t iovcnt);
+    SendResult SendBlob(const iovec* iov, size_t iovcnt, size_t size);
+    // Allocate a block applying the backpressure policy
+    SendStatus Allocate(Arena* arena, size_t size, void*& payload, Descriptor& descriptor);
+};
+
+} // namespace blob
+#endif // _WIN32
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+namespace coalesce {
+
+// Packs the small messages of a chatty sender into frames of the underlying channel, Nagle-style
+// A frame is a sequence of records, each a 4-byte size followed by the payload, and holds up to
+// coalesce_bytes of records. A frame is sent once it is full, once its oldest message has waited
+// coalesce_delay, or on Flush(). The receiver splits frames back into messages
+// Every message on the channel is framed, so both ends must enable coalescing
+class CoalescingChannel final : public Channel {
+public:
+    CoalescingChannel(std::shared_ptr<Channel> channel, NodeType ntype, const ChannelOptions& options);
+    ~CoalescingChannel();
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override;
+    bool Closed() const override { return channel_->Closed(); }
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override { return channel_->Stats(); }
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    SendResult Flush() override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t);
+
+    const std::shared_ptr<Channel> channel_;
+    const NodeType node_type_;
+    size_t frame_size_ = 0;       // Largest frame, the threshold clamped to the underlying channel
+    size_t max_message_size_ = 0; // Largest message, which has to fit into a frame on its own
+    bool limits_known_ = false;   // The underlying channel reported its maximum message size
+    std::chrono::microseconds delay_;
+
+    // kSender
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<char> frame_;
+    Clock::time_point oldest_;              // When the first message of frame_ was added
+    SendStatus deferred_ = SendStatus::kOk; // Failure of a frame sent by the timer
+    bool stopping_ = false;
+    std::thread timer_;
+
+    // kReceiver
+    std::deque<Buffer> unpacked_; // Messages of the last frame not received yet
+
+    // Derive the frame and message limits from the underlying channel, with mutex_ held
+    void UpdateLimits(size_t coalesce_bytes);
+    // Send frame_ with mutex_ held
+    SendStatus FlushLocked();
+    // Body of the thread sending frames whose oldest message is due
+    void Timer();
+    // Receive the next frame and split it into unpacked_
+    bool Unpack();
+};
+
+} // namespace coalesce
@@ -0,0 +1,153 @@
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "ipc/shm/segment.h"
+
+using namespace ipc;
+
+namespace conflate {
+
+// Latest value per key in a shared memory table, for state such as prices, positions or configuration
+// where only the current value matters. A write replaces the value of its key in place, so memory is
+// bounded by the number of keys and a burst of updates never queues up
+// Every key has a slot guarded by a seqlock: writers of the same key take turns, readers copy the value
+// and retry if a writer got in between, they never hold writers up. Keys are never removed
+// The first kReceiver creates the table sized by ChannelOptions::capacity_messages keys of
+// max_message_size bytes, further kReceivers read the same table, kSenders open it on their first write
+// A writer that dies in the middle of a write leaves its key unreadable until the next write, which takes
+// the key over. Readers and writers give up on a key held longer than LOCK_TIMEOUT
+//
+//   conflate::LastValueTable prices("Prices", ipc::NodeType::kReceiver);
+//   std::vector<uint64_t> keys;
+//   while (prices.Wait(std::chrono::seconds(1)))
+//       for (uint64_t key : prices.Changes(keys)) prices.Read(key, value);
+class LastValueTable {
+public:
+    static constexpr size_t DEFAULT_KEYS = 1024;
+    static constexpr size_t DEFAULT_VALUE_SIZE = 256;
+    static constexpr std::chrono::milliseconds LOCK_TIMEOUT { 100 };
+
+    LastValueTable(std::string name, NodeType ntype, const ChannelOptions& options = ChannelOptions());
+    ~LastValueTable();
+
+    // Disable copy constructor and assignment operator
+    LastValueTable(const LastValueTable&) = delete;
+    LastValueTable& operator=(const LastValueTable&) = delete;
+
+    // kSender: replace the value of key, kWouldBlock if every slot holds another key
+    // kError if another writer holds the key for LOCK_TIMEOUT
+    SendResult Write(uint64_t key, const void* data, size_t data_size);
+
+    // Latest complete value of key, false if it has never been written or stays unreadable for LOCK_TIMEOUT
+    bool Read(uint64_t key, Buffer& value);
+    // Copy the latest value of key to dst, kTooSmall with its size if it does not fit, kError if there is none
+    // or it stays unreadable for LOCK_TIMEOUT
+    ReceiveResult ReadInto(uint64_t key, void* dst, size_t capacity);
+    // Keys written since the previous call on this object, the first call returns all keys written so far
+    // keys is cleared first. A key written during the call may be returned again by the next one
+    std::vector<uint64_t>& Changes(std::vector<uint64_t>& keys);
+    // Wait until a key has been written that Changes() has not returned yet
+    // Returns false on timeout and once the table has been removed
+    bool Wait(std::chrono::microseconds timeout);
+
+    // The owning kReceiver deletes the table, the others only stop using it
+    bool Remove();
+    ChannelOptions Options() const;
+    ChannelStats Stats() const;
+
+private:
+    static constexpr uint32_t MAGIC = 0x4950434C; // "IPCL"
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t SPIN_BUDGET = 128; // Spins before yielding and looking at the writer
+    static constexpr uint32_t INDEX_EMPTY = 0;
+    static constexpr uint32_t INDEX_CLAIMED = UINT32_MAX; // A writer is assigning a slot to the key
+
+    struct Slot {
+        std::atomic<uint64_t> seq;    // Odd while a writer changes the value, 0 before the first write
+        std::atomic<uint64_t> writer; // WriterId() of the writer holding the key, 0 if there is none
+        uint64_t key;                 // Set before the slot is published in the index
+        std::atomic<uint64_t> size;
+        uint64_t data[]; // Accessed with relaxed atomics, the seqlock detects torn copies
+    };
+
+    // Layout fields are written once by the creating kReceiver before magic is published
+    struct alignas(64) Header {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint64_t slot_count;
+        uint64_t slot_size;  // sizeof(Slot) + value size, cache line aligned
+        uint64_t index_size; // Power of two, at least twice slot_count
+        uint64_t slots_offset;
+        uint64_t page_size;
+        pid_t owner_pid;
+        unsigned long long owner_start_time;
+        std::atomic<uint32_t> closed; // Set when the owner removes the table
+
+        alignas(64) std::atomic<uint64_t> used; // Slots handed out to keys, may overshoot slot_count
+
+        // Doorbell of readers waiting for changes, writers only make a syscall when one sleeps
+        alignas(64) std::atomic<uint32_t> change_seq;
+        std::atomic<uint32_t> sleeping;
+
+        alignas(64) std::atomic<uint64_t> wakeups;
+        std::atomic<uint64_t> sleeps;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory needs address-free atomics");
+
+    const std::string name_;
+    const std::string segment_name_;
+    const NodeType node_type_;
+    ChannelOptions options_; // Effective options
+    bool owner_ = false;     // This kReceiver created the table
+    uint64_t writer_id_ = 0; // kSender: WriterId() of this process
+
+    // kSenders open the table on their first write and again once it has been replaced, under connect_mutex_
+    std::atomic<Header*> header_ { nullptr };
+    shm::Segment segment_;               // kReceiver
+    std::deque<shm::Segment> segments_; // kSender, replaced mappings are kept for threads still writing
+    mutable std::mutex connect_mutex_;
+    std::vector<uint64_t> seen_; // kReceiver: seq of every slot when Changes() last returned it
+
+    bool Create(const ChannelOptions& options);
+    Header* Attach(shm::Segment& segment);
+    Header* Connect();
+
+    static std::atomic<uint32_t>* Index(Header* header)
+    {
+        return reinterpret_cast<std::atomic<uint32_t>*>(reinterpret_cast<char*>(header) + sizeof(Header));
+    }
+    static Slot* SlotAt(Header* header, uint64_t slot)
+    {
+        return reinterpret_cast<Slot*>(reinterpret_cast<char*>(header) + header->slots_offset + slot * header->slot_size);
+    }
+    // Slot of key, assigned on the first write if insert is set. nullptr if there is none
+    static Slot* Find(Header* header, uint64_t key, bool insert);
+    // Pid of this process in the high half and the low half of its start time, identifies it even if the pid is reused
+    static uint64_t WriterId();
+    static bool WriterAlive(uint64_t writer);
+    // Take the key of slot for this writer, from a writer that died if need be. False after LOCK_TIMEOUT
+    bool Lock(Slot* slot);
+    // Copy the value out of a slot, retrying until no writer interfered
+    // size is the size of the value, dst only holds it if it fits into capacity
+    // Returns false if the value stays torn for LOCK_TIMEOUT or its writer died
+    static bool Load(Slot* slot, void* dst, size_t capacity, size_t& size);
+    // Sequence number of the last complete write, a write in progress only counts once it is done
+    // A writer that dies in the middle of a value leaves it odd, its key is not reported over and over
+    static uint64_t Completed(uint64_t seq) { return seq & ~uint64_t(1); }
+    // Any slot written since seen_
+    bool Changed(Header* header) const;
+};
+
+} // namespace conflate
+#endif // _WIN32
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+namespace deadline {
+
+// Carries the deadline of every message in a trailer, for transports without a slot header to keep it in
+// Receivers drop expired messages before any copy of their own, the transport has copied them already
+// except for journal reads, which are in place. Messages without the trailer are delivered as they are
+// Every message on the channel carries the trailer, so both ends must enable deadlines
+class DeadlineChannel final : public Channel {
+public:
+    static constexpr uint64_t TRAILER_MAGIC = 0x454E494C44414544; // "DEADLINE"
+
+    struct Trailer {
+        uint64_t deadline; // Steady clock nanoseconds, 0 for none
+        uint64_t magic;
+    };
+
+    DeadlineChannel(std::shared_ptr<Channel> channel, NodeType ntype, const ChannelOptions& options);
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override { return channel_->Remove(); }
+    bool Closed() const override { return channel_->Closed(); }
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
+    bool Read(JournalEntry& entry) override;
+    bool Seek(uint64_t seq) override { return channel_->Seek(seq); }
+    SendResult Flush() override { return channel_->Flush(); }
+    SendResult SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt) override;
+
+private:
+    const std::shared_ptr<Channel> channel_;
+    const NodeType node_type_;
+    const std::chrono::microseconds ttl_;
+    std::atomic<uint64_t> expired_ { 0 };
+
+    SendResult Post(const iovec* iov, size_t iovcnt, uint64_t deadline);
+    // Strip the trailer of a received message, false if it is expired
+    bool Take(const void* data, size_t& size);
+};
+
+} // namespace deadline
@@ -0,0 +1,147 @@
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "ipc/msgq/msgq.h"
+#include "ipc/shm/segment.h"
+#include "ipc/shm/shm.h"
+
+using namespace ipc;
+
+namespace hybrid {
+
+// Picks the transport of every message by its size: tiny messages may take the System V queue,
+// most take the shared memory ring and large ones are written to a shared memory segment of their own,
+// whose name travels on the ring. Senders learn the paths of the receiver from a small "hello" segment
+// on their first Send and only use the paths both ends support
+// Every message carries a trailer with the sequence number of its sender, the receiver drains every
+// path with a thread of its own and puts the messages of each sender back in order
+// Paths never evict queued messages, kDropOldest drops the message being sent like kDropNewest. A gap
+// that stays open for GAP_TIMEOUT or holds back more than EARLY_LIMIT messages is skipped
+// A receiver without a hello segment is a plain kMessageQueue Node, senders then send raw messages to it
+class HybridChannel final : public Channel {
+public:
+    static constexpr size_t DEFAULT_SMALL_MESSAGE_SIZE = 0; // The ring is faster than the queue at every size
+    // Measured with ipc-test-performance-bandwidth: the ring beats a segment per message up to the largest
+    // slot, the segment path keeps the ring small and takes what does not fit
+    static constexpr size_t DEFAULT_LARGE_MESSAGE_SIZE = 256 * 1024;
+    static constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+    static constexpr size_t MAX_RING_MESSAGE_SIZE = 1024 * 1024;
+    static constexpr size_t DEFAULT_RING_BYTES = 16 * 1024 * 1024;
+    // Messages that are in order and not received yet, the path threads wait beyond it
+    static constexpr size_t PENDING_LIMIT = 1024;
+    // Messages of one sender held back by an earlier one, and how long they wait for it before it is given up
+    static constexpr size_t EARLY_LIMIT = 1024;
+    static constexpr std::chrono::milliseconds GAP_TIMEOUT { 100 };
+
+    HybridChannel(std::string name, NodeType ntype, key_t key, const ChannelOptions& options);
+    ~HybridChannel();
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override;
+    bool Closed() const override;
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+
+private:
+    static constexpr uint32_t MAGIC = 0x49504859; // "IPHY"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t TRAILER_MAGIC = 0x48594252; // "HYBR"
+
+    // Published by the kReceiver, magic is written last
+    struct alignas(64) Hello {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t paths;              // HYBRID_* paths the receiver drains
+        uint32_t epoch;              // Distinguishes the receivers that used the name over time
+        uint64_t queue_message_size; // Largest payload of each path, trailer included
+        uint64_t ring_message_size;
+        uint64_t max_message_size; // Largest message the receiver accepts on the segment path
+        std::atomic<uint32_t> closed; // Set when the receiver is removed, senders then look up the new one
+        std::atomic<uint32_t> next_sender;
+    };
+
+    // Follows the payload of every message
+    struct Trailer {
+        uint64_t seq; // Per sender, from 0
+        uint32_t epoch;
+        uint32_t sender;
+        uint32_t path; // HYBRID_* path the payload took, the payload of HYBRID_SEGMENT is its size
+        uint32_t magic;
+    };
+
+    // Messages of one sender that arrived ahead of an earlier one on another path
+    struct SenderState {
+        uint64_t next_seq = 0;
+        std::map<uint64_t, std::optional<Buffer>> early; // Empty for messages that were lost on the way
+        std::chrono::steady_clock::time_point stalled_since; // Last progress while early is not empty
+    };
+
+    const std::string name_;
+    const NodeType node_type_;
+    const key_t key_;
+    ChannelOptions options_; // Effective options
+    const std::string hello_name_;
+    shm::Segment hello_segment_;
+    Hello* hello_ = nullptr;
+    std::unique_ptr<msgq::MessageQueue> queue_;
+    std::unique_ptr<shm::SharedMemory> ring_;
+
+    // kSender
+    std::mutex send_mutex_;
+    bool legacy_ = false; // The receiver is a plain kMessageQueue Node
+    uint32_t paths_ = 0;  // Negotiated paths
+    uint32_t sender_ = 0;
+    uint64_t next_seq_ = 0;
+
+    // kReceiver
+    std::vector<std::thread> workers_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Buffer> pending_; // In order, ready to be received
+    std::unordered_map<uint32_t, SenderState> senders_;
+    bool stopping_ = false;
+
+    bool Create();
+    // Negotiate the paths with the current receiver, again whenever it has been replaced
+    bool Connect();
+    void Disconnect();
+    // Name of the segment carrying one large message
+    std::string SegmentName(uint32_t epoch, uint32_t sender, uint64_t seq) const;
+
+    SendResult SendRing(const iovec* iov, size_t iovcnt, Trailer& trailer);
+    SendResult SendQueue(const iovec* iov, size_t iovcnt, Trailer& trailer);
+    SendResult SendSegment(const iovec* iov, size_t iovcnt, size_t size, Trailer& trailer);
+
+    // Body of the receiver thread of a path
+    void Drain(Channel& path);
+    // Strip the trailer, fetch segments and release the message once all earlier ones of its sender are
+    void Deliver(Buffer message);
+    // Move the messages of sender that are next in order to pending_
+    void Release(SenderState& sender);
+    // Give up on the messages missing before the earliest held back one
+    void SkipGap(uint32_t id, SenderState& sender);
+};
+
+} // namespace hybrid
+#endif // _WIN32
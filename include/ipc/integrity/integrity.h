@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+namespace integrity {
+
+// Checks every message end to end with a CRC32C of its payload, carried in a trailer
+// The checksum uses the SSE4.2 crc32 instruction when the CPU has it and slicing-by-8 otherwise,
+// ReceiveInto and ReceiveV verify it while copying to the destination
+// A message that fails the check is reported by ReceiveInto as ReceiveStatus::kCorrupted, the other
+// receive calls skip it, and all count it in ChannelStats::corrupted
+// Every message on the channel carries the trailer, so both ends must enable integrity
+class IntegrityChannel final : public Channel {
+public:
+    static constexpr uint32_t TRAILER_MAGIC = 0x43524343; // "CRCC"
+
+    struct Trailer {
+        uint32_t crc; // CRC32C of the payload
+        uint32_t magic;
+    };
+
+    IntegrityChannel(std::shared_ptr<Channel> channel, NodeType ntype);
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override { return channel_->Remove(); }
+    bool Closed() const override { return channel_->Closed(); }
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
+    ReceiveResult ReceiveInto(void* dst, size_t capacity) override;
+    bool Read(JournalEntry& entry) override;
+    bool Seek(uint64_t seq) override { return channel_->Seek(seq); }
+    SendResult Flush() override { return channel_->Flush(); }
+    // Passed down to the deadline layer beneath, which drops expired messages before they are verified
+    SendResult SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt) override;
+
+private:
+    const std::shared_ptr<Channel> channel_;
+    const NodeType node_type_;
+    std::atomic<uint64_t> corrupted_ { 0 };
+
+    SendResult Post(const iovec* iov, size_t iovcnt, const Deadline* deadline);
+    // Strip the trailer of a received message, false if it has none
+    static bool TakeTrailer(const void* data, size_t& size, Trailer& trailer);
+    // Log and count a message that failed the check
+    void Corrupted(size_t size);
+};
+
+} // namespace integrity
@@ -1,10 +1,23 @@
 #pragma once
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 
+#ifdef _WIN32
+// Scatter/gather element, layout-compatible with the POSIX struct iovec
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 namespace ipc {
 
 enum class NodeType {
@@ -15,26 +28,252 @@ enum class NodeType {
 enum class ChannelType {
     kUnknown,
     kMessageQueue,
-    kNamedPipe
+    kNamedPipe,
+    kSharedMemory,
+    kTcp,    // Length-prefixed messages over TCP, between hosts or over loopback (Linux)
+    kJournal, // Persistent log of memory-mapped segment files, replayable by every receiver (Linux)
+    kHybrid   // Routes every message to the queue, ring or segment path by its size (Linux)
 };
 
-class Buffer {
-    void* data_;
-    size_t data_size_;
+// Paths of a kHybrid channel, ChannelOptions::hybrid_paths is a combination of them
+constexpr uint32_t HYBRID_QUEUE = 1 << 0;   // System V message queue
+constexpr uint32_t HYBRID_RING = 1 << 1;    // Shared memory ring
+constexpr uint32_t HYBRID_SEGMENT = 1 << 2; // Shared memory segment of its own, named in a message on the ring
+constexpr uint32_t HYBRID_ALL = HYBRID_QUEUE | HYBRID_RING | HYBRID_SEGMENT;
+
+// How a kReceiver handles a channel left behind by a previous receiver that is no longer running
+enum class RecoveryPolicy {
+    kReattach, // Keep the channel and its pending messages, connected senders are unaffected
+    kReclaim   // Delete the stale channel and start from an empty one
+};
+
+// What a kSender does when the channel is full because the receiver falls behind
+enum class BackpressurePolicy {
+    kBlock,      // Wait until there is room
+    kTimeout,    // Wait up to ChannelOptions::send_timeout, then fail with SendStatus::kTimedOut
+    kFailFast,   // Fail immediately with SendStatus::kWouldBlock
+    kDropNewest, // Discard the message being sent and report SendStatus::kDropped
+    kDropOldest  // Evict the oldest queued messages until the new one fits
+};
+
+// Pages backing shared-memory transports and buffer pools
+// Huge pages cut TLB misses when streaming large volumes, unavailable ones fall back to the next option
+enum class HugePages {
+    kNone,        // Regular pages
+    kTransparent, // Ask the kernel to promote to transparent huge pages (madvise(MADV_HUGEPAGE))
+    kExplicit     // Reserved huge pages (hugetlbfs, MAP_HUGETLB), falls back to kTransparent
+};
+
+// Creation time settings of a channel, unset (zero) fields keep the transport defaults
+// The kReceiver creates the channel, so capacity is applied by it and only read by kSenders
+// Node::Options() reports the effective values, which may be clamped to the limits of the transport
+struct ChannelOptions {
+    size_t capacity_bytes = 0;    // Total bytes of queued messages before senders are throttled
+    size_t capacity_messages = 0; // Number of queued messages before senders are throttled
+    size_t max_message_size = 0;  // Largest payload of a single message, should agree on both ends
+    RecoveryPolicy recovery = RecoveryPolicy::kReattach;
+    BackpressurePolicy backpressure = BackpressurePolicy::kBlock;
+    std::chrono::microseconds send_timeout = std::chrono::milliseconds(100); // Used by kTimeout
+    // Non-blocking attempts made before a Send/Receive that has to wait sleeps in the kernel
+    // Spinning trades CPU for the wakeup latency when the peer catches up quickly
+    // 0 selects the default of the channel (no spinning for message queues), reported by Options()
+    uint32_t spin_budget = 0;
+    // Receive never sleeps in the kernel, it keeps probing the channel with a pause between probes
+    // Burns a core for the lowest latency, combine with PinThread() on an isolated CPU
+    // Ignored (reported as false) by channels that cannot be probed without blocking
+    bool busy_poll = false;
+    HugePages huge_pages = HugePages::kNone;
+    // Number of System V queues backing a message queue Node (Linux), should agree on both ends
+    // Each sender thread posts to one shard, so its messages stay in order, and the receiver drains
+    // all shards in turn. Capacity options apply to every shard
+    size_t shards = 1;
+    // Drain every shard with a dedicated receiver thread instead of polling them in turn
+    bool shard_threads = false;
+    // Number of partitions of keyed messages, should agree on both ends
+    // Dispatch() runs one worker thread per partition
+    size_t partitions = 1;
+    // Journal: directory holding a subdirectory of segment files per Node name, empty uses $TMPDIR or /tmp
+    std::string journal_dir;
+    // Journal: size of one segment file, the oldest segments are deleted beyond capacity_bytes
+    size_t segment_size = 0;
+    // Hybrid: messages up to small_message_size bytes take the queue path, messages of large_message_size
+    // bytes and more the segment path, the others the ring. The receiver sizes the ring slots by its own
+    // large_message_size, senders route by theirs within what the ring takes
+    size_t small_message_size = 0;
+    size_t large_message_size = 0;
+    // Hybrid: HYBRID_* paths this end supports, a sender only uses the paths both ends support
+    uint32_t hybrid_paths = 0;
+    // Opt-in coalescing, set on both ends: a kSender packs small messages into one transport message
+    // until coalesce_bytes are pending or the oldest one has waited coalesce_delay, or Node::Flush()
+    // The kReceiver unpacks them, every message is still received on its own
+    size_t coalesce_bytes = 0;
+    std::chrono::microseconds coalesce_delay = std::chrono::microseconds(100);
+    // Opt-in blob store (Linux), set on both ends: messages of blob_threshold bytes and more, and those the
+    // transport cannot carry, are written to a shared memory arena and only a small descriptor is sent
+    // The kReceiver creates the arena of blob_arena_bytes, its Buffers map the payload in place and free it
+    // once they are released
+    size_t blob_threshold = 0;
+    size_t blob_arena_bytes = 0;
+    // Opt-in end to end check, set on both ends: every message carries a CRC32C of its payload, computed with
+    // the SSE4.2 crc32 instruction when available, and a message that fails it is not delivered
+    bool integrity = false;
+    // Opt-in deadlines, set deadlines on both ends: a message carries the time after which it is stale,
+    // receivers drop stale messages instead of delivering them late and count them in ChannelStats::expired
+    // Node::SendBefore() sets the deadline of one message, Send stamps now + ttl if ttl is set, which
+    // also enables deadlines. Shared memory keeps it in the slot, senders reclaim stale slots of a full ring
+    // Deadlines are steady_clock times, comparable between processes of one host only
+    bool deadlines = false;
+    std::chrono::microseconds ttl = std::chrono::microseconds(0);
+};
+
+// Runtime information about a channel
+struct ChannelStats {
+    size_t page_size = 0; // Page size backing the transport memory, 0 if it is not memory mapped
+    // Wakeup syscalls issued to sleeping peers and sleeps entered, for channels that track them
+    // Low counts under load mean that the notifications are coalesced
+    uint64_t wakeups = 0;
+    uint64_t sleeps = 0;
+    uint64_t corrupted = 0; // Messages that failed the integrity check and were discarded
+    uint64_t expired = 0;   // Messages dropped past their deadline, by the receiver or by senders reclaiming room
+};
+
+// Time after which a message is no longer delivered, see ChannelOptions::deadlines
+using Deadline = std::chrono::steady_clock::time_point;
+
+enum class SendStatus {
+    kOk,           // The message has been handed to the channel
+    kWouldBlock,   // The channel is full (BackpressurePolicy::kFailFast)
+    kTimedOut,     // The channel stayed full for the whole send timeout (BackpressurePolicy::kTimeout)
+    kDropped,      // The channel is full and the message was discarded (BackpressurePolicy::kDropNewest)
+    kTooLarge,     // The message exceeds the maximum message size of the channel
+    kDisconnected, // There is no receiver to send to
+    kError         // Any other failure, details are logged
+};
 
+// Outcome of a Send, converts to true only if the message was delivered
+class SendResult {
 public:
-    Buffer(void* data, size_t size)
-        : data_(data)
-        , data_size_(size)
+    SendResult(SendStatus status)
+        : status_(status)
     {
     }
-    ~Buffer() { free(data_); }
 
-    size_t Size() { return data_size_; }
+    explicit operator bool() const { return status_ == SendStatus::kOk; }
+    bool operator==(SendStatus status) const { return status_ == status; }
+    SendStatus Status() const { return status_; }
+
+private:
+    SendStatus status_;
+};
+
+enum class ReceiveStatus {
+    kOk,        // The message has been copied to the destination
+    kTooSmall,  // The message is larger than the destination, it is kept for the next receive
+    kClosed,    // The channel has been removed
+    kCorrupted, // The message failed the integrity check and has been discarded (ChannelOptions::integrity)
+    kError      // Any other failure, details are logged
+};
+
+// Outcome of a ReceiveInto, Size() is the size of the message, also when it did not fit
+class ReceiveResult {
+public:
+    ReceiveResult(ReceiveStatus status, size_t size = 0)
+        : status_(status)
+        , size_(size)
+    {
+    }
+
+    explicit operator bool() const { return status_ == ReceiveStatus::kOk; }
+    bool operator==(ReceiveStatus status) const { return status_ == status; }
+    ReceiveStatus Status() const { return status_; }
+    size_t Size() const { return size_; }
+
+private:
+    ReceiveStatus status_;
+    size_t size_;
+};
+
+// Pin the calling thread to a single CPU, e.g. the thread polling a busy_poll channel
+bool PinThread(int cpu);
+
+// Pages of the process-wide pool that received Buffers come from (Linux), HugePages::kNone by default
+// A huge page per size class costs memory as soon as one message of that size is received,
+// so opt in when the process streams large volumes. Applies to the chunks the pool maps afterwards
+void SetBufferPoolPages(HugePages huge_pages);
+
+// Map the name of a kTcp Node to the "host:port" endpoint its receiver listens on
+// Names without a mapping are looked up in the file named by the IPC_ENDPOINTS environment variable,
+// with one "name host:port" pair per line, and are otherwise used as the endpoint themselves
+// A receiver listening on port 0 maps its name to the port the system picked
+void MapEndpoint(const std::string& name, const std::string& endpoint);
+
+// Payload of a received message
+// Payloads up to INLINE_CAPACITY bytes are stored inside the Buffer itself, larger ones come from
+// a process-wide pool of size classes, so receiving a message usually does not call malloc
+// Buffer is move-only and needs no reference counting, Share() converts it to shared ownership
+class Buffer {
+public:
+    static constexpr size_t INLINE_CAPACITY = 256;
+
+    Buffer() = default;
+    // Uninitialized payload of size bytes, Data() is null if the allocation failed
+    explicit Buffer(size_t size);
+    // Take ownership of memory from malloc(), released with free()
+    Buffer(void* data, size_t size);
+    // Refer to memory owned elsewhere, such as shared memory, release(context, data) is called instead of free()
+    using ReleaseFunction = void (*)(void* context, void* data);
+    Buffer(void* data, size_t size, ReleaseFunction release, void* context);
+    ~Buffer();
+
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+    // Disable copy constructor and assignment operator
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    size_t Size() const { return data_size_; }
+    // Shrink the payload, size must not exceed Capacity()
     void SetSize(size_t size) { data_size_ = size; }
-    void* Data() { return data_; }
+    size_t Capacity() const { return capacity_; }
+    void* Data() { return storage_ == Storage::kInline ? inline_ : data_; }
+    const void* Data() const { return storage_ == Storage::kInline ? inline_ : data_; }
+
+    // Move into shared ownership with a single allocation for the control block and the Buffer
+    std::shared_ptr<Buffer> Share() &&;
+
+private:
+    enum class Storage : uint8_t {
+        kInline,  // inline_
+        kPool,    // Block of capacity_ bytes from the buffer pool
+        kHeap,    // malloc()
+        kExternal // release_
+    };
+
+    void* data_ = nullptr;
+    size_t data_size_ = 0;
+    size_t capacity_ = 0;
+    Storage storage_ = Storage::kInline;
+    ReleaseFunction release_ = nullptr;
+    void* release_context_ = nullptr;
+    alignas(16) char inline_[INLINE_CAPACITY];
+
+    void Release();
+};
+
+// A journal message read in place, valid until the Node reads again or is destroyed
+// Payloads are 8-byte aligned in the mapped segment, deleting the segment file does not invalidate them
+struct JournalEntry {
+    uint64_t seq = 0; // Sequence number of the message in the journal, from 0
+    const void* data = nullptr;
+    size_t size = 0;
 };
 
+// Node::Seek() position after the last message, to read only messages sent from then on
+constexpr uint64_t JOURNAL_END = UINT64_MAX;
+
+// Called on the worker thread that owns the partition of the message, see Node::Dispatch()
+using PartitionHandler = std::function<void(size_t partition, std::shared_ptr<Buffer> message)>;
+
 class Channel {
 public:
     Channel() = default;
@@ -44,14 +283,63 @@ public:
     Channel(const Channel&) = delete;
     Channel& operator=(const Channel&) = delete;
 
-    virtual bool Send(const void* data, size_t data_size) = 0;
+    virtual SendResult Send(const void* data, size_t data_size) = 0;
     virtual std::shared_ptr<Buffer> Receive() = 0;
+    // Receive into a move-only Buffer, without the shared_ptr control block
+    // The default implementation moves the payload out of Receive()
+    virtual bool ReceiveBuffer(Buffer& message);
     virtual bool Remove() = 0;
+    // The channel has been removed, a failed receive is then reported as ReceiveStatus::kClosed
+    // The default implementation does not know, decorators ask the channel beneath them
+    virtual bool Closed() const { return false; }
+    // Effective settings of the channel
+    virtual ChannelOptions Options() const = 0;
+    virtual ChannelStats Stats() const { return ChannelStats(); }
+
+    // Send the concatenation of iovcnt segments as a single message
+    // Channels should override it to gather directly into the transport,
+    // the default implementation concatenates into a temporary buffer and calls Send()
+    virtual SendResult SendV(const iovec* iov, size_t iovcnt);
+    // Receive a single message and spread it over the segments in order
+    // received_size is set to the size of the message
+    virtual bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size);
+
+    // Send a message that Dispatch() hands to the worker of partition
+    // The default implementation prefixes the partition to the message
+    virtual SendResult SendPartitioned(size_t partition, const iovec* iov, size_t iovcnt);
+    // Receive the messages of SendPartitioned() with Options().partitions worker threads,
+    // until the channel is removed. The default implementation receives on the calling thread
+    // and queues every message to the worker of its partition
+    virtual bool Dispatch(const PartitionHandler& handler);
+
+    // Receive into caller-provided memory, a message larger than capacity is kept and reported
+    // with kTooSmall and its size, the next call with enough capacity receives it
+    // The default implementation receives into a Buffer and copies it
+    virtual ReceiveResult ReceiveInto(void* dst, size_t capacity);
+
+    // Journals: read the next message in place and seek the read position by sequence number
+    // The default implementations fail, other channels do not keep delivered messages
+    virtual bool Read(JournalEntry& entry);
+    virtual bool Seek(uint64_t seq);
+
+    // Hand messages held back by the sender to the transport, the default has none
+    virtual SendResult Flush() { return SendStatus::kOk; }
+
+    // Send a message that is dropped instead of received after deadline
+    // The default implementation fails, channels without deadlines have nowhere to put it
+    virtual SendResult SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt);
+
+protected:
+    // Message that did not fit into the destination of ReceiveInto()
+    std::optional<Buffer> parked_;
+    // Copy the parked message to dst if it fits
+    ReceiveResult TakeParked(void* dst, size_t capacity);
 };
 
 class Node {
 public:
-    Node(std::string name, NodeType ntype, ChannelType ctype = ChannelType::kUnknown);
+    Node(std::string name, NodeType ntype, ChannelType ctype = ChannelType::kUnknown,
+        const ChannelOptions& options = ChannelOptions());
     ~Node();
 
     // Disable copy constructor and assignment operator
@@ -59,15 +347,50 @@ public:
     Node& operator=(const Node&) = delete;
 
     const std::string& getName() const { return name_; }
+    // Effective settings after the transport applied and clamped the requested ones
+    ChannelOptions Options() const;
+    ChannelStats Stats() const;
 
-    bool Send(const void* data, size_t data_size);
+    // A kSender Node may be shared by many threads, Send, SendV, SendKeyed and Flush are thread-safe
+    // and messages of each thread stay in order. Sending connects lazily, exactly once per Node
+    SendResult Send(const void* data, size_t data_size);
     std::shared_ptr<Buffer> Receive();
+    // Receive without shared ownership, message is replaced by the next message
+    bool Receive(Buffer& message);
+    // Receive into caller-provided memory without any allocation by the library
+    // Message queues receive in place when dst is 8-byte aligned and has 16 bytes of room to spare
+    ReceiveResult ReceiveInto(void* dst, size_t capacity);
     bool Remove();
 
+    // Scatter/gather variants, each message is copied only once into the transport
+    SendResult SendV(const iovec* iov, size_t iovcnt);
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size);
+
+    // Keyed messages: all messages with the same key are handled in order by the same worker
+    // of Dispatch(), while messages with other keys are handled in parallel without waiting on them
+    SendResult SendKeyed(uint64_t key, const void* data, size_t data_size);
+    // Handle keyed messages with one worker thread per partition, returns once the Node is removed
+    bool Dispatch(const PartitionHandler& handler);
+
+    // Journal receivers: read the next message without copying it, waits for new messages at the end
+    // A receiver starts at the oldest message kept, so late or restarted consumers replay the journal
+    bool Read(JournalEntry& entry);
+    // Continue reading at seq, or at JOURNAL_END. Returns false if seq has already been deleted,
+    // the reader is then placed at the oldest message kept
+    bool Seek(uint64_t seq);
+
+    // Send a message that receivers drop once deadline has passed, see ChannelOptions::deadlines
+    SendResult SendBefore(Deadline deadline, const void* data, size_t data_size);
+
+    // Send the messages a coalescing kSender holds back right away, see ChannelOptions::coalesce_bytes
+    // Also reports a failure to send them in the background since the previous Send or Flush
+    SendResult Flush();
+
 private:
     const std::string name_;           // Name of the IPC Node
     const NodeType node_type_;         // Type of the Node (kSender or kReceiver)
     std::shared_ptr<Channel> channel_; // Pointer to the underlying IPC channel
+    size_t partitions_ = 1;            // Effective ChannelOptions::partitions
 };
 
 } // namespace ipc
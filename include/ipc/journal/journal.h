@@ -0,0 +1,148 @@
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <time.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+namespace journal {
+
+// Append-only log of messages in memory-mapped segment files, one directory per Node name
+// Senders claim room in the newest segment with a CAS and copy the message straight into the mapping,
+// a full segment is sealed and continued in a new file named after its first sequence number
+// Every receiver reads the files on its own from the oldest segment kept, so messages are not consumed
+// and late or restarted receivers replay them at memory speed
+// The oldest segments are deleted once the journal exceeds capacity_bytes
+// A sender that dies while writing a record leaves it claimed with its pid, readers skip it by its size
+class Journal final : public Channel {
+public:
+    static constexpr size_t DEFAULT_SEGMENT_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t DEFAULT_CAPACITY_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 1024 * 1024;
+    static constexpr size_t MIN_SEGMENT_SIZE = 64 * 1024;
+    static constexpr size_t MAX_SEGMENT_SIZE = 1024 * 1024 * 1024; // Offsets within a segment are 32-bit
+    static constexpr uint32_t DEFAULT_SPIN_BUDGET = 128;
+
+    Journal(const std::string& name, NodeType ntype, const ChannelOptions& options);
+    ~Journal();
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override;
+    bool Closed() const override { return removed_.load(std::memory_order_acquire); }
+    ChannelOptions Options() const override { return options_; }
+    ChannelStats Stats() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool Read(JournalEntry& entry) override;
+    bool Seek(uint64_t seq) override;
+
+private:
+    static constexpr uint32_t MAGIC = 0x49504a4c; // "IPJL"
+    static constexpr uint32_t VERSION = 2;
+    // Set in the offset of claim once the segment is full, the offset is where the end marker goes
+    static constexpr uint32_t SEALED = 1u << 31;
+
+    enum RecordState : uint32_t {
+        kEmpty = 0,     // Not claimed yet, or claimed by a sender that has not filled in the header yet
+        kCommitted = 1, // Holds a message
+        kEnd = 2,       // The segment continues in the next file
+        kClaimed = 3    // The header is valid, the sender is still writing the message
+    };
+
+    // Records are 8-byte aligned and follow each other from the end of the header
+    struct Record {
+        std::atomic<uint32_t> state;
+        uint32_t size;
+        uint64_t seq;
+        pid_t pid; // Sender of the record with its start time, checked by readers while it is kClaimed
+        unsigned long long start_time;
+        char data[];
+    };
+
+    // Layout fields are written before the file is linked under its final name
+    struct alignas(64) Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t first_seq; // Sequence number of the first record
+        uint64_t size;      // Size of the file
+
+        // Number of records claimed in the high half, offset of the next record in the low half
+        // The offset is SEALED once a record did not fit, the count is then final
+        alignas(64) std::atomic<uint64_t> claim;
+        // Doorbell of the receivers
+        alignas(64) std::atomic<uint32_t> data_seq;
+        std::atomic<uint32_t> data_sleeping;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "segments need address-free atomics");
+
+    // One mapped segment file, the mapping stays valid when the file is deleted
+    struct Segment {
+        Header* header = nullptr;
+        size_t size = 0;
+
+        char* Records() const { return reinterpret_cast<char*>(header) + sizeof(Header); }
+        // Room for records, an kEnd record always fits after the last message
+        size_t Capacity() const { return size - sizeof(Header) - sizeof(Record); }
+    };
+
+    const std::string name_;
+    const std::string dir_;
+    const NodeType node_type_;
+    ChannelOptions options_; // Effective options
+    size_t max_segments_ = 2;
+
+    // kSender
+    std::mutex send_mutex_;
+    Segment writer_;
+    pid_t pid_ = 0;
+    unsigned long long start_time_ = 0;
+
+    // kReceiver, reads happen on one thread at a time
+    std::mutex read_mutex_; // Guards reader_ against Remove() from another thread
+    Segment reader_;
+    size_t read_offset_ = 0;
+    uint64_t skip_until_ = 0; // Set by Seek(), earlier records are skipped
+    std::atomic<bool> removed_ { false };
+
+    // First sequence numbers of the segments on disk, in ascending order
+    std::vector<uint64_t> ListSegments() const;
+    std::string SegmentPath(uint64_t first_seq) const;
+    // Map the segment starting at first_seq, creating it if create is set and it does not exist
+    // Creation is atomic, a segment is initialized under a temporary name and then linked
+    bool OpenSegment(uint64_t first_seq, bool create, Segment& segment);
+    static void CloseSegment(Segment& segment);
+    // Delete the oldest segments beyond max_segments_
+    void Retain();
+
+    // Map the newest segment for the sender
+    bool OpenNewest();
+    // Continue in the segment after the sealed one of the sender, which holds count records
+    // The end marker at offset is written once the next segment exists, by every sender that gets there
+    bool Rollover(uint64_t count, uint32_t offset);
+    // Follow a sealed segment to the next one, or to the oldest if it has been deleted meanwhile
+    bool Advance(uint64_t next_seq);
+    // Place the reader at the start of the oldest segment kept
+    bool OpenOldest();
+
+    // Ring the doorbell of the segment if a receiver is asleep, see shm::SharedMemory::Notify()
+    static void Notify(Header* header);
+    // Sleep until the doorbell rings or timeout passes, unless ready() becomes true after announcing the sleep
+    template <typename Ready>
+    static void Sleep(Header* header, Ready ready, const struct timespec* timeout);
+    // The sender of a kClaimed record has exited
+    static bool Abandoned(const Record* record);
+};
+
+} // namespace journal
+#endif // _WIN32
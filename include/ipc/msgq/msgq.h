@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 
 #include "ipc/ipc.h"
 
@@ -13,23 +15,38 @@ using namespace ipc;
 
 namespace msgq {
 
-class MessageQueue : public Channel {
+class MessageQueue final : public Channel {
 public:
-    MessageQueue(std::string name, NodeType ntype);
+    MessageQueue(std::string name, NodeType ntype, const ChannelOptions& options);
     ~MessageQueue();
 
-    bool Send(const void* data, size_t data_size = 0) override;
+    SendResult Send(const void* data, size_t data_size = 0) override;
     std::shared_ptr<Buffer> Receive() override;
     bool Remove() override;
+    ChannelOptions Options() const override { return options_; }
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
 
 private:
     const std::string msgq_name_;
     const NodeType node_type_;
+    ChannelOptions options_; // Effective options
 
-    const int max_msg_size_ = 1024; // Default max message size
-    const int max_msg_count_ = 100; // Default max message count
+    size_t max_msg_size_ = 1024; // Max message size, 1024 by default
+    size_t max_msg_count_ = 100; // Max message count, 100 by default
 
     std::unique_ptr<boost::interprocess::message_queue> message_queue_;
+    std::once_flag connect_once_; // Senders sharing the Node open the queue once
+    std::unique_ptr<char[]> staging_; // Scatter buffer of max_msg_size_ bytes, the gather buffer is per thread
+
+    bool Connect();
+    // Read the effective capacity back from the queue
+    void UpdateLimits();
+    // Receive one message, spinning up to spin_budget times before blocking
+    void Pop(void* buffer, size_t size, size_t& received_size);
+    // Evict the oldest message to make room for a new one (BackpressurePolicy::kDropOldest)
+    bool DropOldest();
 };
 
 } // namespace msgq
@@ -40,22 +57,49 @@ private:
 
 namespace msgq {
 
-class MessageQueue : public Channel {
+class MessageQueue final : public Channel {
 public:
-    MessageQueue(std::string name, NodeType ntype, key_t key);
+    MessageQueue(std::string name, NodeType ntype, key_t key, const ChannelOptions& options);
     ~MessageQueue();
 
-    bool Send(const void* data, size_t data_size = 0) override;
+    SendResult Send(const void* data, size_t data_size = 0) override;
     std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& buffer) override;
     bool Remove() override;
+    // The queue is gone, only asked once a receive has failed
+    bool Closed() const override;
+    ChannelOptions Options() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
+    ReceiveResult ReceiveInto(void* dst, size_t capacity) override;
+
+    // Receive without waiting, fails with errno set to ENOMSG if the queue is empty
+    std::shared_ptr<Buffer> TryReceive();
+    bool TryReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size);
+
+    // Partitions map to message types, so every worker of Dispatch() receives only its own
+    // partition from the kernel and the messages need no prefix
+    // Senders take the partition count of the receiver when they connect, so that every type they send is read
+    SendResult SendPartitioned(size_t partition, const iovec* iov, size_t iovcnt) override;
+    bool Dispatch(const PartitionHandler& handler) override;
 
 private:
     const std::string msgq_name_;
     const NodeType node_type_;
     const key_t key_;
+    ChannelOptions options_; // Effective options
+
+    // Senders look the queue up on their first Send, threads sharing the Node do it once under
+    // connect_mutex_ and then only load msgid_, which also publishes max_msg_size_ and options_
+    std::atomic<int> msgid_ { -1 };
+    std::atomic<msglen_t> max_msg_size_ { 0 }; // Max size of a whole Message, including mtype
+    std::atomic<size_t> partitions_ { 1 };     // Effective ChannelOptions::partitions, the receiver's for senders
+    mutable std::mutex connect_mutex_;
 
-    int msgid_ = -1;
-    msglen_t max_msg_size_ = 0;
+    // Staging buffer of max_msg_size_ bytes, reused by every Receive
+    // Senders gather into a buffer of the calling thread, see ThreadGatherBuffer()
+    std::unique_ptr<char[]> recv_buffer_;
 
     static constexpr long MESSAGE_TYPE = 1;
     struct Message {
@@ -63,6 +107,38 @@ private:
         size_t size;
         char data[];
     };
+    // msgsnd/msgrcv sizes count the bytes following mtype
+    static constexpr size_t MTEXT_HEADER_SIZE = sizeof(Message) - sizeof(long);
+
+    bool Connect();
+    // Look the queue up if msgid_ is unset, called with connect_mutex_ held
+    bool Lookup();
+    // Apply the requested capacity with msgctl(IPC_SET), called by the kReceiver
+    void ApplyCapacity();
+    // Derive the effective options and max_msg_size_ from the queue and kernel limits
+    void UpdateLimits(const struct msqid_ds& queue_info);
+    // msgsnd the staged message, applying the backpressure policy when the queue is full
+    SendResult Post(Message* message, size_t msgsz);
+    // Drop the cached msgid_ if it is still stale and look the queue up again, used when the receiver recreated it
+    bool Reconnect(int stale);
+    // Gather a message of the given type into the buffer of the calling thread and post it
+    SendResult Stage(long type, const iovec* iov, size_t iovcnt);
+    // Receive one message of the given type (0 for any) into buffer of max_msg_size_ bytes
+    // Returns nullptr with errno ENOMSG if !wait and there is no such message
+    // A smaller buffer of size bytes fails with errno E2BIG and leaves a larger message queued
+    Message* ReceiveMessage(char* buffer, long type = 0, bool wait = true, size_t size = 0);
+    std::shared_ptr<Buffer> CopyMessage(Message* message);
+    bool ScatterMessage(Message* message, const iovec* iov, size_t iovcnt, size_t& received_size);
+
+    // The kReceiver records "<pid> <start time> <partitions>" in a sidecar file next to the queue
+    // so that a restarted receiver can tell a crashed owner from a running one
+    std::string OwnerFilePath() const;
+    bool OwnerAlive(const struct msqid_ds& queue_info) const;
+    void ClaimOwnership() const;
+    // Partitions the receiver dispatches, 0 if its sidecar does not tell
+    size_t OwnerPartitions() const;
+    // Handle a queue that already exists when the kReceiver starts
+    void RecoverStaleQueue();
 };
 
 } // namespace msgq
@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef _WIN32
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "ipc/msgq/msgq.h"
+
+using namespace ipc;
+
+namespace msgq {
+
+// One logical message queue spread over ChannelOptions::shards System V queues
+// All senders of a single queue serialize on its kernel lock, spreading them over several queues
+// lets the aggregate throughput grow with the number of producers
+class ShardedQueue final : public Channel {
+public:
+    ShardedQueue(std::string name, NodeType ntype, key_t key, const ChannelOptions& options);
+    ~ShardedQueue();
+
+    SendResult Send(const void* data, size_t data_size = 0) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool Remove() override;
+    bool Closed() const override;
+    ChannelOptions Options() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
+
+private:
+    const std::string msgq_name_;
+    const NodeType node_type_;
+    const ChannelOptions options_;
+
+    std::vector<std::unique_ptr<MessageQueue>> shards_;
+    size_t next_shard_ = 0; // Shard the next Receive starts polling from
+
+    // ChannelOptions::shard_threads: every shard has a thread blocking on it, which hands
+    // the messages over to Receive through pending_
+    std::vector<std::thread> workers_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::shared_ptr<Buffer>> pending_;
+    bool stopping_ = false;
+
+    // Queue key of a shard, shard 0 uses the key of the Node so that one shard equals a plain queue
+    static key_t ShardKey(const std::string& name, key_t key, size_t shard);
+    // Shard used by the calling thread, fixed for the thread so that its messages stay in order
+    size_t SenderShard() const;
+    // Take the next message from the shards in turn, backing off while all of them are empty
+    // try_receive(shard) fails with errno ENOMSG if the shard is empty
+    template <typename TryReceive>
+    bool Poll(TryReceive try_receive);
+    // Body of the receiver thread of a shard
+    void Drain(size_t shard);
+    // Wait for a message drained by a receiver thread
+    std::shared_ptr<Buffer> Pop();
+};
+
+} // namespace msgq
+#endif // _WIN32
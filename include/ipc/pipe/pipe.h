@@ -3,8 +3,10 @@
 #ifdef _WIN32
 #include <atomic>
 #include <condition_variable>
+#include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 #include <windows.h>
 
 #include "ipc/ipc.h"
@@ -13,21 +15,27 @@ using namespace ipc;
 
 namespace pipe {
 
-class NamedPipe : public Channel {
+class NamedPipe final : public Channel {
 public:
-    NamedPipe(const std::string& name, NodeType ntype);
+    NamedPipe(const std::string& name, NodeType ntype, const ChannelOptions& options);
     ~NamedPipe();
 
-    bool Send(const void* data, size_t data_size);
+    SendResult Send(const void* data, size_t data_size);
     std::shared_ptr<Buffer> Receive();
     bool Remove();
+    ChannelOptions Options() const { return options_; }
 
 private:
     std::string pipe_name_;
     NodeType node_type_;
+    ChannelOptions options_; // Effective options
 
-    HANDLE send_pipe_;
-    bool send_connected_;
+    // Threads sharing the Node connect once under send_mutex_ and then only load send_pipe_
+    // Synchronous writes to one handle are serialized by the system, every message stays whole
+    std::atomic<HANDLE> send_pipe_;
+    std::atomic<bool> send_connected_;
+    std::mutex send_mutex_;
+    std::vector<HANDLE> retired_pipes_; // Replaced by a reconnection, may still be in use by another thread
 
     std::thread recv_thread_; // The main thread of the server
     HANDLE recv_stop_event_; // Event to notify the Receive thread to stop
@@ -39,8 +47,11 @@ private:
     std::mutex queue_mutex_;
 
     static const DWORD BUFFER_SIZE = 4096; // Default buffer size for named pipe communication
+    DWORD buffer_size_; // Max message size, also used as the pipe buffer size
 
     bool Connect();
+    // Connect again unless another thread already replaced the broken pipe
+    bool Reconnect(HANDLE broken);
     void RecvLoop();
     void RecvHandle(HANDLE pipe);
 };
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <variant>
+
+#include "ipc/ipc.h"
+
+namespace ipc {
+
+// Precedes the payload of every protocol message, 8 bytes so that the payload stays 8-byte aligned
+struct ProtocolHeader {
+    uint32_t id;   // Index of the type in the protocol
+    uint32_t size; // sizeof the type, a peer built with another definition of it is detected
+};
+
+// Collect lambdas into one overloaded handler for Protocol::Dispatch()
+template <typename... Handlers>
+struct Overloaded : Handlers... {
+    using Handlers::operator()...;
+};
+template <typename... Handlers>
+Overloaded(Handlers...) -> Overloaded<Handlers...>;
+
+namespace protocol_internal {
+
+template <typename T, typename... Types>
+constexpr uint32_t IndexOf()
+{
+    constexpr bool matches[] = { std::is_same_v<T, Types>... };
+    for (uint32_t i = 0; i < sizeof...(Types); ++i) {
+        if (matches[i])
+            return i;
+    }
+    return sizeof...(Types);
+}
+
+template <typename... Types>
+constexpr bool Distinct()
+{
+    // Every type is first found at its own position
+    uint32_t position = 0;
+    return ((IndexOf<Types, Types...>() == position++) && ...);
+}
+
+} // namespace protocol_internal
+
+// The message types exchanged on a channel, with wire ids assigned at compile time by their position
+// Both ends must declare the same list in the same order. Messages are a ProtocolHeader and the bytes
+// of the object, sent with one gather copy. Receivers dispatch through a table of one function per type
+// built at compile time, the handler gets a const reference into the received payload
+// Works with Node, StaticNode and anything else with the same SendV/ReceiveInto/Receive/Read calls
+//
+//   using Trading = ipc::Protocol<Order, Cancel, Fill>;
+//   Trading::Send(sender, Order { ... });
+//   Trading::Receive(receiver, ipc::Overloaded {
+//       [](const Order& order) { ... },
+//       [](const Cancel& cancel) { ... },
+//       [](const Fill& fill) { ... } });
+template <typename... Types>
+struct Protocol {
+    static_assert(sizeof...(Types) > 0, "A protocol needs at least one message type");
+    static_assert((std::is_trivially_copyable_v<Types> && ...), "Protocol messages are sent as raw bytes");
+    static_assert(protocol_internal::Distinct<Types...>(), "Protocol message types must be distinct");
+
+    using Variant = std::variant<Types...>;
+
+    static constexpr size_t COUNT = sizeof...(Types);
+    // Wire id of T, fails to compile if T is not part of the protocol
+    template <typename T>
+    static constexpr uint32_t ID = []() {
+        constexpr uint32_t id = protocol_internal::IndexOf<T, Types...>();
+        static_assert(id < COUNT, "Type is not part of the protocol");
+        return id;
+    }();
+    // Largest message on the wire, Receive() uses a buffer of this size on the stack
+    static constexpr size_t MAX_SIZE = sizeof(ProtocolHeader) + std::max({ sizeof(Types)... });
+
+    template <typename T, typename NodeT>
+        requires(protocol_internal::IndexOf<T, Types...>() < sizeof...(Types))
+    static SendResult Send(NodeT& node, const T& message)
+    {
+        ProtocolHeader header = { ID<T>, static_cast<uint32_t>(sizeof(T)) };
+        iovec iov[2] = { { &header, sizeof(header) }, { const_cast<T*>(&message), sizeof(T) } };
+        return node.SendV(iov, 2);
+    }
+
+    // Send the alternative the variant holds
+    template <typename NodeT>
+    static SendResult Send(NodeT& node, const Variant& message)
+    {
+        return std::visit([&node](const auto& alternative) { return Send(node, alternative); }, message);
+    }
+
+    // Call handler with the message in data, which starts with its ProtocolHeader
+    // Returns false if the message does not belong to the protocol: unknown id or size mismatch
+    template <typename Handler>
+    static bool Dispatch(const void* data, size_t size, Handler&& handler)
+    {
+        static_assert((std::is_invocable_v<Handler&, const Types&> && ...),
+            "The handler must accept every message type of the protocol");
+        using Entry = bool (*)(const char* payload, size_t size, Handler& handler);
+        static constexpr std::array<Entry, COUNT> TABLE = { &Invoke<Types, Handler>... };
+
+        ProtocolHeader header;
+        if (size < sizeof(header))
+            return false;
+        memcpy(&header, data, sizeof(header));
+        if (header.id >= COUNT)
+            return false;
+        return TABLE[header.id](static_cast<const char*>(data) + sizeof(header), size - sizeof(header), handler);
+    }
+
+    // Receive the next message into a buffer on the stack and dispatch it, without allocating
+    // Returns false if the receive fails or the message does not belong to the protocol
+    template <typename NodeT, typename Handler>
+    static bool Receive(NodeT& node, Handler&& handler)
+    {
+        alignas(std::max({ alignof(ProtocolHeader), alignof(Types)... })) char storage[MAX_SIZE];
+        ReceiveResult result = node.ReceiveInto(storage, sizeof(storage));
+        if (result == ReceiveStatus::kTooSmall) {
+            // Larger than any message of the protocol, take it off the channel
+            Buffer discarded(result.Size());
+            node.ReceiveInto(discarded.Data(), discarded.Size());
+            return false;
+        }
+        return result && Dispatch(storage, result.Size(), handler);
+    }
+
+    // Dispatch straight from a journal segment
+    template <typename NodeT, typename Handler>
+    static bool Read(NodeT& node, Handler&& handler)
+    {
+        JournalEntry entry;
+        return node.Read(entry) && Dispatch(entry.data, entry.size, handler);
+    }
+
+private:
+    template <typename T, typename Handler>
+    static bool Invoke(const char* payload, size_t size, Handler& handler)
+    {
+        if (size != sizeof(T))
+            return false;
+        // A view of the payload where it is aligned, which is the case for Buffers and journal entries
+        if (reinterpret_cast<uintptr_t>(payload) % alignof(T) == 0) {
+            std::invoke(handler, *reinterpret_cast<const T*>(payload));
+        } else {
+            T message;
+            memcpy(&message, payload, sizeof(T));
+            std::invoke(handler, static_cast<const T&>(message));
+        }
+        return true;
+    }
+};
+
+} // namespace ipc
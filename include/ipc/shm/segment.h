@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef _WIN32
+#include <cstddef>
+#include <string>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+namespace shm {
+
+// A named shared memory segment mapped into the address space
+// Backed by hugetlbfs when huge pages are reserved, and by /dev/shm (tmpfs) otherwise
+class Segment {
+public:
+    Segment() = default;
+    ~Segment();
+
+    // Disable copy constructor and assignment operator
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    // Create a new segment, fails if one with the same name exists
+    // huge_pages is a preference, the effective page size is reported by PageSize()
+    bool Create(const std::string& name, size_t size, HugePages huge_pages);
+    // Map an existing segment as a whole
+    bool Open(const std::string& name);
+    void Unmap();
+    // Remove the name, existing mappings stay valid until they are unmapped
+    static bool Unlink(const std::string& name);
+
+    void* Data() const { return data_; }
+    size_t Size() const { return size_; }
+    size_t PageSize() const { return page_size_; }
+
+    // Private anonymous memory for buffer pools, with the same huge page fallbacks
+    // Not prefaulted, pools only pay for the pages they hand out
+    // size is rounded up to the effective page size, which is returned in page_size
+    // Returns nullptr on failure, release with UnmapAnonymous(data, size)
+    static void* MapAnonymous(size_t& size, HugePages huge_pages, size_t& page_size);
+    static void UnmapAnonymous(void* data, size_t size);
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+    size_t page_size_ = 0;
+
+    bool Map(int fd, size_t size, bool populate);
+};
+
+} // namespace shm
+#endif // _WIN32
@@ -0,0 +1,138 @@
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <sys/types.h>
+
+#include "ipc/ipc.h"
+#include "ipc/shm/segment.h"
+
+using namespace ipc;
+
+namespace shm {
+
+// Bounded multi-producer ring of fixed size slots in a shared memory segment
+// Producers claim a slot by advancing tail, copy the message straight into it and publish it
+// through the sequence number of the slot, the receiver consumes slots in order from head
+// Slots carry the deadline of their message, expired ones are released without being copied
+class SharedMemory final : public Channel {
+public:
+    SharedMemory(std::string name, NodeType ntype, key_t key, const ChannelOptions& options);
+    ~SharedMemory();
+
+    SendResult Send(const void* data, size_t data_size = 0) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& buffer) override;
+    bool Remove() override;
+    bool Closed() const override;
+    ChannelOptions Options() const override;
+    ChannelStats Stats() const override;
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size) override;
+    ReceiveResult ReceiveInto(void* dst, size_t capacity) override;
+    SendResult SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt) override;
+
+private:
+    const std::string shm_name_;
+    const std::string segment_name_; // Derived from the key like the System V queue of the same Node
+    const NodeType node_type_;
+    ChannelOptions options_; // Effective options
+
+    static constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 4096;
+    static constexpr size_t DEFAULT_SLOT_COUNT = 256;
+    static constexpr uint32_t DEFAULT_SPIN_BUDGET = 128;
+    static constexpr uint32_t MAGIC = 0x49504352; // "IPCR"
+    static constexpr uint32_t VERSION = 3;
+
+    struct Slot {
+        // pos: free for the producer claiming pos, pos + 1: holds the message written at pos
+        // pos + slot_count: consumed, free for the producer claiming the next lap
+        std::atomic<uint64_t> seq;
+        uint64_t size;
+        // Steady clock nanoseconds after which the message is dropped, 0 for none
+        // Atomic as senders reclaiming expired slots read it while the receiver may be consuming the slot
+        std::atomic<uint64_t> deadline;
+        char data[];
+    };
+
+    // Layout fields are written once by the kReceiver before magic is published
+    struct alignas(64) Header {
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint64_t slot_count; // Power of two
+        uint64_t slot_size;  // sizeof(Slot) + max message size, cache line aligned
+        uint64_t page_size;
+        pid_t owner_pid;
+        unsigned long long owner_start_time;
+        std::atomic<uint32_t> closed; // Set when the kReceiver removes the channel
+
+        alignas(64) std::atomic<uint64_t> tail; // Next position claimed by a producer
+        alignas(64) std::atomic<uint64_t> head; // Next position consumed
+        // Doorbells: a side about to sleep sets its flag, the other side only bumps the futex word
+        // and wakes when it takes the flag, so a burst costs one syscall and none while nobody sleeps
+        alignas(64) std::atomic<uint32_t> data_seq;
+        std::atomic<uint32_t> data_sleeping;
+        alignas(64) std::atomic<uint32_t> space_seq;
+        std::atomic<uint32_t> space_sleeping;
+
+        alignas(64) std::atomic<uint64_t> wakeups;
+        std::atomic<uint64_t> sleeps;
+        std::atomic<uint64_t> expired;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory needs address-free atomics");
+
+    // The ring in use, fixed for the kReceiver. Senders connect on their first Send and again
+    // once the receiver closed the ring, threads sharing the Node do so under connect_mutex_
+    // and otherwise only load header_. Every Send works on the header it loaded
+    std::atomic<Header*> header_ { nullptr };
+    Segment segment_; // kReceiver
+    // kSender: every mapping connected so far, a replaced one may still be in use by another thread
+    std::deque<Segment> segments_;
+    mutable std::mutex connect_mutex_;
+
+    bool Create();
+    // Current ring of a kSender, nullptr if there is no receiver
+    Header* Connect();
+    // Validate the layout of a mapped segment
+    Header* Attach(Segment& segment);
+    // Handle a segment that already exists when the kReceiver starts
+    bool RecoverStaleSegment();
+    static Slot* SlotAt(Header* header, uint64_t pos)
+    {
+        char* slots = reinterpret_cast<char*>(header) + sizeof(Header);
+        return reinterpret_cast<Slot*>(slots + (pos & (header->slot_count - 1)) * header->slot_size);
+    }
+
+    // Claim a free slot, returns nullptr if the ring is full
+    static Slot* TryClaim(Header* header, uint64_t& pos);
+    // Claim the oldest published slot, returns nullptr if the ring is empty
+    static Slot* TryConsume(Header* header, uint64_t& pos);
+    // Release the oldest published slots as long as their messages are expired, returns the number released
+    static uint64_t ReclaimExpired(Header* header);
+    // Hand a claimed slot to the consumer or a consumed slot back to producers
+    static void Publish(Header* header, Slot* slot, uint64_t pos);
+    static void Release(Header* header, Slot* slot, uint64_t pos);
+    // Ring the doorbell of the other side if it is asleep
+    static void Notify(Header* header, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& sleeping);
+    // Sleep until the doorbell rings, unless ready() becomes true after announcing the sleep
+    template <typename Ready>
+    static bool Sleep(Header* header, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& sleeping, Ready ready,
+        const struct timespec* timeout);
+
+    // Claim a slot applying the backpressure policy
+    SendStatus Claim(Header* header, Slot*& slot, uint64_t& pos);
+    // Wait for the next message, spinning and sleeping according to the options
+    Slot* Wait(Header* header, uint64_t& pos);
+    // Wait for the next message that has not expired
+    Slot* Consume(Header* header, uint64_t& pos);
+    // Gather a message into a slot
+    SendResult Post(const iovec* iov, size_t iovcnt, uint64_t deadline);
+};
+
+} // namespace shm
+#endif // _WIN32
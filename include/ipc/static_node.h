@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "ipc/ipc.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+namespace ipc {
+
+#ifndef _WIN32
+// System V key of the channels of a Node, derived from its name so that both ends agree
+key_t NameKey(const std::string& name);
+#endif
+
+// Spread keys over the partitions, keys are often small sequential ids
+inline size_t PartitionOf(uint64_t key, size_t partitions)
+{
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+    return (key ^ (key >> 31)) % partitions;
+}
+
+// Transports that carry deadlines themselves, a StaticNode has no layer to add them to the others
+template <typename ChannelT>
+concept KeepsDeadlines = !std::is_same_v<decltype(&ChannelT::SendBefore), decltype(&Channel::SendBefore)>;
+
+// A StaticNode is the bare transport: options that Node implements with layers on top of it
+// (coalescing, blob store, integrity checks, and deadlines unless keeps_deadlines) exit the process
+void CheckStaticOptions(const std::string& name, const ChannelOptions& options, bool keeps_deadlines);
+
+// Build a transport with the arguments its constructor takes, System V based ones also need the key
+// Returns a prvalue so that non-movable channels are constructed in place
+template <std::derived_from<Channel> ChannelT>
+ChannelT MakeChannel(const std::string& name, NodeType ntype, const ChannelOptions& options)
+{
+#ifndef _WIN32
+    if constexpr (std::is_constructible_v<ChannelT, std::string, NodeType, key_t, const ChannelOptions&>)
+        return ChannelT(name, ntype, NameKey(name), options);
+    else
+#endif
+        return ChannelT(name, ntype, options);
+}
+
+// A Node whose transport and role are fixed at compile time
+// The channel is held by value and the transports are final, so every call is a direct call that the
+// compiler can inline (across the library with IPC_ENABLE_LTO), with no shared_ptr and no runtime checks
+// of the role: calling Send on a kReceiver or Receive on a kSender does not compile
+// Arguments are passed through unchecked, the transports validate what they need to, options that
+// need the layers of a Node are rejected
+//
+//   ipc::StaticNode<shm::SharedMemory, ipc::NodeType::kSender> sender("Fast");
+//   sender.Send(data, size);
+template <std::derived_from<Channel> ChannelT, NodeType Type>
+    requires std::is_final_v<ChannelT>
+class StaticNode {
+public:
+    explicit StaticNode(std::string name, const ChannelOptions& options = ChannelOptions())
+        : name_(std::move(name))
+        , channel_(MakeChannel<ChannelT>(name_, Type, options))
+        , partitions_(std::max<size_t>(1, channel_.Options().partitions))
+    {
+        CheckStaticOptions(name_, options, KeepsDeadlines<ChannelT>);
+    }
+    ~StaticNode() { Remove(); }
+
+    // Disable copy constructor and assignment operator
+    StaticNode(const StaticNode&) = delete;
+    StaticNode& operator=(const StaticNode&) = delete;
+
+    static constexpr NodeType node_type = Type;
+
+    const std::string& getName() const { return name_; }
+    ChannelOptions Options() const { return channel_.Options(); }
+    ChannelStats Stats() const { return channel_.Stats(); }
+    // The transport itself, for what only it offers
+    ChannelT& Transport() { return channel_; }
+
+    SendResult Send(const void* data, size_t data_size)
+        requires(Type == NodeType::kSender)
+    {
+        return channel_.Send(data, data_size);
+    }
+
+    SendResult SendV(const iovec* iov, size_t iovcnt)
+        requires(Type == NodeType::kSender)
+    {
+        return channel_.SendV(iov, iovcnt);
+    }
+
+    SendResult SendBefore(Deadline deadline, const void* data, size_t data_size)
+        requires(Type == NodeType::kSender && KeepsDeadlines<ChannelT>)
+    {
+        iovec iov = { const_cast<void*>(data), data_size };
+        return channel_.SendBefore(deadline, &iov, 1);
+    }
+
+    SendResult SendKeyed(uint64_t key, const void* data, size_t data_size)
+        requires(Type == NodeType::kSender)
+    {
+        iovec iov = { const_cast<void*>(data), data_size };
+        return channel_.SendPartitioned(PartitionOf(key, partitions_), &iov, 1);
+    }
+
+    std::shared_ptr<Buffer> Receive()
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.Receive();
+    }
+
+    bool Receive(Buffer& message)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.ReceiveBuffer(message);
+    }
+
+    ReceiveResult ReceiveInto(void* dst, size_t capacity)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.ReceiveInto(dst, capacity);
+    }
+
+    bool ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.ReceiveV(iov, iovcnt, received_size);
+    }
+
+    // The channel lives as long as the StaticNode, Remove() from another thread stops the workers
+    bool Dispatch(const PartitionHandler& handler)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.Dispatch(handler);
+    }
+
+    bool Read(JournalEntry& entry)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.Read(entry);
+    }
+
+    bool Seek(uint64_t seq)
+        requires(Type == NodeType::kReceiver)
+    {
+        return channel_.Seek(seq);
+    }
+
+    bool Remove() { return channel_.Remove(); }
+
+private:
+    const std::string name_;
+    ChannelT channel_;
+    size_t partitions_ = 1; // Effective ChannelOptions::partitions
+};
+
+} // namespace ipc
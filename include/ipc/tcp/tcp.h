@@ -0,0 +1,87 @@
+#pragma once
+
+#ifndef _WIN32
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "ipc/ipc.h"
+#include "ipc/uring/engine.h"
+
+using namespace ipc;
+
+namespace tcp {
+
+// Messages over TCP connections, framed with a 4-byte length prefix in network byte order
+// The receiver listens on the endpoint of the name and merges the messages of all connected senders,
+// every sender opens one connection on its first Send
+// Sockets are driven by io_uring, queued messages of a sender leave in a single writev
+class TcpChannel final : public Channel {
+public:
+    static constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_CAPACITY_BYTES = 4 * 1024 * 1024;
+
+    TcpChannel(const std::string& name, NodeType ntype, const ChannelOptions& options);
+    ~TcpChannel();
+
+    SendResult Send(const void* data, size_t data_size) override;
+    std::shared_ptr<Buffer> Receive() override;
+    bool ReceiveBuffer(Buffer& message) override;
+    bool Remove() override;
+    bool Closed() const override;
+    ChannelOptions Options() const override { return options_; }
+
+    SendResult SendV(const iovec* iov, size_t iovcnt) override;
+
+    // Resolve the endpoint of name, see ipc::MapEndpoint()
+    static std::string Endpoint(const std::string& name);
+
+private:
+    // A connection accepted by the receiver, and the message it is in the middle of
+    struct Connection {
+        unsigned char header[4];
+        size_t header_size = 0;
+        bool in_message = false;
+        Buffer message;
+        size_t message_size = 0;
+        bool broken = false; // Sent an invalid frame, ignored until the stream ends
+    };
+
+    const std::string name_;
+    const NodeType node_type_;
+    ChannelOptions options_; // Effective options
+    std::shared_ptr<uring::Engine> engine_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool removed_ = false;
+
+    // kReceiver
+    int listen_fd_ = -1;
+    std::thread accept_thread_;
+    std::unordered_map<int, Connection> connections_;
+    std::deque<Buffer> pending_; // Received messages
+    size_t pending_bytes_ = 0;
+
+    // kSender
+    int fd_ = -1;
+    size_t in_flight_ = 0; // Payload bytes handed to the engine and not sent yet
+    bool broken_ = false; // A send failed, the connection is closed by the next Send
+
+    bool Listen();
+    void AcceptLoop();
+    // Split a chunk of the byte stream of a connection into messages, called on the engine thread
+    bool Consume(Connection& connection, const unsigned char* data, size_t size);
+    void Deliver(Buffer message);
+
+    bool Connect();
+    // Close the connection of the sender, called with mutex_ held through lock
+    void Disconnect(std::unique_lock<std::mutex>& lock);
+};
+
+} // namespace tcp
+#endif // _WIN32
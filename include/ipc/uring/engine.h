@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef _WIN32
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+namespace uring {
+
+// Outcome of an operation, the number of bytes transferred or -errno
+using Completion = std::function<void(ssize_t result)>;
+// One chunk of a byte stream, data is only valid during the call
+// size is 0 once the peer has closed and -errno on failure, the handler is not called again after either
+using StreamHandler = std::function<void(const void* data, ssize_t size)>;
+
+struct EngineStats {
+    uint64_t submits = 0; // System calls made to hand operations to the kernel
+    uint64_t operations = 0; // Requests handed to the kernel, queued sends of a socket are coalesced into one
+    uint64_t completions = 0; // Operations completed
+};
+
+// Asynchronous sends and receives on sockets, completed on a small number of threads
+// Backed by io_uring where the kernel allows it and by poll(2) otherwise, so that many
+// connections do not need a thread each
+// Completions of a socket always run on the same thread, in the order the kernel reports them
+class Engine {
+public:
+    // threads: number of completion threads, a socket is served by thread fd % threads
+    // use_io_uring: false forces the poll(2) backend
+    explicit Engine(size_t threads = 1, bool use_io_uring = true);
+    // Cancels every outstanding operation, their callbacks run with -ECANCELED before it returns
+    ~Engine();
+
+    // Disable copy constructor and assignment operator
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // Whether the engine runs on io_uring
+    bool IoUring() const { return io_uring_; }
+
+    // The operations below are queued, and handed to the kernel together by the next Flush()
+    // Callbacks run on a completion thread and must not block it
+
+    // Send every byte described by iov, the segments must stay valid until done is called
+    // The iovec array itself is copied
+    bool SendV(int fd, const iovec* iov, size_t iovcnt, Completion done);
+    // Receive up to size bytes into data, which must stay valid until done is called
+    bool Receive(int fd, void* data, size_t size, Completion done);
+    // Keep receiving from fd into buffers of the engine until the peer closes or Cancel(fd)
+    // On io_uring this is a single multishot receive over registered buffers
+    bool ReceiveStream(int fd, StreamHandler handler);
+    // Complete every operation on fd with -ECANCELED, the socket may be closed afterwards
+    void Cancel(int fd);
+    // Submit all queued operations, with one system call per completion thread
+    void Flush();
+
+    EngineStats Stats() const;
+
+    // Size of the engine buffers ReceiveStream hands to its handler
+    static constexpr size_t STREAM_BUFFER_SIZE = 16 * 1024;
+
+    class Worker;
+
+private:
+    bool io_uring_ = false;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    Worker& WorkerOf(int fd) { return *workers_[static_cast<size_t>(fd) % workers_.size()]; }
+};
+
+} // namespace uring
+#endif // _WIN32
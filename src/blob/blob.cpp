@@ -0,0 +1,514 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc/blob/blob.h"
+#include "utils/assert.h"
+#include "utils/futex.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace blob {
+
+static std::string ArenaName(key_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/ipc-blob-%08x", static_cast<unsigned>(key));
+    return name;
+}
+
+Arena* Arena::Create(const std::string& name, size_t bytes, HugePages huge_pages, RecoveryPolicy recovery)
+{
+    uint32_t max_order = MIN_ORDER;
+    while ((uint64_t(2) << max_order) <= bytes)
+        ++max_order;
+
+    Arena* arena = new Arena();
+    if (!arena->segment_.Create(name, sizeof(Header) + (uint64_t(1) << max_order), huge_pages)) {
+        if (errno == EEXIST && arena->segment_.Open(name)) {
+            if (arena->Attach()) {
+                // Pending descriptors of the previous receiver still resolve in its arena
+                if (recovery == RecoveryPolicy::kReattach) {
+                    XINFO("Blob arena %s reattached", name.c_str());
+                    return arena;
+                }
+                // Senders still mapping the old arena notice this and open the new one
+                arena->Close();
+                arena->header_ = nullptr;
+            }
+            arena->segment_.Unmap();
+            shm::Segment::Unlink(name);
+        }
+        if (!arena->segment_.Create(name, sizeof(Header) + (uint64_t(1) << max_order), huge_pages)) {
+            XERRO("Create blob arena %s fail", name.c_str());
+            delete arena;
+            return nullptr;
+        }
+    }
+    if (!arena->Init(max_order)) {
+        delete arena;
+        shm::Segment::Unlink(name);
+        return nullptr;
+    }
+    return arena;
+}
+
+Arena* Arena::Open(const std::string& name)
+{
+    Arena* arena = new Arena();
+    if (!arena->segment_.Open(name) || !arena->Attach() || arena->Closed()) {
+        // No receiver, one still initializing the arena, or one that is gone
+        delete arena;
+        return nullptr;
+    }
+    return arena;
+}
+
+bool Arena::Init(uint32_t max_order)
+{
+    // A fresh segment is zero filled, construct the shared state in place
+    Header* header = new (segment_.Data()) Header();
+    header->version = VERSION;
+    header->epoch = static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count() ^ getpid());
+    header->max_order = max_order;
+    header->blocks_offset = sizeof(Header);
+
+    // A sender may die while holding the mutex, robust mutexes hand it to the next process instead of hanging
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int ret = pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    errno = ret;
+    XASSERT_RETURN(ret != 0, false, "pthread_mutex_init fail");
+
+    header_ = header;
+    std::fill(header->free_lists, header->free_lists + ORDERS, NONE);
+    Push(0, header->max_order);
+    // Senders only use the arena once the layout is complete
+    header->magic.store(MAGIC, std::memory_order_release);
+    return true;
+}
+
+bool Arena::Attach()
+{
+    Header* header = static_cast<Header*>(segment_.Data());
+    if (segment_.Size() < sizeof(Header) || header->magic.load(std::memory_order_acquire) != MAGIC)
+        return false;
+    XASSERT_RETURN(header->version != VERSION, false, "Blob arena has version %u, expected %u", header->version, VERSION);
+    XASSERT_RETURN(header->max_order >= ORDERS || segment_.Size() < header->blocks_offset + (uint64_t(1) << header->max_order),
+        false, "Blob arena is truncated");
+    header_ = header;
+    return true;
+}
+
+void Arena::Unref()
+{
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+Arena::Block* Arena::BlockAt(uint64_t offset) const
+{
+    return reinterpret_cast<Block*>(static_cast<char*>(segment_.Data()) + header_->blocks_offset + offset);
+}
+
+void Arena::Lock()
+{
+    int ret = pthread_mutex_lock(&header_->mutex);
+    if (ret == EOWNERDEAD) {
+        // Free list updates are short, the one interrupted may leak a block but leaves the lists walkable
+        XWARN("A process died while allocating from a blob arena, recovering its lock");
+        pthread_mutex_consistent(&header_->mutex);
+    }
+}
+
+void Arena::Push(uint64_t offset, uint32_t order)
+{
+    Block* block = BlockAt(offset);
+    block->used = 0;
+    block->order = order;
+    block->prev = NONE;
+    block->next = header_->free_lists[order];
+    if (block->next != NONE)
+        BlockAt(block->next)->prev = offset;
+    header_->free_lists[order] = offset;
+}
+
+void Arena::Unlink(uint64_t offset)
+{
+    Block* block = BlockAt(offset);
+    if (block->prev != NONE)
+        BlockAt(block->prev)->next = block->next;
+    else
+        header_->free_lists[block->order] = block->next;
+    if (block->next != NONE)
+        BlockAt(block->next)->prev = block->prev;
+}
+
+void* Arena::Allocate(size_t size, Descriptor& descriptor)
+{
+    uint32_t order = MIN_ORDER;
+    while ((uint64_t(1) << order) < size + sizeof(Block))
+        ++order;
+    if (order > header_->max_order)
+        return nullptr;
+
+    Lock();
+    uint32_t free_order = order;
+    while (free_order <= header_->max_order && header_->free_lists[free_order] == NONE)
+        ++free_order;
+    if (free_order > header_->max_order) {
+        pthread_mutex_unlock(&header_->mutex);
+        return nullptr;
+    }
+    const uint64_t offset = header_->free_lists[free_order];
+    Unlink(offset);
+    // Split down to the size needed, the upper halves become free blocks of their own
+    while (free_order > order) {
+        --free_order;
+        Push(offset + (uint64_t(1) << free_order), free_order);
+    }
+    Block* block = BlockAt(offset);
+    block->used = 1;
+    block->order = order;
+    block->length = size;
+    block->generation = ++header_->generation;
+    descriptor = { offset, size, block->generation, header_->epoch };
+    pthread_mutex_unlock(&header_->mutex);
+    return block + 1;
+}
+
+void Arena::Free(void* payload)
+{
+    Block* block = static_cast<Block*>(payload) - 1;
+    uint64_t offset = reinterpret_cast<char*>(block) - (static_cast<char*>(segment_.Data()) + header_->blocks_offset);
+
+    Lock();
+    uint32_t order = block->order;
+    // Merge with the buddy for as long as it is free as a whole
+    while (order < header_->max_order) {
+        const uint64_t buddy_offset = offset ^ (uint64_t(1) << order);
+        Block* buddy = BlockAt(buddy_offset);
+        if (buddy->used || buddy->order != order)
+            break;
+        Unlink(buddy_offset);
+        offset = std::min(offset, buddy_offset);
+        ++order;
+    }
+    Push(offset, order);
+    pthread_mutex_unlock(&header_->mutex);
+
+    header_->freed_seq.fetch_add(1);
+    if (header_->waiters.load() > 0)
+        FutexWake(&header_->freed_seq, INT_MAX);
+}
+
+uint32_t Arena::FreedSeq() const
+{
+    return header_->freed_seq.load();
+}
+
+void Arena::WaitFreed(uint32_t seq, const struct timespec* timeout)
+{
+    // Announce the wait before checking the sequence, Free() bumps it before it looks for waiters
+    header_->waiters.fetch_add(1);
+    if (header_->freed_seq.load() == seq && !Closed())
+        FutexWait(&header_->freed_seq, seq, timeout);
+    header_->waiters.fetch_sub(1);
+}
+
+void* Arena::Resolve(const Descriptor& descriptor)
+{
+    const uint64_t arena_size = uint64_t(1) << header_->max_order;
+    if (descriptor.epoch != header_->epoch || descriptor.offset >= arena_size
+        || descriptor.offset % (uint64_t(1) << MIN_ORDER) != 0)
+        return nullptr;
+    // The block has been handed over with the message, its header is not touched by anyone else until it is freed
+    Block* block = BlockAt(descriptor.offset);
+    if (!block->used || block->generation != descriptor.generation || block->length != descriptor.length
+        || block->order > header_->max_order || descriptor.offset + (uint64_t(1) << block->order) > arena_size)
+        return nullptr;
+    return block + 1;
+}
+
+void Arena::Close()
+{
+    header_->closed.store(1, std::memory_order_release);
+    // Wake up senders waiting for room so that they see it is closed
+    header_->freed_seq.fetch_add(1);
+    FutexWake(&header_->freed_seq, INT_MAX);
+}
+
+bool Arena::Closed() const
+{
+    return header_->closed.load(std::memory_order_acquire) != 0;
+}
+
+size_t Arena::MaxBlobSize() const
+{
+    return (size_t(1) << header_->max_order) - sizeof(Block);
+}
+
+size_t Arena::Bytes() const
+{
+    return size_t(1) << header_->max_order;
+}
+
+// Release of a received blob, the Buffer holds a reference to the arena
+static void ReleaseBlob(void* context, void* payload)
+{
+    Arena* arena = static_cast<Arena*>(context);
+    arena->Free(payload);
+    arena->Unref();
+}
+
+BlobChannel::BlobChannel(std::shared_ptr<Channel> channel, std::string name, NodeType ntype, key_t key,
+    const ChannelOptions& options)
+    : channel_(std::move(channel))
+    , name_(name)
+    , arena_name_(ArenaName(key))
+    , node_type_(ntype)
+    , options_(options)
+{
+    if (options_.blob_arena_bytes == 0)
+        options_.blob_arena_bytes = DEFAULT_ARENA_BYTES;
+
+    switch (ntype) {
+    case NodeType::kReceiver: {
+        Arena* arena = Arena::Create(arena_name_, options_.blob_arena_bytes, options_.huge_pages, options_.recovery);
+        XASSERT_EXIT(!arena, "kReceiver (Blob) '%s' create failed", name_.c_str());
+        options_.blob_arena_bytes = arena->Bytes();
+        options_.max_message_size = arena->MaxBlobSize();
+        arena_.store(arena, std::memory_order_release);
+        XDEBG("kReceiver (Blob) '%s' created arena %s with %zu bytes", name_.c_str(), arena_name_.c_str(), arena->Bytes());
+        break;
+    }
+    case NodeType::kSender:
+        // Open the arena on the first large Send, the receiver may not exist yet
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown NodeType %d for Node %s", static_cast<int>(ntype), name_.c_str());
+        break;
+    }
+}
+
+BlobChannel::~BlobChannel()
+{
+    BlobChannel::Remove();
+    // Buffers still referring to blocks keep their arena mapped
+    if (Arena* arena = arena_.load(std::memory_order_relaxed))
+        arena->Unref();
+    for (Arena* arena : retired_)
+        arena->Unref();
+}
+
+Arena* BlobChannel::Connect()
+{
+    Arena* arena = arena_.load(std::memory_order_acquire);
+    if (arena && !arena->Closed())
+        return arena;
+
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    // Another thread sharing the Node may have connected while this one waited for the lock
+    arena = arena_.load(std::memory_order_relaxed);
+    if (arena && !arena->Closed())
+        return arena;
+
+    Arena* current = Arena::Open(arena_name_);
+    if (!current) {
+        XDEBG("Blob arena of Node '%s' (%s) does not exist", name_.c_str(), arena_name_.c_str());
+        return nullptr;
+    }
+    if (arena)
+        retired_.push_back(arena);
+    options_.blob_arena_bytes = current->Bytes();
+    options_.max_message_size = current->MaxBlobSize();
+    arena_.store(current, std::memory_order_release);
+    XDEBG("kSender (Blob) '%s' connected to %s", name_.c_str(), arena_name_.c_str());
+    return current;
+}
+
+size_t BlobChannel::InlineLimit()
+{
+    size_t limit = inline_limit_.load(std::memory_order_relaxed);
+    if (limit == 0) {
+        // Senders of some transports only learn the limit once they connect
+        const size_t channel_size = channel_->Options().max_message_size;
+        if (channel_size > sizeof(Trailer)) {
+            limit = channel_size - sizeof(Trailer);
+            inline_limit_.store(limit, std::memory_order_relaxed);
+        }
+    }
+    return limit;
+}
+
+SendResult BlobChannel::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult BlobChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    const size_t size = IovLength(iov, iovcnt);
+    if (size < options_.blob_threshold) {
+        const size_t limit = InlineLimit();
+        if (limit == 0 || size <= limit) {
+            SendResult result = SendInline(iov, iovcnt);
+            // The transport turned out to be too small for it
+            if (result.Status() != SendStatus::kTooLarge)
+                return result;
+        }
+    }
+    return SendBlob(iov, iovcnt, size);
+}
+
+SendResult BlobChannel::SendInline(const iovec* iov, size_t iovcnt)
+{
+    const Trailer trailer = { Kind::kInline, TRAILER_MAGIC };
+    return SendWithTrailer(*channel_, iov, iovcnt, &trailer, sizeof(trailer));
+}
+
+SendStatus BlobChannel::Allocate(Arena* arena, size_t size, void*& payload, Descriptor& descriptor)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + options_.send_timeout;
+    while (true) {
+        const uint32_t seq = arena->FreedSeq();
+        payload = arena->Allocate(size, descriptor);
+        if (payload)
+            return SendStatus::kOk;
+        if (arena->Closed())
+            return SendStatus::kDisconnected;
+
+        switch (options_.backpressure) {
+        case BackpressurePolicy::kFailFast:
+            return SendStatus::kWouldBlock;
+        case BackpressurePolicy::kDropNewest:
+            return SendStatus::kDropped;
+        case BackpressurePolicy::kTimeout: {
+            const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now());
+            if (remaining.count() <= 0)
+                return SendStatus::kTimedOut;
+            struct timespec timeout = { static_cast<time_t>(remaining.count() / 1000000000),
+                static_cast<long>(remaining.count() % 1000000000) };
+            arena->WaitFreed(seq, &timeout);
+            break;
+        }
+        default:
+            // Blocks cannot be evicted, kDropOldest waits for the receiver like kBlock
+            arena->WaitFreed(seq, nullptr);
+            break;
+        }
+    }
+}
+
+SendResult BlobChannel::SendBlob(const iovec* iov, size_t iovcnt, size_t size)
+{
+    Arena* arena = Connect();
+    if (!arena)
+        return SendStatus::kDisconnected;
+    XASSERT_RETURN(size > arena->MaxBlobSize(), SendStatus::kTooLarge, "Data size %zu exceeds maximum message size %zu",
+        size, arena->MaxBlobSize());
+
+    void* payload;
+    Descriptor descriptor;
+    SendStatus status = Allocate(arena, size, payload, descriptor);
+    if (status != SendStatus::kOk)
+        return status;
+    // The payload is copied once into the arena, the transport only carries the descriptor
+    IovGather(payload, iov, iovcnt);
+
+    const Trailer trailer = { Kind::kBlob, TRAILER_MAGIC };
+    iovec message[2] = { { &descriptor, sizeof(descriptor) }, { const_cast<Trailer*>(&trailer), sizeof(trailer) } };
+    SendResult result = channel_->SendV(message, 2);
+    if (!result)
+        arena->Free(payload);
+    return result;
+}
+
+bool BlobChannel::ReceiveBuffer(Buffer& message)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    while (true) {
+        if (!channel_->ReceiveBuffer(message))
+            return false;
+
+        Trailer trailer;
+        const size_t size = message.Size();
+        if (size >= sizeof(Trailer))
+            memcpy(&trailer, static_cast<const char*>(message.Data()) + size - sizeof(Trailer), sizeof(Trailer));
+        // Messages of senders without the blob store have no trailer and are delivered as they come
+        if (size < sizeof(Trailer) || trailer.magic != TRAILER_MAGIC)
+            return true;
+        message.SetSize(size - sizeof(Trailer));
+        if (trailer.kind == Kind::kInline)
+            return true;
+
+        Descriptor descriptor;
+        Arena* arena = arena_.load(std::memory_order_relaxed);
+        void* payload = nullptr;
+        if (trailer.kind == Kind::kBlob && message.Size() == sizeof(descriptor)) {
+            memcpy(&descriptor, message.Data(), sizeof(descriptor));
+            payload = arena->Resolve(descriptor);
+        }
+        if (!payload) {
+            // Left behind for an arena that has been replaced since, its block is gone
+            XERRO("Discarding a blob of Node '%s' that is not in its arena", name_.c_str());
+            continue;
+        }
+        arena->Ref();
+        message = Buffer(payload, descriptor.length, &ReleaseBlob, arena);
+        return true;
+    }
+}
+
+std::shared_ptr<Buffer> BlobChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+bool BlobChannel::Remove()
+{
+    if (node_type_ == NodeType::kReceiver) {
+        std::lock_guard<std::mutex> lock(connect_mutex_);
+        Arena* arena = arena_.load(std::memory_order_relaxed);
+        // Buffers received so far stay valid, senders fail instead of filling an arena nobody drains
+        if (arena && !arena->Closed()) {
+            arena->Close();
+            shm::Segment::Unlink(arena_name_);
+        }
+    }
+    return channel_->Remove();
+}
+
+ChannelOptions BlobChannel::Options() const
+{
+    ChannelOptions options = channel_->Options();
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    options.blob_threshold = options_.blob_threshold;
+    options.blob_arena_bytes = options_.blob_arena_bytes;
+    // Senders learn the largest blob when they open the arena
+    options.max_message_size = node_type_ == NodeType::kReceiver || arena_.load(std::memory_order_relaxed)
+        ? options_.max_message_size
+        : 0;
+    return options;
+}
+
+} // namespace blob
+#endif // _WIN32
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipc/ipc.h"
+#include "utils/assert.h"
+#include "utils/log.h"
+
+#ifndef _WIN32
+#include "ipc/shm/segment.h"
+#endif
+
+namespace ipc {
+
+// Power of two size classes for payloads above Buffer::INLINE_CAPACITY
+// Blocks are carved from large chunks and kept on per-class free lists, chunks are never returned
+class BufferPool {
+public:
+    static constexpr size_t MIN_BLOCK_SIZE = 512;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t CLASS_COUNT = 8;    // 512 B ... 64 KiB
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+
+    // Buffers may be released during static destruction, so the pool is never destroyed
+    static BufferPool& Instance()
+    {
+        static BufferPool* pool = new BufferPool();
+        return *pool;
+    }
+
+    // Returns nullptr if size exceeds MAX_BLOCK_SIZE or memory is exhausted
+    void* Allocate(size_t size, size_t& capacity)
+    {
+        if (size > MAX_BLOCK_SIZE)
+            return nullptr;
+        size_t index = ClassOf(size);
+        SizeClass& size_class = classes_[index];
+        capacity = MIN_BLOCK_SIZE << index;
+
+        std::lock_guard<std::mutex> lock(size_class.mutex);
+        if (!size_class.free && !Refill(size_class, capacity))
+            return nullptr;
+        FreeBlock* block = size_class.free;
+        size_class.free = block->next;
+        return block;
+    }
+
+    void SetHugePages(HugePages huge_pages) { huge_pages_.store(huge_pages, std::memory_order_relaxed); }
+
+    void Free(void* data, size_t capacity)
+    {
+        SizeClass& size_class = classes_[ClassOf(capacity)];
+        FreeBlock* block = static_cast<FreeBlock*>(data);
+        std::lock_guard<std::mutex> lock(size_class.mutex);
+        block->next = size_class.free;
+        size_class.free = block;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    struct SizeClass {
+        std::mutex mutex;
+        FreeBlock* free = nullptr;
+    };
+    SizeClass classes_[CLASS_COUNT];
+    std::atomic<HugePages> huge_pages_ { HugePages::kNone };
+
+    static size_t ClassOf(size_t size)
+    {
+        size_t index = 0;
+        while ((MIN_BLOCK_SIZE << index) < size)
+            ++index;
+        return index;
+    }
+
+    // Carve a new chunk into free blocks, called with the class mutex held
+    bool Refill(SizeClass& size_class, size_t block_size)
+    {
+        size_t chunk_size = std::max(CHUNK_SIZE, 8 * block_size);
+#ifdef _WIN32
+        char* chunk = static_cast<char*>(malloc(chunk_size));
+#else
+        // The same fallbacks as the transport memory apply, see SetBufferPoolPages()
+        size_t page_size;
+        char* chunk = static_cast<char*>(shm::Segment::MapAnonymous(chunk_size, huge_pages_.load(std::memory_order_relaxed), page_size));
+#endif
+        XASSERT_RETURN(!chunk, false, "Failed to allocate a buffer pool chunk of %zu bytes", chunk_size);
+
+        for (size_t offset = 0; offset + block_size <= chunk_size; offset += block_size) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + offset);
+            block->next = size_class.free;
+            size_class.free = block;
+        }
+        return true;
+    }
+};
+
+void SetBufferPoolPages(HugePages huge_pages)
+{
+    BufferPool::Instance().SetHugePages(huge_pages);
+}
+
+Buffer::Buffer(size_t size)
+    : data_size_(size)
+{
+    if (size <= INLINE_CAPACITY) {
+        capacity_ = INLINE_CAPACITY;
+        return;
+    }
+
+    data_ = BufferPool::Instance().Allocate(size, capacity_);
+    if (data_) {
+        storage_ = Storage::kPool;
+        return;
+    }
+    // Larger than any size class
+    data_ = malloc(size);
+    capacity_ = data_ ? size : 0;
+    storage_ = Storage::kHeap;
+}
+
+Buffer::Buffer(void* data, size_t size)
+    : data_(data)
+    , data_size_(size)
+    , capacity_(size)
+    , storage_(Storage::kHeap)
+{
+}
+
+Buffer::Buffer(void* data, size_t size, ReleaseFunction release, void* context)
+    : data_(data)
+    , data_size_(size)
+    , capacity_(size)
+    , storage_(Storage::kExternal)
+    , release_(release)
+    , release_context_(context)
+{
+}
+
+Buffer::~Buffer()
+{
+    Release();
+}
+
+Buffer::Buffer(Buffer&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    Release();
+    data_ = other.data_;
+    data_size_ = other.data_size_;
+    capacity_ = other.capacity_;
+    storage_ = other.storage_;
+    release_ = other.release_;
+    release_context_ = other.release_context_;
+    if (storage_ == Storage::kInline)
+        memcpy(inline_, other.inline_, data_size_);
+
+    other.data_ = nullptr;
+    other.data_size_ = 0;
+    other.capacity_ = 0;
+    other.storage_ = Storage::kInline;
+    return *this;
+}
+
+void Buffer::Release()
+{
+    switch (storage_) {
+    case Storage::kPool:
+        BufferPool::Instance().Free(data_, capacity_);
+        break;
+    case Storage::kHeap:
+        free(data_);
+        break;
+    case Storage::kExternal:
+        release_(release_context_, data_);
+        break;
+    default:
+        break;
+    }
+    data_ = nullptr;
+    storage_ = Storage::kInline;
+}
+
+std::shared_ptr<Buffer> Buffer::Share() &&
+{
+    return std::make_shared<Buffer>(std::move(*this));
+}
+
+} // namespace ipc
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstdint>
+#include <string.h>
+#include <utility>
+
+#include "ipc/coalesce/coalesce.h"
+#include "utils/assert.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace coalesce {
+
+CoalescingChannel::CoalescingChannel(std::shared_ptr<Channel> channel, NodeType ntype, const ChannelOptions& options)
+    : channel_(std::move(channel))
+    , node_type_(ntype)
+    , delay_(options.coalesce_delay)
+{
+    UpdateLimits(options.coalesce_bytes);
+    if (ntype == NodeType::kSender) {
+        frame_.reserve(frame_size_);
+        timer_ = std::thread(&CoalescingChannel::Timer, this);
+    }
+}
+
+void CoalescingChannel::UpdateLimits(size_t coalesce_bytes)
+{
+    // Senders may only learn the limit of the underlying channel once they connect to a receiver
+    const size_t channel_size = channel_->Options().max_message_size;
+    if (channel_size == 0) {
+        frame_size_ = coalesce_bytes;
+        max_message_size_ = UINT32_MAX;
+        return;
+    }
+    XASSERT_EXIT(channel_size <= RECORD_HEADER_SIZE, "Messages of %zu bytes are too small to coalesce", channel_size);
+    frame_size_ = std::min(coalesce_bytes, channel_size);
+    max_message_size_ = std::min<size_t>(channel_size - RECORD_HEADER_SIZE, UINT32_MAX);
+    limits_known_ = true;
+}
+
+CoalescingChannel::~CoalescingChannel()
+{
+    CoalescingChannel::Remove();
+}
+
+SendResult CoalescingChannel::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult CoalescingChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    const size_t size = IovLength(iov, iovcnt);
+    const size_t record_size = RECORD_HEADER_SIZE + size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (deferred_ != SendStatus::kOk)
+        return std::exchange(deferred_, SendStatus::kOk);
+    if (!limits_known_)
+        UpdateLimits(frame_size_);
+    XASSERT_RETURN(size > max_message_size_, SendStatus::kTooLarge, "Data size %zu exceeds maximum message size %zu",
+        size, max_message_size_);
+    // Start a new frame if the message does not fit, a message larger than the threshold is a frame of its own
+    if (!frame_.empty() && frame_.size() + record_size > frame_size_) {
+        SendStatus status = FlushLocked();
+        if (status != SendStatus::kOk)
+            return status;
+    }
+
+    const bool first = frame_.empty();
+    const size_t offset = frame_.size();
+    frame_.resize(offset + record_size);
+    const uint32_t header = static_cast<uint32_t>(size);
+    memcpy(frame_.data() + offset, &header, RECORD_HEADER_SIZE);
+    IovGather(frame_.data() + offset + RECORD_HEADER_SIZE, iov, iovcnt);
+
+    if (frame_.size() >= frame_size_)
+        return FlushLocked();
+    if (first) {
+        // Only the first message of a frame arms the timer
+        oldest_ = Clock::now();
+        cond_.notify_one();
+    }
+    return SendStatus::kOk;
+}
+
+SendStatus CoalescingChannel::FlushLocked()
+{
+    if (frame_.empty())
+        return SendStatus::kOk;
+    SendStatus status = channel_->Send(frame_.data(), frame_.size()).Status();
+    // A frame that could not be sent is dropped as a whole, its messages are lost like a failed Send
+    frame_.clear();
+    return status;
+}
+
+SendResult CoalescingChannel::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (deferred_ != SendStatus::kOk)
+        return std::exchange(deferred_, SendStatus::kOk);
+    return FlushLocked();
+}
+
+void CoalescingChannel::Timer()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (frame_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+        // A flush in between starts a new frame with a later deadline, wait for that one instead
+        const Clock::time_point deadline = oldest_ + delay_;
+        if (Clock::now() < deadline) {
+            cond_.wait_until(lock, deadline);
+            continue;
+        }
+        SendStatus status = FlushLocked();
+        if (status != SendStatus::kOk) {
+            XWARN("Coalesced frame could not be sent: status %d", static_cast<int>(status));
+            deferred_ = status;
+        }
+    }
+}
+
+bool CoalescingChannel::Unpack()
+{
+    Buffer frame;
+    if (!channel_->ReceiveBuffer(frame))
+        return false;
+
+    const char* data = static_cast<const char*>(frame.Data());
+    size_t offset = 0;
+    while (offset + RECORD_HEADER_SIZE <= frame.Size()) {
+        uint32_t size;
+        memcpy(&size, data + offset, RECORD_HEADER_SIZE);
+        offset += RECORD_HEADER_SIZE;
+        XASSERT_RETURN(size > frame.Size() - offset, false, "Coalesced record of %u bytes exceeds its frame", size);
+        Buffer message(size);
+        XASSERT_RETURN(!message.Data() && size > 0, false, "Buffer allocation fail");
+        if (size > 0)
+            memcpy(message.Data(), data + offset, size);
+        unpacked_.push_back(std::move(message));
+        offset += size;
+    }
+    return true;
+}
+
+bool CoalescingChannel::ReceiveBuffer(Buffer& message)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    // An empty frame is not sent, but keep going should one arrive
+    while (unpacked_.empty()) {
+        if (!Unpack())
+            return false;
+    }
+    message = std::move(unpacked_.front());
+    unpacked_.pop_front();
+    return true;
+}
+
+std::shared_ptr<Buffer> CoalescingChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+bool CoalescingChannel::Remove()
+{
+    if (node_type_ == NodeType::kSender) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_)
+                return true;
+            stopping_ = true;
+            // Messages held back still go out, like those already handed to the transport
+            FlushLocked();
+        }
+        cond_.notify_one();
+        if (timer_.joinable())
+            timer_.join();
+    }
+    return channel_->Remove();
+}
+
+ChannelOptions CoalescingChannel::Options() const
+{
+    ChannelOptions options = channel_->Options();
+    if (options.max_message_size > RECORD_HEADER_SIZE)
+        options.max_message_size = std::min<size_t>(options.max_message_size - RECORD_HEADER_SIZE, UINT32_MAX);
+    options.coalesce_bytes = frame_size_;
+    options.coalesce_delay = delay_;
+    return options;
+}
+
+} // namespace coalesce
@@ -0,0 +1,467 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <new>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc/conflate/table.h"
+#include "ipc/static_node.h"
+#include "utils/assert.h"
+#include "utils/common.h"
+#include "utils/futex.h"
+#include "utils/log.h"
+#include "utils/process.h"
+
+namespace conflate {
+
+static std::string SegmentName(key_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/ipc-lvt-%08x", static_cast<unsigned>(key));
+    return name;
+}
+
+static uint64_t RoundUpPowerOfTwo(uint64_t value)
+{
+    uint64_t result = 2;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+LastValueTable::LastValueTable(std::string name, NodeType ntype, const ChannelOptions& options)
+    : name_(name)
+    , segment_name_(SegmentName(NameKey(name)))
+    , node_type_(ntype)
+    , options_(options)
+{
+    switch (ntype) {
+    case NodeType::kReceiver:
+        XASSERT_EXIT(!Create(options), "kReceiver (LastValueTable) '%s' create failed", name_.c_str());
+        break;
+    case NodeType::kSender:
+        // The table is opened on the first write, the receiver may not have created it yet
+        writer_id_ = WriterId();
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown NodeType %d for Node %s", static_cast<int>(ntype), name_.c_str());
+        break;
+    }
+}
+
+LastValueTable::~LastValueTable()
+{
+    LastValueTable::Remove();
+}
+
+bool LastValueTable::Create(const ChannelOptions& options)
+{
+    const uint64_t value_size = options.max_message_size > 0 ? options.max_message_size : DEFAULT_VALUE_SIZE;
+    const uint64_t slot_count = options.capacity_messages > 0 ? options.capacity_messages : DEFAULT_KEYS;
+    XASSERT_RETURN(slot_count >= INDEX_CLAIMED / 2, false, "Too many keys %lu", static_cast<unsigned long>(slot_count));
+    const uint64_t slot_size = (sizeof(Slot) + value_size + 63) / 64 * 64;
+    // At most half full, so probes stay short
+    const uint64_t index_size = RoundUpPowerOfTwo(2 * slot_count);
+    const uint64_t slots_offset = (sizeof(Header) + index_size * sizeof(uint32_t) + 63) / 64 * 64;
+    const size_t bytes = slots_offset + slot_count * slot_size;
+
+    while (!segment_.Create(segment_name_, bytes, options.huge_pages)) {
+        XASSERT_RETURN(errno != EEXIST, false, "Create segment %s fail", segment_name_.c_str());
+        XASSERT_RETURN(!segment_.Open(segment_name_), false, "Open existing segment %s fail", segment_name_.c_str());
+        Header* header = Attach(segment_);
+        if (header && ProcessStartTime(header->owner_pid) == header->owner_start_time) {
+            // Owned by a running receiver, read along with it
+            header_.store(header, std::memory_order_release);
+            XDEBG("kReceiver (LastValueTable) '%s' reads table %s", name_.c_str(), segment_name_.c_str());
+            return true;
+        }
+        if (header && options.recovery == RecoveryPolicy::kReattach) {
+            // Keep the values of the previous owner
+            header->owner_pid = getpid();
+            header->owner_start_time = ProcessStartTime(header->owner_pid);
+            owner_ = true;
+            header_.store(header, std::memory_order_release);
+            XINFO("kReceiver of Node '%s' reattached to stale table %s", name_.c_str(), segment_name_.c_str());
+            return true;
+        }
+        XINFO("kReceiver of Node '%s' reclaims stale table %s", name_.c_str(), segment_name_.c_str());
+        if (header) {
+            // Senders still mapping the old table notice this and open the new one
+            header->closed.store(1, std::memory_order_release);
+            header->change_seq.fetch_add(1, std::memory_order_release);
+            FutexWake(&header->change_seq, INT_MAX);
+        }
+        segment_.Unmap();
+        shm::Segment::Unlink(segment_name_);
+    }
+
+    // A fresh segment is zero filled: every index entry is INDEX_EMPTY and every slot unwritten
+    Header* header = new (segment_.Data()) Header();
+    header->version = VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->index_size = index_size;
+    header->slots_offset = slots_offset;
+    header->page_size = segment_.PageSize();
+    header->owner_pid = getpid();
+    header->owner_start_time = ProcessStartTime(header->owner_pid);
+    // Readers and writers only use the table once the layout is complete
+    header->magic.store(MAGIC, std::memory_order_release);
+    owner_ = true;
+
+    header = Attach(segment_);
+    header_.store(header, std::memory_order_release);
+    XDEBG("kReceiver (LastValueTable) '%s' created table %s", name_.c_str(), segment_name_.c_str());
+    return header != nullptr;
+}
+
+LastValueTable::Header* LastValueTable::Attach(shm::Segment& segment)
+{
+    Header* header = static_cast<Header*>(segment.Data());
+    if (segment.Size() < sizeof(Header) || header->magic.load(std::memory_order_acquire) != MAGIC)
+        return nullptr;
+    XASSERT_RETURN(header->version != VERSION, nullptr, "Table %s has version %u, expected %u", segment_name_.c_str(),
+        header->version, VERSION);
+    XASSERT_RETURN(segment.Size() < header->slots_offset + header->slot_count * header->slot_size, nullptr,
+        "Table %s is truncated", segment_name_.c_str());
+
+    options_.capacity_messages = header->slot_count;
+    options_.max_message_size = header->slot_size - sizeof(Slot);
+    options_.capacity_bytes = header->slot_count * options_.max_message_size;
+    return header;
+}
+
+LastValueTable::Header* LastValueTable::Connect()
+{
+    Header* header = header_.load(std::memory_order_acquire);
+    if (header && !header->closed.load(std::memory_order_acquire))
+        return header;
+
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    header = header_.load(std::memory_order_relaxed);
+    if (header && !header->closed.load(std::memory_order_acquire))
+        return header;
+
+    shm::Segment& segment = segments_.emplace_back();
+    if (!segment.Open(segment_name_)) {
+        segments_.pop_back();
+        XDEBG("kReceiver of Node '%s' (%s) does not exist", name_.c_str(), segment_name_.c_str());
+        return nullptr;
+    }
+    header = Attach(segment);
+    if (!header || header->closed.load(std::memory_order_acquire)) {
+        segments_.pop_back();
+        return nullptr;
+    }
+    header_.store(header, std::memory_order_release);
+    XDEBG("kSender (LastValueTable) '%s' connected to %s", name_.c_str(), segment_name_.c_str());
+    return header;
+}
+
+LastValueTable::Slot* LastValueTable::Find(Header* header, uint64_t key, bool insert)
+{
+    std::atomic<uint32_t>* index = Index(header);
+    const uint64_t mask = header->index_size - 1;
+    // Mixed like partition keys, sequential ids would otherwise probe neighbouring entries
+    uint64_t pos = PartitionOf(key, header->index_size);
+    std::chrono::steady_clock::time_point claimed_until;
+    for (uint64_t probes = 0, spins = 0; probes < header->index_size;) {
+        uint32_t entry = index[pos].load(std::memory_order_acquire);
+        if (entry == INDEX_CLAIMED) {
+            // Possibly this very key, its slot is assigned right after the claim. A writer that died in
+            // between never assigns it, after LOCK_TIMEOUT the entry is passed over like one of another key
+            if (spins++ < SPIN_BUDGET) {
+                CpuRelax();
+                continue;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (spins == SPIN_BUDGET + 1)
+                claimed_until = now + LOCK_TIMEOUT;
+            if (now < claimed_until) {
+                sched_yield();
+                continue;
+            }
+            XWARN("Index entry %lu has been claimed for too long, skipped", static_cast<unsigned long>(pos));
+            pos = (pos + 1) & mask;
+            ++probes;
+            spins = 0;
+            continue;
+        }
+        spins = 0;
+        if (entry == INDEX_EMPTY) {
+            if (!insert)
+                return nullptr;
+            if (!index[pos].compare_exchange_weak(entry, INDEX_CLAIMED, std::memory_order_acquire))
+                continue;
+            const uint64_t slot = header->used.fetch_add(1, std::memory_order_relaxed);
+            if (slot >= header->slot_count) {
+                index[pos].store(INDEX_EMPTY, std::memory_order_release);
+                return nullptr;
+            }
+            SlotAt(header, slot)->key = key;
+            index[pos].store(static_cast<uint32_t>(slot + 1), std::memory_order_release);
+            return SlotAt(header, slot);
+        }
+        Slot* slot = SlotAt(header, entry - 1);
+        if (slot->key == key)
+            return slot;
+        pos = (pos + 1) & mask;
+        ++probes;
+    }
+    return nullptr;
+}
+
+uint64_t LastValueTable::WriterId()
+{
+    const PID pid = getpid();
+    return static_cast<uint64_t>(pid) << 32 | static_cast<uint32_t>(ProcessStartTime(pid));
+}
+
+bool LastValueTable::WriterAlive(uint64_t writer)
+{
+    return static_cast<uint32_t>(ProcessStartTime(static_cast<PID>(writer >> 32))) == static_cast<uint32_t>(writer);
+}
+
+bool LastValueTable::Lock(Slot* slot)
+{
+    std::chrono::steady_clock::time_point deadline;
+    for (uint32_t spins = 0;; ++spins) {
+        uint64_t writer = slot->writer.load(std::memory_order_relaxed);
+        if (writer == 0 || (spins > SPIN_BUDGET && !WriterAlive(writer))) {
+            if (!slot->writer.compare_exchange_weak(writer, writer_id_, std::memory_order_acquire))
+                continue;
+            if (writer != 0)
+                XWARN("Writer %d of table '%s' died holding key %lu, taken over", static_cast<int>(writer >> 32),
+                    name_.c_str(), static_cast<unsigned long>(slot->key));
+            return true;
+        }
+        if (spins < SPIN_BUDGET) {
+            CpuRelax();
+            continue;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (spins == SPIN_BUDGET)
+            deadline = now + LOCK_TIMEOUT;
+        if (now >= deadline)
+            return false;
+        sched_yield();
+    }
+}
+
+SendResult LastValueTable::Write(uint64_t key, const void* data, size_t data_size)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+    Header* header = Connect();
+    if (!header)
+        return SendStatus::kDisconnected;
+    const size_t value_size = header->slot_size - sizeof(Slot);
+    XASSERT_RETURN(data_size > value_size, SendStatus::kTooLarge, "Data size %zu exceeds maximum value size %zu",
+        data_size, value_size);
+
+    Slot* slot = Find(header, key, true);
+    if (!slot) {
+        XWARN("Table '%s' has no slot left for key %lu", name_.c_str(), static_cast<unsigned long>(key));
+        return SendStatus::kWouldBlock;
+    }
+
+    // Writers of the same key take turns through the writer word, then make the sequence number odd
+    // It is odd already if the writer this one took over died in the middle of the value
+    XASSERT_RETURN(!Lock(slot), SendStatus::kError, "Key %lu of table '%s' is held by writer %d",
+        static_cast<unsigned long>(key), name_.c_str(), static_cast<int>(slot->writer.load(std::memory_order_relaxed) >> 32));
+    uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+    if (seq % 2 == 0)
+        slot->seq.store(++seq, std::memory_order_relaxed);
+    // Readers that see any of the new words also see the odd sequence number
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->size.store(data_size, std::memory_order_relaxed);
+    const char* src = static_cast<const char*>(data);
+    for (size_t offset = 0; offset < data_size; offset += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, src + offset, std::min(sizeof(word), data_size - offset));
+        std::atomic_ref<uint64_t>(slot->data[offset / sizeof(uint64_t)]).store(word, std::memory_order_relaxed);
+    }
+    slot->seq.store(seq + 1, std::memory_order_release);
+    slot->writer.store(0, std::memory_order_release);
+
+    // Pairs with the fence in Wait(): either the reader sees the new value, or this sees its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->sleeping.load(std::memory_order_relaxed) && header->sleeping.exchange(0, std::memory_order_acq_rel)) {
+        header->change_seq.fetch_add(1, std::memory_order_release);
+        header->wakeups.fetch_add(1, std::memory_order_relaxed);
+        FutexWake(&header->change_seq, INT_MAX);
+    }
+    return SendStatus::kOk;
+}
+
+bool LastValueTable::Load(Slot* slot, void* dst, size_t capacity, size_t& size)
+{
+    char* out = static_cast<char*>(dst);
+    std::chrono::steady_clock::time_point deadline;
+    for (uint32_t spins = 0;;) {
+        const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq % 2 != 0) {
+            if (spins++ < SPIN_BUDGET) {
+                CpuRelax();
+                continue;
+            }
+            // A writer that died in the middle leaves the value torn until the next write
+            const uint64_t writer = slot->writer.load(std::memory_order_relaxed);
+            if (writer != 0 && !WriterAlive(writer))
+                return false;
+            const auto now = std::chrono::steady_clock::now();
+            if (spins == SPIN_BUDGET + 1)
+                deadline = now + LOCK_TIMEOUT;
+            if (now >= deadline)
+                return false;
+            sched_yield();
+            continue;
+        }
+        size = slot->size.load(std::memory_order_relaxed);
+        if (size <= capacity) {
+            for (size_t offset = 0; offset < size; offset += sizeof(uint64_t)) {
+                const uint64_t word
+                    = std::atomic_ref<uint64_t>(slot->data[offset / sizeof(uint64_t)]).load(std::memory_order_relaxed);
+                memcpy(out + offset, &word, std::min(sizeof(word), size - offset));
+            }
+        }
+        // The copy is only valid if no writer started meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) == seq)
+            return true;
+    }
+}
+
+bool LastValueTable::Read(uint64_t key, Buffer& value)
+{
+    Header* header = node_type_ == NodeType::kSender ? Connect() : header_.load(std::memory_order_acquire);
+    XASSERT_RETURN(!header, false, "Table is not initialized");
+
+    Slot* slot = Find(header, key, false);
+    if (!slot || slot->seq.load(std::memory_order_acquire) == 0)
+        return false;
+    // The value may grow between reading its size and copying it, then the copy is retried in a larger Buffer
+    size_t capacity = slot->size.load(std::memory_order_relaxed);
+    while (true) {
+        value = Buffer(capacity);
+        XASSERT_RETURN(!value.Data() && capacity > 0, false, "Buffer allocation fail");
+        size_t size;
+        XASSERT_RETURN(!Load(slot, value.Data(), capacity, size), false, "Value of key %lu of table '%s' is unreadable",
+            static_cast<unsigned long>(key), name_.c_str());
+        if (size <= capacity) {
+            value.SetSize(size);
+            return true;
+        }
+        capacity = size;
+    }
+}
+
+ReceiveResult LastValueTable::ReadInto(uint64_t key, void* dst, size_t capacity)
+{
+    Header* header = node_type_ == NodeType::kSender ? Connect() : header_.load(std::memory_order_acquire);
+    XASSERT_RETURN(!header, ReceiveStatus::kError, "Table is not initialized");
+    XASSERT_RETURN(!dst && capacity > 0, ReceiveStatus::kError, "Destination is null");
+
+    Slot* slot = Find(header, key, false);
+    if (!slot || slot->seq.load(std::memory_order_acquire) == 0)
+        return ReceiveStatus::kError;
+    size_t size;
+    XASSERT_RETURN(!Load(slot, dst, capacity, size), ReceiveStatus::kError, "Value of key %lu of table '%s' is unreadable",
+        static_cast<unsigned long>(key), name_.c_str());
+    return { size <= capacity ? ReceiveStatus::kOk : ReceiveStatus::kTooSmall, size };
+}
+
+std::vector<uint64_t>& LastValueTable::Changes(std::vector<uint64_t>& keys)
+{
+    keys.clear();
+    Header* header = header_.load(std::memory_order_acquire);
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver || !header, keys, "Changes are only tracked by kReceivers");
+
+    const uint64_t used = std::min(header->used.load(std::memory_order_acquire), header->slot_count);
+    seen_.resize(header->slot_count);
+    for (uint64_t i = 0; i < used; ++i) {
+        Slot* slot = SlotAt(header, i);
+        // Acquire, the key has been set before the first write
+        const uint64_t seq = Completed(slot->seq.load(std::memory_order_acquire));
+        if (seq == 0 || seq == seen_[i])
+            continue;
+        keys.push_back(slot->key);
+        seen_[i] = seq;
+    }
+    return keys;
+}
+
+bool LastValueTable::Changed(Header* header) const
+{
+    const uint64_t used = std::min(header->used.load(std::memory_order_acquire), header->slot_count);
+    for (uint64_t i = 0; i < used; ++i) {
+        const uint64_t seq = Completed(SlotAt(header, i)->seq.load(std::memory_order_relaxed));
+        if (seq != 0 && (i >= seen_.size() || seq != seen_[i]))
+            return true;
+    }
+    return false;
+}
+
+bool LastValueTable::Wait(std::chrono::microseconds timeout)
+{
+    Header* header = header_.load(std::memory_order_acquire);
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver || !header, false, "Changes are only tracked by kReceivers");
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!header->closed.load(std::memory_order_acquire)) {
+        // Read the futex word first, a wakeup after this point changes it and the wait returns at once
+        const uint32_t current = header->change_seq.load(std::memory_order_acquire);
+        header->sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (Changed(header))
+            return true;
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+            return false;
+        struct timespec wait = { static_cast<time_t>(remaining.count() / 1000000000), static_cast<long>(remaining.count() % 1000000000) };
+        header->sleeps.fetch_add(1, std::memory_order_relaxed);
+        FutexWait(&header->change_seq, current, &wait);
+    }
+    return false;
+}
+
+bool LastValueTable::Remove()
+{
+    Header* header = header_.load(std::memory_order_relaxed);
+    if (!owner_ || !header || header->closed.load(std::memory_order_acquire))
+        return true;
+
+    XDEBG("Removing table '%s' (%s)", name_.c_str(), segment_name_.c_str());
+    // Wake up readers waiting for changes so that they see it is closed
+    header->closed.store(1, std::memory_order_release);
+    header->change_seq.fetch_add(1, std::memory_order_release);
+    FutexWake(&header->change_seq, INT_MAX);
+    // The mapping stays until destruction, other threads may still be reading it
+    shm::Segment::Unlink(segment_name_);
+    return true;
+}
+
+ChannelOptions LastValueTable::Options() const
+{
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    return options_;
+}
+
+ChannelStats LastValueTable::Stats() const
+{
+    ChannelStats stats;
+    if (Header* header = header_.load(std::memory_order_acquire)) {
+        stats.page_size = header->page_size;
+        stats.wakeups = header->wakeups.load(std::memory_order_relaxed);
+        stats.sleeps = header->sleeps.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+} // namespace conflate
+#endif // _WIN32
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "ipc/deadline/deadline.h"
+#include "utils/assert.h"
+#include "utils/deadline.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace deadline {
+
+DeadlineChannel::DeadlineChannel(std::shared_ptr<Channel> channel, NodeType ntype, const ChannelOptions& options)
+    : channel_(std::move(channel))
+    , node_type_(ntype)
+    , ttl_(options.ttl)
+{
+}
+
+SendResult DeadlineChannel::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult DeadlineChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, TtlTicks(ttl_));
+}
+
+SendResult DeadlineChannel::SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, DeadlineTicks(deadline));
+}
+
+SendResult DeadlineChannel::Post(const iovec* iov, size_t iovcnt, uint64_t deadline)
+{
+    Trailer trailer = { deadline, TRAILER_MAGIC };
+    return SendWithTrailer(*channel_, iov, iovcnt, &trailer, sizeof(trailer));
+}
+
+bool DeadlineChannel::Take(const void* data, size_t& size)
+{
+    Trailer trailer;
+    if (size < sizeof(Trailer))
+        return true;
+    memcpy(&trailer, static_cast<const char*>(data) + size - sizeof(Trailer), sizeof(Trailer));
+    if (trailer.magic != TRAILER_MAGIC)
+        return true;
+    size -= sizeof(Trailer);
+    if (!Expired(trailer.deadline))
+        return true;
+    expired_.fetch_add(1, std::memory_order_relaxed);
+    XDEBG("Dropping a message of %zu bytes past its deadline", size);
+    return false;
+}
+
+bool DeadlineChannel::ReceiveBuffer(Buffer& message)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    while (channel_->ReceiveBuffer(message)) {
+        size_t size = message.Size();
+        if (Take(message.Data(), size)) {
+            message.SetSize(size);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<Buffer> DeadlineChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+bool DeadlineChannel::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return false;
+    received_size = message.Size();
+    XASSERT_RETURN(!IovScatter(iov, iovcnt, message.Data(), message.Size()), false,
+        "Message size %zu exceeds scatter capacity %zu", message.Size(), IovLength(iov, iovcnt));
+    return true;
+}
+
+bool DeadlineChannel::Read(JournalEntry& entry)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    while (channel_->Read(entry)) {
+        if (Take(entry.data, entry.size))
+            return true;
+    }
+    return false;
+}
+
+ChannelOptions DeadlineChannel::Options() const
+{
+    ChannelOptions options = channel_->Options();
+    if (options.max_message_size > sizeof(Trailer))
+        options.max_message_size -= sizeof(Trailer);
+    options.deadlines = true;
+    options.ttl = ttl_;
+    return options;
+}
+
+ChannelStats DeadlineChannel::Stats() const
+{
+    ChannelStats stats = channel_->Stats();
+    stats.expired += expired_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace deadline
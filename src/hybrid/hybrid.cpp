@@ -0,0 +1,469 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/msg.h>
+#include <unistd.h>
+
+#include "ipc/hybrid/hybrid.h"
+#include "utils/assert.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace hybrid {
+
+static std::string HelloName(key_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/ipc-hybrid-%08x", static_cast<unsigned>(key));
+    return name;
+}
+
+HybridChannel::HybridChannel(std::string name, NodeType ntype, key_t key, const ChannelOptions& options)
+    : name_(name)
+    , node_type_(ntype)
+    , key_(key)
+    , options_(options)
+    , hello_name_(HelloName(key))
+{
+    if (options_.large_message_size == 0)
+        options_.large_message_size = DEFAULT_LARGE_MESSAGE_SIZE;
+    if (options_.max_message_size == 0)
+        options_.max_message_size = DEFAULT_MAX_MESSAGE_SIZE;
+    if (options_.hybrid_paths == 0)
+        options_.hybrid_paths = HYBRID_ALL;
+    // Large messages are named on the ring, so there is no segment path without it
+    if (!(options_.hybrid_paths & HYBRID_RING))
+        options_.hybrid_paths &= ~HYBRID_SEGMENT;
+    XASSERT_EXIT(options_.hybrid_paths == 0, "Node '%s' has no hybrid path", name_.c_str());
+    options_.shards = 1;
+    options_.shard_threads = false;
+    // The receiver waits for every sequence number, a message evicted from a path would hold back all later ones
+    if (options_.backpressure == BackpressurePolicy::kDropOldest)
+        options_.backpressure = BackpressurePolicy::kDropNewest;
+
+    switch (ntype) {
+    case NodeType::kReceiver:
+        XASSERT_EXIT(!Create(), "kReceiver (Hybrid) '%s' create failed", name_.c_str());
+        XDEBG("kReceiver (Hybrid) '%s' created with paths 0x%x", name_.c_str(), hello_->paths);
+        break;
+    case NodeType::kSender:
+        // Negotiate on the first Send, the receiver may not exist yet
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown NodeType %d for Node %s", static_cast<int>(ntype), name_.c_str());
+        break;
+    }
+}
+
+HybridChannel::~HybridChannel()
+{
+    HybridChannel::Remove();
+}
+
+std::string HybridChannel::SegmentName(uint32_t epoch, uint32_t sender, uint64_t seq) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s-%08x-%u-%llu", hello_name_.c_str(), epoch, sender, static_cast<unsigned long long>(seq));
+    return name;
+}
+
+bool HybridChannel::Create()
+{
+    // A hello left behind belongs to a receiver that is gone, its senders negotiate again with this one
+    if (hello_segment_.Open(hello_name_)) {
+        if (hello_segment_.Size() >= sizeof(Hello))
+            static_cast<Hello*>(hello_segment_.Data())->closed.store(1, std::memory_order_release);
+        hello_segment_.Unmap();
+        shm::Segment::Unlink(hello_name_);
+    }
+
+    // Published before the paths exist, a sender that finds the queue without a hello would take this
+    // receiver for a plain kMessageQueue Node. Senders wait for the magic, which is stored last
+    XASSERT_RETURN(!hello_segment_.Create(hello_name_, sizeof(Hello), HugePages::kNone), false,
+        "Create hello segment %s fail", hello_name_.c_str());
+    hello_ = new (hello_segment_.Data()) Hello();
+
+    // The paths are plain channels of the same name, the queue is the one a kMessageQueue Node would use
+    ChannelOptions path_options = options_;
+    if (options_.hybrid_paths & HYBRID_QUEUE) {
+        path_options.max_message_size = 0;
+        queue_ = std::make_unique<msgq::MessageQueue>(name_, NodeType::kReceiver, key_, path_options);
+    }
+    if (options_.hybrid_paths & HYBRID_RING) {
+        path_options.max_message_size = std::min(options_.large_message_size, MAX_RING_MESSAGE_SIZE) + sizeof(Trailer);
+        if (path_options.capacity_messages == 0 && path_options.capacity_bytes == 0)
+            path_options.capacity_bytes = DEFAULT_RING_BYTES;
+        ring_ = std::make_unique<shm::SharedMemory>(name_, NodeType::kReceiver, key_, path_options);
+    }
+
+    hello_->version = VERSION;
+    hello_->paths = options_.hybrid_paths;
+    hello_->epoch = static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count() ^ getpid());
+    hello_->queue_message_size = queue_ ? queue_->Options().max_message_size : 0;
+    hello_->ring_message_size = ring_ ? ring_->Options().max_message_size : 0;
+    hello_->max_message_size = options_.max_message_size;
+    hello_->magic.store(MAGIC, std::memory_order_release);
+
+    if (queue_)
+        workers_.emplace_back(&HybridChannel::Drain, this, std::ref(*queue_));
+    if (ring_)
+        workers_.emplace_back(&HybridChannel::Drain, this, std::ref(*ring_));
+    return true;
+}
+
+void HybridChannel::Disconnect()
+{
+    queue_.reset();
+    ring_.reset();
+    hello_ = nullptr;
+    hello_segment_.Unmap();
+    legacy_ = false;
+    paths_ = 0;
+}
+
+bool HybridChannel::Connect()
+{
+    if (legacy_ || (hello_ && !hello_->closed.load(std::memory_order_acquire)))
+        return true;
+    Disconnect();
+
+    if (!hello_segment_.Open(hello_name_)) {
+        // No hello from the receiver, it predates hybrid channels if its queue exists
+        if (msgget(key_, 0666) == -1) {
+            XDEBG("kReceiver of Node '%s' does not exist", name_.c_str());
+            return false;
+        }
+        XINFO("kReceiver of Node '%s' is a plain message queue, sending raw messages", name_.c_str());
+        ChannelOptions queue_options = options_;
+        queue_options.max_message_size = 0;
+        queue_ = std::make_unique<msgq::MessageQueue>(name_, NodeType::kSender, key_, queue_options);
+        legacy_ = true;
+        paths_ = HYBRID_QUEUE;
+        return true;
+    }
+
+    Hello* hello = static_cast<Hello*>(hello_segment_.Data());
+    if (hello_segment_.Size() < sizeof(Hello) || hello->magic.load(std::memory_order_acquire) != MAGIC
+        || hello->closed.load(std::memory_order_acquire)) {
+        // Still being initialized by the receiver, or already removed
+        hello_segment_.Unmap();
+        return false;
+    }
+    hello_ = hello;
+    // Newer receivers may offer paths this end does not know, those bits are dropped here
+    paths_ = hello_->paths & options_.hybrid_paths;
+    XASSERT_RETURN(paths_ == 0, false, "Node '%s' shares no path with its receiver (0x%x / 0x%x)", name_.c_str(),
+        hello_->paths, options_.hybrid_paths);
+    sender_ = hello_->next_sender.fetch_add(1, std::memory_order_relaxed);
+    next_seq_ = 0;
+
+    ChannelOptions path_options = options_;
+    path_options.max_message_size = 0;
+    if (paths_ & HYBRID_QUEUE)
+        queue_ = std::make_unique<msgq::MessageQueue>(name_, NodeType::kSender, key_, path_options);
+    if (paths_ & HYBRID_RING)
+        ring_ = std::make_unique<shm::SharedMemory>(name_, NodeType::kSender, key_, path_options);
+    XDEBG("kSender (Hybrid) '%s' connected as sender %u with paths 0x%x", name_.c_str(), sender_, paths_);
+    return true;
+}
+
+SendResult HybridChannel::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult HybridChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (!Connect())
+        return SendStatus::kDisconnected;
+    if (legacy_)
+        return queue_->SendV(iov, iovcnt);
+
+    const size_t size = IovLength(iov, iovcnt);
+    XASSERT_RETURN(size > std::min<uint64_t>(options_.max_message_size, hello_->max_message_size), SendStatus::kTooLarge,
+        "Data size %zu exceeds maximum message size %zu", size, options_.max_message_size);
+    const bool fits_queue = (paths_ & HYBRID_QUEUE) && size + sizeof(Trailer) <= hello_->queue_message_size;
+    const bool fits_ring = (paths_ & HYBRID_RING) && size + sizeof(Trailer) <= hello_->ring_message_size;
+    const bool fits_segment = (paths_ & HYBRID_SEGMENT) && size > 0;
+
+    Trailer trailer = { next_seq_, hello_->epoch, sender_, 0, TRAILER_MAGIC };
+    SendResult result = SendStatus::kTooLarge;
+    // Take the path the thresholds ask for, and the next best one the receiver offers otherwise
+    if (fits_queue && size <= options_.small_message_size)
+        result = SendQueue(iov, iovcnt, trailer);
+    else if (fits_segment && size >= options_.large_message_size)
+        result = SendSegment(iov, iovcnt, size, trailer);
+    else if (fits_ring)
+        result = SendRing(iov, iovcnt, trailer);
+    else if (fits_segment)
+        result = SendSegment(iov, iovcnt, size, trailer);
+    else if (fits_queue)
+        result = SendQueue(iov, iovcnt, trailer);
+    else
+        XERRO("Data size %zu fits no path of Node '%s'", size, name_.c_str());
+
+    // A message that was not sent leaves no gap, the next one takes its sequence number
+    if (result)
+        ++next_seq_;
+    return result;
+}
+
+SendResult HybridChannel::SendQueue(const iovec* iov, size_t iovcnt, Trailer& trailer)
+{
+    trailer.path = HYBRID_QUEUE;
+    return SendWithTrailer(*queue_, iov, iovcnt, &trailer, sizeof(trailer));
+}
+
+SendResult HybridChannel::SendRing(const iovec* iov, size_t iovcnt, Trailer& trailer)
+{
+    trailer.path = HYBRID_RING;
+    return SendWithTrailer(*ring_, iov, iovcnt, &trailer, sizeof(trailer));
+}
+
+SendResult HybridChannel::SendSegment(const iovec* iov, size_t iovcnt, size_t size, Trailer& trailer)
+{
+    // The payload is copied once into a segment of its own, the receiver maps it instead of
+    // pulling it through slots sized for the common case
+    const std::string segment_name = SegmentName(trailer.epoch, trailer.sender, trailer.seq);
+    shm::Segment segment;
+    if (!segment.Create(segment_name, size, options_.huge_pages)) {
+        // Left behind by an earlier attempt that failed to post it
+        XASSERT_RETURN(errno != EEXIST || !shm::Segment::Unlink(segment_name) || !segment.Create(segment_name, size, options_.huge_pages),
+            SendStatus::kError, "Create segment %s fail", segment_name.c_str());
+    }
+    IovGather(segment.Data(), iov, iovcnt);
+    segment.Unmap();
+
+    trailer.path = HYBRID_SEGMENT;
+    uint64_t segment_size = size;
+    iovec descriptor = { &segment_size, sizeof(segment_size) };
+    SendResult result = SendWithTrailer(*ring_, &descriptor, 1, &trailer, sizeof(trailer));
+    if (!result)
+        shm::Segment::Unlink(segment_name);
+    return result;
+}
+
+void HybridChannel::Drain(Channel& path)
+{
+    while (true) {
+        Buffer message;
+        bool received = path.ReceiveBuffer(message);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopping_)
+                return;
+            if (!received) {
+                // The path has been removed under the Node, let Receive fail instead of waiting forever
+                XERRO("A path of Node '%s' has been removed", name_.c_str());
+                stopping_ = true;
+                cond_.notify_all();
+                return;
+            }
+            // Backpressure reaches the senders through the paths once the receiver falls behind
+            cond_.wait(lock, [this] { return pending_.size() < PENDING_LIMIT || stopping_; });
+            if (stopping_)
+                return;
+        }
+        Deliver(std::move(message));
+    }
+}
+
+void HybridChannel::Deliver(Buffer message)
+{
+    Trailer trailer;
+    const size_t size = message.Size();
+    if (size >= sizeof(Trailer))
+        memcpy(&trailer, static_cast<const char*>(message.Data()) + size - sizeof(Trailer), sizeof(Trailer));
+    // Messages of senders that predate hybrid channels have no trailer and are delivered as they come
+    const bool framed = size >= sizeof(Trailer) && trailer.magic == TRAILER_MAGIC;
+    bool lost = false; // Still takes its place in the order of its sender
+    if (framed) {
+        message.SetSize(size - sizeof(Trailer));
+        if (trailer.path == HYBRID_SEGMENT) {
+            uint64_t segment_size = 0;
+            if (message.Size() == sizeof(segment_size))
+                memcpy(&segment_size, message.Data(), sizeof(segment_size));
+            const std::string segment_name = SegmentName(trailer.epoch, trailer.sender, trailer.seq);
+            shm::Segment segment;
+            bool opened = segment.Open(segment_name);
+            shm::Segment::Unlink(segment_name);
+            message = Buffer(segment_size);
+            if (opened && segment.Size() >= segment_size && message.Data()) {
+                memcpy(message.Data(), segment.Data(), segment_size);
+            } else {
+                XERRO("Segment %s of Node '%s' is missing, message dropped", segment_name.c_str(), name_.c_str());
+                lost = true;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Messages left in the paths by an earlier receiver are not ordered against the current senders
+    if (!framed || trailer.epoch != hello_->epoch) {
+        if (!lost) {
+            pending_.push_back(std::move(message));
+            cond_.notify_all();
+        }
+        return;
+    }
+
+    SenderState& sender = senders_[trailer.sender];
+    if (trailer.seq < sender.next_seq) {
+        XWARN("Message %llu of sender %u of Node '%s' arrived after its gap was skipped, dropped",
+            static_cast<unsigned long long>(trailer.seq), trailer.sender, name_.c_str());
+        return;
+    }
+    if (sender.early.empty())
+        sender.stalled_since = std::chrono::steady_clock::now();
+    sender.early.emplace(trailer.seq, lost ? std::nullopt : std::optional<Buffer>(std::move(message)));
+    // The message may have been the one holding back later ones that took a faster path
+    Release(sender);
+    if (sender.early.size() > EARLY_LIMIT)
+        SkipGap(trailer.sender, sender);
+    cond_.notify_all();
+}
+
+void HybridChannel::Release(SenderState& sender)
+{
+    auto it = sender.early.begin();
+    if (it == sender.early.end() || it->first != sender.next_seq)
+        return;
+    for (; it != sender.early.end() && it->first == sender.next_seq; it = sender.early.erase(it)) {
+        if (it->second)
+            pending_.push_back(std::move(*it->second));
+        ++sender.next_seq;
+    }
+    sender.stalled_since = std::chrono::steady_clock::now();
+}
+
+void HybridChannel::SkipGap(uint32_t id, SenderState& sender)
+{
+    const uint64_t next_seq = sender.early.begin()->first;
+    XWARN("Messages %llu to %llu of sender %u of Node '%s' never arrived, skipped",
+        static_cast<unsigned long long>(sender.next_seq), static_cast<unsigned long long>(next_seq - 1), id, name_.c_str());
+    sender.next_seq = next_seq;
+    Release(sender);
+}
+
+bool HybridChannel::ReceiveBuffer(Buffer& message)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (pending_.empty() && !stopping_) {
+        // Wake up in time to give up on the oldest gap that holds messages back
+        auto stalled_since = std::chrono::steady_clock::time_point::max();
+        for (auto& [id, sender] : senders_) {
+            if (!sender.early.empty())
+                stalled_since = std::min(stalled_since, sender.stalled_since);
+        }
+        if (stalled_since == std::chrono::steady_clock::time_point::max()) {
+            cond_.wait(lock);
+            continue;
+        }
+        cond_.wait_until(lock, stalled_since + GAP_TIMEOUT);
+        const auto now = std::chrono::steady_clock::now();
+        for (auto& [id, sender] : senders_) {
+            if (!sender.early.empty() && now - sender.stalled_since >= GAP_TIMEOUT)
+                SkipGap(id, sender);
+        }
+    }
+    if (pending_.empty()) {
+        XDEBG("Hybrid channel '%s' has been removed", name_.c_str());
+        return false;
+    }
+    message = std::move(pending_.front());
+    pending_.pop_front();
+    // Wake a path thread waiting for room
+    cond_.notify_all();
+    return true;
+}
+
+std::shared_ptr<Buffer> HybridChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+bool HybridChannel::Closed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopping_;
+}
+
+bool HybridChannel::Remove()
+{
+    if (node_type_ != NodeType::kReceiver) {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        Disconnect();
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ && workers_.empty())
+            return true;
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    XDEBG("Removing hybrid channel '%s'", name_.c_str());
+    if (hello_)
+        hello_->closed.store(1, std::memory_order_release);
+    // Removing the paths wakes up the threads blocked on them
+    bool removed = true;
+    if (queue_)
+        removed &= queue_->Remove();
+    if (ring_)
+        removed &= ring_->Remove();
+    for (auto& worker : workers_) {
+        if (worker.joinable())
+            worker.join();
+    }
+    workers_.clear();
+
+    // Large messages that were never received
+    if (hello_) {
+        char stem[48];
+        snprintf(stem, sizeof(stem), "%s-%08x-", hello_name_.c_str() + 1, hello_->epoch);
+        const size_t stem_size = strlen(stem);
+        if (DIR* dir = opendir("/dev/shm")) {
+            while (struct dirent* entry = readdir(dir)) {
+                if (strncmp(entry->d_name, stem, stem_size) == 0)
+                    shm::Segment::Unlink(std::string("/") + entry->d_name);
+            }
+            closedir(dir);
+        }
+    }
+    shm::Segment::Unlink(hello_name_);
+    return removed;
+}
+
+ChannelOptions HybridChannel::Options() const
+{
+    ChannelOptions options = options_;
+    // Paths negotiated by a connected sender
+    if (node_type_ == NodeType::kSender && paths_ != 0)
+        options.hybrid_paths = paths_;
+    return options;
+}
+
+ChannelStats HybridChannel::Stats() const
+{
+    return ring_ ? ring_->Stats() : ChannelStats();
+}
+
+} // namespace hybrid
+#endif // _WIN32
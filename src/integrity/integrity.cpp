@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <string.h>
+
+#include "ipc/integrity/integrity.h"
+#include "utils/assert.h"
+#include "utils/crc32c.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace integrity {
+
+IntegrityChannel::IntegrityChannel(std::shared_ptr<Channel> channel, NodeType ntype)
+    : channel_(std::move(channel))
+    , node_type_(ntype)
+{
+}
+
+SendResult IntegrityChannel::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult IntegrityChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, nullptr);
+}
+
+SendResult IntegrityChannel::SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, &deadline);
+}
+
+SendResult IntegrityChannel::Post(const iovec* iov, size_t iovcnt, const Deadline* deadline)
+{
+    // The payload is still in the cache when the transport copies it right after
+    Trailer trailer = { 0, TRAILER_MAGIC };
+    for (size_t i = 0; i < iovcnt; ++i)
+        trailer.crc = Crc32c(iov[i].iov_base, iov[i].iov_len, trailer.crc);
+
+    return SendWithTrailer(*channel_, iov, iovcnt, &trailer, sizeof(trailer), deadline);
+}
+
+bool IntegrityChannel::TakeTrailer(const void* data, size_t& size, Trailer& trailer)
+{
+    if (size < sizeof(Trailer))
+        return false;
+    size -= sizeof(Trailer);
+    memcpy(&trailer, static_cast<const char*>(data) + size, sizeof(Trailer));
+    return trailer.magic == TRAILER_MAGIC;
+}
+
+void IntegrityChannel::Corrupted(size_t size)
+{
+    corrupted_.fetch_add(1, std::memory_order_relaxed);
+    XERRO("Discarding a corrupted message of %zu bytes", size);
+}
+
+bool IntegrityChannel::ReceiveBuffer(Buffer& message)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    while (channel_->ReceiveBuffer(message)) {
+        size_t size = message.Size();
+        Trailer trailer;
+        if (TakeTrailer(message.Data(), size, trailer) && Crc32c(message.Data(), size) == trailer.crc) {
+            message.SetSize(size);
+            return true;
+        }
+        Corrupted(message.Size());
+    }
+    return false;
+}
+
+std::shared_ptr<Buffer> IntegrityChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+ReceiveResult IntegrityChannel::ReceiveInto(void* dst, size_t capacity)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, ReceiveStatus::kError, "Cannot Receive data from a kSender Node");
+    // A parked message has been verified already
+    if (parked_)
+        return TakeParked(dst, capacity);
+
+    Buffer message;
+    if (!channel_->ReceiveBuffer(message))
+        return channel_->Closed() ? ReceiveStatus::kClosed : ReceiveStatus::kError;
+    size_t size = message.Size();
+    Trailer trailer;
+    if (!TakeTrailer(message.Data(), size, trailer)) {
+        Corrupted(message.Size());
+        return { ReceiveStatus::kCorrupted, message.Size() };
+    }
+    if (size > capacity) {
+        if (Crc32c(message.Data(), size) != trailer.crc) {
+            Corrupted(size);
+            return { ReceiveStatus::kCorrupted, size };
+        }
+        message.SetSize(size);
+        parked_.emplace(std::move(message));
+        return { ReceiveStatus::kTooSmall, size };
+    }
+    // Verify while copying, the payload is read once
+    if (CopyCrc32c(dst, message.Data(), size) != trailer.crc) {
+        Corrupted(size);
+        return { ReceiveStatus::kCorrupted, size };
+    }
+    return { ReceiveStatus::kOk, size };
+}
+
+bool IntegrityChannel::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    Buffer message;
+    while (channel_->ReceiveBuffer(message)) {
+        size_t size = message.Size();
+        Trailer trailer;
+        if (!TakeTrailer(message.Data(), size, trailer)) {
+            Corrupted(message.Size());
+            continue;
+        }
+        received_size = size;
+        XASSERT_RETURN(IovLength(iov, iovcnt) < size, false, "Message size %zu exceeds scatter capacity %zu", size,
+            IovLength(iov, iovcnt));
+
+        // Verify while scattering, the payload is read once
+        const char* pos = static_cast<const char*>(message.Data());
+        size_t remaining = size;
+        uint32_t crc = 0;
+        for (size_t i = 0; i < iovcnt && remaining > 0; ++i) {
+            const size_t len = std::min(iov[i].iov_len, remaining);
+            crc = CopyCrc32c(iov[i].iov_base, pos, len, crc);
+            pos += len;
+            remaining -= len;
+        }
+        if (crc == trailer.crc)
+            return true;
+        Corrupted(size);
+    }
+    return false;
+}
+
+bool IntegrityChannel::Read(JournalEntry& entry)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    while (channel_->Read(entry)) {
+        size_t size = entry.size;
+        Trailer trailer;
+        if (TakeTrailer(entry.data, size, trailer) && Crc32c(entry.data, size) == trailer.crc) {
+            entry.size = size;
+            return true;
+        }
+        Corrupted(entry.size);
+    }
+    return false;
+}
+
+ChannelOptions IntegrityChannel::Options() const
+{
+    ChannelOptions options = channel_->Options();
+    if (options.max_message_size > sizeof(Trailer))
+        options.max_message_size -= sizeof(Trailer);
+    options.integrity = true;
+    return options;
+}
+
+ChannelStats IntegrityChannel::Stats() const
+{
+    ChannelStats stats = channel_->Stats();
+    stats.corrupted = corrupted_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace integrity
@@ -1,51 +1,155 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "ipc/blob/blob.h"
+#include "ipc/coalesce/coalesce.h"
+#include "ipc/deadline/deadline.h"
+#include "ipc/hybrid/hybrid.h"
+#include "ipc/integrity/integrity.h"
 #include "ipc/ipc.h"
+#include "ipc/journal/journal.h"
 #include "ipc/msgq/msgq.h"
+#include "ipc/msgq/sharded.h"
 #include "ipc/pipe/pipe.h"
+#include "ipc/shm/shm.h"
+#include "ipc/static_node.h"
+#include "ipc/tcp/tcp.h"
 #include "utils/assert.h"
+#include "utils/iov.h"
 #include "utils/log.h"
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ipc.h> // For IPC_PRIVATE
 #endif
 
 namespace ipc {
 
-Node::Node(std::string name, NodeType ntype, ChannelType ctype)
+bool PinThread(int cpu)
+{
+#ifdef _WIN32
+    XASSERT_RETURN(cpu < 0 || cpu >= 64, false, "CPU %d out of range", cpu);
+    XASSERT_RETURN(SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) == 0, false, "SetThreadAffinityMask fail");
+#else
+    XASSERT_RETURN(cpu < 0 || cpu >= CPU_SETSIZE, false, "CPU %d out of range", cpu);
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    // pthread functions return the error instead of setting errno
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    errno = ret;
+    XASSERT_RETURN(ret != 0, false, "pthread_setaffinity_np to CPU %d fail", cpu);
+#endif
+    return true;
+}
+
+#ifndef _WIN32
+key_t NameKey(const std::string& name)
+{
+    std::hash<std::string> hasher;
+    size_t hash = hasher(name);
+    key_t key = static_cast<key_t>(hash & 0xFFFFFFFF);
+    XASSERT_EXIT(key == IPC_PRIVATE, "Generated key is IPC_PRIVATE, which is invalid");
+    return key;
+}
+#endif
+
+void CheckStaticOptions(const std::string& name, const ChannelOptions& options, bool keeps_deadlines)
+{
+    XASSERT_EXIT(options.coalesce_bytes > 0, "StaticNode '%s' does not coalesce, use a Node", name.c_str());
+    XASSERT_EXIT(options.blob_threshold > 0, "StaticNode '%s' has no blob store, use a Node", name.c_str());
+    XASSERT_EXIT(options.integrity, "StaticNode '%s' does not check integrity, use a Node", name.c_str());
+    XASSERT_EXIT((options.deadlines || options.ttl.count() > 0) && !keeps_deadlines,
+        "The transport of StaticNode '%s' does not keep deadlines, use a Node", name.c_str());
+}
+
+Node::Node(std::string name, NodeType ntype, ChannelType ctype, const ChannelOptions& options)
     : name_(name)
     , node_type_(ntype)
 {
+    const bool deadlines = options.deadlines || options.ttl.count() > 0;
+    // Shared memory keeps deadlines in its slots, unless a layer on top packs or rewrites the messages
+    const bool slot_deadlines = ctype == ChannelType::kSharedMemory && options.coalesce_bytes == 0
+        && options.blob_threshold == 0 && !options.integrity;
+    ChannelOptions transport_options = options;
+    if (!slot_deadlines)
+        transport_options.ttl = std::chrono::microseconds(0);
 #ifdef _WIN32
     switch (ctype) {
     case ChannelType::kMessageQueue:
-        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype);
+        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, transport_options);
         break;
     case ChannelType::kNamedPipe:
-        channel_ = std::make_shared<pipe::NamedPipe>(name, ntype);
+        channel_ = std::make_shared<pipe::NamedPipe>(name, ntype, transport_options);
         break;
+    case ChannelType::kSharedMemory:
+        XASSERT_EXIT(true, "Shared memory channel is not supported on Windows.");
+    case ChannelType::kTcp:
+        XASSERT_EXIT(true, "TCP channel is not supported on Windows.");
+    case ChannelType::kJournal:
+        XASSERT_EXIT(true, "Journal channel is not supported on Windows.");
+    case ChannelType::kHybrid:
+        XASSERT_EXIT(true, "Hybrid channel is not supported on Windows.");
     default:
-        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype);
+        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, transport_options);
     }
+    XASSERT_EXIT(options.blob_threshold > 0, "Blob store is not supported on Windows.");
 #else
-    std::hash<std::string> hasher;
-    size_t hash = hasher(name);
-    key_t key = static_cast<key_t>(hash & 0xFFFFFFFF);
-    XASSERT_EXIT(key == IPC_PRIVATE, "Generated key is IPC_PRIVATE, which is invalid");
+    key_t key = NameKey(name);
 
     switch (ctype) {
     case ChannelType::kMessageQueue:
-        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, key);
+        if (options.shards > 1)
+            channel_ = std::make_shared<msgq::ShardedQueue>(name, ntype, key, transport_options);
+        else
+            channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, key, transport_options);
         break;
     case ChannelType::kNamedPipe:
         XASSERT_EXIT(true, "Named pipe channel is not supported on Linux.");
+    case ChannelType::kSharedMemory:
+        channel_ = std::make_shared<shm::SharedMemory>(name, ntype, key, transport_options);
+        break;
+    case ChannelType::kTcp:
+        channel_ = std::make_shared<tcp::TcpChannel>(name, ntype, transport_options);
+        break;
+    case ChannelType::kJournal:
+        channel_ = std::make_shared<journal::Journal>(name, ntype, transport_options);
+        break;
+    case ChannelType::kHybrid:
+        channel_ = std::make_shared<hybrid::HybridChannel>(name, ntype, key, transport_options);
+        break;
     default:
-        channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, key);
+        if (options.shards > 1)
+            channel_ = std::make_shared<msgq::ShardedQueue>(name, ntype, key, transport_options);
+        else
+            channel_ = std::make_shared<msgq::MessageQueue>(name, ntype, key, transport_options);
     }
 #endif
+    if (options.coalesce_bytes > 0)
+        channel_ = std::make_shared<coalesce::CoalescingChannel>(std::move(channel_), ntype, options);
+#ifndef _WIN32
+    // On top of coalescing, so that the descriptors of large messages are packed like small messages
+    if (options.blob_threshold > 0)
+        channel_ = std::make_shared<blob::BlobChannel>(std::move(channel_), name, ntype, key, options);
+#endif
+    // Beneath the checksum, so that a receiver drops expired messages without verifying them
+    if (deadlines && !slot_deadlines)
+        channel_ = std::make_shared<deadline::DeadlineChannel>(std::move(channel_), ntype, options);
+    // Outermost, the checksum covers the payload wherever the layers below put it
+    if (options.integrity)
+        channel_ = std::make_shared<integrity::IntegrityChannel>(std::move(channel_), ntype);
+    partitions_ = std::max<size_t>(1, channel_->Options().partitions);
 }
 
 Node::~Node()
@@ -53,10 +157,22 @@ Node::~Node()
     Remove();
 }
 
-bool Node::Send(void const* data, size_t data_size)
+ChannelOptions Node::Options() const
 {
-    XASSERT_RETURN(!channel_, false, "Channel not initialized");
-    XASSERT_RETURN(node_type_ != NodeType::kSender, false, "Cannot Send data from a Receiver Node");
+    XASSERT_RETURN(!channel_, ChannelOptions(), "Channel not initialized");
+    return channel_->Options();
+}
+
+ChannelStats Node::Stats() const
+{
+    XASSERT_RETURN(!channel_, ChannelStats(), "Channel not initialized");
+    return channel_->Stats();
+}
+
+SendResult Node::Send(void const* data, size_t data_size)
+{
+    XASSERT_RETURN(!channel_, SendStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
 
     return channel_->Send(data, data_size);
 }
@@ -69,14 +185,238 @@ std::shared_ptr<Buffer> Node::Receive()
     return channel_->Receive();
 }
 
+bool Node::Receive(Buffer& message)
+{
+    XASSERT_RETURN(!channel_, false, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    return channel_->ReceiveBuffer(message);
+}
+
+ReceiveResult Node::ReceiveInto(void* dst, size_t capacity)
+{
+    XASSERT_RETURN(!channel_, ReceiveStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, ReceiveStatus::kError, "Cannot Receive data from a kSender Node");
+    XASSERT_RETURN(!dst && capacity > 0, ReceiveStatus::kError, "Destination is null");
+
+    return channel_->ReceiveInto(dst, capacity);
+}
+
+SendResult Node::SendV(const iovec* iov, size_t iovcnt)
+{
+    XASSERT_RETURN(!channel_, SendStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+    XASSERT_RETURN(!iov && iovcnt > 0, SendStatus::kError, "iovec is null");
+
+    return channel_->SendV(iov, iovcnt);
+}
+
+bool Node::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    XASSERT_RETURN(!channel_, false, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+    XASSERT_RETURN(!iov && iovcnt > 0, false, "iovec is null");
+
+    return channel_->ReceiveV(iov, iovcnt, received_size);
+}
+
+SendResult Node::SendBefore(Deadline deadline, const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!channel_, SendStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return channel_->SendBefore(deadline, &iov, 1);
+}
+
+SendResult Node::SendKeyed(uint64_t key, const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!channel_, SendStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return channel_->SendPartitioned(PartitionOf(key, partitions_), &iov, 1);
+}
+
+bool Node::Dispatch(const PartitionHandler& handler)
+{
+    // Keep the channel alive while Remove() is called from another thread to stop the workers
+    std::shared_ptr<Channel> channel = std::atomic_load(&channel_);
+    XASSERT_RETURN(!channel, false, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+    XASSERT_RETURN(!handler, false, "Handler is empty");
+
+    return channel->Dispatch(handler);
+}
+
+bool Node::Read(JournalEntry& entry)
+{
+    // Read waits for the next record, Remove() from another thread ends the wait
+    std::shared_ptr<Channel> channel = std::atomic_load(&channel_);
+    XASSERT_RETURN(!channel, false, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    return channel->Read(entry);
+}
+
+bool Node::Seek(uint64_t seq)
+{
+    XASSERT_RETURN(!channel_, false, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kReceiver, false, "Cannot Receive data from a kSender Node");
+
+    return channel_->Seek(seq);
+}
+
+SendResult Node::Flush()
+{
+    XASSERT_RETURN(!channel_, SendStatus::kError, "Channel not initialized");
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Cannot Send data from a Receiver Node");
+
+    return channel_->Flush();
+}
+
 bool Node::Remove()
 {
-    if (channel_) {
-        bool result = channel_->Remove();
-        channel_.reset(); // Reset the shared pointer to release the channel
-        return result;
-    }
+    // Release the channel, readers blocked in Dispatch() or Read() hold their own reference
+    std::shared_ptr<Channel> channel = std::atomic_exchange(&channel_, std::shared_ptr<Channel>());
+    if (channel)
+        return channel->Remove();
     return true; // No channel to disconnect
 }
 
-} // namespace ipc
\ No newline at end of file
+bool Channel::ReceiveBuffer(Buffer& message)
+{
+    auto buffer = Receive();
+    if (!buffer)
+        return false;
+    // The Buffer has not been shared yet, its payload can be taken over
+    message = std::move(*buffer);
+    return true;
+}
+
+ReceiveResult Channel::ReceiveInto(void* dst, size_t capacity)
+{
+    if (!parked_) {
+        Buffer message;
+        if (!ReceiveBuffer(message))
+            return Closed() ? ReceiveStatus::kClosed : ReceiveStatus::kError;
+        parked_.emplace(std::move(message));
+    }
+    return TakeParked(dst, capacity);
+}
+
+ReceiveResult Channel::TakeParked(void* dst, size_t capacity)
+{
+    size_t size = parked_->Size();
+    if (size > capacity)
+        return { ReceiveStatus::kTooSmall, size };
+    if (size > 0)
+        memcpy(dst, parked_->Data(), size);
+    parked_.reset();
+    return { ReceiveStatus::kOk, size };
+}
+
+SendResult Channel::SendV(const iovec* iov, size_t iovcnt)
+{
+    std::unique_ptr<char[]> buffer(new char[IovLength(iov, iovcnt)]);
+    size_t size = IovGather(buffer.get(), iov, iovcnt);
+    return Send(buffer.get(), size);
+}
+
+bool Channel::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    auto buffer = Receive();
+    XASSERT_RETURN(!buffer, false, "Receive fail");
+
+    received_size = buffer->Size();
+    XASSERT_RETURN(!IovScatter(iov, iovcnt, buffer->Data(), buffer->Size()), false,
+        "Message size %zu exceeds scatter capacity %zu", buffer->Size(), IovLength(iov, iovcnt));
+    return true;
+}
+
+SendResult Channel::SendPartitioned(size_t partition, const iovec* iov, size_t iovcnt)
+{
+    uint64_t header = partition;
+    std::vector<iovec> segments(iov, iov + iovcnt);
+    segments.insert(segments.begin(), { &header, sizeof(header) });
+    return SendV(segments.data(), segments.size());
+}
+
+bool Channel::Dispatch(const PartitionHandler& handler)
+{
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::shared_ptr<Buffer>> queue;
+        bool done = false;
+        std::thread thread;
+    };
+
+    const size_t partitions = std::max<size_t>(1, Options().partitions);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t partition = 0; partition < partitions; ++partition) {
+        workers.push_back(std::make_unique<Worker>());
+        Worker* worker = workers.back().get();
+        worker->thread = std::thread([worker, partition, &handler]() {
+            while (true) {
+                std::unique_lock<std::mutex> lock(worker->mutex);
+                worker->cond.wait(lock, [worker] { return !worker->queue.empty() || worker->done; });
+                if (worker->queue.empty())
+                    return;
+                auto message = std::move(worker->queue.front());
+                worker->queue.pop_front();
+                lock.unlock();
+                handler(partition, std::move(message));
+            }
+        });
+    }
+
+    // The queues are unbounded, a slow partition never holds the others back
+    while (auto message = Receive()) {
+        uint64_t partition;
+        if (message->Size() < sizeof(partition)) {
+            XERRO("Dropped a message of %zu bytes without partition", message->Size());
+            continue;
+        }
+        memcpy(&partition, message->Data(), sizeof(partition));
+        memmove(message->Data(), static_cast<char*>(message->Data()) + sizeof(partition), message->Size() - sizeof(partition));
+        message->SetSize(message->Size() - sizeof(partition));
+
+        Worker* worker = workers[partition % partitions].get();
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->queue.push_back(std::move(message));
+        }
+        worker->cond.notify_one();
+    }
+
+    // Let the workers finish the messages already queued
+    for (auto& worker : workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->done = true;
+        }
+        worker->cond.notify_one();
+        worker->thread.join();
+    }
+    return true;
+}
+
+SendResult Channel::SendBefore(Deadline, const iovec*, size_t)
+{
+    XASSERT_RETURN(true, SendStatus::kError, "SendBefore needs ChannelOptions::deadlines");
+}
+
+bool Channel::Read(JournalEntry&)
+{
+    XASSERT_RETURN(true, false, "Read is only supported by journal channels");
+}
+
+bool Channel::Seek(uint64_t)
+{
+    XASSERT_RETURN(true, false, "Seek is only supported by journal channels");
+}
+
+} // namespace ipc
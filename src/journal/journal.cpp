@@ -0,0 +1,540 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ipc/journal/journal.h"
+#include "utils/assert.h"
+#include "utils/common.h"
+#include "utils/futex.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+#include "utils/process.h"
+
+namespace journal {
+
+static constexpr size_t SEGMENT_NAME_DIGITS = 20;
+static constexpr const char* SEGMENT_SUFFIX = ".journal";
+
+static size_t AlignRecord(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static uint64_t ClaimCount(uint64_t claim)
+{
+    return claim >> 32;
+}
+
+static uint32_t ClaimOffset(uint64_t claim)
+{
+    return static_cast<uint32_t>(claim);
+}
+
+static uint64_t MakeClaim(uint64_t count, uint32_t offset)
+{
+    return count << 32 | offset;
+}
+
+static std::string BaseDirectory(const std::string& journal_dir)
+{
+    if (!journal_dir.empty())
+        return journal_dir;
+    const char* tmpdir = getenv("TMPDIR");
+    return tmpdir && *tmpdir ? tmpdir : "/tmp";
+}
+
+Journal::Journal(const std::string& name, NodeType ntype, const ChannelOptions& options)
+    : name_(name)
+    , dir_(BaseDirectory(options.journal_dir) + "/ipc-journal-" + name)
+    , node_type_(ntype)
+    , options_(options)
+{
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t segment_size = options_.segment_size > 0 ? options_.segment_size : DEFAULT_SEGMENT_SIZE;
+    segment_size = std::clamp(segment_size, MIN_SEGMENT_SIZE, MAX_SEGMENT_SIZE);
+    segment_size = (segment_size + page_size - 1) / page_size * page_size;
+    size_t capacity_bytes = options_.capacity_bytes > 0 ? options_.capacity_bytes : DEFAULT_CAPACITY_BYTES;
+    max_segments_ = std::max<size_t>(2, capacity_bytes / segment_size);
+
+    // A message has to fit into an empty segment next to its record header and the end marker
+    const size_t largest = (segment_size - sizeof(Header) - 2 * sizeof(Record)) & ~static_cast<size_t>(7);
+    size_t max_message_size = options_.max_message_size > 0 ? options_.max_message_size : DEFAULT_MAX_MESSAGE_SIZE;
+
+    options_.journal_dir = BaseDirectory(options.journal_dir);
+    options_.segment_size = segment_size;
+    options_.capacity_bytes = max_segments_ * segment_size;
+    options_.capacity_messages = 0;
+    options_.max_message_size = std::min(max_message_size, largest);
+    // Senders append without waiting for receivers, the oldest segments make room instead
+    options_.backpressure = BackpressurePolicy::kDropOldest;
+    if (options_.spin_budget == 0)
+        options_.spin_budget = DEFAULT_SPIN_BUDGET;
+    options_.shards = 1;
+    options_.shard_threads = false;
+
+    XASSERT_EXIT(mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST, "Create journal directory %s fail: %s",
+        dir_.c_str(), strerror(errno));
+
+    switch (ntype) {
+    case NodeType::kReceiver:
+        if (options_.recovery == RecoveryPolicy::kReclaim) {
+            // Senders still appending to a deleted segment lose those messages
+            for (uint64_t first_seq : ListSegments())
+                unlink(SegmentPath(first_seq).c_str());
+        }
+        XASSERT_EXIT(!OpenOldest(), "kReceiver (Journal) '%s' open failed", name_.c_str());
+        XDEBG("kReceiver (Journal) '%s' reading %s from %llu", name_.c_str(), dir_.c_str(),
+            static_cast<unsigned long long>(reader_.header->first_seq));
+        break;
+    case NodeType::kSender:
+        // Senders map the newest segment on their first Send
+        pid_ = getpid();
+        start_time_ = ProcessStartTime(pid_);
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown NodeType %d for Node %s", static_cast<int>(ntype), name_.c_str());
+        break;
+    }
+}
+
+Journal::~Journal()
+{
+    Journal::Remove();
+    CloseSegment(writer_);
+    CloseSegment(reader_);
+}
+
+std::string Journal::SegmentPath(uint64_t first_seq) const
+{
+    char file[SEGMENT_NAME_DIGITS + 16];
+    snprintf(file, sizeof(file), "%020llu%s", static_cast<unsigned long long>(first_seq), SEGMENT_SUFFIX);
+    return dir_ + "/" + file;
+}
+
+std::vector<uint64_t> Journal::ListSegments() const
+{
+    std::vector<uint64_t> segments;
+    DIR* dir = opendir(dir_.c_str());
+    XASSERT_RETURN(!dir, segments, "Open journal directory %s fail: %s", dir_.c_str(), strerror(errno));
+
+    while (struct dirent* entry = readdir(dir)) {
+        // Temporary files of segments being created do not match
+        const char* file = entry->d_name;
+        if (strlen(file) != SEGMENT_NAME_DIGITS + strlen(SEGMENT_SUFFIX) || strcmp(file + SEGMENT_NAME_DIGITS, SEGMENT_SUFFIX) != 0)
+            continue;
+        if (!std::all_of(file, file + SEGMENT_NAME_DIGITS, [](char c) { return c >= '0' && c <= '9'; }))
+            continue;
+        segments.push_back(strtoull(file, nullptr, 10));
+    }
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+bool Journal::OpenSegment(uint64_t first_seq, bool create, Segment& segment)
+{
+    static std::atomic<uint64_t> temporaries { 0 };
+    const std::string path = SegmentPath(first_seq);
+
+    for (;;) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd >= 0) {
+            struct stat st;
+            void* data = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= MIN_SEGMENT_SIZE)
+                data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            // The file exists, errno must not tell callers to look for it again
+            if (data == MAP_FAILED) {
+                XERRO("Map journal segment %s fail", path.c_str());
+                errno = EINVAL;
+                return false;
+            }
+
+            Header* header = static_cast<Header*>(data);
+            if (header->magic != MAGIC || header->version != VERSION || header->size != static_cast<uint64_t>(st.st_size)
+                || header->first_seq != first_seq) {
+                munmap(data, st.st_size);
+                XERRO("Journal segment %s is invalid", path.c_str());
+                errno = EINVAL;
+                return false;
+            }
+            segment.header = header;
+            segment.size = st.st_size;
+            return true;
+        }
+        if (errno != ENOENT || !create) {
+            XASSERT_RETURN(errno != ENOENT, false, "Open journal segment %s fail: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        // Initialize the segment under a temporary name and link it, so that a segment file is
+        // complete as soon as it can be opened and only one of the racing creators wins
+        char temporary[64];
+        snprintf(temporary, sizeof(temporary), "/.segment-%d-%llu", static_cast<int>(getpid()),
+            static_cast<unsigned long long>(temporaries.fetch_add(1)));
+        const std::string temporary_path = dir_ + temporary;
+        fd = open(temporary_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        XASSERT_RETURN(fd < 0, false, "Create journal segment %s fail: %s", temporary_path.c_str(), strerror(errno));
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, options_.segment_size) == 0)
+            data = mmap(nullptr, options_.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            unlink(temporary_path.c_str());
+            XASSERT_RETURN(true, false, "Map journal segment %s fail", temporary_path.c_str());
+        }
+
+        Header* header = new (data) Header();
+        header->magic = MAGIC;
+        header->version = VERSION;
+        header->first_seq = first_seq;
+        header->size = options_.segment_size;
+        header->claim.store(0, std::memory_order_relaxed);
+        const bool linked = link(temporary_path.c_str(), path.c_str()) == 0;
+        const int link_errno = errno;
+        unlink(temporary_path.c_str());
+        if (!linked) {
+            munmap(data, options_.segment_size);
+            // Another process created it first, use theirs
+            XASSERT_RETURN(link_errno != EEXIST, false, "Link journal segment %s fail: %s", path.c_str(), strerror(link_errno));
+            continue;
+        }
+
+        segment.header = header;
+        segment.size = options_.segment_size;
+        XDEBG("Journal '%s' created segment %llu", name_.c_str(), static_cast<unsigned long long>(first_seq));
+        Retain();
+        return true;
+    }
+}
+
+void Journal::CloseSegment(Segment& segment)
+{
+    if (segment.header)
+        munmap(segment.header, segment.size);
+    segment = Segment();
+}
+
+void Journal::Retain()
+{
+    std::vector<uint64_t> segments = ListSegments();
+    for (size_t i = 0; i + max_segments_ < segments.size(); ++i) {
+        XDEBG("Journal '%s' deletes segment %llu", name_.c_str(), static_cast<unsigned long long>(segments[i]));
+        unlink(SegmentPath(segments[i]).c_str());
+    }
+}
+
+void Journal::Notify(Header* header)
+{
+    // Pairs with the fence in Sleep(): either the receiver sees the record, or this sees its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->data_sleeping.load(std::memory_order_relaxed) && header->data_sleeping.exchange(0, std::memory_order_acq_rel)) {
+        header->data_seq.fetch_add(1, std::memory_order_release);
+        FutexWake(&header->data_seq, INT_MAX);
+    }
+}
+
+template <typename Ready>
+void Journal::Sleep(Header* header, Ready ready, const struct timespec* timeout)
+{
+    uint32_t current = header->data_seq.load(std::memory_order_acquire);
+    header->data_sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ready())
+        return;
+    FutexWait(&header->data_seq, current, timeout);
+}
+
+bool Journal::Abandoned(const Record* record)
+{
+    return ProcessStartTime(record->pid) != record->start_time;
+}
+
+bool Journal::OpenNewest()
+{
+    for (;;) {
+        std::vector<uint64_t> segments = ListSegments();
+        if (segments.empty())
+            return OpenSegment(0, true, writer_);
+        // Retention of another process may delete it in between, look again
+        if (OpenSegment(segments.back(), false, writer_))
+            return true;
+        XASSERT_RETURN(errno != ENOENT, false, "Open newest segment of journal '%s' fail", name_.c_str());
+    }
+}
+
+bool Journal::Rollover(uint64_t count, uint32_t offset)
+{
+    // A sender that has been idle for long may find the next segment deleted already, it continues
+    // in the newest one rather than creating a segment behind the retained ones
+    const uint64_t next_seq = writer_.header->first_seq + count;
+    Segment next;
+    if (!OpenSegment(next_seq, false, next)) {
+        std::vector<uint64_t> segments = ListSegments();
+        const uint64_t first_seq = !segments.empty() && segments.back() > next_seq ? segments.back() : next_seq;
+        if (!OpenSegment(first_seq, first_seq == next_seq, next))
+            return false;
+    }
+
+    // Receivers follow the end marker only once the next segment exists. Every sender that finds the
+    // segment sealed writes it, and receivers follow a seal without marker once the next segment exists,
+    // so a sealing sender that failed here or died does not hold them up
+    reinterpret_cast<Record*>(writer_.Records() + offset)->state.store(kEnd, std::memory_order_release);
+    Notify(writer_.header);
+    CloseSegment(writer_);
+    writer_ = next;
+    return true;
+}
+
+SendResult Journal::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data && data_size > 0, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult Journal::SendV(const iovec* iov, size_t iovcnt)
+{
+    XASSERT_RETURN(node_type_ != NodeType::kSender, SendStatus::kError, "Only a kSender can append to journal '%s'", name_.c_str());
+    size_t data_size = IovLength(iov, iovcnt);
+    XASSERT_RETURN(data_size > options_.max_message_size, SendStatus::kTooLarge,
+        "Data size %zu exceeds maximum message size %zu", data_size, options_.max_message_size);
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (!writer_.header && !OpenNewest())
+        return SendStatus::kError;
+
+    const size_t record_size = sizeof(Record) + AlignRecord(data_size);
+    for (;;) {
+        Header* header = writer_.header;
+        uint64_t claim = header->claim.load(std::memory_order_acquire);
+        const uint64_t count = ClaimCount(claim);
+        const uint32_t offset = ClaimOffset(claim);
+
+        if (offset & SEALED) {
+            if (!Rollover(count, offset & ~SEALED))
+                return SendStatus::kError;
+            continue;
+        }
+        if (offset + record_size > writer_.Capacity()) {
+            // Segments created with a smaller size by another process may not take the message at all
+            XASSERT_RETURN(offset == 0, SendStatus::kTooLarge, "Data size %zu does not fit into segment %llu",
+                data_size, static_cast<unsigned long long>(header->first_seq));
+            // The count is final from here on, the end marker takes the place of the record that did not fit
+            if (header->claim.compare_exchange_weak(claim, MakeClaim(count, offset | SEALED), std::memory_order_acq_rel)
+                && !Rollover(count, offset))
+                return SendStatus::kError;
+            continue;
+        }
+        if (!header->claim.compare_exchange_weak(claim, MakeClaim(count + 1, offset + record_size), std::memory_order_acq_rel))
+            continue;
+
+        // Gather straight into the mapping, receivers read it from there
+        // The header goes first, readers skip the record by its size if this process dies before committing
+        Record* record = reinterpret_cast<Record*>(writer_.Records() + offset);
+        record->size = static_cast<uint32_t>(data_size);
+        record->seq = header->first_seq + count;
+        record->pid = pid_;
+        record->start_time = start_time_;
+        record->state.store(kClaimed, std::memory_order_release);
+        IovGather(record->data, iov, iovcnt);
+        record->state.store(kCommitted, std::memory_order_release);
+        Notify(header);
+        return SendStatus::kOk;
+    }
+}
+
+bool Journal::OpenOldest()
+{
+    for (;;) {
+        std::vector<uint64_t> segments = ListSegments();
+        Segment oldest;
+        if (segments.empty() ? OpenSegment(0, true, oldest) : OpenSegment(segments.front(), false, oldest)) {
+            std::lock_guard<std::mutex> lock(read_mutex_);
+            CloseSegment(reader_);
+            reader_ = oldest;
+            read_offset_ = 0;
+            return true;
+        }
+        XASSERT_RETURN(errno != ENOENT, false, "Open oldest segment of journal '%s' fail", name_.c_str());
+    }
+}
+
+bool Journal::Advance(uint64_t next_seq)
+{
+    Segment next;
+    if (!OpenSegment(next_seq, false, next)) {
+        // Segments are only deleted once they are sealed and followed by others, so this reader fell behind
+        XWARN("Journal '%s' deleted messages from %llu before they were read, continuing at the oldest kept", name_.c_str(),
+            static_cast<unsigned long long>(next_seq));
+        return OpenOldest();
+    }
+
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    CloseSegment(reader_);
+    reader_ = next;
+    read_offset_ = 0;
+    return true;
+}
+
+bool Journal::Read(JournalEntry& entry)
+{
+    XASSERT_RETURN(!reader_.header, false, "Journal is not initialized");
+
+    for (uint32_t spin = 0;;) {
+        if (removed_.load(std::memory_order_acquire)) {
+            XDEBG("Journal '%s' has been removed", name_.c_str());
+            return false;
+        }
+
+        Record* record = reinterpret_cast<Record*>(reader_.Records() + read_offset_);
+        uint32_t state = record->state.load(std::memory_order_acquire);
+        if (state == kCommitted) {
+            read_offset_ += sizeof(Record) + AlignRecord(record->size);
+            if (record->seq < skip_until_)
+                continue;
+            entry.seq = record->seq;
+            entry.data = record->data;
+            entry.size = record->size;
+            return true;
+        }
+        if (state == kEnd) {
+            const uint64_t count = ClaimCount(reader_.header->claim.load(std::memory_order_acquire));
+            if (!Advance(reader_.header->first_seq + count))
+                return false;
+            continue;
+        }
+        // Sealed right here, the end marker only follows once the next segment exists. Its sender may have
+        // died in between, and later senders start in the newest segment, so the next segment itself decides
+        const uint64_t claim = reader_.header->claim.load(std::memory_order_acquire);
+        const bool sealed_here = state == kEmpty && ClaimOffset(claim) == (read_offset_ | SEALED);
+        if (sealed_here && access(SegmentPath(reader_.header->first_seq + ClaimCount(claim)).c_str(), F_OK) == 0) {
+            if (!Advance(reader_.header->first_seq + ClaimCount(claim)))
+                return false;
+            continue;
+        }
+
+        // A claimed record whose sender died is never committed
+        if (state == kClaimed && spin >= options_.spin_budget && Abandoned(record)) {
+            XWARN("Sender %d of journal '%s' died while writing message %llu, skipped", static_cast<int>(record->pid),
+                name_.c_str(), static_cast<unsigned long long>(record->seq));
+            read_offset_ += sizeof(Record) + AlignRecord(record->size);
+            continue;
+        }
+
+        // Caught up with the senders, a record that is being written is waited for the same way
+        if (options_.busy_poll || spin < options_.spin_budget) {
+            spin = std::min(spin + 1, options_.spin_budget);
+            CpuRelax();
+            continue;
+        }
+        // A sender that died does not ring the doorbell, the sender of a claimed record and the segment
+        // following a seal are checked again after a while
+        static constexpr struct timespec ABANDONED_CHECK = { 0, 10 * 1000 * 1000 };
+        Sleep(
+            reader_.header,
+            [&]() { return record->state.load(std::memory_order_acquire) != state || removed_.load(std::memory_order_acquire); },
+            state == kClaimed || sealed_here ? &ABANDONED_CHECK : nullptr);
+        spin = 0;
+    }
+}
+
+bool Journal::Seek(uint64_t seq)
+{
+    XASSERT_RETURN(!reader_.header, false, "Journal is not initialized");
+
+    std::vector<uint64_t> segments = ListSegments();
+    if (seq == JOURNAL_END) {
+        // Skip everything claimed so far, the newest segment knows how many records that is
+        Segment newest;
+        for (;;) {
+            if (segments.empty()) {
+                skip_until_ = 0;
+                return OpenOldest();
+            }
+            if (OpenSegment(segments.back(), false, newest))
+                break;
+            // Retention of another process may delete it in between, look again
+            XASSERT_RETURN(errno != ENOENT, false, "Open newest segment of journal '%s' fail", name_.c_str());
+            segments = ListSegments();
+        }
+        seq = newest.header->first_seq + ClaimCount(newest.header->claim.load(std::memory_order_acquire));
+        CloseSegment(newest);
+    }
+
+    // The segment holding seq is the last one that starts at or before it
+    auto it = std::upper_bound(segments.begin(), segments.end(), seq);
+    Segment segment;
+    if (it == segments.begin() || !OpenSegment(*(it - 1), false, segment)) {
+        XWARN("Journal '%s' no longer holds message %llu", name_.c_str(), static_cast<unsigned long long>(seq));
+        skip_until_ = 0;
+        OpenOldest();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    CloseSegment(reader_);
+    reader_ = segment;
+    read_offset_ = 0;
+    skip_until_ = seq;
+    return true;
+}
+
+std::shared_ptr<Buffer> Journal::Receive()
+{
+    JournalEntry entry;
+    if (!Read(entry))
+        return nullptr;
+
+    auto result = std::make_shared<Buffer>(entry.size);
+    XASSERT_RETURN(!result->Data() && entry.size > 0, nullptr, "Buffer allocation fail");
+    memcpy(result->Data(), entry.data, entry.size);
+    return result;
+}
+
+bool Journal::ReceiveBuffer(Buffer& message)
+{
+    JournalEntry entry;
+    if (!Read(entry))
+        return false;
+
+    message = Buffer(entry.size);
+    XASSERT_RETURN(!message.Data() && entry.size > 0, false, "Buffer allocation fail");
+    memcpy(message.Data(), entry.data, entry.size);
+    return true;
+}
+
+bool Journal::Remove()
+{
+    // The journal stays on disk for later receivers, only a blocked Read() is stopped
+    if (node_type_ != NodeType::kReceiver || removed_.exchange(true))
+        return true;
+
+    XDEBG("Removing journal reader '%s'", name_.c_str());
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    if (reader_.header) {
+        reader_.header->data_seq.fetch_add(1, std::memory_order_release);
+        FutexWake(&reader_.header->data_seq, INT_MAX);
+    }
+    return true;
+}
+
+ChannelStats Journal::Stats() const
+{
+    ChannelStats stats;
+    stats.page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return stats;
+}
+
+} // namespace journal
+#endif // _WIN32
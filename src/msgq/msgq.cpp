@@ -1,12 +1,17 @@
-#include <iostream>
+#include <algorithm>
+#include <fstream>
 #include <memory>
+#include <sstream>
+#include <thread>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "ipc/msgq/msgq.h"
 #include "utils/assert.h"
+#include "utils/iov.h"
 #include "utils/log.h"
+#include "utils/process.h"
 
 #ifdef _WIN32
 
@@ -16,23 +21,45 @@ using namespace boost::interprocess;
 
 namespace msgq {
 
-MessageQueue::MessageQueue(std::string name, NodeType ntype)
+MessageQueue::MessageQueue(std::string name, NodeType ntype, const ChannelOptions& options)
     : msgq_name_(name)
     , node_type_(ntype)
+    , options_(options)
 {
+    if (options_.max_message_size > 0)
+        max_msg_size_ = options_.max_message_size;
+    if (options_.capacity_messages > 0)
+        max_msg_count_ = options_.capacity_messages;
+    else if (options_.capacity_bytes > 0)
+        max_msg_count_ = std::max<size_t>(1, options_.capacity_bytes / max_msg_size_);
+    // Sharding only applies to System V queues
+    options_.shards = 1;
+    options_.shard_threads = false;
+
     switch (ntype) {
     case NodeType::kReceiver:
-        message_queue::remove(msgq_name_.c_str());
         try {
-            message_queue_ = std::make_unique<message_queue>(
-                create_only,
-                msgq_name_.c_str(),
-                max_msg_count_, // Max number of messages
-                max_msg_size_   // Max message size
-            );
+            if (options_.recovery == RecoveryPolicy::kReclaim) {
+                message_queue::remove(msgq_name_.c_str());
+                message_queue_ = std::make_unique<message_queue>(
+                    create_only,
+                    msgq_name_.c_str(),
+                    max_msg_count_, // Max number of messages
+                    max_msg_size_   // Max message size
+                );
+            } else {
+                // Reuse a queue left behind by a previous receiver together with its pending messages
+                message_queue_ = std::make_unique<message_queue>(
+                    open_or_create,
+                    msgq_name_.c_str(),
+                    max_msg_count_,
+                    max_msg_size_);
+            }
         } catch (const interprocess_exception& e) {
             XASSERT_EXIT(true, "Receiver %s create failed: %s", msgq_name_.c_str(), e.what());
         }
+        // A reattached queue keeps the capacity it was created with
+        UpdateLimits();
         break;
     case NodeType::kSender:
         // Move connection establishment to Send method
@@ -49,9 +76,10 @@ MessageQueue::~MessageQueue()
     MessageQueue::Remove();
 }
 
-bool MessageQueue::Send(const void* data, size_t data_size)
+bool MessageQueue::Connect()
 {
-    if (!message_queue_)
+    // Threads sharing the Node open the queue once, later calls only check the flag
+    std::call_once(connect_once_, [this]() {
         try {
             message_queue_ = std::make_unique<message_queue>(
                 open_only,
@@ -59,30 +87,114 @@ bool MessageQueue::Send(const void* data, size_t data_size)
         } catch (const interprocess_exception& e) {
             XASSERT_EXIT(true, "Sender %s create failed: %s", msgq_name_.c_str(), e.what());
         }
+        UpdateLimits();
+    });
+    return true;
+}
 
-    XASSERT_RETURN(node_type_ == NodeType::kReceiver, false, "kReceiver can't send data");
-    XASSERT_RETURN(!data, false, "Data is null");
-    XASSERT_RETURN(!message_queue_, false, "Message queue is not initialized");
+void MessageQueue::UpdateLimits()
+{
+    max_msg_size_ = message_queue_->get_max_msg_size();
+    max_msg_count_ = message_queue_->get_max_msg();
+    options_.max_message_size = max_msg_size_;
+    options_.capacity_messages = max_msg_count_;
+    options_.capacity_bytes = max_msg_size_ * max_msg_count_;
+}
+
+void MessageQueue::Pop(void* buffer, size_t size, size_t& received_size)
+{
+    unsigned int priority;
+    if (options_.busy_poll) {
+        while (!message_queue_->try_receive(buffer, size, received_size, priority))
+            CpuRelax();
+        return;
+    }
+    for (uint32_t spin = 0; spin < options_.spin_budget; ++spin) {
+        if (message_queue_->try_receive(buffer, size, received_size, priority))
+            return;
+        CpuRelax();
+    }
+    message_queue_->receive(buffer, size, received_size, priority);
+}
+
+SendResult MessageQueue::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(node_type_ == NodeType::kReceiver, SendStatus::kError, "kReceiver can't send data");
+    XASSERT_RETURN(!data, SendStatus::kError, "Data is null");
+    XASSERT_RETURN(!Connect(), SendStatus::kDisconnected, "Message queue is not initialized");
+    XASSERT_RETURN(data_size > max_msg_size_, SendStatus::kTooLarge,
+        "Data size %zu exceeds maximum message size %zu", data_size, max_msg_size_);
 
     try {
-        message_queue_->send(data, data_size, 0);
-        return true;
+        switch (options_.backpressure) {
+        case BackpressurePolicy::kBlock:
+            for (uint32_t spin = 0; spin < options_.spin_budget; ++spin) {
+                if (message_queue_->try_send(data, data_size, 0))
+                    return SendStatus::kOk;
+                CpuRelax();
+            }
+            message_queue_->send(data, data_size, 0);
+            return SendStatus::kOk;
+        case BackpressurePolicy::kTimeout: {
+            auto deadline = boost::posix_time::microsec_clock::universal_time()
+                + boost::posix_time::microseconds(options_.send_timeout.count());
+            return message_queue_->timed_send(data, data_size, 0, deadline) ? SendStatus::kOk : SendStatus::kTimedOut;
+        }
+        case BackpressurePolicy::kFailFast:
+            return message_queue_->try_send(data, data_size, 0) ? SendStatus::kOk : SendStatus::kWouldBlock;
+        case BackpressurePolicy::kDropNewest:
+            return message_queue_->try_send(data, data_size, 0) ? SendStatus::kOk : SendStatus::kDropped;
+        case BackpressurePolicy::kDropOldest:
+            while (!message_queue_->try_send(data, data_size, 0)) {
+                XASSERT_RETURN(!DropOldest(), SendStatus::kError, "Sender %s failed to evict the oldest message", msgq_name_.c_str());
+            }
+            return SendStatus::kOk;
+        default:
+            XASSERT_RETURN(true, SendStatus::kError, "Unknown BackpressurePolicy %d", static_cast<int>(options_.backpressure));
+        }
     } catch (const interprocess_exception& e) {
         XINFO("Sender %s Send failed: %s", msgq_name_.c_str(), e.what());
-        return false;
+        return SendStatus::kError;
     }
 }
 
+bool MessageQueue::DropOldest()
+{
+    // Racing with the receiver is fine: an empty queue means there is room again
+    std::unique_ptr<char[]> evicted(new char[max_msg_size_]);
+    size_t received_size;
+    unsigned int priority;
+    message_queue_->try_receive(evicted.get(), max_msg_size_, received_size, priority);
+    return true;
+}
+
+SendResult MessageQueue::SendV(const iovec* iov, size_t iovcnt)
+{
+    // A single segment needs no staging
+    if (iovcnt == 1)
+        return Send(iov[0].iov_base, iov[0].iov_len);
+
+    XASSERT_RETURN(node_type_ == NodeType::kReceiver, SendStatus::kError, "kReceiver can't send data");
+    XASSERT_RETURN(!Connect(), SendStatus::kDisconnected, "Message queue is not initialized");
+
+    size_t data_size = IovLength(iov, iovcnt);
+    XASSERT_RETURN(data_size > max_msg_size_, SendStatus::kTooLarge,
+        "Data size %zu exceeds maximum message size %zu", data_size, max_msg_size_);
+    char* staging = ThreadGatherBuffer(data_size);
+    IovGather(staging, iov, iovcnt);
+
+    return Send(staging, data_size);
+}
+
 std::shared_ptr<Buffer> MessageQueue::Receive()
 {
     XASSERT_RETURN(!message_queue_, nullptr, "Message queue is not initialized");
 
     try {
         size_t received_size;
-        unsigned int priority;
-        auto buffer = std::make_shared<Buffer>(malloc(max_msg_size_), max_msg_size_);
+        auto buffer = std::make_shared<Buffer>(max_msg_size_);
 
-        message_queue_->receive(buffer->Data(), buffer->Size(), received_size, priority);
+        Pop(buffer->Data(), buffer->Size(), received_size);
         buffer->SetSize(received_size);
 
         return buffer;
@@ -93,6 +205,31 @@ std::shared_ptr<Buffer> MessageQueue::Receive()
     }
 }
 
+bool MessageQueue::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    XASSERT_RETURN(!message_queue_, false, "Message queue is not initialized");
+
+    try {
+        // boost requires the receive buffer to hold a message of max_msg_size_
+        // so only stage when the first segment is not large enough on its own
+        if (iovcnt > 0 && iov[0].iov_len >= max_msg_size_) {
+            Pop(iov[0].iov_base, iov[0].iov_len, received_size);
+            return true;
+        }
+
+        if (!staging_)
+            staging_.reset(new char[max_msg_size_]);
+        Pop(staging_.get(), max_msg_size_, received_size);
+        XASSERT_RETURN(!IovScatter(iov, iovcnt, staging_.get(), received_size), false,
+            "Message size %zu exceeds scatter capacity %zu", received_size, IovLength(iov, iovcnt));
+        return true;
+
+    } catch (const interprocess_exception& e) {
+        XINFO("Receiver %s Receive failed: %s", msgq_name_.c_str(), e.what());
+        return false;
+    }
+}
+
 bool MessageQueue::Remove()
 {
     try {
@@ -116,11 +253,15 @@ bool MessageQueue::Remove()
 
 namespace msgq {
 
-MessageQueue::MessageQueue(std::string name, NodeType ntype, key_t key)
+MessageQueue::MessageQueue(std::string name, NodeType ntype, key_t key, const ChannelOptions& options)
     : msgq_name_(name)
     , node_type_(ntype)
     , key_(key)
+    , options_(options)
 {
+    options_.partitions = std::max<size_t>(1, options_.partitions);
+    partitions_ = options_.partitions;
+
     switch (ntype) {
     case NodeType::kReceiver:
         // IPC_CREAT: create the message queue if it does not exist
@@ -130,32 +271,18 @@ MessageQueue::MessageQueue(std::string name, NodeType ntype, key_t key)
         // 0666 indicates that all users (owners, groups, and others) can read and write to this message queue
         msgid_ = msgget(key, IPC_EXCL | IPC_CREAT | 0666);
         if (msgid_ == -1) {
-            // -1 indicates that msgq already exists
-            // But only one receiver can exist for a message queue
-            XINFO("kReceiver of Node '%s' (key: 0x%x) already exists, do you want to delete it? (y/n)", msgq_name_.c_str(), key);
-            char response;
-            std::cin >> response;
-            XASSERT_EXIT(response != 'y' && response != 'Y', "kReceiver already exists, exiting");
-
-            // Delete the existing message queue
-            XDEBG("Deleting existing message queue '%s' (key: 0x%x)", msgq_name_.c_str(), key);
-            msgid_ = msgget(key, 0666);
-            XASSERT_EXIT(msgid_ == -1, "Failed to get existing message queue, key: 0x%x", key);
-            // IPC_RMID: Remove the message queue
-            // If the message queue is not empty, it will be deleted after all messages are read
-            // If the message queue is empty, it will be deleted immediately
-            XASSERT_EXIT(msgctl(msgid_, IPC_RMID, nullptr) == -1, "Delete fail, msgid: %d", msgid_);
-            msgid_ = msgget(key, IPC_EXCL | IPC_CREAT | 0666);
-            XASSERT_EXIT(msgid_ == -1, "Failed to create new message queue, key: 0x%x", key);
+            XASSERT_EXIT(errno != EEXIST, "Failed to create message queue, key: 0x%x", key);
+            // The queue already exists, it is either owned by a running receiver
+            // or left behind by one that crashed before calling Remove()
+            RecoverStaleQueue();
         } else {
             // Successfully created a new message queue
-            XDEBG("kReceiver (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key, msgid_);
+            XDEBG("kReceiver (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key, msgid_.load());
         }
-
-        struct msqid_ds queue_info;
-        XASSERT_EXIT(msgctl(msgid_, IPC_STAT, &queue_info) == -1, "msgctl(IPC_STAT) fail");
-        max_msg_size_ = queue_info.msg_qbytes;
-        XDEBG("kReceiver (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key, msgid_);
+        ClaimOwnership();
+        ApplyCapacity();
+        recv_buffer_.reset(new char[max_msg_size_]);
+        XDEBG("kReceiver (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key, msgid_.load());
         break;
     case NodeType::kSender:
         // Move connection establishment to Send method
@@ -172,68 +299,449 @@ MessageQueue::~MessageQueue()
     MessageQueue::Remove();
 }
 
-bool MessageQueue::Send(const void* data, size_t data_size)
+std::string MessageQueue::OwnerFilePath() const
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ipc-msgq-%08x.owner", static_cast<unsigned>(key_));
+    return path;
+}
+
+bool MessageQueue::OwnerAlive(const struct msqid_ds& queue_info) const
+{
+    std::ifstream file(OwnerFilePath());
+    PID pid = 0;
+    unsigned long long start_time = 0;
+    if (file >> pid >> start_time)
+        return ProcessStartTime(pid) == start_time;
+
+    // No sidecar (e.g. the queue was created by an older version)
+    // fall back to the pid of the last msgrcv, a queue nobody has received from is treated as stale
+    return queue_info.msg_lrpid != 0 && ProcessStartTime(queue_info.msg_lrpid) != 0;
+}
+
+void MessageQueue::ClaimOwnership() const
 {
-    if (msgid_ == -1) {
-        msgid_ = msgget(key_, 0666);
-        XASSERT_RETURN(msgid_ == -1, false, "kReceiver of Node '%s' (key: 0x%x) does not exist", msgq_name_.c_str(), key_);
-        XDEBG("kSender (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key_, msgid_);
+    PID pid = getpid();
+    std::ofstream file(OwnerFilePath(), std::ios::trunc);
+    file << pid << " " << ProcessStartTime(pid) << " " << options_.partitions << std::endl;
+    XASSERT(!file, "Failed to write owner file of Node '%s'", msgq_name_.c_str());
+}
+
+size_t MessageQueue::OwnerPartitions() const
+{
+    std::ifstream file(OwnerFilePath());
+    PID pid = 0;
+    unsigned long long start_time = 0;
+    size_t partitions = 0;
+    // Written by older versions without the count
+    if (!(file >> pid >> start_time >> partitions))
+        return 0;
+    return partitions;
+}
 
-        // Get the maximum message size for this queue
-        struct msqid_ds queue_info;
-        XASSERT_RETURN(msgctl(msgid_, IPC_STAT, &queue_info) == -1, false, "msgctl(IPC_STAT) fail");
-        max_msg_size_ = queue_info.msg_qbytes;
+void MessageQueue::RecoverStaleQueue()
+{
+    msgid_ = msgget(key_, 0666);
+    XASSERT_EXIT(msgid_ == -1, "Failed to get existing message queue, key: 0x%x", key_);
+
+    struct msqid_ds queue_info;
+    XASSERT_EXIT(msgctl(msgid_, IPC_STAT, &queue_info) == -1, "msgctl(IPC_STAT) fail");
+    // Only one receiver can exist for a message queue
+    XASSERT_EXIT(OwnerAlive(queue_info), "kReceiver of Node '%s' (key: 0x%x) is owned by a running process, exiting",
+        msgq_name_.c_str(), key_);
+
+    switch (options_.recovery) {
+    case RecoveryPolicy::kReattach:
+        // Keeping msgid_ lets connected senders continue without noticing the restart
+        XINFO("kReceiver of Node '%s' (key: 0x%x) reattached to stale queue with %lu pending messages",
+            msgq_name_.c_str(), key_, static_cast<unsigned long>(queue_info.msg_qnum));
+        break;
+    case RecoveryPolicy::kReclaim:
+        XINFO("kReceiver of Node '%s' (key: 0x%x) reclaims stale queue, dropping %lu pending messages",
+            msgq_name_.c_str(), key_, static_cast<unsigned long>(queue_info.msg_qnum));
+        // IPC_RMID: Remove the message queue immediately, senders will find the new one on their next Send
+        XASSERT_EXIT(msgctl(msgid_, IPC_RMID, nullptr) == -1, "Delete fail, msgid: %d", msgid_.load());
+        msgid_ = msgget(key_, IPC_EXCL | IPC_CREAT | 0666);
+        XASSERT_EXIT(msgid_ == -1, "Failed to create new message queue, key: 0x%x", key_);
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown RecoveryPolicy %d for Node %s", static_cast<int>(options_.recovery), msgq_name_.c_str());
+        break;
     }
+}
 
-    XASSERT_RETURN(!data, false, "Data is null");
+bool MessageQueue::Connect()
+{
+    if (msgid_.load(std::memory_order_acquire) != -1)
+        return true;
 
-    size_t total_size = sizeof(Message) + data_size;
-    XASSERT_RETURN(total_size > max_msg_size_, false, "Data size %zu exceeds maximum message size %zu", data_size, max_msg_size_);
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    return Lookup();
+}
+
+bool MessageQueue::Lookup()
+{
+    // Another thread sharing the Node may have looked the queue up while this one waited for the lock
+    if (msgid_.load(std::memory_order_relaxed) != -1)
+        return true;
+
+    int msgid = msgget(key_, 0666);
+    XASSERT_RETURN(msgid == -1, false, "kReceiver of Node '%s' (key: 0x%x) does not exist", msgq_name_.c_str(), key_);
+    XDEBG("kSender (MessageQueue) '%s' (key: 0x%x) created with ID %d", msgq_name_.c_str(), key_, msgid);
+
+    // Get the maximum message size for this queue
+    struct msqid_ds queue_info;
+    XASSERT_RETURN(msgctl(msgid, IPC_STAT, &queue_info) == -1, false, "msgctl(IPC_STAT) fail");
+    UpdateLimits(queue_info);
+    // Dispatch() of the receiver only reads the types of its own partitions
+    const size_t partitions = OwnerPartitions();
+    if (partitions > 0 && partitions != options_.partitions) {
+        XWARN("kSender of Node '%s' uses the %zu partitions of its receiver instead of %zu", msgq_name_.c_str(),
+            partitions, options_.partitions);
+        options_.partitions = partitions;
+        partitions_.store(partitions, std::memory_order_relaxed);
+    }
+    msgid_.store(msgid, std::memory_order_release);
+    return true;
+}
+
+ChannelOptions MessageQueue::Options() const
+{
+    // Senders update the limits when they connect
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    return options_;
+}
 
-    Message* message = static_cast<Message*>(malloc(total_size));
-    XASSERT_RETURN(!message, false, "malloc fail");
+// Read a System V limit from /proc/sys/kernel, returns fallback if unavailable
+static size_t KernelLimit(const char* name, size_t fallback)
+{
+    std::ifstream file(std::string("/proc/sys/kernel/") + name);
+    size_t value = 0;
+    return (file >> value) && value > 0 ? value : fallback;
+}
 
-    message->mtype = MESSAGE_TYPE;
+void MessageQueue::ApplyCapacity()
+{
+    struct msqid_ds queue_info;
+    XASSERT_EXIT(msgctl(msgid_, IPC_STAT, &queue_info) == -1, "msgctl(IPC_STAT) fail");
+
+    // The kernel throttles senders once either the queued bytes or the queued messages exceed msg_qbytes
+    // so both capacities are expressed through it, whichever is larger wins
+    size_t requested = std::max(options_.capacity_bytes, options_.capacity_messages);
+    if (requested > 0 && requested != queue_info.msg_qbytes) {
+        queue_info.msg_qbytes = requested;
+        if (msgctl(msgid_, IPC_SET, &queue_info) == -1) {
+            // Raising msg_qbytes above MSGMNB requires CAP_SYS_RESOURCE
+            XASSERT_EXIT(errno != EPERM, "msgctl(IPC_SET) fail");
+            queue_info.msg_qbytes = std::min<size_t>(requested, KernelLimit("msgmnb", 16384));
+            XASSERT_EXIT(msgctl(msgid_, IPC_SET, &queue_info) == -1, "msgctl(IPC_SET) fail");
+            XWARN("Capacity of Node '%s' clamped to %zu bytes by kernel.msgmnb, %zu requested",
+                msgq_name_.c_str(), static_cast<size_t>(queue_info.msg_qbytes), requested);
+        }
+        XASSERT_EXIT(msgctl(msgid_, IPC_STAT, &queue_info) == -1, "msgctl(IPC_STAT) fail");
+    }
+    UpdateLimits(queue_info);
+}
+
+void MessageQueue::UpdateLimits(const struct msqid_ds& queue_info)
+{
+    // A single message is bounded by kernel.msgmax (excluding mtype) and by the queue capacity
+    size_t limit = std::min<size_t>(KernelLimit("msgmax", 8192), queue_info.msg_qbytes) - MTEXT_HEADER_SIZE;
+    options_.max_message_size = options_.max_message_size > 0 ? std::min(options_.max_message_size, limit) : limit;
+    options_.capacity_bytes = queue_info.msg_qbytes;
+    options_.capacity_messages = queue_info.msg_qbytes;
+    max_msg_size_ = sizeof(Message) + options_.max_message_size;
+}
+
+bool MessageQueue::Reconnect(int stale)
+{
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    int expected = stale;
+    msgid_.compare_exchange_strong(expected, -1, std::memory_order_relaxed);
+    return Lookup();
+}
+
+SendResult MessageQueue::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult MessageQueue::SendV(const iovec* iov, size_t iovcnt)
+{
+    return Stage(MESSAGE_TYPE, iov, iovcnt);
+}
+
+SendResult MessageQueue::SendPartitioned(size_t partition, const iovec* iov, size_t iovcnt)
+{
+    // Partition 0 shares its type with plain messages, the count is the receiver's once connected
+    if (!Connect())
+        return SendStatus::kDisconnected;
+    return Stage(MESSAGE_TYPE + static_cast<long>(partition % partitions_.load(std::memory_order_relaxed)), iov, iovcnt);
+}
+
+SendResult MessageQueue::Stage(long type, const iovec* iov, size_t iovcnt)
+{
+    if (!Connect())
+        return SendStatus::kDisconnected;
+
+    size_t data_size = IovLength(iov, iovcnt);
+    size_t total_size = sizeof(Message) + data_size;
+    const size_t max_msg_size = max_msg_size_.load(std::memory_order_relaxed);
+    // max_msg_size counts the header, the limit is reported as the payload callers can send
+    XASSERT_RETURN(total_size > max_msg_size, SendStatus::kTooLarge, "Data size %zu exceeds maximum message size %zu", data_size,
+        max_msg_size - sizeof(Message));
+
+    // Gather the segments straight behind the header, this is the only user space copy
+    Message* message = reinterpret_cast<Message*>(ThreadGatherBuffer(total_size));
+    message->mtype = type;
     message->size = data_size;
-    memcpy(message->data, data, data_size);
+    IovGather(message->data, iov, iovcnt);
 
-    if (msgsnd(msgid_, message, total_size, 0) == -1) {
-        // Fail reasons:
-        // 1. kReceiver restart makes the msgid_ invalid
-        XASSERT(true, "msgsnd fail");
-        free(message);
-        return false;
+    return Post(message, MTEXT_HEADER_SIZE + data_size);
+}
+
+SendResult MessageQueue::Post(Message* message, size_t msgsz)
+{
+    // Every policy but kBlock polls with IPC_NOWAIT so that a full queue is reported as EAGAIN
+    // kBlock also polls while it has spin budget left
+    const bool block = options_.backpressure == BackpressurePolicy::kBlock;
+    int flags = block && options_.spin_budget == 0 ? 0 : IPC_NOWAIT;
+    const auto deadline = std::chrono::steady_clock::now() + options_.send_timeout;
+    auto backoff = std::chrono::microseconds(10);
+    uint32_t spins = 0;
+    bool reconnected = false;
+    int msgid = msgid_.load(std::memory_order_relaxed);
+
+    while (msgsnd(msgid, message, msgsz, flags) == -1) {
+        switch (errno) {
+        case EINTR:
+            continue;
+        case EIDRM:
+        case EINVAL:
+            // A kReceiver that reclaimed the queue after a restart invalidates msgid_
+            // look the new queue up and retry once, the staged message is still intact
+            XASSERT_RETURN(reconnected, SendStatus::kError, "msgsnd fail");
+            XASSERT_RETURN(!Reconnect(msgid), SendStatus::kDisconnected, "msgsnd fail, queue has been removed");
+            msgid = msgid_.load(std::memory_order_acquire);
+            XDEBG("kSender (MessageQueue) '%s' (key: 0x%x) reconnected with ID %d", msgq_name_.c_str(), key_, msgid);
+            reconnected = true;
+            continue;
+        case EAGAIN:
+            break;
+        default:
+            XASSERT_RETURN(true, SendStatus::kError, "msgsnd fail");
+        }
+
+        // The queue is full
+        switch (options_.backpressure) {
+        case BackpressurePolicy::kBlock:
+            if (++spins >= options_.spin_budget)
+                flags = 0;
+            else
+                CpuRelax();
+            break;
+        case BackpressurePolicy::kFailFast:
+            return SendStatus::kWouldBlock;
+        case BackpressurePolicy::kDropNewest:
+            return SendStatus::kDropped;
+        case BackpressurePolicy::kDropOldest: {
+            // Any process with write access may receive, so the sender evicts the head of the queue itself
+            // MSG_NOERROR truncates the evicted message into a small local buffer
+            // Racing with the receiver is fine: an empty queue means there is room again
+            struct {
+                long mtype;
+                char mtext[1];
+            } evicted;
+            msgrcv(msgid, &evicted, sizeof(evicted.mtext), 0, IPC_NOWAIT | MSG_NOERROR);
+            break;
+        }
+        case BackpressurePolicy::kTimeout: {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                return SendStatus::kTimedOut;
+            // System V has no timed msgsnd, poll with an exponential backoff bounded by the deadline
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(backoff, deadline - now));
+            backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+            break;
+        }
+        default:
+            XASSERT_RETURN(true, SendStatus::kError, "Unknown BackpressurePolicy %d", static_cast<int>(options_.backpressure));
+        }
     }
 
-    free(message);
-    return true;
+    return SendStatus::kOk;
 }
 
-std::shared_ptr<Buffer> MessageQueue::Receive()
+MessageQueue::Message* MessageQueue::ReceiveMessage(char* buffer, long type, bool wait, size_t size)
 {
-    std::unique_ptr<char[]> buffer(new char[max_msg_size_]);
-    XASSERT_RETURN(!buffer, nullptr, "malloc fail");
+    const size_t max_msg_size = max_msg_size_.load(std::memory_order_relaxed);
+    const bool staging = size == 0 || size >= max_msg_size;
+    const size_t msgsz = (staging ? max_msg_size : size) - sizeof(long);
+    ssize_t received = -1;
+    // busy_poll keeps probing with IPC_NOWAIT, the thread never sleeps waiting for a wakeup
+    for (uint32_t spin = 0; !wait || options_.busy_poll || spin < options_.spin_budget; ++spin) {
+        received = msgrcv(msgid_, buffer, msgsz, type, IPC_NOWAIT);
+        if (received != -1 || errno != ENOMSG || !wait)
+            break;
+        CpuRelax();
+    }
+
+    while (received == -1) {
+        if (!wait && errno == ENOMSG)
+            return nullptr;
+        received = msgrcv(msgid_, buffer, msgsz, type, wait ? 0 : IPC_NOWAIT);
+        if (received != -1 || errno == EINTR || errno == ENOMSG)
+            continue;
+        if (errno == EIDRM || errno == EINVAL) {
+            // Removed while waiting, which is how Dispatch() and other blocked receivers are stopped
+            XDEBG("Message queue '%s' has been removed", msgq_name_.c_str());
+            return nullptr;
+        }
+        // The message is still queued, the caller retries with a staging buffer
+        if (errno == E2BIG && !staging)
+            return nullptr;
+        // A sender with a larger max_message_size must not wedge the queue, discard its message
+        XASSERT_RETURN(errno != E2BIG, nullptr, "msgrcv fail");
+        msgrcv(msgid_, buffer, msgsz, type, MSG_NOERROR);
+        XERRO("Node '%s' discarded a message exceeding the maximum message size %zu", msgq_name_.c_str(), options_.max_message_size);
+    }
 
-    ssize_t received = msgrcv(msgid_, buffer.get(), max_msg_size_, 0, 0);
-    XASSERT_RETURN(received == -1, nullptr, "msgrcv fail");
+    Message* message = reinterpret_cast<Message*>(buffer);
+    XASSERT_RETURN(static_cast<size_t>(received) != MTEXT_HEADER_SIZE + message->size, nullptr,
+        "Received size %ld does not match expected size %zu", received, MTEXT_HEADER_SIZE + message->size);
+    return message;
+}
 
-    Message* message = reinterpret_cast<Message*>(buffer.get());
-    XASSERT_RETURN(static_cast<size_t>(received) != sizeof(Message) + message->size, nullptr,
-        "Received size %ld does not match expected size %zu", received, sizeof(Message) + message->size);
+std::shared_ptr<Buffer> MessageQueue::CopyMessage(Message* message)
+{
+    if (!message)
+        return nullptr;
 
-    auto result = std::make_shared<Buffer>(malloc(message->size), message->size);
-    XASSERT_RETURN(!result, nullptr, "malloc fail");
+    auto result = std::make_shared<Buffer>(message->size);
+    XASSERT_RETURN(!result->Data() && message->size > 0, nullptr, "Buffer allocation fail");
     memcpy(result->Data(), message->data, message->size);
     return result;
 }
 
+bool MessageQueue::ScatterMessage(Message* message, const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    if (!message)
+        return false;
+
+    received_size = message->size;
+    if (IovScatter(iov, iovcnt, message->data, message->size))
+        return true;
+    XERRO("Message size %zu exceeds scatter capacity %zu", message->size, IovLength(iov, iovcnt));
+    // Tell the failure apart from an empty queue for TryReceiveV
+    errno = EMSGSIZE;
+    return false;
+}
+
+std::shared_ptr<Buffer> MessageQueue::Receive()
+{
+    return CopyMessage(ReceiveMessage(recv_buffer_.get()));
+}
+
+bool MessageQueue::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    return ScatterMessage(ReceiveMessage(recv_buffer_.get()), iov, iovcnt, received_size);
+}
+
+bool MessageQueue::ReceiveBuffer(Buffer& buffer)
+{
+    Message* message = ReceiveMessage(recv_buffer_.get());
+    if (!message)
+        return false;
+
+    buffer = Buffer(message->size);
+    XASSERT_RETURN(!buffer.Data() && message->size > 0, false, "Buffer allocation fail");
+    memcpy(buffer.Data(), message->data, message->size);
+    return true;
+}
+
+ReceiveResult MessageQueue::ReceiveInto(void* dst, size_t capacity)
+{
+    if (parked_)
+        return TakeParked(dst, capacity);
+
+    // msgrcv writes the Message header in front of the payload, receive in place and move the
+    // payload down by the header size, so the payload never passes through the staging buffer
+    if (capacity >= sizeof(Message) && reinterpret_cast<uintptr_t>(dst) % alignof(Message) == 0) {
+        Message* message = ReceiveMessage(static_cast<char*>(dst), 0, true, capacity);
+        if (message) {
+            size_t size = message->size;
+            memmove(dst, message->data, size);
+            return { ReceiveStatus::kOk, size };
+        }
+        if (errno != E2BIG)
+            return errno == EIDRM || errno == EINVAL ? ReceiveStatus::kClosed : ReceiveStatus::kError;
+    }
+
+    // The message needs more room than the destination has to spare for the header
+    Message* message = ReceiveMessage(recv_buffer_.get());
+    if (!message)
+        return errno == EIDRM || errno == EINVAL ? ReceiveStatus::kClosed : ReceiveStatus::kError;
+    if (message->size <= capacity) {
+        memcpy(dst, message->data, message->size);
+        return { ReceiveStatus::kOk, message->size };
+    }
+    // The staging buffer is reused by the next receive, keep the message in a Buffer of its own
+    parked_.emplace(message->size);
+    memcpy(parked_->Data(), message->data, message->size);
+    return { ReceiveStatus::kTooSmall, message->size };
+}
+
+std::shared_ptr<Buffer> MessageQueue::TryReceive()
+{
+    return CopyMessage(ReceiveMessage(recv_buffer_.get(), 0, false));
+}
+
+bool MessageQueue::TryReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    return ScatterMessage(ReceiveMessage(recv_buffer_.get(), 0, false), iov, iovcnt, received_size);
+}
+
+bool MessageQueue::Dispatch(const PartitionHandler& handler)
+{
+    XASSERT_RETURN(msgid_ == -1, false, "Message queue is not initialized");
+
+    // Every worker blocks in msgrcv on the type of its partition with its own staging buffer
+    std::vector<std::thread> workers;
+    for (size_t partition = 0; partition < options_.partitions; ++partition) {
+        workers.emplace_back([this, partition, &handler]() {
+            std::unique_ptr<char[]> buffer(new char[max_msg_size_]);
+            const long type = MESSAGE_TYPE + static_cast<long>(partition);
+            while (Message* message = ReceiveMessage(buffer.get(), type)) {
+                auto result = CopyMessage(message);
+                if (result)
+                    handler(partition, std::move(result));
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    return true;
+}
+
+bool MessageQueue::Closed() const
+{
+    // A removed queue cannot be looked up by its id any more
+    const int msgid = msgid_.load(std::memory_order_acquire);
+    struct msqid_ds queue_info;
+    return msgid != -1 && msgctl(msgid, IPC_STAT, &queue_info) == -1 && (errno == EIDRM || errno == EINVAL);
+}
+
 bool MessageQueue::Remove()
 {
     if (node_type_ == NodeType::kReceiver) {
-        XDEBG("Removing message queue '%s' (key: 0x%x) with ID %d", msgq_name_.c_str(), key_, msgid_);
+        XDEBG("Removing message queue '%s' (key: 0x%x) with ID %d", msgq_name_.c_str(), key_, msgid_.load());
         // The destructors of Node and msgq will call Remove() multiple times
         // msgctl will return -1 and set errno to EINVAL if Remove repeatedly
-        XASSERT_RETURN(msgctl(msgid_, IPC_RMID, nullptr) == -1 && errno != EINVAL, false, "msgctl(IPC_RMID) fail, msgid: %d", msgid_);
+        XASSERT_RETURN(msgctl(msgid_, IPC_RMID, nullptr) == -1 && errno != EINVAL, false, "msgctl(IPC_RMID) fail, msgid: %d", msgid_.load());
+        unlink(OwnerFilePath().c_str());
     }
     return true;
 }
@@ -0,0 +1,195 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <sys/ipc.h>
+#include <unistd.h>
+
+#include "ipc/msgq/sharded.h"
+#include "utils/assert.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace msgq {
+
+ShardedQueue::ShardedQueue(std::string name, NodeType ntype, key_t key, const ChannelOptions& options)
+    : msgq_name_(name)
+    , node_type_(ntype)
+    , options_(options)
+{
+    XASSERT_EXIT(options_.shards == 0, "Node '%s' needs at least one shard", msgq_name_.c_str());
+
+    for (size_t shard = 0; shard < options_.shards; ++shard) {
+        std::string shard_name = msgq_name_ + "#" + std::to_string(shard);
+        shards_.push_back(std::make_unique<MessageQueue>(shard_name, ntype, ShardKey(name, key, shard), options_));
+    }
+
+    if (ntype == NodeType::kReceiver && options_.shard_threads) {
+        for (size_t shard = 0; shard < shards_.size(); ++shard)
+            workers_.emplace_back(&ShardedQueue::Drain, this, shard);
+    }
+    XDEBG("Node '%s' spread over %zu message queues", msgq_name_.c_str(), shards_.size());
+}
+
+ShardedQueue::~ShardedQueue()
+{
+    ShardedQueue::Remove();
+}
+
+key_t ShardedQueue::ShardKey(const std::string& name, key_t key, size_t shard)
+{
+    if (shard == 0)
+        return key;
+
+    std::hash<std::string> hasher;
+    key_t shard_key = static_cast<key_t>(hasher(name + "#" + std::to_string(shard)) & 0xFFFFFFFF);
+    XASSERT_EXIT(shard_key == IPC_PRIVATE, "Generated key of shard %zu is IPC_PRIVATE, which is invalid", shard);
+    return shard_key;
+}
+
+size_t ShardedQueue::SenderShard() const
+{
+    // Mix the thread and the process, thread ids of different processes are often the same addresses
+    static thread_local const uint64_t hash = [] {
+        uint64_t x = std::hash<std::thread::id>()(std::this_thread::get_id()) ^ (static_cast<uint64_t>(getpid()) << 32);
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }();
+    return hash % shards_.size();
+}
+
+SendResult ShardedQueue::Send(const void* data, size_t data_size)
+{
+    return shards_[SenderShard()]->Send(data, data_size);
+}
+
+SendResult ShardedQueue::SendV(const iovec* iov, size_t iovcnt)
+{
+    return shards_[SenderShard()]->SendV(iov, iovcnt);
+}
+
+template <typename TryReceive>
+bool ShardedQueue::Poll(TryReceive try_receive)
+{
+    auto backoff = std::chrono::microseconds(10);
+    for (uint32_t spin = 0;; ++spin) {
+        // Start after the shard served last, so that a busy shard cannot starve the others
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            size_t shard = (next_shard_ + i) % shards_.size();
+            if (try_receive(*shards_[shard])) {
+                next_shard_ = shard + 1;
+                return true;
+            }
+            if (errno != ENOMSG)
+                return false;
+        }
+
+        if (options_.busy_poll || spin < options_.spin_budget) {
+            CpuRelax();
+            continue;
+        }
+        // System V cannot wait on several queues at once, sleep with an exponential backoff
+        // Use shard_threads to block in the kernel instead
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+    }
+}
+
+void ShardedQueue::Drain(size_t shard)
+{
+    while (true) {
+        auto buffer = shards_[shard]->Receive();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+            return;
+        if (!buffer) {
+            if (errno != EIDRM && errno != EINVAL)
+                continue;
+            // The queue has been removed under the Node, let Receive fail instead of waiting forever
+            XERRO("Shard %zu of Node '%s' has been removed", shard, msgq_name_.c_str());
+            stopping_ = true;
+            cond_.notify_all();
+            return;
+        }
+        pending_.push_back(std::move(buffer));
+        cond_.notify_one();
+    }
+}
+
+std::shared_ptr<Buffer> ShardedQueue::Pop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !pending_.empty() || stopping_; });
+    if (pending_.empty())
+        return nullptr;
+    auto buffer = std::move(pending_.front());
+    pending_.pop_front();
+    return buffer;
+}
+
+std::shared_ptr<Buffer> ShardedQueue::Receive()
+{
+    if (!workers_.empty())
+        return Pop();
+
+    std::shared_ptr<Buffer> result;
+    Poll([&result](MessageQueue& shard) { return (result = shard.TryReceive()) != nullptr; });
+    return result;
+}
+
+bool ShardedQueue::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    if (!workers_.empty()) {
+        auto buffer = Pop();
+        if (!buffer)
+            return false;
+        received_size = buffer->Size();
+        XASSERT_RETURN(!IovScatter(iov, iovcnt, buffer->Data(), buffer->Size()), false,
+            "Message size %zu exceeds scatter capacity %zu", buffer->Size(), IovLength(iov, iovcnt));
+        return true;
+    }
+
+    return Poll([&](MessageQueue& shard) { return shard.TryReceiveV(iov, iovcnt, received_size); });
+}
+
+bool ShardedQueue::Remove()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+
+    // Removing the queues wakes up the receiver threads blocked on them
+    bool removed = true;
+    for (auto& shard : shards_)
+        removed &= shard->Remove();
+    for (auto& worker : workers_) {
+        if (worker.joinable())
+            worker.join();
+    }
+    return removed;
+}
+
+bool ShardedQueue::Closed() const
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+            return true;
+    }
+    return std::any_of(shards_.begin(), shards_.end(), [](const auto& shard) { return shard->Closed(); });
+}
+
+ChannelOptions ShardedQueue::Options() const
+{
+    ChannelOptions options = shards_[0]->Options();
+    options.shards = shards_.size();
+    options.shard_threads = !workers_.empty();
+    return options;
+}
+
+} // namespace msgq
+#endif // _WIN32
@@ -23,10 +23,22 @@ namespace pipe {
 // The client can write <ServerName> as a dot or remote hostname.
 #define LOCAL_PIPI R"(\\.\pipe\)"
 
-NamedPipe::NamedPipe(const std::string& name, NodeType ntype)
+NamedPipe::NamedPipe(const std::string& name, NodeType ntype, const ChannelOptions& options)
     : pipe_name_(LOCAL_PIPI + name)
     , node_type_(ntype)
+    , options_(options)
+    , buffer_size_(options.max_message_size > 0 ? static_cast<DWORD>(options.max_message_size) : BUFFER_SIZE)
 {
+    // Each connection reads whole messages into a buffer of buffer_size_ bytes
+    // the pipe quota is the only capacity limit, messages are not counted
+    options_.max_message_size = buffer_size_;
+    options_.capacity_bytes = buffer_size_;
+    options_.capacity_messages = 0;
+    // Messages arrive through the RecvHandle threads, there is nothing to poll
+    options_.busy_poll = false;
+    options_.shards = 1;
+    options_.shard_threads = false;
+
     switch (ntype) {
     case NodeType::kSender:
         send_pipe_ = INVALID_HANDLE_VALUE;
@@ -57,16 +69,18 @@ NamedPipe::~NamedPipe()
     NamedPipe::Remove();
 }
 
-bool NamedPipe::Send(const void* data, size_t data_size)
+// Named pipe writes always block until the receiver has room, the backpressure policy does not apply
+SendResult NamedPipe::Send(const void* data, size_t data_size)
 {
-    XASSERT_RETURN(node_type_ == NodeType::kReceiver, false, "kReceiver can't send data");
-    XASSERT_RETURN(!data, false, "Data is null");
-    XASSERT_RETURN(!Connect(), false, "Connect failed in send");
+    XASSERT_RETURN(node_type_ == NodeType::kReceiver, SendStatus::kError, "kReceiver can't send data");
+    XASSERT_RETURN(!data, SendStatus::kError, "Data is null");
+    XASSERT_RETURN(!Connect(), SendStatus::kDisconnected, "Connect failed in send");
 
     DWORD bytesWritten;
     while (true) {
+        HANDLE pipe = send_pipe_.load(std::memory_order_acquire);
         BOOL success = WriteFile(
-            send_pipe_,
+            pipe,
             data,
             static_cast<DWORD>(data_size),
             &bytesWritten,
@@ -75,20 +89,17 @@ bool NamedPipe::Send(const void* data, size_t data_size)
         if (!success && GetLastError() == ERROR_PIPE_NOT_CONNECTED) {
             // The pipe has been closed by Receiver
             XINFO("The pipe has been ended, try to reconnect...");
-            send_connected_ = false;
-            // Reset the current pipe instance and reconnect
-            DisconnectNamedPipe(send_pipe_);
-            Connect();
+            XASSERT_RETURN(!Reconnect(pipe), SendStatus::kDisconnected, "Reconnect failed in send");
             // Try sending data again after reconnecting
             continue;
         }
-        XASSERT_RETURN(!success, false, "WriteFile failed");
+        XASSERT_RETURN(!success, SendStatus::kError, "WriteFile failed");
         break;
     }
 
-    XASSERT_RETURN(bytesWritten != data_size, false, "WriteFile write wrong size data, expected: %zu, written: %lu", data_size, bytesWritten);
+    XASSERT_RETURN(bytesWritten != data_size, SendStatus::kError, "WriteFile write wrong size data, expected: %zu, written: %lu", data_size, bytesWritten);
     XDEBG("kSender '%s' write %lu byte", pipe_name_.c_str(), bytesWritten);
-    return true;
+    return SendStatus::kOk;
 }
 
 std::shared_ptr<Buffer> NamedPipe::Receive()
@@ -123,9 +134,15 @@ bool NamedPipe::Remove()
 {
     XDEBG("Removing named pipe %s '%s'", node_type_ == NodeType::kSender ? "sender" : "receiver", pipe_name_.c_str());
 
-    if (node_type_ == NodeType::kSender && send_connected_) {
-        DisconnectNamedPipe(send_pipe_);
-        send_connected_ = false;
+    if (node_type_ == NodeType::kSender) {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (send_connected_) {
+            DisconnectNamedPipe(send_pipe_.load());
+            send_connected_ = false;
+        }
+        for (HANDLE pipe : retired_pipes_)
+            CloseHandle(pipe);
+        retired_pipes_.clear();
         return true;
     } else {
         recv_stop_flag_.store(true);
@@ -162,8 +179,8 @@ void NamedPipe::RecvLoop()
             PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED, // OpenMode
             PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, // PipeMode
             PIPE_UNLIMITED_INSTANCES, // Maximum instances of pipes with the same name
-            BUFFER_SIZE, // Output buffer size
-            BUFFER_SIZE, // Input buffer size
+            buffer_size_, // Output buffer size
+            buffer_size_, // Input buffer size
             0, // Default timeout
             NULL);
 
@@ -227,7 +244,7 @@ void NamedPipe::RecvLoop()
 void NamedPipe::RecvHandle(HANDLE pipe)
 {
     XDEBG("Receiver '%s' started a thread to handle connection", pipe_name_.c_str());
-    char buffer[BUFFER_SIZE];
+    std::unique_ptr<char[]> buffer(new char[buffer_size_]);
     OVERLAPPED overlapped = { 0 };
     overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
@@ -236,8 +253,8 @@ void NamedPipe::RecvHandle(HANDLE pipe)
         DWORD bytesRead;
         BOOL success = ReadFile(
             pipe,
-            buffer,
-            BUFFER_SIZE,
+            buffer.get(),
+            buffer_size_,
             &bytesRead,
             &overlapped);
 
@@ -271,8 +288,8 @@ void NamedPipe::RecvHandle(HANDLE pipe)
 
         // Processing valid data
         if (bytesRead > 0) {
-            auto data = std::make_shared<Buffer>(malloc(bytesRead), bytesRead);
-            memcpy(data->Data(), buffer, bytesRead);
+            auto data = std::make_shared<Buffer>(bytesRead);
+            memcpy(data->Data(), buffer.get(), bytesRead);
             {
                 std::lock_guard<std::mutex> lock(queue_mutex_);
                 recv_queue_.push(data);
@@ -290,10 +307,30 @@ void NamedPipe::RecvHandle(HANDLE pipe)
     CloseHandle(pipe);
 }
 
+bool NamedPipe::Reconnect(HANDLE broken)
+{
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (send_connected_.load(std::memory_order_relaxed) && send_pipe_.load(std::memory_order_relaxed) == broken) {
+            // Reset the current pipe instance, other threads may still be writing to it
+            DisconnectNamedPipe(broken);
+            retired_pipes_.push_back(broken);
+            send_connected_.store(false, std::memory_order_release);
+        }
+    }
+    return Connect();
+}
+
 // kSender connects to Receiver
 bool NamedPipe::Connect()
 {
-    if (send_connected_) {
+    if (send_connected_.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    // Another thread sharing the Node may have connected while this one waited for the lock
+    if (send_connected_.load(std::memory_order_relaxed)) {
         return true;
     }
 
@@ -302,7 +339,7 @@ bool NamedPipe::Connect()
 
     for (int i = 0; i < max_retries; ++i) {
         if (WaitNamedPipeA(pipe_name_.c_str(), NMPWAIT_USE_DEFAULT_WAIT)) {
-            send_pipe_ = CreateFileA(
+            HANDLE pipe = CreateFileA(
                 pipe_name_.c_str(),
                 GENERIC_WRITE, // Write only for sender
                 FILE_SHARE_READ | FILE_SHARE_WRITE, // Allow sharing for reading and writing
@@ -311,8 +348,9 @@ bool NamedPipe::Connect()
                 FILE_ATTRIBUTE_NORMAL,
                 NULL);
 
-            if (send_pipe_ != INVALID_HANDLE_VALUE) {
-                send_connected_ = true;
+            if (pipe != INVALID_HANDLE_VALUE) {
+                send_pipe_.store(pipe, std::memory_order_release);
+                send_connected_.store(true, std::memory_order_release);
                 XDEBG("kSender '%s' connected successfully", pipe_name_.c_str());
                 return true;
             }
@@ -0,0 +1,247 @@
+#ifndef _WIN32
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ipc/shm/segment.h"
+#include "utils/assert.h"
+#include "utils/log.h"
+
+namespace shm {
+
+static size_t BasePageSize()
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+// Default huge page size from /proc/meminfo
+static size_t HugePageSize()
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        size_t kb;
+        if (sscanf(line.c_str(), "Hugepagesize: %zu kB", &kb) == 1)
+            return kb * 1024;
+    }
+    return 2 * 1024 * 1024;
+}
+
+// Mount point of a hugetlbfs file system, empty if there is none
+static std::string HugetlbfsMount()
+{
+    std::ifstream mounts("/proc/mounts");
+    std::string device, dir, type, rest;
+    while (mounts >> device >> dir >> type && std::getline(mounts, rest)) {
+        if (type == "hugetlbfs")
+            return dir;
+    }
+    return "";
+}
+
+// Whether madvise(MADV_HUGEPAGE) can take effect
+// setting is "enabled" for anonymous memory and "shmem_enabled" for tmpfs
+static bool TransparentHugePagesAllowed(const char* setting)
+{
+    std::ifstream file(std::string("/sys/kernel/mm/transparent_hugepage/") + setting);
+    std::string modes;
+    std::getline(file, modes);
+    for (const char* mode : { "[always]", "[madvise]", "[advise]", "[within_size]", "[force]" }) {
+        if (modes.find(mode) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+static size_t RoundUp(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+// Fault every page in up front, so that first touches on the data path do not add jitter
+static void Prefault(void* data, size_t size)
+{
+    volatile char* pos = static_cast<volatile char*>(data);
+    for (size_t offset = 0; offset < size; offset += BasePageSize())
+        pos[offset] = pos[offset];
+}
+
+// Open an existing segment from either backing file system
+static int OpenExisting(const std::string& name, bool& on_hugetlbfs)
+{
+    on_hugetlbfs = false;
+    int fd = shm_open(name.c_str(), O_RDWR, 0666);
+    if (fd != -1 || errno != ENOENT)
+        return fd;
+
+    std::string mount = HugetlbfsMount();
+    if (mount.empty())
+        return -1;
+    fd = open((mount + name).c_str(), O_RDWR);
+    on_hugetlbfs = fd != -1;
+    return fd;
+}
+
+Segment::~Segment()
+{
+    Unmap();
+}
+
+bool Segment::Map(int fd, size_t size, bool populate)
+{
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    data_ = data;
+    size_ = size;
+    return true;
+}
+
+bool Segment::Create(const std::string& name, size_t size, HugePages huge_pages)
+{
+    XASSERT_RETURN(data_, false, "Segment '%s' is already mapped", name.c_str());
+
+    // O_EXCL only covers one file system, check both
+    bool on_hugetlbfs;
+    int fd = OpenExisting(name, on_hugetlbfs);
+    if (fd != -1) {
+        close(fd);
+        errno = EEXIST;
+        return false;
+    }
+
+    if (huge_pages == HugePages::kExplicit) {
+        std::string mount = HugetlbfsMount();
+        std::string path = mount + name;
+        fd = mount.empty() ? -1 : open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd != -1) {
+            // hugetlbfs reserves the pages at mmap time, so a shortage fails here instead of faulting later
+            size_t huge_page_size = HugePageSize();
+            size_t rounded = RoundUp(size, huge_page_size);
+            bool mapped = fchmod(fd, 0666) == 0 && ftruncate(fd, rounded) == 0 && Map(fd, rounded, true);
+            close(fd);
+            if (mapped) {
+                page_size_ = huge_page_size;
+                XDEBG("Segment '%s' created on hugetlbfs with %zu bytes", name.c_str(), rounded);
+                return true;
+            }
+            unlink(path.c_str());
+        }
+        XINFO("Huge pages unavailable for segment '%s', falling back to transparent huge pages", name.c_str());
+        huge_pages = HugePages::kTransparent;
+    }
+
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    XASSERT_RETURN(fd == -1, false, "shm_open '%s' fail", name.c_str());
+    // shm_open applies the umask, while senders of any user must be able to write like with msgget(0666)
+    fchmod(fd, 0666);
+    // The kernel decides on huge pages at fault time, so advise first and prefault afterwards
+    bool mapped = ftruncate(fd, size) == 0 && Map(fd, size, false);
+    close(fd);
+    if (!mapped) {
+        XASSERT(true, "Map segment '%s' fail", name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    page_size_ = BasePageSize();
+    if (huge_pages == HugePages::kTransparent && TransparentHugePagesAllowed("shmem_enabled")
+        && madvise(data_, size_, MADV_HUGEPAGE) == 0) {
+        page_size_ = HugePageSize();
+    }
+    Prefault(data_, size_);
+    XDEBG("Segment '%s' created with %zu bytes, page size %zu", name.c_str(), size_, page_size_);
+    return true;
+}
+
+bool Segment::Open(const std::string& name)
+{
+    XASSERT_RETURN(data_, false, "Segment '%s' is already mapped", name.c_str());
+
+    bool on_hugetlbfs;
+    int fd = OpenExisting(name, on_hugetlbfs);
+    if (fd == -1)
+        return false;
+
+    struct stat info;
+    bool mapped = fstat(fd, &info) == 0 && Map(fd, info.st_size, true);
+    close(fd);
+    XASSERT_RETURN(!mapped, false, "Map segment '%s' fail", name.c_str());
+    page_size_ = on_hugetlbfs ? HugePageSize() : BasePageSize();
+    return true;
+}
+
+void Segment::Unmap()
+{
+    if (data_) {
+        munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+bool Segment::Unlink(const std::string& name)
+{
+    bool removed = shm_unlink(name.c_str()) == 0;
+    std::string mount = HugetlbfsMount();
+    if (!mount.empty())
+        removed |= unlink((mount + name).c_str()) == 0;
+    return removed;
+}
+
+void* Segment::MapAnonymous(size_t& size, HugePages huge_pages, size_t& page_size)
+{
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* data;
+
+    if (huge_pages == HugePages::kExplicit) {
+        size_t huge_page_size = HugePageSize();
+        size_t rounded = RoundUp(size, huge_page_size);
+        data = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            size = rounded;
+            page_size = huge_page_size;
+            return data;
+        }
+        huge_pages = HugePages::kTransparent;
+    }
+
+    if (huge_pages == HugePages::kTransparent && TransparentHugePagesAllowed("enabled")) {
+        // Transparent huge pages need a huge page aligned range, over-map and trim
+        size_t huge_page_size = HugePageSize();
+        size_t rounded = RoundUp(size, huge_page_size);
+        data = mmap(nullptr, rounded + huge_page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        XASSERT_RETURN(data == MAP_FAILED, nullptr, "mmap %zu bytes fail", rounded + huge_page_size);
+        char* begin = static_cast<char*>(data);
+        char* aligned = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(begin), huge_page_size));
+        if (aligned > begin)
+            munmap(begin, aligned - begin);
+        munmap(aligned + rounded, begin + huge_page_size - aligned);
+
+        size = rounded;
+        page_size = madvise(aligned, rounded, MADV_HUGEPAGE) == 0 ? huge_page_size : BasePageSize();
+        return aligned;
+    }
+
+    size = RoundUp(size, BasePageSize());
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    XASSERT_RETURN(data == MAP_FAILED, nullptr, "mmap %zu bytes fail", size);
+    page_size = BasePageSize();
+    return data;
+}
+
+void Segment::UnmapAnonymous(void* data, size_t size)
+{
+    if (data)
+        munmap(data, size);
+}
+
+} // namespace shm
+#endif // _WIN32
\ No newline at end of file
@@ -0,0 +1,548 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc/shm/shm.h"
+#include "utils/assert.h"
+#include "utils/deadline.h"
+#include "utils/futex.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+#include "utils/process.h"
+
+namespace shm {
+
+static std::string SegmentName(key_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/ipc-shm-%08x", static_cast<unsigned>(key));
+    return name;
+}
+
+static uint64_t RoundUpPowerOfTwo(uint64_t value)
+{
+    uint64_t result = 2;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+SharedMemory::SharedMemory(std::string name, NodeType ntype, key_t key, const ChannelOptions& options)
+    : shm_name_(name)
+    , segment_name_(SegmentName(key))
+    , node_type_(ntype)
+    , options_(options)
+{
+    if (options_.spin_budget == 0)
+        options_.spin_budget = DEFAULT_SPIN_BUDGET;
+    // A single ring already takes senders without a kernel lock
+    options_.shards = 1;
+    options_.shard_threads = false;
+    // Every slot has room for a deadline, the ttl only decides whether Send sets it
+    if (options_.ttl.count() > 0)
+        options_.deadlines = true;
+    switch (ntype) {
+    case NodeType::kReceiver:
+        XASSERT_EXIT(!Create(), "kReceiver (SharedMemory) '%s' create failed", shm_name_.c_str());
+        XDEBG("kReceiver (SharedMemory) '%s' created segment %s", shm_name_.c_str(), segment_name_.c_str());
+        break;
+    case NodeType::kSender:
+        // Move connection establishment to Send method
+        // Prevent errors caused by not creating a receiver during initialization
+        break;
+    default:
+        XASSERT_EXIT(true, "Unknown NodeType %d for Node %s", static_cast<int>(ntype), shm_name_.c_str());
+        break;
+    }
+}
+
+SharedMemory::~SharedMemory()
+{
+    SharedMemory::Remove();
+}
+
+bool SharedMemory::Create()
+{
+    uint64_t max_message_size = options_.max_message_size > 0 ? options_.max_message_size : DEFAULT_MAX_MESSAGE_SIZE;
+    uint64_t slot_size = (sizeof(Slot) + max_message_size + 63) / 64 * 64;
+    uint64_t slot_count = DEFAULT_SLOT_COUNT;
+    if (options_.capacity_messages > 0)
+        slot_count = options_.capacity_messages;
+    else if (options_.capacity_bytes > 0)
+        slot_count = options_.capacity_bytes / slot_size;
+    slot_count = RoundUpPowerOfTwo(slot_count);
+
+    if (!segment_.Create(segment_name_, sizeof(Header) + slot_count * slot_size, options_.huge_pages)) {
+        XASSERT_RETURN(errno != EEXIST, false, "Create segment %s fail", segment_name_.c_str());
+        // The segment is either owned by a running receiver or left behind by one that crashed
+        return RecoverStaleSegment();
+    }
+
+    // A fresh segment is zero filled, construct the shared state in place
+    Header* header = new (segment_.Data()) Header();
+    header->version = VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->page_size = segment_.PageSize();
+    header->owner_pid = getpid();
+    header->owner_start_time = ProcessStartTime(header->owner_pid);
+    for (uint64_t pos = 0; pos < slot_count; ++pos)
+        new (&SlotAt(header, pos)->seq) std::atomic<uint64_t>(pos);
+    // Senders only use the segment once the layout is complete
+    header->magic.store(MAGIC, std::memory_order_release);
+
+    header_.store(Attach(segment_), std::memory_order_release);
+    return header_.load(std::memory_order_relaxed) != nullptr;
+}
+
+bool SharedMemory::RecoverStaleSegment()
+{
+    XASSERT_RETURN(!segment_.Open(segment_name_), false, "Open existing segment %s fail", segment_name_.c_str());
+    Header* header = static_cast<Header*>(segment_.Data());
+    bool valid = segment_.Size() >= sizeof(Header) && header->magic.load(std::memory_order_acquire) == MAGIC
+        && header->version == VERSION;
+
+    // Only one receiver can exist for a channel
+    XASSERT_EXIT(valid && ProcessStartTime(header->owner_pid) == header->owner_start_time,
+        "kReceiver of Node '%s' (%s) is owned by a running process, exiting", shm_name_.c_str(), segment_name_.c_str());
+
+    if (valid && options_.recovery == RecoveryPolicy::kReattach) {
+        // Keep the layout and the pending messages, connected senders are unaffected
+        header->owner_pid = getpid();
+        header->owner_start_time = ProcessStartTime(header->owner_pid);
+        XASSERT_RETURN(!Attach(segment_), false, "Attach segment %s fail", segment_name_.c_str());
+        header_.store(header, std::memory_order_release);
+        XINFO("kReceiver of Node '%s' reattached to stale segment with %lu pending messages", shm_name_.c_str(),
+            static_cast<unsigned long>(header->tail.load() - header->head.load()));
+        return true;
+    }
+
+    XINFO("kReceiver of Node '%s' reclaims stale segment %s", shm_name_.c_str(), segment_name_.c_str());
+    if (valid) {
+        // Senders still mapping the old segment notice this and reconnect to the new one
+        header->closed.store(1, std::memory_order_release);
+        header->space_seq.fetch_add(1, std::memory_order_release);
+        FutexWake(&header->space_seq, INT_MAX);
+    }
+    segment_.Unmap();
+    Segment::Unlink(segment_name_);
+    return Create();
+}
+
+SharedMemory::Header* SharedMemory::Attach(Segment& segment)
+{
+    Header* header = static_cast<Header*>(segment.Data());
+    if (segment.Size() < sizeof(Header) || header->magic.load(std::memory_order_acquire) != MAGIC)
+        return nullptr;
+    XASSERT_RETURN(header->version != VERSION, nullptr, "Segment %s has version %u, expected %u",
+        segment_name_.c_str(), header->version, VERSION);
+    XASSERT_RETURN(segment.Size() < sizeof(Header) + header->slot_count * header->slot_size, nullptr,
+        "Segment %s is truncated", segment_name_.c_str());
+
+    options_.max_message_size = header->slot_size - sizeof(Slot);
+    options_.capacity_messages = header->slot_count;
+    options_.capacity_bytes = header->slot_count * options_.max_message_size;
+    return header;
+}
+
+SharedMemory::Header* SharedMemory::Connect()
+{
+    Header* header = header_.load(std::memory_order_acquire);
+    if (header && !header->closed.load(std::memory_order_acquire))
+        return header;
+
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    // Another thread sharing the Node may have connected while this one waited for the lock
+    header = header_.load(std::memory_order_relaxed);
+    if (header && !header->closed.load(std::memory_order_acquire))
+        return header;
+
+    // The receiver removed or reclaimed the segment, or there was none yet, look the current one up
+    // A replaced mapping is kept until destruction, other threads may still be sending into it
+    Segment& segment = segments_.emplace_back();
+    if (!segment.Open(segment_name_)) {
+        segments_.pop_back();
+        XDEBG("kReceiver of Node '%s' (%s) does not exist", shm_name_.c_str(), segment_name_.c_str());
+        return nullptr;
+    }
+    header = Attach(segment);
+    if (!header || header->closed.load(std::memory_order_acquire)) {
+        // Still being initialized by the receiver, or already removed
+        segments_.pop_back();
+        return nullptr;
+    }
+    header_.store(header, std::memory_order_release);
+    XDEBG("kSender (SharedMemory) '%s' connected to %s", shm_name_.c_str(), segment_name_.c_str());
+    return header;
+}
+
+ChannelOptions SharedMemory::Options() const
+{
+    // Senders learn the layout when they connect
+    std::lock_guard<std::mutex> lock(connect_mutex_);
+    return options_;
+}
+
+SharedMemory::Slot* SharedMemory::TryClaim(Header* header, uint64_t& pos)
+{
+    pos = header->tail.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = SlotAt(header, pos);
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(seq - pos);
+        if (diff == 0) {
+            if (header->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                return slot;
+        } else if (diff < 0) {
+            // The slot still holds the message of the previous lap
+            return nullptr;
+        } else {
+            pos = header->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+SharedMemory::Slot* SharedMemory::TryConsume(Header* header, uint64_t& pos)
+{
+    // head is claimed with a CAS as senders evict messages too (kDropOldest)
+    pos = header->head.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = SlotAt(header, pos);
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(seq - (pos + 1));
+        if (diff == 0) {
+            if (header->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                return slot;
+        } else if (diff < 0) {
+            // Not published yet
+            return nullptr;
+        } else {
+            pos = header->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t SharedMemory::ReclaimExpired(Header* header)
+{
+    // Only from head, so the ring stays in order. With one ttl for all messages the oldest expire first
+    uint64_t reclaimed = 0;
+    uint64_t pos = header->head.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = SlotAt(header, pos);
+        if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+            break;
+        // The deadline may belong to a later lap if the receiver got there first, the CAS then fails
+        if (!Expired(slot->deadline.load(std::memory_order_relaxed)))
+            break;
+        if (!header->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            continue;
+        Release(header, slot, pos);
+        ++reclaimed;
+        ++pos;
+    }
+    if (reclaimed > 0)
+        header->expired.fetch_add(reclaimed, std::memory_order_relaxed);
+    return reclaimed;
+}
+
+void SharedMemory::Publish(Header* header, Slot* slot, uint64_t pos)
+{
+    slot->seq.store(pos + 1, std::memory_order_release);
+    Notify(header, header->data_seq, header->data_sleeping);
+}
+
+void SharedMemory::Release(Header* header, Slot* slot, uint64_t pos)
+{
+    slot->seq.store(pos + header->slot_count, std::memory_order_release);
+    Notify(header, header->space_seq, header->space_sleeping);
+}
+
+void SharedMemory::Notify(Header* header, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& sleeping)
+{
+    // Pairs with the fence in Sleep(): either the sleeper sees the slot, or this sees its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Only the first notifier of a burst takes the flag and pays for the syscall
+    if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(0, std::memory_order_acq_rel)) {
+        seq.fetch_add(1, std::memory_order_release);
+        header->wakeups.fetch_add(1, std::memory_order_relaxed);
+        FutexWake(&seq, INT_MAX);
+    }
+}
+
+template <typename Ready>
+bool SharedMemory::Sleep(Header* header, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& sleeping, Ready ready,
+    const struct timespec* timeout)
+{
+    // Read the futex word first, a wakeup after this point changes it and the wait returns at once
+    uint32_t current = seq.load(std::memory_order_acquire);
+    sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // The flag stays set if the re-check succeeds, which costs at most one spurious wakeup
+    if (ready())
+        return true;
+    header->sleeps.fetch_add(1, std::memory_order_relaxed);
+    FutexWait(&seq, current, timeout);
+    return false;
+}
+
+SendStatus SharedMemory::Claim(Header* header, Slot*& slot, uint64_t& pos)
+{
+    const auto deadline = std::chrono::steady_clock::now() + options_.send_timeout;
+    uint32_t spins = 0;
+
+    while (!(slot = TryClaim(header, pos))) {
+        if (header->closed.load(std::memory_order_acquire))
+            return SendStatus::kDisconnected;
+        // Messages nobody wants any more make room first, whatever the policy
+        if (ReclaimExpired(header) > 0)
+            continue;
+
+        switch (options_.backpressure) {
+        case BackpressurePolicy::kFailFast:
+            return SendStatus::kWouldBlock;
+        case BackpressurePolicy::kDropNewest:
+            return SendStatus::kDropped;
+        case BackpressurePolicy::kDropOldest: {
+            // Racing with the receiver is fine: an empty ring means there is room again
+            uint64_t oldest;
+            if (Slot* evicted = TryConsume(header, oldest))
+                Release(header, evicted, oldest);
+            break;
+        }
+        case BackpressurePolicy::kBlock:
+        case BackpressurePolicy::kTimeout: {
+            if (spins++ < options_.spin_budget) {
+                CpuRelax();
+                break;
+            }
+            auto ready = [&]() { return (slot = TryClaim(header, pos)) || header->closed.load(std::memory_order_acquire); };
+            if (options_.backpressure == BackpressurePolicy::kBlock) {
+                Sleep(header, header->space_seq, header->space_sleeping, ready, nullptr);
+            } else {
+                auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+                if (remaining.count() <= 0)
+                    return SendStatus::kTimedOut;
+                struct timespec timeout = { static_cast<time_t>(remaining.count() / 1000000000), static_cast<long>(remaining.count() % 1000000000) };
+                Sleep(header, header->space_seq, header->space_sleeping, ready, &timeout);
+            }
+            if (slot)
+                return SendStatus::kOk;
+            break;
+        }
+        default:
+            XASSERT_RETURN(true, SendStatus::kError, "Unknown BackpressurePolicy %d", static_cast<int>(options_.backpressure));
+        }
+    }
+    return SendStatus::kOk;
+}
+
+SharedMemory::Slot* SharedMemory::Wait(Header* header, uint64_t& pos)
+{
+    for (uint32_t spin = 0;; ++spin) {
+        if (Slot* slot = TryConsume(header, pos))
+            return slot;
+        // Spin before announcing the sleep, a consumer that keeps up never makes producers call into the kernel
+        if (options_.busy_poll || spin < options_.spin_budget) {
+            // Nobody wakes a spinning consumer, it has to notice the removal itself
+            if (header->closed.load(std::memory_order_acquire))
+                return nullptr;
+            CpuRelax();
+            continue;
+        }
+        Slot* slot = nullptr;
+        auto ready = [&]() { return (slot = TryConsume(header, pos)) || header->closed.load(std::memory_order_acquire); };
+        Sleep(header, header->data_seq, header->data_sleeping, ready, nullptr);
+        if (slot)
+            return slot;
+        if (header->closed.load(std::memory_order_acquire))
+            return nullptr;
+    }
+}
+
+SharedMemory::Slot* SharedMemory::Consume(Header* header, uint64_t& pos)
+{
+    while (Slot* slot = Wait(header, pos)) {
+        if (!Expired(slot->deadline.load(std::memory_order_relaxed)))
+            return slot;
+        Release(header, slot, pos);
+        header->expired.fetch_add(1, std::memory_order_relaxed);
+    }
+    return nullptr;
+}
+
+SendResult SharedMemory::Send(const void* data, size_t data_size)
+{
+    XASSERT_RETURN(!data, SendStatus::kError, "Data is null");
+
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult SharedMemory::SendV(const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, TtlTicks(options_.ttl));
+}
+
+SendResult SharedMemory::SendBefore(Deadline deadline, const iovec* iov, size_t iovcnt)
+{
+    return Post(iov, iovcnt, DeadlineTicks(deadline));
+}
+
+SendResult SharedMemory::Post(const iovec* iov, size_t iovcnt, uint64_t deadline)
+{
+    Header* header = Connect();
+    if (!header)
+        return SendStatus::kDisconnected;
+
+    size_t data_size = IovLength(iov, iovcnt);
+    const size_t max_message_size = header->slot_size - sizeof(Slot);
+    XASSERT_RETURN(data_size > max_message_size, SendStatus::kTooLarge,
+        "Data size %zu exceeds maximum message size %zu", data_size, max_message_size);
+
+    Slot* slot;
+    uint64_t pos;
+    SendStatus status = Claim(header, slot, pos);
+    if (status != SendStatus::kOk)
+        return status;
+
+    // Gather straight into the slot, this is the only copy on the sending side
+    slot->size = data_size;
+    slot->deadline.store(deadline, std::memory_order_relaxed);
+    IovGather(slot->data, iov, iovcnt);
+    Publish(header, slot, pos);
+    return SendStatus::kOk;
+}
+
+std::shared_ptr<Buffer> SharedMemory::Receive()
+{
+    Header* header = header_.load(std::memory_order_relaxed);
+    XASSERT_RETURN(!header, nullptr, "Shared memory is not initialized");
+
+    uint64_t pos;
+    Slot* slot = Consume(header, pos);
+    if (!slot) {
+        // Removed while waiting, which is how Dispatch() and other blocked receivers are stopped
+        XDEBG("Shared memory '%s' has been removed", shm_name_.c_str());
+        return nullptr;
+    }
+
+    const size_t size = slot->size;
+    auto result = std::make_shared<Buffer>(size);
+    if (result->Data())
+        memcpy(result->Data(), slot->data, size);
+    Release(header, slot, pos);
+    XASSERT_RETURN(!result->Data() && size > 0, nullptr, "Buffer allocation fail");
+    return result;
+}
+
+bool SharedMemory::ReceiveBuffer(Buffer& buffer)
+{
+    Header* header = header_.load(std::memory_order_relaxed);
+    XASSERT_RETURN(!header, false, "Shared memory is not initialized");
+
+    uint64_t pos;
+    Slot* slot = Consume(header, pos);
+    if (!slot) {
+        XDEBG("Shared memory '%s' has been removed", shm_name_.c_str());
+        return false;
+    }
+
+    const size_t size = slot->size;
+    buffer = Buffer(size);
+    if (buffer.Data())
+        memcpy(buffer.Data(), slot->data, size);
+    Release(header, slot, pos);
+    XASSERT_RETURN(!buffer.Data() && size > 0, false, "Buffer allocation fail");
+    return true;
+}
+
+bool SharedMemory::ReceiveV(const iovec* iov, size_t iovcnt, size_t& received_size)
+{
+    Header* header = header_.load(std::memory_order_relaxed);
+    XASSERT_RETURN(!header, false, "Shared memory is not initialized");
+
+    uint64_t pos;
+    Slot* slot = Consume(header, pos);
+    if (!slot) {
+        XDEBG("Shared memory '%s' has been removed", shm_name_.c_str());
+        return false;
+    }
+
+    received_size = slot->size;
+    bool scattered = IovScatter(iov, iovcnt, slot->data, slot->size);
+    Release(header, slot, pos);
+    XASSERT_RETURN(!scattered, false, "Message size %zu exceeds scatter capacity %zu", received_size, IovLength(iov, iovcnt));
+    return true;
+}
+
+ReceiveResult SharedMemory::ReceiveInto(void* dst, size_t capacity)
+{
+    Header* header = header_.load(std::memory_order_relaxed);
+    XASSERT_RETURN(!header, ReceiveStatus::kError, "Shared memory is not initialized");
+    if (parked_)
+        return TakeParked(dst, capacity);
+
+    uint64_t pos;
+    Slot* slot = Consume(header, pos);
+    if (!slot)
+        return ReceiveStatus::kClosed;
+
+    // Copy once from the slot, a message that does not fit has to leave the ring all the same
+    const size_t size = slot->size;
+    if (size <= capacity) {
+        memcpy(dst, slot->data, size);
+    } else {
+        parked_.emplace(size);
+        memcpy(parked_->Data(), slot->data, size);
+    }
+    Release(header, slot, pos);
+    return { size <= capacity ? ReceiveStatus::kOk : ReceiveStatus::kTooSmall, size };
+}
+
+bool SharedMemory::Remove()
+{
+    // A closed segment has been removed already, or reclaimed by a newer receiver that owns the name now
+    Header* header = header_.load(std::memory_order_relaxed);
+    if (node_type_ != NodeType::kReceiver || !header || header->closed.load(std::memory_order_acquire))
+        return true;
+
+    XDEBG("Removing shared memory '%s' (%s)", shm_name_.c_str(), segment_name_.c_str());
+    // Wake up everyone blocked on the channel so that they see it is closed
+    header->closed.store(1, std::memory_order_release);
+    header->space_seq.fetch_add(1, std::memory_order_release);
+    FutexWake(&header->space_seq, INT_MAX);
+    header->data_seq.fetch_add(1, std::memory_order_release);
+    FutexWake(&header->data_seq, INT_MAX);
+    // The mapping stays until destruction, threads still blocked in Receive() may be touching it
+    Segment::Unlink(segment_name_);
+    return true;
+}
+
+bool SharedMemory::Closed() const
+{
+    Header* header = header_.load(std::memory_order_acquire);
+    return header && header->closed.load(std::memory_order_acquire);
+}
+
+ChannelStats SharedMemory::Stats() const
+{
+    ChannelStats stats;
+    if (Header* header = header_.load(std::memory_order_acquire)) {
+        stats.page_size = header->page_size;
+        stats.wakeups = header->wakeups.load(std::memory_order_relaxed);
+        stats.sleeps = header->sleeps.load(std::memory_order_relaxed);
+        stats.expired = header->expired.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+} // namespace shm
+#endif // _WIN32
\ No newline at end of file
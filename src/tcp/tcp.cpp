@@ -0,0 +1,469 @@
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+
+#include "ipc/ipc.h"
+
+namespace ipc {
+
+static std::mutex endpoints_mutex;
+
+static std::unordered_map<std::string, std::string>& Endpoints()
+{
+    static std::unordered_map<std::string, std::string> endpoints;
+    return endpoints;
+}
+
+void MapEndpoint(const std::string& name, const std::string& endpoint)
+{
+    std::lock_guard<std::mutex> lock(endpoints_mutex);
+    Endpoints()[name] = endpoint;
+}
+
+// Endpoint of name from MapEndpoint(), then from the IPC_ENDPOINTS file, and the name itself otherwise
+static std::string ResolveEndpoint(const std::string& name)
+{
+    {
+        std::lock_guard<std::mutex> lock(endpoints_mutex);
+        auto it = Endpoints().find(name);
+        if (it != Endpoints().end())
+            return it->second;
+    }
+
+    const char* path = getenv("IPC_ENDPOINTS");
+    if (path) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string key, endpoint;
+            if (fields >> key >> endpoint && key == name)
+                return endpoint;
+        }
+    }
+    return name;
+}
+
+} // namespace ipc
+
+#ifndef _WIN32
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ipc/tcp/tcp.h"
+#include "utils/assert.h"
+#include "utils/iov.h"
+#include "utils/log.h"
+
+namespace tcp {
+
+static constexpr size_t HEADER_SIZE = 4;
+// How long a removed sender waits for its queued messages to leave
+static constexpr auto LINGER_TIMEOUT = std::chrono::seconds(1);
+
+// Senders of all Nodes in the process share one engine, and so one completion thread
+static std::shared_ptr<uring::Engine> SenderEngine()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<uring::Engine> shared;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto engine = shared.lock();
+    if (!engine) {
+        engine = std::make_shared<uring::Engine>();
+        shared = engine;
+    }
+    return engine;
+}
+
+// Split "host:port", the host of an IPv6 endpoint is enclosed in brackets
+static bool SplitEndpoint(const std::string& endpoint, std::string& host, std::string& port)
+{
+    size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos || colon + 1 == endpoint.size())
+        return false;
+    host = endpoint.substr(0, colon);
+    port = endpoint.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    return true;
+}
+
+static addrinfo* ResolveAddress(const std::string& endpoint, bool passive)
+{
+    std::string host, port;
+    if (!SplitEndpoint(endpoint, host, port)) {
+        XERRO("Endpoint '%s' is not of the form host:port", endpoint.c_str());
+        return nullptr;
+    }
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* result = nullptr;
+    int ret = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (ret != 0) {
+        XERRO("Failed to resolve endpoint '%s': %s", endpoint.c_str(), gai_strerror(ret));
+        return nullptr;
+    }
+    return result;
+}
+
+static void SetNoDelay(int fd)
+{
+    // Messages are complete when they are sent, do not hold them back for Nagle's algorithm
+    int one = 1;
+    XASSERT(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0, "Failed to set TCP_NODELAY");
+}
+
+TcpChannel::TcpChannel(const std::string& name, NodeType ntype, const ChannelOptions& options)
+    : name_(name)
+    , node_type_(ntype)
+    , options_(options)
+{
+    if (options_.max_message_size == 0)
+        options_.max_message_size = DEFAULT_MAX_MESSAGE_SIZE;
+    // The length prefix has 32 bits
+    options_.max_message_size = std::min<size_t>(options_.max_message_size, UINT32_MAX);
+    if (options_.capacity_bytes == 0)
+        options_.capacity_bytes = DEFAULT_CAPACITY_BYTES;
+    options_.capacity_bytes = std::max(options_.capacity_bytes, options_.max_message_size);
+    options_.capacity_messages = 0;
+    // Messages arrive through the engine thread, there is nothing to poll
+    options_.spin_budget = 0;
+    options_.busy_poll = false;
+    options_.shards = 1;
+    options_.shard_threads = false;
+
+    if (ntype == NodeType::kReceiver) {
+        // The receiver has a completion thread of its own, it stops reading while Receive falls behind
+        engine_ = std::make_shared<uring::Engine>();
+        XASSERT_EXIT(!Listen(), "Node '%s' failed to listen on %s", name_.c_str(), Endpoint(name_).c_str());
+        accept_thread_ = std::thread(&TcpChannel::AcceptLoop, this);
+    } else {
+        engine_ = SenderEngine();
+    }
+}
+
+TcpChannel::~TcpChannel()
+{
+    TcpChannel::Remove();
+}
+
+std::string TcpChannel::Endpoint(const std::string& name)
+{
+    return ipc::ResolveEndpoint(name);
+}
+
+bool TcpChannel::Listen()
+{
+    std::string endpoint = Endpoint(name_);
+    addrinfo* addresses = ResolveAddress(endpoint, true);
+    if (!addresses)
+        return false;
+
+    for (addrinfo* address = addresses; address && listen_fd_ < 0; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0)
+            continue;
+        // A restarted receiver can listen again while connections of the previous one linger in TIME_WAIT
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+            listen_fd_ = fd;
+        else
+            close(fd);
+    }
+    freeaddrinfo(addresses);
+    XASSERT_RETURN(listen_fd_ < 0, false, "Failed to bind %s", endpoint.c_str());
+
+    // Publish the port the system picked for port 0, so that senders in this process find it
+    sockaddr_storage bound;
+    socklen_t length = sizeof(bound);
+    XASSERT_RETURN(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&bound), &length) < 0, false, "getsockname fail");
+    uint16_t port = ntohs(bound.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+                                                      : reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+    std::string host, requested_port;
+    SplitEndpoint(endpoint, host, requested_port);
+    if (requested_port == "0") {
+        bool ipv6 = host.find(':') != std::string::npos;
+        MapEndpoint(name_, (ipv6 ? "[" + host + "]" : host) + ":" + std::to_string(port));
+    }
+    XDEBG("Node '%s' listening on port %u", name_.c_str(), port);
+    return true;
+}
+
+void TcpChannel::AcceptLoop()
+{
+    while (true) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Remove() shuts the listening socket down
+            std::lock_guard<std::mutex> lock(mutex_);
+            XASSERT(!removed_, "Node '%s' failed to accept connections", name_.c_str());
+            return;
+        }
+        SetNoDelay(fd);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (removed_) {
+                close(fd);
+                return;
+            }
+            connections_.emplace(fd, Connection());
+        }
+        // One multishot receive per connection, all of them completed on the engine thread
+        engine_->ReceiveStream(fd, [this, fd](const void* data, ssize_t size) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = connections_.find(fd);
+            if (size > 0 && it != connections_.end() && !it->second.broken) {
+                lock.unlock();
+                if (Consume(it->second, static_cast<const unsigned char*>(data), size))
+                    return;
+                lock.lock();
+            }
+            // The sender closed the connection or sent an invalid frame, the stream is over
+            if (size <= 0) {
+                connections_.erase(fd);
+                close(fd);
+            } else if (it != connections_.end() && !it->second.broken) {
+                it->second.broken = true;
+                shutdown(fd, SHUT_RDWR);
+            }
+        });
+        engine_->Flush();
+    }
+}
+
+bool TcpChannel::Consume(Connection& connection, const unsigned char* data, size_t size)
+{
+    while (size > 0) {
+        if (!connection.in_message) {
+            size_t part = std::min(HEADER_SIZE - connection.header_size, size);
+            memcpy(connection.header + connection.header_size, data, part);
+            connection.header_size += part;
+            data += part;
+            size -= part;
+            if (connection.header_size < HEADER_SIZE)
+                return true;
+
+            uint32_t length;
+            memcpy(&length, connection.header, HEADER_SIZE);
+            length = ntohl(length);
+            XASSERT_RETURN(length > options_.max_message_size, false,
+                "Node '%s' received a message of %u bytes, larger than the maximum %zu", name_.c_str(), length, options_.max_message_size);
+            connection.header_size = 0;
+            connection.in_message = true;
+            connection.message = Buffer(length);
+            connection.message_size = 0;
+        }
+
+        size_t part = std::min(connection.message.Size() - connection.message_size, size);
+        memcpy(static_cast<char*>(connection.message.Data()) + connection.message_size, data, part);
+        connection.message_size += part;
+        data += part;
+        size -= part;
+        if (connection.message_size == connection.message.Size()) {
+            connection.in_message = false;
+            Deliver(std::move(connection.message));
+        }
+    }
+    return true;
+}
+
+void TcpChannel::Deliver(Buffer message)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Stop reading while Receive falls behind, TCP flow control then throttles the senders
+    cond_.wait(lock, [this] { return pending_bytes_ < options_.capacity_bytes || removed_; });
+    if (removed_)
+        return;
+    pending_bytes_ += message.Size();
+    pending_.push_back(std::move(message));
+    cond_.notify_all();
+}
+
+bool TcpChannel::ReceiveBuffer(Buffer& message)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !pending_.empty() || removed_; });
+    if (pending_.empty())
+        return false;
+    message = std::move(pending_.front());
+    pending_.pop_front();
+    pending_bytes_ -= message.Size();
+    cond_.notify_all();
+    return true;
+}
+
+std::shared_ptr<Buffer> TcpChannel::Receive()
+{
+    Buffer message;
+    if (!ReceiveBuffer(message))
+        return nullptr;
+    return std::move(message).Share();
+}
+
+bool TcpChannel::Connect()
+{
+    std::string endpoint = Endpoint(name_);
+    addrinfo* addresses = ResolveAddress(endpoint, false);
+    if (!addresses)
+        return false;
+
+    for (addrinfo* address = addresses; address && fd_ < 0; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+            fd_ = fd;
+        else
+            close(fd);
+    }
+    freeaddrinfo(addresses);
+    if (fd_ < 0) {
+        XDEBG("Node '%s' failed to connect to %s: (%d)%s", name_.c_str(), endpoint.c_str(), errno, strerror(errno));
+        return false;
+    }
+    SetNoDelay(fd_);
+    broken_ = false;
+    return true;
+}
+
+void TcpChannel::Disconnect(std::unique_lock<std::mutex>& lock)
+{
+    int fd = fd_;
+    fd_ = -1;
+    // Cancel waits for the send callbacks, which take the lock
+    lock.unlock();
+    engine_->Cancel(fd);
+    close(fd);
+    lock.lock();
+}
+
+SendResult TcpChannel::Send(const void* data, size_t data_size)
+{
+    iovec iov = { const_cast<void*>(data), data_size };
+    return SendV(&iov, 1);
+}
+
+SendResult TcpChannel::SendV(const iovec* iov, size_t iovcnt)
+{
+    size_t size = IovLength(iov, iovcnt);
+    XASSERT_RETURN(size > options_.max_message_size, SendStatus::kTooLarge,
+        "Message size %zu exceeds the maximum %zu", size, options_.max_message_size);
+
+    // The engine sends asynchronously, so the message is copied behind its length prefix
+    // This happens before taking the lock, threads sharing the Node only serialize on the connection
+    Buffer frame(HEADER_SIZE + size);
+    XASSERT_RETURN(!frame.Data(), SendStatus::kError, "Failed to allocate a frame of %zu bytes", HEADER_SIZE + size);
+    uint32_t length = htonl(static_cast<uint32_t>(size));
+    memcpy(frame.Data(), &length, HEADER_SIZE);
+    IovGather(static_cast<char*>(frame.Data()) + HEADER_SIZE, iov, iovcnt);
+    auto shared = std::move(frame).Share();
+    iovec out = { shared->Data(), shared->Size() };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (removed_)
+        return SendStatus::kDisconnected;
+    if (fd_ >= 0 && broken_)
+        Disconnect(lock);
+    if (fd_ < 0 && !Connect())
+        return SendStatus::kDisconnected;
+
+    // Messages not sent yet count against the capacity, the kernel socket buffer comes on top
+    auto fits = [&] { return in_flight_ == 0 || in_flight_ + size <= options_.capacity_bytes || broken_ || removed_; };
+    if (!fits()) {
+        switch (options_.backpressure) {
+        case BackpressurePolicy::kFailFast:
+            return SendStatus::kWouldBlock;
+        case BackpressurePolicy::kDropNewest:
+        case BackpressurePolicy::kDropOldest: // Messages handed to the socket cannot be taken back
+            return SendStatus::kDropped;
+        case BackpressurePolicy::kBlock:
+            cond_.wait(lock, fits);
+            break;
+        case BackpressurePolicy::kTimeout:
+            if (!cond_.wait_for(lock, options_.send_timeout, fits))
+                return SendStatus::kTimedOut;
+            break;
+        default:
+            XASSERT_RETURN(true, SendStatus::kError, "Unknown BackpressurePolicy %d", static_cast<int>(options_.backpressure));
+        }
+    }
+    if (broken_ || removed_)
+        return SendStatus::kDisconnected;
+
+    in_flight_ += size;
+    bool queued = engine_->SendV(fd_, &out, 1, [this, shared, size](ssize_t result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_ -= size;
+        if (result < 0) {
+            XDEBG("Node '%s' lost its connection: (%zd)%s", name_.c_str(), -result, strerror(-result));
+            broken_ = true;
+        }
+        cond_.notify_all();
+    });
+    if (!queued) {
+        in_flight_ -= size;
+        return SendStatus::kError;
+    }
+    // Sends queued behind one in flight leave together once it completes
+    engine_->Flush();
+    return SendStatus::kOk;
+}
+
+bool TcpChannel::Closed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return removed_;
+}
+
+bool TcpChannel::Remove()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (removed_)
+        return true;
+
+    if (node_type_ == NodeType::kSender) {
+        // Give queued messages a chance to leave before the connection is closed
+        cond_.wait_for(lock, LINGER_TIMEOUT, [this] { return in_flight_ == 0 || broken_; });
+        removed_ = true;
+        if (fd_ >= 0)
+            Disconnect(lock);
+        cond_.notify_all();
+        return true;
+    }
+
+    removed_ = true;
+    cond_.notify_all();
+    lock.unlock();
+
+    // Wake the accept thread, then end every stream, their handlers close the connections
+    shutdown(listen_fd_, SHUT_RDWR);
+    if (accept_thread_.joinable())
+        accept_thread_.join();
+    close(listen_fd_);
+    listen_fd_ = -1;
+    engine_.reset();
+
+    lock.lock();
+    pending_.clear();
+    pending_bytes_ = 0;
+    return true;
+}
+
+} // namespace tcp
+#endif // _WIN32
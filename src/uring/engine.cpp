@@ -0,0 +1,904 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ipc/ipc.h"
+#include "ipc/uring/engine.h"
+#include "utils/assert.h"
+#include "utils/log.h"
+
+namespace uring {
+
+static constexpr unsigned RING_ENTRIES = 256;
+static constexpr unsigned STREAM_BUFFER_COUNT = 64; // Registered buffers per ring, a power of two
+static constexpr uint16_t BUFFER_GROUP = 0;
+
+struct Operation {
+    enum class Kind {
+        kSend,
+        kReceive,
+        kStream,
+    };
+    Kind kind;
+    int fd;
+
+    // kSend: the segments not sent yet, and the bytes sent so far
+    std::vector<iovec> iov;
+    msghdr msg {};
+    size_t transferred = 0;
+    Completion done;
+
+    // kReceive
+    void* data = nullptr;
+    size_t size = 0;
+
+    // kStream, buffer is only used when the engine does not provide the receive buffers
+    StreamHandler handler;
+    ipc::Buffer buffer;
+};
+
+// Skip sent bytes of the segments, returns true if there is more to send
+static bool Advance(Operation& op, size_t sent)
+{
+    op.transferred += sent;
+    auto it = op.iov.begin();
+    while (it != op.iov.end() && sent >= it->iov_len) {
+        sent -= it->iov_len;
+        ++it;
+    }
+    op.iov.erase(op.iov.begin(), it);
+    if (op.iov.empty())
+        return false;
+    op.iov[0].iov_base = static_cast<char*>(op.iov[0].iov_base) + sent;
+    op.iov[0].iov_len -= sent;
+    return true;
+}
+
+static bool Retry(int error)
+{
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+// A completion thread with the operations of its sockets
+class Engine::Worker {
+public:
+    virtual ~Worker() = default;
+
+    // Take ownership of op and queue it for the next Flush()
+    void Add(Operation* op)
+    {
+        {
+            std::lock_guard<std::mutex> lock(live_mutex_);
+            ++live_[op->fd];
+            ++live_total_;
+        }
+        Queue(op);
+    }
+
+    virtual void Flush() = 0;
+
+    // Cancel the operations on fd and wait until their callbacks have run
+    void Cancel(int fd)
+    {
+        {
+            std::lock_guard<std::mutex> lock(live_mutex_);
+            cancelling_.insert(fd);
+        }
+        RequestCancel(fd);
+        std::unique_lock<std::mutex> lock(live_mutex_);
+        live_cond_.wait(lock, [&] { return live_.count(fd) == 0; });
+        cancelling_.erase(fd);
+    }
+
+    // Whether stream receives use buffers of the worker instead of Operation::buffer
+    virtual bool ProvidesBuffers() const { return false; }
+
+    EngineStats Stats() const
+    {
+        EngineStats stats;
+        stats.submits = submits_.load(std::memory_order_relaxed);
+        stats.operations = operations_.load(std::memory_order_relaxed);
+        stats.completions = completions_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+protected:
+    std::atomic<uint64_t> submits_ { 0 };
+    std::atomic<uint64_t> operations_ { 0 };
+    std::atomic<uint64_t> completions_ { 0 };
+
+    virtual void Queue(Operation* op) = 0;
+    // Make the operations on fd complete with -ECANCELED, possibly later on the worker thread
+    virtual void RequestCancel(int fd) = 0;
+
+    bool Cancelling(int fd)
+    {
+        std::lock_guard<std::mutex> lock(live_mutex_);
+        return cancelling_.count(fd) != 0;
+    }
+
+    size_t Live()
+    {
+        std::lock_guard<std::mutex> lock(live_mutex_);
+        return live_total_;
+    }
+
+    // Run the final callback of op with result and release it
+    void Complete(Operation* op, ssize_t result)
+    {
+        if (op->kind == Operation::Kind::kStream)
+            op->handler(nullptr, result);
+        else
+            op->done(result);
+
+        int fd = op->fd;
+        delete op;
+        completions_.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(live_mutex_);
+        --live_total_;
+        if (--live_[fd] == 0) {
+            live_.erase(fd);
+            live_cond_.notify_all();
+        }
+    }
+
+private:
+    std::mutex live_mutex_;
+    std::condition_variable live_cond_;
+    std::unordered_map<int, size_t> live_; // Operations not completed yet, per socket
+    size_t live_total_ = 0;
+    std::unordered_set<int> cancelling_;
+};
+
+// io_uring instance driven through the raw system calls
+// Submissions come from any thread under sq_mutex_, completions are reaped by the worker thread only
+class RingWorker : public Engine::Worker {
+public:
+    RingWorker() = default;
+    ~RingWorker();
+
+    // Returns false if the kernel does not allow io_uring
+    bool Setup();
+    void Flush() override;
+    bool ProvidesBuffers() const override { return provided_buffers_; }
+
+protected:
+    void Queue(Operation* op) override;
+    void RequestCancel(int fd) override;
+
+private:
+    int ring_fd_ = -1;
+    void* sq_ring_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = MAP_FAILED;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    std::mutex sq_mutex_;
+    unsigned queued_ = 0; // Entries written to the SQ but not submitted yet
+    bool stopping_ = false;
+    // Sends of a socket, queued sends go out together in a single sendmsg(2) once the previous one
+    // has completed, so that their bytes cannot interleave
+    struct SendQueue {
+        std::deque<Operation*> ops;
+        size_t in_flight = 0; // Operations at the front covered by the sendmsg in flight
+        std::vector<iovec> iov;
+        msghdr msg {};
+    };
+    std::unordered_map<int, SendQueue> sends_;
+    std::vector<int> ready_sends_; // Sockets with queued sends and none in flight
+
+    // Registered buffers of the stream receives, taken from the buffer pool
+    // Used as a plain array, io_uring_buf_ring does not have the kernel layout in C++
+    io_uring_buf* buf_ring_ = static_cast<io_uring_buf*>(MAP_FAILED);
+    size_t buf_ring_size_ = 0;
+    std::vector<ipc::Buffer> buffers_;
+    bool provided_buffers_ = false;
+    // Cleared by the worker thread when the kernel rejects multishot receives, read by Prepare() in any thread
+    std::atomic<bool> multishot_ { false };
+
+    std::thread thread_;
+
+    bool SetupBuffers();
+    // Hand a buffer back to the kernel, only called by the worker thread once set up
+    void Provide(uint16_t bid);
+
+    // Next free SQ entry, called with sq_mutex_ held
+    io_uring_sqe* NextSqe();
+    void Prepare(io_uring_sqe* sqe, Operation* op);
+    void Push();
+    void SubmitLocked();
+    // Queue and submit an operation again from the worker thread, returns false if it has to be cancelled
+    bool Resubmit(Operation* op);
+    // Queue one sendmsg(2) for the sends of fd, called with sq_mutex_ held
+    void StartSends(int fd);
+    void StartReadySends();
+
+    void Run();
+    void Reap(Operation* op, int res, unsigned flags);
+    void ReapSends(int fd, int res);
+};
+
+// user_data of sendmsg(2) entries, the socket tagged with a bit no Operation pointer has
+static constexpr uint64_t SEND_TAG = 1;
+
+
+bool RingWorker::Setup()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    if (ring_fd_ < 0) {
+        XDEBG("io_uring_setup failed: (%d)%s", errno, strerror(errno));
+        return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    XASSERT_RETURN(sq_ring_ == MAP_FAILED, false, "Failed to map the io_uring submission queue");
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        XASSERT_RETURN(cq_ring_ == MAP_FAILED, false, "Failed to map the io_uring completion queue");
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    XASSERT_RETURN(sqes_ == MAP_FAILED, false, "Failed to map the io_uring submission entries");
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    // SQ entries are used in ring order, the indirection array is the identity
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i)
+        array[i] = i;
+
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    provided_buffers_ = SetupBuffers();
+    multishot_.store(provided_buffers_, std::memory_order_relaxed);
+    thread_ = std::thread(&RingWorker::Run, this);
+    XDEBG("io_uring with %u entries, %s stream receives", sq_entries_, multishot_.load(std::memory_order_relaxed) ? "multishot" : "single shot");
+    return true;
+}
+
+bool RingWorker::SetupBuffers()
+{
+    // Provided buffer rings need Linux 5.19, older kernels receive into a buffer per operation
+    buf_ring_size_ = STREAM_BUFFER_COUNT * sizeof(io_uring_buf);
+    buf_ring_ = static_cast<io_uring_buf*>(mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    XASSERT_RETURN(buf_ring_ == MAP_FAILED, false, "Failed to map the io_uring buffer ring");
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = STREAM_BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        XDEBG("Provided buffer rings are not supported: (%d)%s", errno, strerror(errno));
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = static_cast<io_uring_buf*>(MAP_FAILED);
+        return false;
+    }
+
+    buffers_.reserve(STREAM_BUFFER_COUNT);
+    for (uint16_t bid = 0; bid < STREAM_BUFFER_COUNT; ++bid) {
+        buffers_.emplace_back(Engine::STREAM_BUFFER_SIZE);
+        Provide(bid);
+    }
+    return true;
+}
+
+void RingWorker::Provide(uint16_t bid)
+{
+    // The tail overlays the reserved field of the first entry, so entries are written field by field
+    uint16_t* tail = &buf_ring_[0].resv;
+    io_uring_buf& buf = buf_ring_[*tail & (STREAM_BUFFER_COUNT - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_[bid].Data());
+    buf.len = static_cast<uint32_t>(buffers_[bid].Size());
+    buf.bid = bid;
+    __atomic_store_n(tail, static_cast<uint16_t>(*tail + 1), __ATOMIC_RELEASE);
+}
+
+RingWorker::~RingWorker()
+{
+    if (thread_.joinable()) {
+        {
+            // Cancel everything in flight, the worker thread exits once all operations have completed
+            std::lock_guard<std::mutex> lock(sq_mutex_);
+            stopping_ = true;
+            StartReadySends();
+            io_uring_sqe* sqe = NextSqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+                Push();
+            }
+            SubmitLocked();
+        }
+        thread_.join();
+    }
+
+    if (buf_ring_ != MAP_FAILED)
+        munmap(buf_ring_, buf_ring_size_);
+    if (sqes_ != MAP_FAILED)
+        munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+        munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+}
+
+io_uring_sqe* RingWorker::NextSqe()
+{
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        // Full, hand the queued entries to the kernel to make room
+        SubmitLocked();
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+            return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void RingWorker::Prepare(io_uring_sqe* sqe, Operation* op)
+{
+    sqe->fd = op->fd;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+    switch (op->kind) {
+    case Operation::Kind::kSend:
+        break; // Sent through SendQueue
+    case Operation::Kind::kReceive:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = reinterpret_cast<uint64_t>(op->data);
+        sqe->len = static_cast<uint32_t>(op->size);
+        break;
+    case Operation::Kind::kStream:
+        sqe->opcode = IORING_OP_RECV;
+        if (provided_buffers_) {
+            // The kernel picks a registered buffer for every chunk it receives
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = BUFFER_GROUP;
+            sqe->ioprio = multishot_.load(std::memory_order_relaxed) ? IORING_RECV_MULTISHOT : 0;
+        } else {
+            sqe->addr = reinterpret_cast<uint64_t>(op->buffer.Data());
+            sqe->len = static_cast<uint32_t>(op->buffer.Size());
+        }
+        break;
+    }
+}
+
+void RingWorker::Push()
+{
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+    ++queued_;
+}
+
+void RingWorker::SubmitLocked()
+{
+    while (queued_ > 0) {
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, queued_, 0, 0, nullptr, 0));
+        submits_.fetch_add(1, std::memory_order_relaxed);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        // EAGAIN and EBUSY leave the entries queued for the next submission
+        XASSERT_RETURN(ret <= 0, , "Failed to submit %u io_uring entries", queued_);
+        queued_ -= ret;
+        operations_.fetch_add(ret, std::memory_order_relaxed);
+    }
+}
+
+void RingWorker::Queue(Operation* op)
+{
+    std::unique_lock<std::mutex> lock(sq_mutex_);
+    if (op->kind == Operation::Kind::kSend) {
+        SendQueue& sends = sends_[op->fd];
+        sends.ops.push_back(op);
+        if (sends.ops.size() == 1)
+            ready_sends_.push_back(op->fd);
+        return;
+    }
+    io_uring_sqe* sqe = NextSqe();
+    if (sqe) {
+        Prepare(sqe, op);
+        Push();
+        return;
+    }
+    lock.unlock();
+    XERRO("The io_uring submission queue is full");
+    Complete(op, -EBUSY);
+}
+
+void RingWorker::StartSends(int fd)
+{
+    SendQueue& sends = sends_[fd];
+    io_uring_sqe* sqe = NextSqe();
+    XASSERT_RETURN(!sqe, , "The io_uring submission queue is full");
+
+    // Gather the segments of as many queued sends as one sendmsg(2) takes
+    sends.iov.clear();
+    sends.in_flight = 0;
+    for (Operation* op : sends.ops) {
+        if (sends.in_flight > 0 && sends.iov.size() + op->iov.size() > IOV_MAX)
+            break;
+        sends.iov.insert(sends.iov.end(), op->iov.begin(), op->iov.end());
+        ++sends.in_flight;
+    }
+    sends.msg.msg_iov = sends.iov.data();
+    sends.msg.msg_iovlen = std::min<size_t>(sends.iov.size(), IOV_MAX);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&sends.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = static_cast<uint64_t>(fd) << 1 | SEND_TAG;
+    Push();
+}
+
+void RingWorker::StartReadySends()
+{
+    for (int fd : ready_sends_)
+        StartSends(fd);
+    ready_sends_.clear();
+}
+
+void RingWorker::Flush()
+{
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    StartReadySends();
+    SubmitLocked();
+}
+
+void RingWorker::RequestCancel(int fd)
+{
+    // Queued operations of fd are submitted ahead of the cancellation, so it covers them as well
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    StartReadySends();
+    io_uring_sqe* sqe = NextSqe();
+    XASSERT_RETURN(!sqe, , "The io_uring submission queue is full");
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    Push();
+    SubmitLocked();
+}
+
+bool RingWorker::Resubmit(Operation* op)
+{
+    if (Cancelling(op->fd))
+        return false;
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    if (stopping_)
+        return false;
+    io_uring_sqe* sqe = NextSqe();
+    if (!sqe)
+        return false;
+    Prepare(sqe, op);
+    Push();
+    SubmitLocked();
+    return true;
+}
+
+void RingWorker::Run()
+{
+    while (true) {
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        XASSERT_RETURN(ret < 0 && errno != EINTR, , "Failed to wait for io_uring completions");
+
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+            // Cancellation requests carry no operation
+            if (cqe.user_data & SEND_TAG)
+                ReapSends(static_cast<int>(cqe.user_data >> 1), cqe.res);
+            else if (cqe.user_data)
+                Reap(reinterpret_cast<Operation*>(cqe.user_data), cqe.res, cqe.flags);
+        }
+
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        if (stopping_ && Live() == 0)
+            return;
+    }
+}
+
+void RingWorker::Reap(Operation* op, int res, unsigned flags)
+{
+    switch (op->kind) {
+    case Operation::Kind::kSend:
+        return; // Completed by ReapSends
+
+    case Operation::Kind::kReceive:
+        Complete(op, res);
+        return;
+
+    case Operation::Kind::kStream:
+        if (flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (res > 0)
+                op->handler(buffers_[bid].Data(), res);
+            Provide(bid);
+        } else if (res > 0) {
+            op->handler(op->buffer.Data(), res);
+        }
+        // A multishot receive stays armed as long as the kernel says so
+        if (flags & IORING_CQE_F_MORE)
+            return;
+        if (res == -EINVAL && multishot_.load(std::memory_order_relaxed)) {
+            XWARN("Multishot receive is not supported, falling back to single shot receives");
+            multishot_.store(false, std::memory_order_relaxed);
+        } else if (res <= 0 && res != -ENOBUFS) {
+            Complete(op, res);
+            return;
+        }
+        if (!Resubmit(op))
+            Complete(op, -ECANCELED);
+        return;
+    }
+}
+
+void RingWorker::ReapSends(int fd, int res)
+{
+    // Sends to complete, with their results
+    std::vector<std::pair<Operation*, ssize_t>> completed;
+    bool cancelling = Cancelling(fd);
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        SendQueue& sends = sends_[fd];
+        // Stream sockets may send only part of the data, the rest is sent again
+        size_t sent = res > 0 ? res : 0;
+        for (size_t i = 0; i < sends.in_flight; ++i) {
+            Operation* op = sends.ops.front();
+            if (res < 0) {
+                completed.emplace_back(op, res);
+            } else {
+                size_t length = 0;
+                for (const iovec& segment : op->iov)
+                    length += segment.iov_len;
+                size_t part = std::min(sent, length);
+                sent -= part;
+                if (Advance(*op, part))
+                    break;
+                completed.emplace_back(op, op->transferred);
+            }
+            sends.ops.pop_front();
+        }
+        sends.in_flight = 0;
+
+        if (cancelling || stopping_) {
+            for (Operation* op : sends.ops)
+                completed.emplace_back(op, -ECANCELED);
+            sends.ops.clear();
+        }
+        if (sends.ops.empty()) {
+            sends_.erase(fd);
+        } else {
+            StartSends(fd);
+            SubmitLocked();
+        }
+    }
+
+    for (auto& [op, result] : completed)
+        Complete(op, result);
+}
+
+// poll(2) loop for kernels or sandboxes without io_uring
+// Operations are performed with non-blocking calls once their sockets are ready
+class PollWorker : public Engine::Worker {
+public:
+    PollWorker() = default;
+    ~PollWorker();
+
+    bool Setup();
+    void Flush() override;
+
+protected:
+    void Queue(Operation* op) override;
+    void RequestCancel(int fd) override;
+
+private:
+    int wake_fd_ = -1; // eventfd interrupting poll(2) when there is work for the thread
+    std::mutex mutex_;
+    std::vector<Operation*> queued_; // Waiting for Flush()
+    std::vector<Operation*> submitted_; // Waiting for the thread to pick them up
+    std::vector<int> cancels_;
+    bool stopping_ = false;
+    std::thread thread_;
+
+    void Wake();
+    void Run();
+    // Try op on its ready socket, returns true once it has completed
+    bool Perform(Operation* op);
+};
+
+bool PollWorker::Setup()
+{
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    XASSERT_RETURN(wake_fd_ < 0, false, "Failed to create an eventfd");
+    thread_ = std::thread(&PollWorker::Run, this);
+    return true;
+}
+
+PollWorker::~PollWorker()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            submitted_.insert(submitted_.end(), queued_.begin(), queued_.end());
+            queued_.clear();
+        }
+        Wake();
+        thread_.join();
+    }
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+}
+
+void PollWorker::Queue(Operation* op)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_.push_back(op);
+}
+
+void PollWorker::Flush()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queued_.empty())
+            return;
+        submitted_.insert(submitted_.end(), queued_.begin(), queued_.end());
+        queued_.clear();
+    }
+    Wake();
+}
+
+void PollWorker::RequestCancel(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        submitted_.insert(submitted_.end(), queued_.begin(), queued_.end());
+        queued_.clear();
+        cancels_.push_back(fd);
+    }
+    Wake();
+}
+
+void PollWorker::Wake()
+{
+    uint64_t one = 1;
+    XASSERT(write(wake_fd_, &one, sizeof(one)) < 0, "Failed to wake up the poll thread");
+    submits_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PollWorker::Run()
+{
+    std::vector<Operation*> active;
+    std::vector<pollfd> fds;
+    while (true) {
+        std::vector<int> cancels;
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            operations_.fetch_add(submitted_.size(), std::memory_order_relaxed);
+            active.insert(active.end(), submitted_.begin(), submitted_.end());
+            submitted_.clear();
+            cancels.swap(cancels_);
+            stopping = stopping_;
+        }
+
+        for (auto it = active.begin(); it != active.end();) {
+            if (stopping || std::find(cancels.begin(), cancels.end(), (*it)->fd) != cancels.end()) {
+                Complete(*it, -ECANCELED);
+                it = active.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (stopping)
+            return;
+
+        fds.assign(1, pollfd { wake_fd_, POLLIN, 0 });
+        for (Operation* op : active)
+            fds.push_back(pollfd { op->fd, static_cast<short>(op->kind == Operation::Kind::kSend ? POLLOUT : POLLIN), 0 });
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            XASSERT_RETURN(errno != EINTR, , "Failed to poll %zu sockets", active.size());
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            UNUSED(read(wake_fd_, &count, sizeof(count)));
+        }
+
+        // Sends of a socket go out in order, a send waits until those before it have completed
+        std::unordered_set<int> blocked;
+        for (size_t i = 0; i < active.size(); ++i) {
+            Operation* op = active[i];
+            bool send = op->kind == Operation::Kind::kSend;
+            if (send && blocked.count(op->fd))
+                continue;
+            if (fds[i + 1].revents && Perform(op))
+                active[i] = nullptr;
+            else if (send)
+                blocked.insert(op->fd);
+        }
+        active.erase(std::remove(active.begin(), active.end(), nullptr), active.end());
+    }
+}
+
+bool PollWorker::Perform(Operation* op)
+{
+    ssize_t ret;
+    switch (op->kind) {
+    case Operation::Kind::kSend:
+        op->msg.msg_iov = op->iov.data();
+        op->msg.msg_iovlen = op->iov.size();
+        ret = sendmsg(op->fd, &op->msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0 && Retry(errno))
+            return false;
+        if (ret >= 0 && Advance(*op, ret))
+            return false;
+        Complete(op, ret < 0 ? -errno : static_cast<ssize_t>(op->transferred));
+        return true;
+
+    case Operation::Kind::kReceive:
+        ret = recv(op->fd, op->data, op->size, MSG_DONTWAIT);
+        if (ret < 0 && Retry(errno))
+            return false;
+        Complete(op, ret < 0 ? -errno : ret);
+        return true;
+
+    case Operation::Kind::kStream:
+        ret = recv(op->fd, op->buffer.Data(), op->buffer.Size(), MSG_DONTWAIT);
+        if (ret > 0) {
+            op->handler(op->buffer.Data(), ret);
+            return false;
+        }
+        if (ret < 0 && Retry(errno))
+            return false;
+        Complete(op, ret < 0 ? -errno : 0);
+        return true;
+    }
+    return false;
+}
+
+Engine::Engine(size_t threads, bool use_io_uring)
+{
+    threads = std::max<size_t>(threads, 1);
+    if (use_io_uring) {
+        for (size_t i = 0; i < threads; ++i) {
+            auto worker = std::make_unique<RingWorker>();
+            if (!worker->Setup()) {
+                workers_.clear();
+                break;
+            }
+            workers_.push_back(std::move(worker));
+        }
+        io_uring_ = !workers_.empty();
+        if (!io_uring_)
+            XWARN("io_uring is not available, falling back to poll");
+    }
+
+    if (!io_uring_) {
+        for (size_t i = 0; i < threads; ++i) {
+            auto worker = std::make_unique<PollWorker>();
+            XASSERT_EXIT(!worker->Setup(), "Failed to start a poll thread");
+            workers_.push_back(std::move(worker));
+        }
+    }
+}
+
+Engine::~Engine()
+{
+    workers_.clear();
+}
+
+bool Engine::SendV(int fd, const iovec* iov, size_t iovcnt, Completion done)
+{
+    XASSERT_RETURN(fd < 0, false, "Invalid socket %d", fd);
+    Operation* op = new Operation();
+    op->kind = Operation::Kind::kSend;
+    op->fd = fd;
+    op->iov.assign(iov, iov + iovcnt);
+    op->done = std::move(done);
+    WorkerOf(fd).Add(op);
+    return true;
+}
+
+bool Engine::Receive(int fd, void* data, size_t size, Completion done)
+{
+    XASSERT_RETURN(fd < 0, false, "Invalid socket %d", fd);
+    Operation* op = new Operation();
+    op->kind = Operation::Kind::kReceive;
+    op->fd = fd;
+    op->data = data;
+    op->size = size;
+    op->done = std::move(done);
+    WorkerOf(fd).Add(op);
+    return true;
+}
+
+bool Engine::ReceiveStream(int fd, StreamHandler handler)
+{
+    XASSERT_RETURN(fd < 0, false, "Invalid socket %d", fd);
+    Operation* op = new Operation();
+    op->kind = Operation::Kind::kStream;
+    op->fd = fd;
+    op->handler = std::move(handler);
+    if (!WorkerOf(fd).ProvidesBuffers())
+        op->buffer = ipc::Buffer(STREAM_BUFFER_SIZE);
+    WorkerOf(fd).Add(op);
+    return true;
+}
+
+void Engine::Cancel(int fd)
+{
+    if (fd >= 0)
+        WorkerOf(fd).Cancel(fd);
+}
+
+void Engine::Flush()
+{
+    for (auto& worker : workers_)
+        worker->Flush();
+}
+
+EngineStats Engine::Stats() const
+{
+    EngineStats stats;
+    for (auto& worker : workers_) {
+        EngineStats worker_stats = worker->Stats();
+        stats.submits += worker_stats.submits;
+        stats.operations += worker_stats.operations;
+        stats.completions += worker_stats.completions;
+    }
+    return stats;
+}
+
+} // namespace uring
+#endif // _WIN32
@@ -0,0 +1,93 @@
+#ifndef _WIN32
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "test_utils.h"
+
+using namespace ipc;
+
+static void blob_loop(ipc::ChannelType type)
+{
+    ipc::ChannelOptions options;
+    options.blob_threshold = 4096;
+    options.blob_arena_bytes = 16 * 1024 * 1024;
+    ipc::Node server_node("blob_loop", ipc::NodeType::kReceiver, type, options);
+    ipc::Node client_node("blob_loop", ipc::NodeType::kSender, type, options);
+    EXPECT_GE(server_node.Options().max_message_size, 8u * 1024 * 1024);
+
+    // Small messages travel inline, large ones far beyond the limit of the transport as descriptors
+    const size_t sizes[] = { 0, 5, 4095, 4096, 100000, 1024 * 1024, 8 * 1024 * 1024 };
+    std::thread client_thread([&]() {
+        for (int round = 0; round < 3; ++round) {
+            for (size_t size : sizes) {
+                std::vector<char> msg = Pattern(size, round);
+                EXPECT_TRUE(client_node.Send(msg.data(), msg.size()));
+            }
+        }
+    });
+    for (int round = 0; round < 3; ++round) {
+        for (size_t size : sizes) {
+            Buffer rec;
+            ASSERT_TRUE(server_node.Receive(rec));
+            ASSERT_EQ(rec.Size(), size);
+            std::vector<char> expected = Pattern(size, round);
+            EXPECT_EQ(memcmp(rec.Data(), expected.data(), size), 0);
+        }
+    }
+    client_thread.join();
+
+    std::vector<char> too_large(client_node.Options().max_message_size + 1);
+    EXPECT_EQ(client_node.Send(too_large.data(), too_large.size()), SendStatus::kTooLarge);
+}
+
+void blob_release()
+{
+    // Four blocks fill the arena, the last reader of a blob frees its block
+    ipc::ChannelOptions options;
+    options.blob_threshold = 4096;
+    options.blob_arena_bytes = 1024 * 1024;
+    options.backpressure = ipc::BackpressurePolicy::kFailFast;
+    ipc::Node server_node("blob_release", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    ipc::Node client_node("blob_release", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+
+    std::vector<char> msg = Pattern(200 * 1024, 7);
+    for (int i = 0; i < 4; ++i)
+        ASSERT_TRUE(client_node.Send(msg.data(), msg.size()));
+    EXPECT_EQ(client_node.Send(msg.data(), msg.size()), SendStatus::kWouldBlock);
+
+    std::shared_ptr<Buffer> first = server_node.Receive();
+    ASSERT_TRUE(first);
+    ASSERT_EQ(first->Size(), msg.size());
+    EXPECT_EQ(memcmp(first->Data(), msg.data(), msg.size()), 0);
+    std::shared_ptr<Buffer> reader = first;
+    first.reset();
+    EXPECT_EQ(client_node.Send(msg.data(), msg.size()), SendStatus::kWouldBlock);
+    reader.reset();
+    ASSERT_TRUE(client_node.Send(msg.data(), msg.size()));
+
+    // Blobs outlive the Node they were received from
+    Buffer kept;
+    ASSERT_TRUE(server_node.Receive(kept));
+    server_node.Remove();
+    EXPECT_EQ(memcmp(kept.Data(), msg.data(), msg.size()), 0);
+}
+
+TEST(BLOB, loop)
+{
+    blob_loop(ipc::ChannelType::kMessageQueue);
+}
+
+TEST(BLOB, shm)
+{
+    blob_loop(ipc::ChannelType::kSharedMemory);
+}
+
+TEST(BLOB, release)
+{
+    blob_release();
+}
+#endif // _WIN32
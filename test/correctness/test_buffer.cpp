@@ -0,0 +1,85 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+#include <utility>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+void buffer_storage()
+{
+    // Small payloads live inside the Buffer, larger ones in pool blocks or on the heap
+    for (size_t size : { size_t(0), size_t(100), Buffer::INLINE_CAPACITY, size_t(1000), size_t(64 * 1024), size_t(1 << 20) }) {
+        Buffer buffer(size);
+        ASSERT_TRUE(buffer.Data() || size == 0);
+        EXPECT_EQ(buffer.Size(), size);
+        EXPECT_GE(buffer.Capacity(), size);
+        memset(buffer.Data(), 0x5a, size);
+
+        // Moving keeps the payload and empties the source
+        Buffer moved(std::move(buffer));
+        EXPECT_EQ(moved.Size(), size);
+        EXPECT_EQ(buffer.Size(), 0u);
+        for (size_t i = 0; i < size; i += 97)
+            EXPECT_EQ(static_cast<unsigned char*>(moved.Data())[i], 0x5a);
+
+        auto shared = std::move(moved).Share();
+        EXPECT_EQ(shared->Size(), size);
+    }
+
+    // Memory from malloc() is adopted
+    const char* msg = "Hello, IPC!";
+    Buffer adopted(strdup(msg), strlen(msg) + 1);
+    EXPECT_STREQ(static_cast<const char*>(adopted.Data()), msg);
+}
+
+void buffer_pool_reuse()
+{
+    // A released pool block is handed out again for the next payload of its size class
+    void* first;
+    {
+        Buffer buffer(1000);
+        first = buffer.Data();
+    }
+    Buffer buffer(1000);
+    EXPECT_EQ(buffer.Data(), first);
+}
+
+void buffer_receive(ChannelType ctype, const char* name)
+{
+    ipc::Node server_node(name, ipc::NodeType::kReceiver, ctype);
+    ipc::Node client_node(name, ipc::NodeType::kSender, ctype);
+
+    const char* small = "Hello, IPC!";
+    char large[3000];
+    memset(large, 'x', sizeof(large));
+    EXPECT_TRUE(client_node.Send(small, strlen(small) + 1));
+    EXPECT_TRUE(client_node.Send(large, sizeof(large)));
+
+    Buffer message;
+    ASSERT_TRUE(server_node.Receive(message));
+    EXPECT_STREQ(static_cast<const char*>(message.Data()), small);
+    // Receiving again replaces the payload
+    ASSERT_TRUE(server_node.Receive(message));
+    ASSERT_EQ(message.Size(), sizeof(large));
+    EXPECT_EQ(memcmp(message.Data(), large, sizeof(large)), 0);
+}
+
+TEST(BUFFER, storage)
+{
+    buffer_storage();
+}
+
+TEST(BUFFER, pool_reuse)
+{
+    buffer_pool_reuse();
+}
+
+TEST(BUFFER, receive)
+{
+    buffer_receive(ChannelType::kMessageQueue, "buffer_receive");
+#ifndef _WIN32
+    buffer_receive(ChannelType::kSharedMemory, "buffer_receive_shm");
+#endif
+}
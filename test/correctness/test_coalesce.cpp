@@ -0,0 +1,148 @@
+#ifndef _WIN32
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/coalesce/coalesce.h"
+#include "ipc/ipc.h"
+#include "ipc/shm/shm.h"
+#include "ipc/static_node.h"
+
+using namespace ipc;
+
+static void coalesce_loop(ipc::ChannelType type)
+{
+    ipc::ChannelOptions options;
+    options.coalesce_bytes = 4096;
+    options.coalesce_delay = std::chrono::microseconds(100);
+    ipc::Node server_node("coalesce_loop", ipc::NodeType::kReceiver, type, options);
+    ipc::Node client_node("coalesce_loop", ipc::NodeType::kSender, type, options);
+
+    // Messages of every size come out one by one and in order, frames are sent when full or due
+    const int count = 2000;
+    std::thread client_thread([&]() {
+        for (int i = 0; i < count; ++i) {
+            std::string msg(i % 300, static_cast<char>('a' + i % 26));
+            msg += std::to_string(i);
+            EXPECT_TRUE(client_node.Send(msg.data(), msg.size()));
+        }
+    });
+    for (int i = 0; i < count; ++i) {
+        Buffer rec;
+        ASSERT_TRUE(server_node.Receive(rec));
+        std::string expected(i % 300, static_cast<char>('a' + i % 26));
+        expected += std::to_string(i);
+        ASSERT_EQ(rec.Size(), expected.size());
+        EXPECT_EQ(memcmp(rec.Data(), expected.data(), rec.Size()), 0);
+    }
+    client_thread.join();
+
+    // A message that fills a frame is sent on its own
+    std::vector<char> large(client_node.Options().max_message_size, 'x');
+    ASSERT_TRUE(client_node.Send(large.data(), large.size()));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_EQ(rec->Size(), large.size());
+
+    std::vector<char> too_large(client_node.Options().max_message_size + 1);
+    EXPECT_EQ(client_node.Send(too_large.data(), too_large.size()), SendStatus::kTooLarge);
+}
+
+void coalesce_flush()
+{
+    // The timer would hold the messages for a minute, Flush() sends them right away
+    ipc::ChannelOptions options;
+    options.coalesce_bytes = 4096;
+    options.coalesce_delay = std::chrono::minutes(1);
+    ipc::Node server_node("coalesce_flush", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    ipc::Node client_node("coalesce_flush", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+
+    const char* msgs[] = { "Hello", "", "IPC!" };
+    std::atomic<bool> received { false };
+    std::thread server_thread([&]() {
+        for (const char* msg : msgs) {
+            auto rec = server_node.Receive();
+            received = true;
+            ASSERT_TRUE(rec);
+            ASSERT_EQ(rec->Size(), strlen(msg));
+            EXPECT_EQ(memcmp(rec->Data(), msg, rec->Size()), 0);
+        }
+    });
+    for (const char* msg : msgs)
+        ASSERT_TRUE(client_node.Send(msg, strlen(msg)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(received);
+    ASSERT_TRUE(client_node.Flush());
+    server_thread.join();
+
+    // Removing the sender sends what it still holds
+    ASSERT_TRUE(client_node.Send("bye", 3));
+    client_node.Remove();
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_EQ(rec->Size(), 3u);
+}
+
+void coalesce_deadline()
+{
+    // Without Flush() the messages go out once the oldest has waited the delay
+    ipc::ChannelOptions options;
+    options.coalesce_bytes = 4096;
+    options.coalesce_delay = std::chrono::milliseconds(5);
+    ipc::Node server_node("coalesce_deadline", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    ipc::Node client_node("coalesce_deadline", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+
+    for (int round = 0; round < 3; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_TRUE(client_node.Send(&round, sizeof(round)));
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        ASSERT_EQ(rec->Size(), sizeof(round));
+        EXPECT_EQ(*static_cast<const int*>(rec->Data()), round);
+        EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(5));
+    }
+}
+
+void coalesce_closed()
+{
+    // ReceiveInto of a removed channel reports it closed, as the transport underneath does
+    ipc::ChannelOptions options;
+    options.coalesce_bytes = 4096;
+    auto ring = std::make_shared<shm::SharedMemory>("coalesce_closed", ipc::NodeType::kReceiver, NameKey("coalesce_closed"), options);
+    coalesce::CoalescingChannel channel(ring, ipc::NodeType::kReceiver, options);
+    ASSERT_TRUE(channel.Remove());
+
+    char dst[64];
+    EXPECT_EQ(channel.ReceiveInto(dst, sizeof(dst)), ReceiveStatus::kClosed);
+}
+
+TEST(COALESCE, loop)
+{
+    coalesce_loop(ipc::ChannelType::kMessageQueue);
+}
+
+TEST(COALESCE, shm)
+{
+    coalesce_loop(ipc::ChannelType::kSharedMemory);
+}
+
+TEST(COALESCE, flush)
+{
+    coalesce_flush();
+}
+
+TEST(COALESCE, deadline)
+{
+    coalesce_deadline();
+}
+
+TEST(COALESCE, closed)
+{
+    coalesce_closed();
+}
+#endif // _WIN32
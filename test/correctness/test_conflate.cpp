@@ -0,0 +1,216 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <set>
+#include <signal.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "ipc/conflate/table.h"
+#include "ipc/ipc.h"
+
+using namespace ipc;
+using namespace std::chrono_literals;
+
+static std::set<uint64_t> Changed(conflate::LastValueTable& table)
+{
+    std::vector<uint64_t> keys;
+    table.Changes(keys);
+    return std::set<uint64_t>(keys.begin(), keys.end());
+}
+
+void conflate_basic()
+{
+    ipc::ChannelOptions options;
+    options.capacity_messages = 16;
+    options.max_message_size = 64;
+    conflate::LastValueTable reader("conflate_basic", ipc::NodeType::kReceiver, options);
+    conflate::LastValueTable writer("conflate_basic", ipc::NodeType::kSender, options);
+    EXPECT_EQ(reader.Options().capacity_messages, 16u);
+    EXPECT_GE(reader.Options().max_message_size, 64u);
+
+    EXPECT_TRUE(Changed(reader).empty());
+    ASSERT_TRUE(writer.Write(1, "one", 3));
+    ASSERT_TRUE(writer.Write(2, "two", 3));
+    ASSERT_TRUE(writer.Write(3, "three", 5));
+    EXPECT_EQ(Changed(reader), (std::set<uint64_t> { 1, 2, 3 }));
+    EXPECT_TRUE(Changed(reader).empty());
+
+    // Intermediate values are overwritten, only the latest one is read
+    ASSERT_TRUE(writer.Write(2, "deux", 4));
+    ASSERT_TRUE(writer.Write(2, "zwei", 4));
+    EXPECT_EQ(Changed(reader), (std::set<uint64_t> { 2 }));
+    Buffer value;
+    ASSERT_TRUE(reader.Read(2, value));
+    ASSERT_EQ(value.Size(), 4u);
+    EXPECT_EQ(memcmp(value.Data(), "zwei", 4), 0);
+    ASSERT_TRUE(reader.Read(3, value));
+    ASSERT_EQ(value.Size(), 5u);
+    EXPECT_EQ(memcmp(value.Data(), "three", 5), 0);
+    EXPECT_FALSE(reader.Read(4, value));
+
+    char dst[4];
+    ReceiveResult result = reader.ReadInto(3, dst, sizeof(dst));
+    EXPECT_EQ(result, ReceiveStatus::kTooSmall);
+    EXPECT_EQ(result.Size(), 5u);
+    result = reader.ReadInto(1, dst, sizeof(dst));
+    ASSERT_TRUE(result);
+    EXPECT_EQ(memcmp(dst, "one", 3), 0);
+    EXPECT_EQ(reader.ReadInto(4, dst, sizeof(dst)), ReceiveStatus::kError);
+
+    std::vector<char> large(reader.Options().max_message_size + 1);
+    EXPECT_EQ(writer.Write(5, large.data(), large.size()), SendStatus::kTooLarge);
+    // Memory is bounded by the number of keys
+    for (uint64_t key = 100; key < 113; ++key)
+        ASSERT_TRUE(writer.Write(key, &key, sizeof(key)));
+    EXPECT_EQ(writer.Write(200, "x", 1), SendStatus::kWouldBlock);
+    ASSERT_TRUE(writer.Write(1, "still", 5));
+}
+
+void conflate_wait()
+{
+    ipc::ChannelOptions options;
+    options.capacity_messages = 16;
+    options.max_message_size = 64;
+    conflate::LastValueTable reader("conflate_wait", ipc::NodeType::kReceiver, options);
+    conflate::LastValueTable writer("conflate_wait", ipc::NodeType::kSender, options);
+    EXPECT_FALSE(reader.Wait(10ms));
+
+    std::thread writer_thread([&]() {
+        std::this_thread::sleep_for(20ms);
+        EXPECT_TRUE(writer.Write(7, "seven", 5));
+    });
+    EXPECT_TRUE(reader.Wait(5s));
+    writer_thread.join();
+    EXPECT_EQ(Changed(reader), (std::set<uint64_t> { 7 }));
+    EXPECT_FALSE(reader.Wait(10ms));
+
+    // A second kReceiver reads the same table with changes of its own
+    conflate::LastValueTable other("conflate_wait", ipc::NodeType::kReceiver, options);
+    EXPECT_EQ(Changed(other), (std::set<uint64_t> { 7 }));
+    Buffer value;
+    ASSERT_TRUE(other.Read(7, value));
+    EXPECT_EQ(memcmp(value.Data(), "seven", 5), 0);
+
+    // Removing the table stops waiting readers
+    std::thread remover([&]() {
+        std::this_thread::sleep_for(20ms);
+        reader.Remove();
+    });
+    EXPECT_FALSE(other.Wait(5s));
+    remover.join();
+}
+
+void conflate_consistent()
+{
+    // Readers never see a mix of two writes, all words of a value and its size come from one writer
+    ipc::ChannelOptions options;
+    options.capacity_messages = 16;
+    options.max_message_size = 64;
+    conflate::LastValueTable reader("conflate_consistent", ipc::NodeType::kReceiver, options);
+    conflate::LastValueTable writer("conflate_consistent", ipc::NodeType::kSender, options);
+    const size_t words = reader.Options().max_message_size / sizeof(uint64_t);
+    std::atomic<bool> done { false };
+    std::vector<std::thread> writers;
+    for (uint64_t id = 1; id <= 2; ++id) {
+        writers.emplace_back([&, id]() {
+            for (uint64_t i = 0; i < 20000; ++i) {
+                const uint64_t stamp = (id << 32) | i;
+                std::vector<uint64_t> value(1 + stamp % words, stamp);
+                EXPECT_TRUE(writer.Write(42, value.data(), value.size() * sizeof(uint64_t)));
+            }
+        });
+    }
+    std::thread stopper([&]() {
+        for (auto& thread : writers)
+            thread.join();
+        done = true;
+    });
+    Buffer value;
+    size_t torn = 0;
+    while (!done) {
+        if (!reader.Read(42, value))
+            continue;
+        std::vector<uint64_t> words_read(value.Size() / sizeof(uint64_t));
+        memcpy(words_read.data(), value.Data(), words_read.size() * sizeof(uint64_t));
+        if (value.Size() % sizeof(uint64_t) != 0 || words_read.empty() || words_read.size() != 1 + words_read[0] % words
+            || std::count(words_read.begin(), words_read.end(), words_read[0]) != static_cast<long>(words_read.size()))
+            ++torn;
+    }
+    stopper.join();
+    EXPECT_EQ(torn, 0u);
+}
+
+void conflate_crash()
+{
+    ipc::ChannelOptions options;
+    options.capacity_messages = 16;
+    options.max_message_size = 1024 * 1024;
+    conflate::LastValueTable reader("conflate_crash", ipc::NodeType::kReceiver, options);
+
+    // A writer stopped and then killed, most likely in the middle of a value
+    pid_t pid = fork();
+    if (pid == 0) {
+        conflate::LastValueTable writer("conflate_crash", ipc::NodeType::kSender, options);
+        std::vector<char> value(options.max_message_size, 'a');
+        while (writer.Write(1, value.data(), value.size())) { }
+        _exit(1);
+    }
+    ASSERT_GT(pid, 0);
+    // At least one value is complete, the key is reported even if the writer stops in the middle of the next
+    EXPECT_TRUE(reader.Wait(5s));
+    std::this_thread::sleep_for(20ms);
+    kill(pid, SIGSTOP);
+
+    // Readers give up on a value that stays torn instead of spinning on it
+    Buffer value;
+    const auto start = std::chrono::steady_clock::now();
+    if (reader.Read(1, value)) {
+        EXPECT_EQ(value.Size(), options.max_message_size);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+
+    // The torn key is reported once, then the table is quiet until the next write
+    std::vector<uint64_t> keys;
+    EXPECT_EQ(reader.Changes(keys), std::vector<uint64_t> { 1 });
+    EXPECT_FALSE(reader.Wait(50ms));
+    EXPECT_TRUE(reader.Changes(keys).empty());
+
+    // The next writer takes the key over
+    conflate::LastValueTable writer("conflate_crash", ipc::NodeType::kSender, options);
+    ASSERT_TRUE(writer.Write(1, "recovered", 9));
+    EXPECT_TRUE(reader.Wait(1s));
+    EXPECT_EQ(reader.Changes(keys), std::vector<uint64_t> { 1 });
+    ASSERT_TRUE(reader.Read(1, value));
+    ASSERT_EQ(value.Size(), 9u);
+    EXPECT_EQ(memcmp(value.Data(), "recovered", 9), 0);
+}
+
+TEST(CONFLATE, basic)
+{
+    conflate_basic();
+}
+
+TEST(CONFLATE, wait)
+{
+    conflate_wait();
+}
+
+TEST(CONFLATE, consistent)
+{
+    conflate_consistent();
+}
+
+TEST(CONFLATE, crash)
+{
+    conflate_crash();
+}
+#endif // _WIN32
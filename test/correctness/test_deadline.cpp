@@ -0,0 +1,168 @@
+#ifndef _WIN32
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+using namespace std::chrono_literals;
+
+static void deadline_skip(ipc::ChannelType type, bool integrity)
+{
+    ipc::ChannelOptions options;
+    options.deadlines = true;
+    options.integrity = integrity;
+    ipc::Node server_node("deadline_skip", ipc::NodeType::kReceiver, type, options);
+    ipc::Node client_node("deadline_skip", ipc::NodeType::kSender, type, options);
+    EXPECT_TRUE(server_node.Options().deadlines);
+
+    // Stale messages between current ones are dropped by every receive call
+    const Deadline past = std::chrono::steady_clock::now() - 1ms;
+    const Deadline future = std::chrono::steady_clock::now() + 1h;
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(client_node.SendBefore(past, "stale", 5));
+        ASSERT_TRUE(client_node.SendBefore(future, "fresh", 5));
+        ASSERT_TRUE(client_node.Send("plain", 5));
+    }
+
+    Buffer rec;
+    ASSERT_TRUE(server_node.Receive(rec));
+    ASSERT_EQ(rec.Size(), 5u);
+    EXPECT_EQ(memcmp(rec.Data(), "fresh", 5), 0);
+    ASSERT_TRUE(server_node.Receive(rec));
+    EXPECT_EQ(memcmp(rec.Data(), "plain", 5), 0);
+
+    char dst[16];
+    ReceiveResult result = server_node.ReceiveInto(dst, sizeof(dst));
+    ASSERT_TRUE(result);
+    ASSERT_EQ(result.Size(), 5u);
+    EXPECT_EQ(memcmp(dst, "fresh", 5), 0);
+    ASSERT_TRUE(server_node.ReceiveInto(dst, sizeof(dst)));
+
+    iovec iov = { dst, sizeof(dst) };
+    size_t received;
+    ASSERT_TRUE(server_node.ReceiveV(&iov, 1, received));
+    ASSERT_EQ(received, 5u);
+    EXPECT_EQ(memcmp(dst, "fresh", 5), 0);
+    ASSERT_TRUE(server_node.ReceiveV(&iov, 1, received));
+    EXPECT_EQ(memcmp(dst, "plain", 5), 0);
+    EXPECT_EQ(server_node.Stats().expired, 3u);
+}
+
+void deadline_ttl()
+{
+    // Send stamps the ttl, messages left unread past it are never delivered
+    ipc::ChannelOptions options;
+    options.ttl = 20ms;
+    ipc::Node server_node("deadline_ttl", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    ipc::Node client_node("deadline_ttl", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    EXPECT_TRUE(client_node.Options().deadlines);
+    EXPECT_EQ(client_node.Options().ttl, 20ms);
+
+    ASSERT_TRUE(client_node.Send("late", 4));
+    std::this_thread::sleep_for(40ms);
+    ASSERT_TRUE(client_node.Send("on time", 7));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    ASSERT_EQ(rec->Size(), 7u);
+    EXPECT_EQ(memcmp(rec->Data(), "on time", 7), 0);
+    EXPECT_EQ(server_node.Stats().expired, 1u);
+}
+
+void deadline_reclaim()
+{
+    // A full ring of expired messages makes room for new ones even when the policy fails fast
+    ipc::ChannelOptions options;
+    options.capacity_messages = 4;
+    options.backpressure = ipc::BackpressurePolicy::kFailFast;
+    ipc::Node server_node("deadline_reclaim", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+    ipc::Node client_node("deadline_reclaim", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+
+    const Deadline soon = std::chrono::steady_clock::now() + 20ms;
+    for (int i = 0; i < 4; ++i)
+        ASSERT_TRUE(client_node.SendBefore(soon, "old", 3));
+    EXPECT_EQ(client_node.Send("new", 3), SendStatus::kWouldBlock);
+    std::this_thread::sleep_for(40ms);
+    for (int i = 0; i < 4; ++i)
+        ASSERT_TRUE(client_node.Send("new", 3));
+    EXPECT_EQ(client_node.Stats().expired, 4u);
+
+    for (int i = 0; i < 4; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_EQ(memcmp(rec->Data(), "new", 3), 0);
+    }
+}
+
+void deadline_journal()
+{
+    // Journal entries are checked in place
+    ipc::ChannelOptions options;
+    options.deadlines = true;
+    char dir[] = "/tmp/ipc-test-deadline-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir));
+    options.journal_dir = dir;
+    ipc::Node journal("deadline_journal", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::Node writer("deadline_journal", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    ASSERT_TRUE(writer.SendBefore(std::chrono::steady_clock::now() - 1ms, "stale", 5));
+    ASSERT_TRUE(writer.Send("kept", 4));
+
+    JournalEntry entry;
+    ASSERT_TRUE(journal.Read(entry));
+    EXPECT_EQ(entry.seq, 1u);
+    ASSERT_EQ(entry.size, 4u);
+    EXPECT_EQ(memcmp(entry.data, "kept", 4), 0);
+    EXPECT_EQ(journal.Stats().expired, 1u);
+    journal.Remove();
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+void deadline_unsupported()
+{
+    // Without deadlines the transport has nowhere to put them
+    ipc::Node server_node("deadline_unsupported", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    ipc::Node client_node("deadline_unsupported", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    EXPECT_EQ(client_node.SendBefore(std::chrono::steady_clock::now(), "x", 1), SendStatus::kError);
+}
+
+TEST(DEADLINE, msgq)
+{
+    deadline_skip(ipc::ChannelType::kMessageQueue, false);
+}
+
+TEST(DEADLINE, shm)
+{
+    deadline_skip(ipc::ChannelType::kSharedMemory, false);
+}
+
+TEST(DEADLINE, integrity)
+{
+    // Shared memory under another layer carries the deadline in a trailer
+    deadline_skip(ipc::ChannelType::kSharedMemory, true);
+}
+
+TEST(DEADLINE, ttl)
+{
+    deadline_ttl();
+}
+
+TEST(DEADLINE, reclaim)
+{
+    deadline_reclaim();
+}
+
+TEST(DEADLINE, journal)
+{
+    deadline_journal();
+}
+
+TEST(DEADLINE, unsupported)
+{
+    deadline_unsupported();
+}
+#endif // _WIN32
@@ -0,0 +1,203 @@
+#ifndef _WIN32
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+// Sizes that take the queue, the ring and the segment path with the options below
+static const size_t SIZES[] = { 16, 1000, 10000 };
+
+// Message i of sender id, with a recognizable payload of the size for i
+static std::vector<int> Message(int id, int i)
+{
+    std::vector<int> msg(SIZES[i % 3] / sizeof(int), i);
+    msg[0] = id;
+    return msg;
+}
+
+void hybrid_loop()
+{
+    ipc::ChannelOptions options;
+    options.small_message_size = 64;
+    options.large_message_size = 4096;
+    ipc::Node server_node("hybrid_loop", ipc::NodeType::kReceiver, ipc::ChannelType::kHybrid, options);
+    ipc::Node client_node("hybrid_loop", ipc::NodeType::kSender, ipc::ChannelType::kHybrid, options);
+
+    // Messages of every path arrive in the order they were sent
+    const int count = 600;
+    std::thread client_thread([&]() {
+        for (int i = 0; i < count; ++i) {
+            std::vector<int> msg = Message(0, i);
+            EXPECT_TRUE(client_node.Send(msg.data(), msg.size() * sizeof(int)));
+        }
+    });
+    for (int i = 0; i < count; ++i) {
+        Buffer rec;
+        ASSERT_TRUE(server_node.Receive(rec));
+        std::vector<int> expected = Message(0, i);
+        ASSERT_EQ(rec.Size(), expected.size() * sizeof(int));
+        EXPECT_EQ(memcmp(rec.Data(), expected.data(), rec.Size()), 0);
+    }
+    client_thread.join();
+    EXPECT_EQ(client_node.Options().hybrid_paths, HYBRID_ALL);
+
+    // Receive returns once the receiver is removed
+    std::thread remover([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        server_node.Remove();
+    });
+    EXPECT_FALSE(server_node.Receive());
+    remover.join();
+}
+
+void hybrid_negotiate()
+{
+    // A receiver without the segment path, senders route large messages over the ring instead
+    ipc::ChannelOptions options;
+    options.small_message_size = 64;
+    options.large_message_size = 4096;
+    ipc::ChannelOptions receiver_options = options;
+    receiver_options.hybrid_paths = HYBRID_QUEUE | HYBRID_RING;
+    receiver_options.large_message_size = 64 * 1024;
+    {
+        ipc::Node server_node("hybrid_negotiate", ipc::NodeType::kReceiver, ipc::ChannelType::kHybrid, receiver_options);
+        ipc::Node client_node("hybrid_negotiate", ipc::NodeType::kSender, ipc::ChannelType::kHybrid, options);
+        for (int i = 0; i < 30; ++i) {
+            std::vector<int> msg = Message(0, i);
+            ASSERT_TRUE(client_node.Send(msg.data(), msg.size() * sizeof(int)));
+        }
+        EXPECT_EQ(client_node.Options().hybrid_paths, HYBRID_QUEUE | HYBRID_RING);
+        for (int i = 0; i < 30; ++i) {
+            auto rec = server_node.Receive();
+            ASSERT_TRUE(rec);
+            std::vector<int> expected = Message(0, i);
+            ASSERT_EQ(rec->Size(), expected.size() * sizeof(int));
+            EXPECT_EQ(memcmp(rec->Data(), expected.data(), rec->Size()), 0);
+        }
+    }
+
+    // A receiver with only the queue takes what fits into it
+    receiver_options.hybrid_paths = HYBRID_QUEUE;
+    ipc::Node server_node("hybrid_negotiate", ipc::NodeType::kReceiver, ipc::ChannelType::kHybrid, receiver_options);
+    ipc::Node client_node("hybrid_negotiate", ipc::NodeType::kSender, ipc::ChannelType::kHybrid, options);
+    std::vector<int> msg = Message(0, 1);
+    ASSERT_TRUE(client_node.Send(msg.data(), msg.size() * sizeof(int)));
+    EXPECT_EQ(client_node.Options().hybrid_paths, HYBRID_QUEUE);
+    std::vector<char> large(1024 * 1024);
+    EXPECT_EQ(client_node.Send(large.data(), large.size()), SendStatus::kTooLarge);
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_EQ(rec->Size(), msg.size() * sizeof(int));
+}
+
+void hybrid_legacy()
+{
+    // A plain message queue receiver gets the messages of hybrid senders without trailers
+    const char* msg = "Hello, IPC!";
+    ipc::Node server_node("hybrid_legacy", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    ipc::Node client_node("hybrid_legacy", ipc::NodeType::kSender, ipc::ChannelType::kHybrid);
+    ASSERT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_EQ(rec->Size(), strlen(msg) + 1);
+    EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+    EXPECT_EQ(client_node.Options().hybrid_paths, HYBRID_QUEUE);
+}
+
+void hybrid_multiterminal()
+{
+    const int senders = 3;
+    const int count = 300;
+
+    ipc::ChannelOptions options;
+    options.small_message_size = 64;
+    options.large_message_size = 4096;
+    ipc::Node server_node("hybrid_multiterminal", ipc::NodeType::kReceiver, ipc::ChannelType::kHybrid, options);
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id, &options]() {
+            ipc::Node client_node("hybrid_multiterminal", ipc::NodeType::kSender, ipc::ChannelType::kHybrid, options);
+            for (int i = 0; i < count; ++i) {
+                std::vector<int> msg = Message(id, i);
+                EXPECT_TRUE(client_node.Send(msg.data(), msg.size() * sizeof(int)));
+            }
+        });
+    }
+
+    // Every sender keeps its order across the paths
+    std::vector<int> next(senders, 0);
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        const int* msg = static_cast<const int*>(rec->Data());
+        ASSERT_GE(msg[0], 0);
+        ASSERT_LT(msg[0], senders);
+        std::vector<int> expected = Message(msg[0], next[msg[0]]++);
+        ASSERT_EQ(rec->Size(), expected.size() * sizeof(int));
+        EXPECT_EQ(memcmp(rec->Data(), expected.data(), rec->Size()), 0);
+    }
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+void hybrid_drop()
+{
+    // Full paths drop the message being sent, every message that was accepted is delivered in order
+    ipc::ChannelOptions options;
+    options.small_message_size = 64;
+    options.large_message_size = 4096;
+    options.capacity_messages = 16;
+    options.backpressure = ipc::BackpressurePolicy::kDropOldest;
+    ipc::Node server_node("hybrid_drop", ipc::NodeType::kReceiver, ipc::ChannelType::kHybrid, options);
+    ipc::Node client_node("hybrid_drop", ipc::NodeType::kSender, ipc::ChannelType::kHybrid, options);
+    EXPECT_EQ(client_node.Options().backpressure, ipc::BackpressurePolicy::kDropNewest);
+
+    std::vector<int> accepted;
+    for (int i = 0; i < 3000; ++i) {
+        std::vector<int> msg = Message(0, i);
+        SendResult result = client_node.Send(msg.data(), msg.size() * sizeof(int));
+        ASSERT_TRUE(result || result == SendStatus::kDropped);
+        if (result)
+            accepted.push_back(i);
+    }
+    ASSERT_FALSE(accepted.empty());
+    for (int i : accepted) {
+        Buffer rec;
+        ASSERT_TRUE(server_node.Receive(rec));
+        std::vector<int> expected = Message(0, i);
+        ASSERT_EQ(rec.Size(), expected.size() * sizeof(int));
+        EXPECT_EQ(memcmp(rec.Data(), expected.data(), rec.Size()), 0);
+    }
+}
+
+TEST(HYBRID, loop)
+{
+    hybrid_loop();
+}
+
+TEST(HYBRID, negotiate)
+{
+    hybrid_negotiate();
+}
+
+TEST(HYBRID, legacy)
+{
+    hybrid_legacy();
+}
+
+TEST(HYBRID, multiterminal)
+{
+    hybrid_multiterminal();
+}
+
+TEST(HYBRID, drop)
+{
+    hybrid_drop();
+}
+#endif // _WIN32
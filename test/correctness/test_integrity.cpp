@@ -0,0 +1,231 @@
+#ifndef _WIN32
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/integrity/integrity.h"
+#include "ipc/ipc.h"
+#include "ipc/msgq/msgq.h"
+#include "ipc/static_node.h"
+#include "test_utils.h"
+#include "utils/crc32c.h"
+
+using namespace ipc;
+
+void integrity_crc32c()
+{
+    // Check value of the Castagnoli polynomial
+    EXPECT_EQ(Crc32c("123456789", 9), 0xE3069283u);
+    EXPECT_EQ(Crc32c(nullptr, 0), 0u);
+
+    // The hardware streams, the software fallback and the fused copy agree at every size and alignment
+    std::vector<char> data = Pattern(80000, 3);
+    std::vector<char> copy(data.size() + 8);
+    for (size_t size : { 0, 1, 7, 8, 255, 256, 767, 768, 769, 4096, 24575, 24576, 24577, 49152 + 100, 79990 }) {
+        for (size_t offset = 0; offset < 8; offset += 3) {
+            const uint32_t expected = Crc32cSoftware(data.data() + offset, size);
+            EXPECT_EQ(Crc32c(data.data() + offset, size), expected) << size << " at " << offset;
+            EXPECT_EQ(CopyCrc32c(copy.data() + 1, data.data() + offset, size), expected) << size << " at " << offset;
+            EXPECT_EQ(memcmp(copy.data() + 1, data.data() + offset, size), 0);
+            // Continued in two pieces
+            EXPECT_EQ(Crc32c(data.data() + offset + size / 3, size - size / 3, Crc32c(data.data() + offset, size / 3)),
+                expected);
+        }
+    }
+}
+
+static void integrity_loop(ipc::ChannelType type)
+{
+    ipc::ChannelOptions options;
+    options.integrity = true;
+    options.max_message_size = 64 * 1024;
+    ipc::Node server_node("integrity_loop", ipc::NodeType::kReceiver, type, options);
+    ipc::Node client_node("integrity_loop", ipc::NodeType::kSender, type, options);
+    EXPECT_TRUE(server_node.Options().integrity);
+
+    const size_t max_size = server_node.Options().max_message_size;
+    const size_t sizes[] = { 0, 1, 100, 4096, max_size / 2 + 3, max_size };
+    std::thread client_thread([&]() {
+        for (int round = 0; round < 3; ++round) {
+            for (size_t size : sizes) {
+                std::vector<char> msg = Pattern(size, round);
+                EXPECT_TRUE(client_node.Send(msg.data(), msg.size()));
+            }
+        }
+    });
+    std::vector<char> dst(max_size);
+    for (int round = 0; round < 3; ++round) {
+        for (size_t size : sizes) {
+            std::vector<char> expected = Pattern(size, round);
+            // Every receive call strips and verifies the checksum
+            if (round == 0) {
+                Buffer rec;
+                ASSERT_TRUE(server_node.Receive(rec));
+                ASSERT_EQ(rec.Size(), size);
+                EXPECT_EQ(memcmp(rec.Data(), expected.data(), size), 0);
+            } else if (round == 1) {
+                ReceiveResult result = server_node.ReceiveInto(dst.data(), dst.size());
+                ASSERT_TRUE(result);
+                ASSERT_EQ(result.Size(), size);
+                EXPECT_EQ(memcmp(dst.data(), expected.data(), size), 0);
+            } else {
+                iovec iov[2] = { { dst.data(), 10 }, { dst.data() + 10, dst.size() - 10 } };
+                size_t received;
+                ASSERT_TRUE(server_node.ReceiveV(iov, 2, received));
+                ASSERT_EQ(received, size);
+                EXPECT_EQ(memcmp(dst.data(), expected.data(), size), 0);
+            }
+        }
+    }
+    client_thread.join();
+    EXPECT_EQ(server_node.Stats().corrupted, 0u);
+}
+
+void integrity_corrupted()
+{
+    ipc::ChannelOptions options;
+    options.integrity = true;
+    options.max_message_size = 64 * 1024;
+    ipc::Node server_node("integrity_corrupted", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    // A peer without integrity stands in for one that corrupts its messages
+    ipc::ChannelOptions raw_options;
+    ipc::Node raw_node("integrity_corrupted", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, raw_options);
+    ipc::Node client_node("integrity_corrupted", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+
+    std::vector<char> msg = Pattern(1000, 1);
+    integrity::IntegrityChannel::Trailer trailer = { Crc32c(msg.data(), msg.size()), integrity::IntegrityChannel::TRAILER_MAGIC };
+    msg[500] ^= 0x10;
+    iovec flipped[2] = { { msg.data(), msg.size() }, { &trailer, sizeof(trailer) } };
+    ASSERT_TRUE(raw_node.SendV(flipped, 2));
+    ASSERT_TRUE(raw_node.Send("no trailer", 10));
+
+    char dst[2048];
+    ReceiveResult result = server_node.ReceiveInto(dst, sizeof(dst));
+    EXPECT_EQ(result, ReceiveStatus::kCorrupted);
+    EXPECT_EQ(result.Size(), msg.size());
+    EXPECT_EQ(server_node.ReceiveInto(dst, sizeof(dst)), ReceiveStatus::kCorrupted);
+
+    // Receive skips corrupted messages and returns the next good one
+    msg[500] ^= 0x10;
+    ASSERT_TRUE(raw_node.SendV(flipped, 2));
+    ASSERT_TRUE(raw_node.Send("no trailer", 10));
+    ASSERT_TRUE(client_node.Send("good", 4));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    ASSERT_EQ(rec->Size(), msg.size());
+    EXPECT_EQ(memcmp(rec->Data(), msg.data(), msg.size()), 0);
+    rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    ASSERT_EQ(rec->Size(), 4u);
+    EXPECT_EQ(memcmp(rec->Data(), "good", 4), 0);
+    EXPECT_EQ(server_node.Stats().corrupted, 3u);
+}
+
+void integrity_expired()
+{
+    // Expired messages are dropped before they are verified, live ones are still checked
+    ipc::ChannelOptions options;
+    options.integrity = true;
+    options.deadlines = true;
+    ipc::Node server_node("integrity_expired", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    // A peer with deadlines but without integrity forges the checksums
+    ipc::ChannelOptions raw_options;
+    raw_options.deadlines = true;
+    ipc::Node raw_node("integrity_expired", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, raw_options);
+    ipc::Node client_node("integrity_expired", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+
+    integrity::IntegrityChannel::Trailer trailer = { Crc32c("stale", 5) ^ 1, integrity::IntegrityChannel::TRAILER_MAGIC };
+    char forged[5 + sizeof(trailer)];
+    memcpy(forged, "stale", 5);
+    memcpy(forged + 5, &trailer, sizeof(trailer));
+    ASSERT_TRUE(raw_node.SendBefore(std::chrono::steady_clock::now() - std::chrono::milliseconds(1), forged, sizeof(forged)));
+    ASSERT_TRUE(raw_node.SendBefore(std::chrono::steady_clock::now() + std::chrono::hours(1), forged, sizeof(forged)));
+    ASSERT_TRUE(client_node.SendBefore(std::chrono::steady_clock::now() + std::chrono::hours(1), "fresh", 5));
+
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    ASSERT_EQ(rec->Size(), 5u);
+    EXPECT_EQ(memcmp(rec->Data(), "fresh", 5), 0);
+    EXPECT_EQ(server_node.Stats().expired, 1u);
+    EXPECT_EQ(server_node.Stats().corrupted, 1u);
+}
+
+void integrity_closed()
+{
+    // A removed transport is reported as closed through the checksum layer, as the transport does
+    auto queue = std::make_shared<msgq::MessageQueue>("integrity_closed", ipc::NodeType::kReceiver, NameKey("integrity_closed"), ipc::ChannelOptions());
+    integrity::IntegrityChannel channel(queue, ipc::NodeType::kReceiver);
+    ASSERT_TRUE(queue->Remove());
+
+    char dst[64];
+    EXPECT_EQ(queue->ReceiveInto(dst, sizeof(dst)), ReceiveStatus::kClosed);
+    EXPECT_EQ(channel.ReceiveInto(dst, sizeof(dst)), ReceiveStatus::kClosed);
+}
+
+void integrity_journal()
+{
+    // Journal entries are verified in place
+    ipc::ChannelOptions options;
+    options.integrity = true;
+    options.max_message_size = 64 * 1024;
+    char dir[] = "/tmp/ipc-test-integrity-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir));
+    options.journal_dir = dir;
+    ipc::Node journal("integrity_journal", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::Node writer("integrity_journal", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    for (int i = 0; i < 10; ++i) {
+        std::vector<char> msg = Pattern(100 * i, i);
+        ASSERT_TRUE(writer.Send(msg.data(), msg.size()));
+    }
+    for (int i = 0; i < 10; ++i) {
+        JournalEntry entry;
+        ASSERT_TRUE(journal.Read(entry));
+        std::vector<char> expected = Pattern(100 * i, i);
+        ASSERT_EQ(entry.size, expected.size());
+        EXPECT_EQ(memcmp(entry.data, expected.data(), entry.size), 0);
+    }
+    journal.Remove();
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+TEST(INTEGRITY, crc32c)
+{
+    integrity_crc32c();
+}
+
+TEST(INTEGRITY, msgq)
+{
+    integrity_loop(ipc::ChannelType::kMessageQueue);
+}
+
+TEST(INTEGRITY, shm)
+{
+    integrity_loop(ipc::ChannelType::kSharedMemory);
+}
+
+TEST(INTEGRITY, corrupted)
+{
+    integrity_corrupted();
+}
+
+TEST(INTEGRITY, expired)
+{
+    integrity_expired();
+}
+
+TEST(INTEGRITY, closed)
+{
+    integrity_closed();
+}
+
+TEST(INTEGRITY, journal)
+{
+    integrity_journal();
+}
+#endif // _WIN32
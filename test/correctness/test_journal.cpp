@@ -0,0 +1,284 @@
+#ifndef _WIN32
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+// Journals outlive their Nodes, every test keeps its segments in a directory of its own
+static std::string JournalDirectory()
+{
+    char dir[] = "/tmp/ipc-test-journal-XXXXXX";
+    EXPECT_TRUE(mkdtemp(dir));
+    return dir;
+}
+
+static std::string Message(uint64_t i)
+{
+    return "Hello, IPC - Message #" + std::to_string(i) + std::string(i % 7 == 0 ? i % 1000 : 0, 'x');
+}
+
+void journal_loop()
+{
+    ipc::ChannelOptions options;
+    options.journal_dir = JournalDirectory();
+    ipc::Node server_node("journal_loop", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::Node client_node("journal_loop", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+
+    const int count = 1000;
+    std::thread client_thread([&]() {
+        for (int i = 0; i < count; ++i) {
+            std::string msg = Message(i);
+            EXPECT_TRUE(client_node.Send(msg.c_str(), msg.size() + 1));
+        }
+    });
+
+    // Read hands out the messages in place, numbered in the order they were appended
+    for (int i = 0; i < count; ++i) {
+        ipc::JournalEntry entry;
+        ASSERT_TRUE(server_node.Read(entry));
+        EXPECT_EQ(entry.seq, static_cast<uint64_t>(i));
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(entry.data) % 8, 0u);
+        EXPECT_STREQ(static_cast<const char*>(entry.data), Message(i).c_str());
+    }
+    client_thread.join();
+
+    // Receive copies, and a second receiver replays the journal from the start
+    const char* msg = "Hello, IPC!";
+    EXPECT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+    ipc::Node replay_node("journal_loop", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::JournalEntry entry;
+    ASSERT_TRUE(replay_node.Read(entry));
+    EXPECT_EQ(entry.seq, 0u);
+
+    // Oversized messages are rejected by the sender
+    std::vector<char> large(client_node.Options().max_message_size + 1);
+    EXPECT_EQ(client_node.Send(large.data(), large.size()), SendStatus::kTooLarge);
+
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+void journal_rollover()
+{
+    // Small segments and room for only two of them
+    ipc::ChannelOptions options;
+    options.journal_dir = JournalDirectory();
+    options.segment_size = 64 * 1024;
+    options.capacity_bytes = 128 * 1024;
+    ipc::Node client_node("journal_rollover", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    EXPECT_EQ(client_node.Options().segment_size, options.segment_size);
+    EXPECT_LT(client_node.Options().max_message_size, options.segment_size);
+
+    const uint64_t count = 5000;
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string msg = Message(i);
+        ASSERT_TRUE(client_node.Send(msg.c_str(), msg.size() + 1));
+    }
+    size_t segments = 0;
+    for (auto& file : std::filesystem::directory_iterator(options.journal_dir + "/ipc-journal-journal_rollover")) {
+        EXPECT_EQ(file.path().extension(), ".journal");
+        ++segments;
+    }
+    EXPECT_EQ(segments, 2u);
+
+    // A late receiver starts at the oldest message kept and reads through the segments
+    ipc::Node server_node("journal_rollover", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::JournalEntry entry;
+    ASSERT_TRUE(server_node.Read(entry));
+    const uint64_t oldest = entry.seq;
+    EXPECT_GT(oldest, 0u);
+    for (uint64_t seq = oldest;; ++seq) {
+        EXPECT_EQ(entry.seq, seq);
+        EXPECT_STREQ(static_cast<const char*>(entry.data), Message(seq).c_str());
+        if (seq == count - 1)
+            break;
+        ASSERT_TRUE(server_node.Read(entry));
+    }
+
+    // Seek to a message kept, to one deleted already and to the end
+    const uint64_t middle = (oldest + count) / 2;
+    ASSERT_TRUE(server_node.Seek(middle));
+    ASSERT_TRUE(server_node.Read(entry));
+    EXPECT_EQ(entry.seq, middle);
+    EXPECT_STREQ(static_cast<const char*>(entry.data), Message(middle).c_str());
+    EXPECT_FALSE(server_node.Seek(0));
+    ASSERT_TRUE(server_node.Read(entry));
+    EXPECT_EQ(entry.seq, oldest);
+    ASSERT_TRUE(server_node.Seek(ipc::JOURNAL_END));
+    const char* msg = "Hello, IPC!";
+    ASSERT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    ASSERT_TRUE(server_node.Read(entry));
+    EXPECT_EQ(entry.seq, count);
+    EXPECT_STREQ(static_cast<const char*>(entry.data), msg);
+
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+void journal_recovery()
+{
+    ipc::ChannelOptions options;
+    options.journal_dir = JournalDirectory();
+
+    // Messages survive their sender, a restarted sender continues the sequence
+    for (int run = 0; run < 2; ++run) {
+        ipc::Node client_node("journal_recovery", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+        for (int i = 0; i < 100; ++i) {
+            std::string msg = Message(run * 100 + i);
+            ASSERT_TRUE(client_node.Send(msg.c_str(), msg.size() + 1));
+        }
+    }
+    {
+        ipc::Node server_node("journal_recovery", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+        for (uint64_t i = 0; i < 200; ++i) {
+            ipc::JournalEntry entry;
+            ASSERT_TRUE(server_node.Read(entry));
+            EXPECT_EQ(entry.seq, i);
+            EXPECT_STREQ(static_cast<const char*>(entry.data), Message(i).c_str());
+        }
+    }
+
+    // kReclaim starts over with an empty journal
+    options.recovery = RecoveryPolicy::kReclaim;
+    ipc::Node server_node("journal_recovery", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::Node client_node("journal_recovery", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    const char* msg = "Hello, IPC!";
+    ASSERT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    ipc::JournalEntry entry;
+    ASSERT_TRUE(server_node.Read(entry));
+    EXPECT_EQ(entry.seq, 0u);
+    EXPECT_STREQ(static_cast<const char*>(entry.data), msg);
+
+    // Read returns once the receiver is removed
+    std::thread remover([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        server_node.Remove();
+    });
+    EXPECT_FALSE(server_node.Read(entry));
+    remover.join();
+
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+void journal_multiterminal()
+{
+    const int senders = 3;
+    const int count = 2000;
+
+    // Senders race for the same segments and their rollovers
+    ipc::ChannelOptions options;
+    options.journal_dir = JournalDirectory();
+    options.segment_size = 64 * 1024;
+    options.capacity_bytes = 1024 * 1024;
+    ipc::Node server_node("journal_multiterminal", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id, &options]() {
+            ipc::Node client_node("journal_multiterminal", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+
+    // Sequence numbers have no gaps, and every sender keeps its order
+    std::vector<int> next(senders, 0);
+    for (uint64_t seq = 0; seq < senders * count; ++seq) {
+        ipc::JournalEntry entry;
+        ASSERT_TRUE(server_node.Read(entry));
+        ASSERT_EQ(entry.seq, seq);
+        ASSERT_EQ(entry.size, 2 * sizeof(int));
+        const int* msg = static_cast<const int*>(entry.data);
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+void journal_crash()
+{
+    ipc::ChannelOptions options;
+    options.journal_dir = JournalDirectory();
+    options.segment_size = 4 * 1024 * 1024;
+    options.capacity_bytes = 256 * 1024 * 1024;
+    ipc::Node server_node("journal_crash", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+
+    // A sender killed while appending large messages, most likely in the middle of one
+    pid_t pid = fork();
+    if (pid == 0) {
+        ipc::Node client_node("journal_crash", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+        std::vector<char> msg(256 * 1024, 'x');
+        while (client_node.Send(msg.data(), msg.size())) { }
+        _exit(1);
+    }
+    ASSERT_GT(pid, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+
+    // Records it left behind do not hold back the messages of other senders
+    ipc::Node client_node("journal_crash", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    const char* msg = "Hello, IPC!";
+    ASSERT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    std::atomic<bool> done { false };
+    std::thread watchdog([&]() {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!done && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        server_node.Remove();
+    });
+    ipc::JournalEntry entry;
+    bool read;
+    while ((read = server_node.Read(entry)) && entry.size != strlen(msg) + 1) { }
+    EXPECT_TRUE(read);
+    if (read) {
+        EXPECT_STREQ(static_cast<const char*>(entry.data), msg);
+    }
+    done = true;
+    watchdog.join();
+
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+TEST(JOURNAL, loop)
+{
+    journal_loop();
+}
+
+TEST(JOURNAL, rollover)
+{
+    journal_rollover();
+}
+
+TEST(JOURNAL, recovery)
+{
+    journal_recovery();
+}
+
+TEST(JOURNAL, multiterminal)
+{
+    journal_multiterminal();
+}
+
+TEST(JOURNAL, crash)
+{
+    journal_crash();
+}
+#endif // _WIN32
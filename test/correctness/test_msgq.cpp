@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
 #include <gtest/gtest.h>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -238,6 +243,319 @@ void msgq_multiterminal()
     client_thread_3.join();
 }
 
+void msgq_shared_sender()
+{
+    const int senders = 4;
+    const int count = 500;
+
+    // One Node shared by all sender threads, which connect concurrently on their first Send
+    ipc::Node client_node("msgq_shared_sender", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    ipc::Node server_node("msgq_shared_sender", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    std::atomic<bool> start { false };
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id, &start, &client_node]() {
+            while (!start.load())
+                std::this_thread::yield();
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+    start = true;
+
+    // Messages of each thread arrive in order
+    int next[senders] = {};
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        ASSERT_EQ(rec->Size(), 2 * sizeof(int));
+        const int* msg = static_cast<const int*>(rec->Data());
+        ASSERT_GE(msg[0], 0);
+        ASSERT_LT(msg[0], senders);
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+void msgq_scatter_gather()
+{
+    struct header {
+        int id;
+        size_t payload_size;
+    };
+    const char* payload = "Hello, IPC with iovec!";
+
+    std::thread server_thread([payload]() {
+        ipc::Node server_node("scatter_gather", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+        header hdr;
+        char body[64];
+        iovec iov[2] = { { &hdr, sizeof(hdr) }, { body, sizeof(body) } };
+        size_t received_size = 0;
+        if (!server_node.ReceiveV(iov, 2, received_size)) {
+            fprintf(stderr, "Server failed to Receive message\n");
+            exit(1);
+        }
+        EXPECT_EQ(received_size, sizeof(hdr) + strlen(payload) + 1);
+        EXPECT_EQ(hdr.id, 7);
+        EXPECT_EQ(hdr.payload_size, strlen(payload) + 1);
+        EXPECT_STREQ(body, payload);
+    });
+
+    // Ensure that the server is started and waiting for connection
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ipc::Node client_node("scatter_gather", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    header hdr = { 7, strlen(payload) + 1 };
+    iovec iov[2] = { { &hdr, sizeof(hdr) }, { const_cast<char*>(payload), hdr.payload_size } };
+    EXPECT_TRUE(client_node.SendV(iov, 2));
+
+    server_thread.join();
+}
+
+void msgq_backpressure()
+{
+    char msg[1024] = {};
+    int* index = reinterpret_cast<int*>(msg);
+    ipc::Node server_node("backpressure", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+
+    // Fill the queue until the receiver, which never reads, falls behind
+    ipc::ChannelOptions options;
+    options.backpressure = ipc::BackpressurePolicy::kFailFast;
+    ipc::Node fail_fast("backpressure", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    int queued = 0;
+    SendResult result = SendStatus::kOk;
+    for (; queued < 1000; ++queued) {
+        *index = queued;
+        result = fail_fast.Send(msg, sizeof(msg));
+        if (!result)
+            break;
+    }
+    EXPECT_EQ(result.Status(), SendStatus::kWouldBlock);
+    ASSERT_GT(queued, 0);
+
+    options.backpressure = ipc::BackpressurePolicy::kDropNewest;
+    ipc::Node drop_newest("backpressure", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    EXPECT_EQ(drop_newest.Send(msg, sizeof(msg)).Status(), SendStatus::kDropped);
+
+    options.backpressure = ipc::BackpressurePolicy::kTimeout;
+    options.send_timeout = std::chrono::milliseconds(20);
+    ipc::Node timeout("backpressure", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(timeout.Send(msg, sizeof(msg)).Status(), SendStatus::kTimedOut);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, options.send_timeout);
+
+    // Evicting the oldest message makes room for the newest one
+    options.backpressure = ipc::BackpressurePolicy::kDropOldest;
+    ipc::Node drop_oldest("backpressure", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    *index = queued;
+    EXPECT_TRUE(drop_oldest.Send(msg, sizeof(msg)));
+
+    for (int i = 1; i <= queued; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_EQ(*static_cast<int*>(rec->Data()), i);
+    }
+}
+
+void msgq_options()
+{
+    ipc::ChannelOptions options;
+    options.capacity_bytes = 4096;
+    options.max_message_size = 1000;
+    ipc::Node server_node("options", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    ipc::ChannelOptions effective = server_node.Options();
+    EXPECT_EQ(effective.max_message_size, 1000u);
+    EXPECT_GE(effective.capacity_bytes, 1000u);
+
+    ipc::Node client_node("options", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    char msg[1001] = {};
+    EXPECT_EQ(client_node.Send(msg, sizeof(msg)).Status(), SendStatus::kTooLarge);
+    EXPECT_TRUE(client_node.Send(msg, 1000));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_EQ(rec->Size(), 1000u);
+
+    // Requests beyond what the transport supports are clamped and reported
+    ipc::ChannelOptions huge;
+    huge.max_message_size = 1 << 30;
+    ipc::Node huge_node("options_huge", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, huge);
+    EXPECT_LT(huge_node.Options().max_message_size, huge.max_message_size);
+    EXPECT_GT(huge_node.Options().max_message_size, 0u);
+}
+
+void msgq_dispatch(size_t sender_partitions)
+{
+    const int keys = 16;
+    const int count = 50;
+    ipc::ChannelOptions options;
+    options.partitions = 4;
+
+    ipc::Node server_node("dispatch", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    EXPECT_EQ(server_node.Options().partitions, 4u);
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    int next[keys] = {};
+    size_t owner[keys];
+    std::fill(owner, owner + keys, SIZE_MAX);
+    int handled = 0;
+    std::thread server_thread([&]() {
+        EXPECT_TRUE(server_node.Dispatch([&](size_t partition, std::shared_ptr<Buffer> message) {
+            ASSERT_EQ(message->Size(), 2 * sizeof(int));
+            const int* msg = static_cast<const int*>(message->Data());
+            std::lock_guard<std::mutex> lock(mutex);
+            // Every key sticks to one partition and its messages are handled in order
+            if (owner[msg[0]] == SIZE_MAX)
+                owner[msg[0]] = partition;
+            EXPECT_EQ(owner[msg[0]], partition);
+            EXPECT_EQ(msg[1], next[msg[0]]++);
+            if (++handled == keys * count)
+                cond.notify_one();
+        }));
+    });
+
+    // A sender configured with another count maps its partitions onto those of the receiver
+    options.partitions = sender_partitions;
+    ipc::Node client_node("dispatch", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+    for (int i = 0; i < count; ++i) {
+        for (int key = 0; key < keys; ++key) {
+            int msg[2] = { key, i };
+            EXPECT_TRUE(client_node.SendKeyed(key, msg, sizeof(msg)));
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return handled == keys * count; });
+    }
+    // Removing the Node stops the workers
+    server_node.Remove();
+    server_thread.join();
+}
+
+void msgq_receive_into()
+{
+    ipc::Node server_node("receive_into", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    ipc::Node client_node("receive_into", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+
+    char msg[1000];
+    for (size_t i = 0; i < sizeof(msg); ++i)
+        msg[i] = static_cast<char>(i);
+    EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+    EXPECT_TRUE(client_node.Send(msg, 100));
+    EXPECT_TRUE(client_node.Send(msg, 100));
+
+    // A destination that is too small reports the required size and keeps the message
+    alignas(8) char arena[2048];
+    ReceiveResult result = server_node.ReceiveInto(arena, 500);
+    EXPECT_EQ(result.Status(), ReceiveStatus::kTooSmall);
+    EXPECT_EQ(result.Size(), sizeof(msg));
+    result = server_node.ReceiveInto(arena, result.Size());
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.Size(), sizeof(msg));
+    EXPECT_EQ(memcmp(arena, msg, sizeof(msg)), 0);
+
+    // Room to spare and an unaligned destination
+    result = server_node.ReceiveInto(arena, sizeof(arena));
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.Size(), 100u);
+    EXPECT_EQ(memcmp(arena, msg, 100), 0);
+    result = server_node.ReceiveInto(arena + 1, 100);
+    ASSERT_TRUE(result);
+    EXPECT_EQ(memcmp(arena + 1, msg, 100), 0);
+}
+
+void msgq_sharded(bool shard_threads)
+{
+    const char* name = shard_threads ? "sharded_threads" : "sharded";
+    const int senders = 8;
+    const int count = 100;
+    ipc::ChannelOptions options;
+    options.shards = 4;
+    options.shard_threads = shard_threads;
+
+    ipc::Node server_node(name, ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+#ifdef _WIN32
+    EXPECT_EQ(server_node.Options().shards, 1u);
+#else
+    EXPECT_EQ(server_node.Options().shards, 4u);
+    EXPECT_EQ(server_node.Options().shard_threads, shard_threads);
+#endif
+
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([name, options, id]() {
+            ipc::Node client_node(name, ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue, options);
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+
+    // Shards are drained in turn, messages of each sender still arrive in order
+    int next[senders] = {};
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        const int* msg = static_cast<const int*>(rec->Data());
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Start a kReceiver in a child process that dies without calling Remove()
+// leaving its queue behind as a crashed receiver would
+void msgq_crash_receiver(const char* name)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        new ipc::Node(name, ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+        _exit(0);
+    }
+    ASSERT_GT(pid, 0);
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+void msgq_restart(RecoveryPolicy policy)
+{
+    const char* name = policy == RecoveryPolicy::kReattach ? "restart_reattach" : "restart_reclaim";
+    const char* before = "Sent before restart";
+    const char* after = "Sent after restart";
+    ipc::ChannelOptions options;
+    options.recovery = policy;
+
+    msgq_crash_receiver(name);
+    ipc::Node client_node(name, ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    EXPECT_TRUE(client_node.Send(before, strlen(before) + 1));
+
+    // The restart must neither prompt nor block
+    ipc::Node server_node(name, ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue, options);
+    // The sender keeps using the Node it created before the restart
+    EXPECT_TRUE(client_node.Send(after, strlen(after) + 1));
+
+    if (policy == RecoveryPolicy::kReattach) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), before);
+    }
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_STREQ(static_cast<const char*>(rec->Data()), after);
+}
+#endif
+
 TEST(MSGQ, basic)
 {
     msgq_basic();
@@ -262,4 +580,53 @@ TEST(MSGQ, class)
 TEST(MSGQ, multiterminal)
 {
     msgq_multiterminal();
-}
\ No newline at end of file
+}
+
+TEST(MSGQ, shared_sender)
+{
+    msgq_shared_sender();
+}
+
+TEST(MSGQ, scatter_gather)
+{
+    msgq_scatter_gather();
+}
+
+TEST(MSGQ, backpressure)
+{
+    msgq_backpressure();
+}
+
+TEST(MSGQ, options)
+{
+    msgq_options();
+}
+
+TEST(MSGQ, dispatch)
+{
+    msgq_dispatch(4);
+}
+
+TEST(MSGQ, dispatch_mismatch)
+{
+    msgq_dispatch(8);
+}
+
+TEST(MSGQ, receive_into)
+{
+    msgq_receive_into();
+}
+
+TEST(MSGQ, sharded)
+{
+    msgq_sharded(false);
+    msgq_sharded(true);
+}
+
+#ifndef _WIN32
+TEST(MSGQ, restart)
+{
+    msgq_restart(RecoveryPolicy::kReattach);
+    msgq_restart(RecoveryPolicy::kReclaim);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,180 @@
+#ifndef _WIN32
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "ipc/protocol.h"
+#include "ipc/shm/shm.h"
+#include "ipc/static_node.h"
+
+using namespace ipc;
+
+struct Order {
+    uint64_t id;
+    double price;
+    uint32_t quantity;
+};
+
+struct Cancel {
+    uint64_t id;
+};
+
+struct Quote {
+    char symbol[8];
+    double bid;
+    double ask;
+};
+
+using Trading = Protocol<Order, Cancel, Quote>;
+
+static_assert(Trading::ID<Order> == 0 && Trading::ID<Cancel> == 1 && Trading::ID<Quote> == 2);
+static_assert(Trading::MAX_SIZE == sizeof(ProtocolHeader) + sizeof(Quote));
+
+// Sum up what the handlers saw, one counter per type
+struct Tally {
+    std::vector<uint64_t> orders;
+    std::vector<uint64_t> cancels;
+    std::vector<double> quotes;
+
+    auto Handler()
+    {
+        return Overloaded {
+            [this](const Order& order) { orders.push_back(order.id * order.quantity); },
+            [this](const Cancel& cancel) { cancels.push_back(cancel.id); },
+            [this](const Quote& quote) { quotes.push_back(quote.ask - quote.bid); },
+        };
+    }
+};
+
+template <typename SenderT, typename ReceiverT>
+static void protocol_roundtrip(SenderT& client_node, ReceiverT& server_node)
+{
+    ASSERT_TRUE(Trading::Send(client_node, Order { 7, 101.5, 3 }));
+    ASSERT_TRUE(Trading::Send(client_node, Cancel { 7 }));
+    Trading::Variant quote = Quote { "ACME", 10.0, 10.5 };
+    ASSERT_TRUE(Trading::Send(client_node, quote));
+
+    Tally tally;
+    for (int i = 0; i < 3; ++i)
+        ASSERT_TRUE(Trading::Receive(server_node, tally.Handler()));
+    EXPECT_EQ(tally.orders, std::vector<uint64_t> { 21 });
+    EXPECT_EQ(tally.cancels, std::vector<uint64_t> { 7 });
+    EXPECT_EQ(tally.quotes, std::vector<double> { 0.5 });
+}
+
+void protocol_node()
+{
+    ipc::Node server_node("protocol_node", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    ipc::Node client_node("protocol_node", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    protocol_roundtrip(client_node, server_node);
+}
+
+void protocol_static_node()
+{
+    StaticNode<shm::SharedMemory, NodeType::kReceiver> server_node("protocol_static_node");
+    StaticNode<shm::SharedMemory, NodeType::kSender> client_node("protocol_static_node");
+    protocol_roundtrip(client_node, server_node);
+}
+
+void protocol_reject()
+{
+    // Messages outside the protocol are not handed to any handler
+    ipc::Node server_node("protocol_reject", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    ipc::Node client_node("protocol_reject", ipc::NodeType::kSender, ipc::ChannelType::kMessageQueue);
+    Tally tally;
+
+    ProtocolHeader unknown = { Trading::COUNT, sizeof(Cancel) };
+    ASSERT_TRUE(client_node.Send(&unknown, sizeof(unknown)));
+    EXPECT_FALSE(Trading::Receive(server_node, tally.Handler()));
+
+    // A Cancel whose size differs from ours, as a peer built with another definition would send
+    ProtocolHeader mismatch = { Trading::ID<Cancel>, sizeof(Cancel) + 4 };
+    char message[sizeof(mismatch) + sizeof(Cancel) + 4] = {};
+    memcpy(message, &mismatch, sizeof(mismatch));
+    ASSERT_TRUE(client_node.Send(message, sizeof(message)));
+    EXPECT_FALSE(Trading::Receive(server_node, tally.Handler()));
+
+    // Too large for any message type, dropped without disturbing the next one
+    std::vector<char> large(Trading::MAX_SIZE + 64);
+    ASSERT_TRUE(client_node.Send(large.data(), large.size()));
+    ASSERT_TRUE(Trading::Send(client_node, Cancel { 9 }));
+    EXPECT_FALSE(Trading::Receive(server_node, tally.Handler()));
+    EXPECT_TRUE(Trading::Receive(server_node, tally.Handler()));
+
+    EXPECT_TRUE(tally.orders.empty());
+    EXPECT_TRUE(tally.quotes.empty());
+    EXPECT_EQ(tally.cancels, std::vector<uint64_t> { 9 });
+}
+
+void protocol_view()
+{
+    // Aligned payloads are handed out in place, misaligned ones are copied first
+    alignas(8) char message[1 + sizeof(ProtocolHeader) + sizeof(Order)];
+    ProtocolHeader header = { Trading::ID<Order>, sizeof(Order) };
+    Order order = { 1, 2.0, 3 };
+    memcpy(message, &header, sizeof(header));
+    memcpy(message + sizeof(header), &order, sizeof(order));
+
+    const void* seen = nullptr;
+    auto handler = Overloaded {
+        [&seen](const Order& order) { seen = &order; EXPECT_EQ(order.quantity, 3u); },
+        [](const Cancel&) {},
+        [](const Quote&) {},
+    };
+    ASSERT_TRUE(Trading::Dispatch(message, sizeof(message) - 1, handler));
+    EXPECT_EQ(seen, message + sizeof(header));
+
+    memmove(message + 1, message, sizeof(message) - 1);
+    ASSERT_TRUE(Trading::Dispatch(message + 1, sizeof(message) - 1, handler));
+    EXPECT_NE(seen, message + 1 + sizeof(header));
+}
+
+void protocol_journal()
+{
+    ipc::ChannelOptions options;
+    char dir[] = "/tmp/ipc-test-protocol-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir));
+    options.journal_dir = dir;
+    ipc::Node journal("protocol_journal", ipc::NodeType::kReceiver, ipc::ChannelType::kJournal, options);
+    ipc::Node writer("protocol_journal", ipc::NodeType::kSender, ipc::ChannelType::kJournal, options);
+    ASSERT_TRUE(Trading::Send(writer, Order { 2, 1.0, 5 }));
+    ASSERT_TRUE(Trading::Send(writer, Cancel { 2 }));
+
+    Tally tally;
+    ASSERT_TRUE(Trading::Read(journal, tally.Handler()));
+    ASSERT_TRUE(Trading::Read(journal, tally.Handler()));
+    EXPECT_EQ(tally.orders, std::vector<uint64_t> { 10 });
+    EXPECT_EQ(tally.cancels, std::vector<uint64_t> { 2 });
+    journal.Remove();
+    std::filesystem::remove_all(options.journal_dir);
+}
+
+TEST(PROTOCOL, node)
+{
+    protocol_node();
+}
+
+TEST(PROTOCOL, static_node)
+{
+    protocol_static_node();
+}
+
+TEST(PROTOCOL, reject)
+{
+    protocol_reject();
+}
+
+TEST(PROTOCOL, view)
+{
+    protocol_view();
+}
+
+TEST(PROTOCOL, journal)
+{
+    protocol_journal();
+}
+#endif // _WIN32
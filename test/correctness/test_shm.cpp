@@ -0,0 +1,478 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+void shm_basic()
+{
+    const char* msg = "Hello, IPC!";
+
+    std::thread server_thread([msg]() {
+        ipc::Node server_node("shm_basic", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+        auto rec = server_node.Receive();
+        if (!rec) {
+            fprintf(stderr, "Server failed to Receive message\n");
+            exit(1);
+        }
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+    });
+
+    // Ensure that the server is started and waiting for connection
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ipc::Node client_node("shm_basic", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    EXPECT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+
+    server_thread.join();
+}
+
+void shm_loop()
+{
+    const char* msg = "Hello, IPC";
+    // More messages than slots, so that the ring wraps and the sender has to wait for space
+    const int count = 1000;
+
+    std::thread server_thread([msg]() {
+        ipc::Node server_node("shm_loop", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+        for (int i = 0; i < count; ++i) {
+            auto rec = server_node.Receive();
+            if (!rec) {
+                fprintf(stderr, "Failed to Receive message\n");
+                exit(1);
+            }
+            std::string expected_msg = std::string(msg) + " - Message #" + std::to_string(i + 1);
+            EXPECT_STREQ(static_cast<const char*>(rec->Data()), expected_msg.c_str());
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ipc::Node client_node("shm_loop", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    for (int i = 0; i < count; ++i) {
+        std::string full_msg = std::string(msg) + " - Message #" + std::to_string(i + 1);
+        EXPECT_TRUE(client_node.Send(full_msg.c_str(), full_msg.size() + 1));
+    }
+
+    server_thread.join();
+}
+
+void shm_multiterminal()
+{
+    const int senders = 3;
+    const int count = 200;
+
+    ipc::Node server_node("shm_multiterminal", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id]() {
+            ipc::Node client_node("shm_multiterminal", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+
+    // Messages of each sender arrive in order
+    int next[senders] = {};
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        ASSERT_EQ(rec->Size(), 2 * sizeof(int));
+        const int* msg = static_cast<const int*>(rec->Data());
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+void shm_shared_sender()
+{
+    const int senders = 4;
+    const int count = 500;
+
+    // One Node shared by all sender threads, which connect concurrently on their first Send
+    ipc::Node client_node("shm_shared_sender", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    ipc::Node server_node("shm_shared_sender", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+    std::atomic<bool> start { false };
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id, &start, &client_node]() {
+            while (!start.load())
+                std::this_thread::yield();
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+    start = true;
+
+    // Messages of each thread arrive in order
+    int next[senders] = {};
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        ASSERT_EQ(rec->Size(), 2 * sizeof(int));
+        const int* msg = static_cast<const int*>(rec->Data());
+        ASSERT_GE(msg[0], 0);
+        ASSERT_LT(msg[0], senders);
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+void shm_scatter_gather()
+{
+    const char* header = "header|";
+    const char* payload = "Hello, IPC with iovec!";
+
+    ipc::Node server_node("shm_scatter_gather", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+    ipc::Node client_node("shm_scatter_gather", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    iovec send_iov[2] = { { const_cast<char*>(header), strlen(header) },
+        { const_cast<char*>(payload), strlen(payload) + 1 } };
+    EXPECT_TRUE(client_node.SendV(send_iov, 2));
+
+    char head[8] = {};
+    char body[64];
+    iovec recv_iov[2] = { { head, strlen(header) }, { body, sizeof(body) } };
+    size_t received_size = 0;
+    ASSERT_TRUE(server_node.ReceiveV(recv_iov, 2, received_size));
+    EXPECT_EQ(received_size, strlen(header) + strlen(payload) + 1);
+    EXPECT_STREQ(head, header);
+    EXPECT_STREQ(body, payload);
+}
+
+void shm_backpressure()
+{
+    ipc::ChannelOptions options;
+    options.capacity_messages = 4;
+    ipc::Node server_node("shm_backpressure", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+    EXPECT_EQ(server_node.Options().capacity_messages, 4u);
+
+    options.backpressure = ipc::BackpressurePolicy::kFailFast;
+    ipc::Node fail_fast("shm_backpressure", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(fail_fast.Send(&i, sizeof(i)));
+    int extra = 4;
+    EXPECT_EQ(fail_fast.Send(&extra, sizeof(extra)).Status(), SendStatus::kWouldBlock);
+
+    options.backpressure = ipc::BackpressurePolicy::kTimeout;
+    options.send_timeout = std::chrono::milliseconds(20);
+    ipc::Node timeout("shm_backpressure", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+    EXPECT_EQ(timeout.Send(&extra, sizeof(extra)).Status(), SendStatus::kTimedOut);
+
+    options.backpressure = ipc::BackpressurePolicy::kDropOldest;
+    ipc::Node drop_oldest("shm_backpressure", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+    EXPECT_TRUE(drop_oldest.Send(&extra, sizeof(extra)));
+
+    for (int i = 1; i <= 4; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_EQ(*static_cast<int*>(rec->Data()), i);
+    }
+
+    char large[5000] = {};
+    EXPECT_EQ(fail_fast.Send(large, sizeof(large)).Status(), SendStatus::kTooLarge);
+}
+
+void shm_huge_pages()
+{
+    const long base_page_size = sysconf(_SC_PAGESIZE);
+    for (HugePages huge_pages : { HugePages::kNone, HugePages::kTransparent, HugePages::kExplicit }) {
+        ipc::ChannelOptions options;
+        options.huge_pages = huge_pages;
+        ipc::Node server_node("shm_huge_pages", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+        // Huge pages are best effort, the page size actually used is reported either way
+        size_t page_size = server_node.Stats().page_size;
+        EXPECT_GE(page_size, static_cast<size_t>(base_page_size));
+        if (huge_pages == HugePages::kNone) {
+            EXPECT_EQ(page_size, static_cast<size_t>(base_page_size));
+        }
+
+        ipc::Node client_node("shm_huge_pages", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+        const char* msg = "Hello, huge pages!";
+        EXPECT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+        EXPECT_EQ(client_node.Stats().page_size, page_size);
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+    }
+}
+
+void shm_disconnected()
+{
+    const char* msg = "Hello, IPC!";
+    ipc::Node client_node("shm_disconnected", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    EXPECT_EQ(client_node.Send(msg, strlen(msg) + 1).Status(), SendStatus::kDisconnected);
+
+    // The sender connects as soon as a receiver exists, and again after it is replaced
+    for (int i = 0; i < 2; ++i) {
+        ipc::Node server_node("shm_disconnected", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+        EXPECT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+    }
+    EXPECT_EQ(client_node.Send(msg, strlen(msg) + 1).Status(), SendStatus::kDisconnected);
+}
+
+void shm_doorbell()
+{
+    ipc::Node server_node("shm_doorbell", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+    ipc::Node client_node("shm_doorbell", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    EXPECT_GT(server_node.Options().spin_budget, 0u);
+
+    // Nobody sleeps while the ring neither runs empty nor full, so no wakeup syscalls are made
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE(client_node.Send(&i, sizeof(i)));
+    for (int i = 0; i < 100; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_EQ(*static_cast<int*>(rec->Data()), i);
+    }
+    EXPECT_EQ(server_node.Stats().wakeups, 0u);
+    EXPECT_EQ(server_node.Stats().sleeps, 0u);
+
+    // A sleeping receiver is woken up by the next message
+    std::thread server_thread([&server_node]() {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_EQ(*static_cast<int*>(rec->Data()), 100);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int last = 100;
+    EXPECT_TRUE(client_node.Send(&last, sizeof(last)));
+    server_thread.join();
+    EXPECT_GE(server_node.Stats().sleeps, 1u);
+    EXPECT_GE(server_node.Stats().wakeups, 1u);
+}
+
+void shm_dispatch()
+{
+    const int keys = 16;
+    const int count = 50;
+    ipc::ChannelOptions options;
+    options.partitions = 4;
+
+    ipc::Node server_node("shm_dispatch", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+    EXPECT_EQ(server_node.Options().partitions, 4u);
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    int next[keys] = {};
+    size_t owner[keys];
+    std::fill(owner, owner + keys, SIZE_MAX);
+    int handled = 0;
+    std::thread server_thread([&]() {
+        EXPECT_TRUE(server_node.Dispatch([&](size_t partition, std::shared_ptr<Buffer> message) {
+            ASSERT_EQ(message->Size(), 2 * sizeof(int));
+            const int* msg = static_cast<const int*>(message->Data());
+            std::lock_guard<std::mutex> lock(mutex);
+            // Every key sticks to one partition and its messages are handled in order
+            if (owner[msg[0]] == SIZE_MAX)
+                owner[msg[0]] = partition;
+            EXPECT_EQ(owner[msg[0]], partition);
+            EXPECT_EQ(msg[1], next[msg[0]]++);
+            if (++handled == keys * count)
+                cond.notify_one();
+        }));
+    });
+
+    ipc::Node client_node("shm_dispatch", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+    for (int i = 0; i < count; ++i) {
+        for (int key = 0; key < keys; ++key) {
+            int msg[2] = { key, i };
+            EXPECT_TRUE(client_node.SendKeyed(key, msg, sizeof(msg)));
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return handled == keys * count; });
+    }
+    // Removing the Node stops the workers
+    server_node.Remove();
+    server_thread.join();
+}
+
+void shm_receive_into()
+{
+    ipc::Node server_node("shm_receive_into", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+    ipc::Node client_node("shm_receive_into", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+
+    char msg[1000];
+    for (size_t i = 0; i < sizeof(msg); ++i)
+        msg[i] = static_cast<char>(i);
+    EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+    EXPECT_TRUE(client_node.Send(msg, 100));
+    EXPECT_TRUE(client_node.Send(msg, 100));
+
+    // A destination that is too small reports the required size and keeps the message
+    alignas(8) char arena[2048];
+    ReceiveResult result = server_node.ReceiveInto(arena, 500);
+    EXPECT_EQ(result.Status(), ReceiveStatus::kTooSmall);
+    EXPECT_EQ(result.Size(), sizeof(msg));
+    result = server_node.ReceiveInto(arena, result.Size());
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.Size(), sizeof(msg));
+    EXPECT_EQ(memcmp(arena, msg, sizeof(msg)), 0);
+
+    // Room to spare and an unaligned destination
+    result = server_node.ReceiveInto(arena, sizeof(arena));
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.Size(), 100u);
+    EXPECT_EQ(memcmp(arena, msg, 100), 0);
+    result = server_node.ReceiveInto(arena + 1, 100);
+    ASSERT_TRUE(result);
+    EXPECT_EQ(memcmp(arena + 1, msg, 100), 0);
+}
+
+void shm_busy_poll_remove()
+{
+    // A busy polling receiver never sleeps, Remove() must still stop it
+    ipc::ChannelOptions options;
+    options.busy_poll = true;
+    ipc::Node server_node("shm_busy_poll_remove", ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+
+    std::atomic<bool> handled = false;
+    std::atomic<bool> returned = false;
+    std::thread server_thread([&]() {
+        EXPECT_TRUE(server_node.Dispatch([&](size_t, std::shared_ptr<Buffer>) { handled = true; }));
+        returned = true;
+    });
+
+    // Once a message has been handled the receiver spins on the empty ring
+    ipc::Node client_node("shm_busy_poll_remove", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory, options);
+    int msg = 1;
+    ASSERT_TRUE(client_node.SendKeyed(0, &msg, sizeof(msg)));
+    while (!handled)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(returned);
+    server_node.Remove();
+    server_thread.join();
+    EXPECT_TRUE(returned);
+}
+
+// Start a kReceiver in a child process that dies without calling Remove()
+void shm_crash_receiver(const char* name)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        new ipc::Node(name, ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory);
+        _exit(0);
+    }
+    ASSERT_GT(pid, 0);
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+void shm_restart(RecoveryPolicy policy)
+{
+    const char* name = policy == RecoveryPolicy::kReattach ? "shm_restart_reattach" : "shm_restart_reclaim";
+    const char* before = "Sent before restart";
+    const char* after = "Sent after restart";
+    ipc::ChannelOptions options;
+    options.recovery = policy;
+
+    shm_crash_receiver(name);
+    ipc::Node client_node(name, ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    EXPECT_TRUE(client_node.Send(before, strlen(before) + 1));
+
+    ipc::Node server_node(name, ipc::NodeType::kReceiver, ipc::ChannelType::kSharedMemory, options);
+    // The sender keeps using the Node it created before the restart
+    EXPECT_TRUE(client_node.Send(after, strlen(after) + 1));
+
+    if (policy == RecoveryPolicy::kReattach) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), before);
+    }
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_STREQ(static_cast<const char*>(rec->Data()), after);
+}
+
+TEST(SHM, basic)
+{
+    shm_basic();
+}
+
+TEST(SHM, loop)
+{
+    shm_loop();
+}
+
+TEST(SHM, multiterminal)
+{
+    shm_multiterminal();
+}
+
+TEST(SHM, shared_sender)
+{
+    shm_shared_sender();
+}
+
+TEST(SHM, scatter_gather)
+{
+    shm_scatter_gather();
+}
+
+TEST(SHM, backpressure)
+{
+    shm_backpressure();
+}
+
+TEST(SHM, huge_pages)
+{
+    shm_huge_pages();
+}
+
+TEST(SHM, disconnected)
+{
+    shm_disconnected();
+}
+TEST(SHM, doorbell)
+{
+    shm_doorbell();
+}
+
+TEST(SHM, dispatch)
+{
+    shm_dispatch();
+}
+
+TEST(SHM, receive_into)
+{
+    shm_receive_into();
+}
+
+TEST(SHM, busy_poll_remove)
+{
+    shm_busy_poll_remove();
+}
+
+TEST(SHM, restart)
+{
+    shm_restart(RecoveryPolicy::kReattach);
+    shm_restart(RecoveryPolicy::kReclaim);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef _WIN32
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "ipc/ipc.h"
+#include "ipc/msgq/msgq.h"
+#include "ipc/shm/shm.h"
+#include "ipc/static_node.h"
+
+using namespace ipc;
+
+using ShmSender = StaticNode<shm::SharedMemory, NodeType::kSender>;
+using ShmReceiver = StaticNode<shm::SharedMemory, NodeType::kReceiver>;
+
+// The role is part of the type, calls it does not allow do not compile
+template <typename NodeT>
+concept CanSend = requires(NodeT& node) { node.Send(nullptr, 0); node.SendV(nullptr, 0); };
+template <typename NodeT>
+concept CanReceive = requires(NodeT& node) { node.Receive(); node.Read(std::declval<JournalEntry&>()); };
+static_assert(CanSend<ShmSender> && !CanReceive<ShmSender>);
+static_assert(CanReceive<ShmReceiver> && !CanSend<ShmReceiver>);
+// Only transports that keep deadlines themselves offer SendBefore
+template <typename NodeT>
+concept CanSendBefore = requires(NodeT& node) { node.SendBefore(Deadline(), nullptr, 0); };
+static_assert(CanSendBefore<ShmSender> && !CanSendBefore<StaticNode<msgq::MessageQueue, NodeType::kSender>>);
+
+void static_node_loop()
+{
+    const int count = 1000;
+    ShmReceiver server_node("static_node_loop");
+    ShmSender client_node("static_node_loop");
+
+    std::thread client_thread([&]() {
+        for (int i = 0; i < count; ++i) {
+            std::string msg = "Hello, IPC - Message #" + std::to_string(i + 1);
+            EXPECT_TRUE(client_node.Send(msg.c_str(), msg.size() + 1));
+        }
+    });
+    for (int i = 0; i < count; ++i) {
+        Buffer rec;
+        ASSERT_TRUE(server_node.Receive(rec));
+        std::string expected = "Hello, IPC - Message #" + std::to_string(i + 1);
+        EXPECT_STREQ(static_cast<const char*>(rec.Data()), expected.c_str());
+    }
+    client_thread.join();
+    EXPECT_EQ(server_node.Options().max_message_size, client_node.Options().max_message_size);
+}
+
+void static_node_interop()
+{
+    // A StaticNode and a Node of the same name and transport talk to each other
+    const char* msg = "Hello, IPC!";
+    ipc::Node server_node("static_node_interop", ipc::NodeType::kReceiver, ipc::ChannelType::kMessageQueue);
+    StaticNode<msgq::MessageQueue, NodeType::kSender> client_node("static_node_interop");
+    ASSERT_TRUE(client_node.Send(msg, strlen(msg) + 1));
+    auto rec = server_node.Receive();
+    ASSERT_TRUE(rec);
+    EXPECT_STREQ(static_cast<const char*>(rec->Data()), msg);
+
+    ipc::Node sender_node("static_node_interop_back", ipc::NodeType::kSender, ipc::ChannelType::kSharedMemory);
+    ShmReceiver receiver_node("static_node_interop_back");
+    ASSERT_TRUE(sender_node.Send(msg, strlen(msg) + 1));
+    char data[64];
+    ReceiveResult result = receiver_node.ReceiveInto(data, sizeof(data));
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result.Size(), strlen(msg) + 1);
+    EXPECT_STREQ(data, msg);
+
+    // Remove stops a blocked receiver, the channel stays valid until the StaticNode goes away
+    std::thread remover([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        receiver_node.Remove();
+    });
+    EXPECT_FALSE(receiver_node.Receive());
+    remover.join();
+}
+
+TEST(STATIC, loop)
+{
+    static_node_loop();
+}
+
+TEST(STATIC, interop)
+{
+    static_node_interop();
+}
+#endif // _WIN32
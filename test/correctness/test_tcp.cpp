@@ -0,0 +1,118 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+using namespace ipc;
+
+void tcp_loop()
+{
+    // Port 0 lets the system pick a free port, the receiver maps the name to it
+    ipc::MapEndpoint("tcp_loop", "127.0.0.1:0");
+    ipc::ChannelOptions options;
+    options.max_message_size = 256 * 1024;
+    ipc::Node server_node("tcp_loop", ipc::NodeType::kReceiver, ipc::ChannelType::kTcp, options);
+    ipc::Node client_node("tcp_loop", ipc::NodeType::kSender, ipc::ChannelType::kTcp, options);
+
+    // Messages of every size stay whole and in order, including empty ones and those larger
+    // than the receive buffers
+    const int count = 1000;
+    std::thread client_thread([&]() {
+        for (int i = 0; i < count; ++i) {
+            std::string msg = "Hello, IPC - Message #" + std::to_string(i + 1) + std::string(i % 7 == 0 ? i * 200 : 0, 'x');
+            EXPECT_TRUE(client_node.Send(msg.c_str(), msg.size() + 1));
+        }
+        EXPECT_TRUE(client_node.Send(nullptr, 0));
+    });
+
+    for (int i = 0; i < count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        std::string expected = "Hello, IPC - Message #" + std::to_string(i + 1) + std::string(i % 7 == 0 ? i * 200 : 0, 'x');
+        EXPECT_STREQ(static_cast<const char*>(rec->Data()), expected.c_str());
+    }
+    Buffer empty;
+    ASSERT_TRUE(server_node.Receive(empty));
+    EXPECT_EQ(empty.Size(), 0u);
+    client_thread.join();
+
+    // Oversized messages are rejected by the sender
+    std::vector<char> large(options.max_message_size + 1);
+    EXPECT_EQ(client_node.Send(large.data(), large.size()), SendStatus::kTooLarge);
+}
+
+void tcp_multiterminal()
+{
+    const int senders = 3;
+    const int count = 200;
+
+    ipc::MapEndpoint("tcp_multiterminal", "127.0.0.1:0");
+    ipc::Node server_node("tcp_multiterminal", ipc::NodeType::kReceiver, ipc::ChannelType::kTcp);
+    std::vector<std::thread> client_threads;
+    for (int id = 0; id < senders; ++id) {
+        client_threads.emplace_back([id]() {
+            ipc::Node client_node("tcp_multiterminal", ipc::NodeType::kSender, ipc::ChannelType::kTcp);
+            for (int i = 0; i < count; ++i) {
+                int msg[2] = { id, i };
+                EXPECT_TRUE(client_node.Send(msg, sizeof(msg)));
+            }
+        });
+    }
+
+    // Every connection delivers its messages in order
+    std::vector<int> next(senders, 0);
+    for (int i = 0; i < senders * count; ++i) {
+        auto rec = server_node.Receive();
+        ASSERT_TRUE(rec);
+        ASSERT_EQ(rec->Size(), 2 * sizeof(int));
+        const int* msg = static_cast<const int*>(rec->Data());
+        EXPECT_EQ(msg[1], next[msg[0]]++);
+    }
+    for (auto& client_thread : client_threads)
+        client_thread.join();
+}
+
+void tcp_disconnected()
+{
+    // Nothing listens on the endpoint of the receiver once it is removed
+    ipc::MapEndpoint("tcp_disconnected", "127.0.0.1:0");
+    std::string endpoint;
+    {
+        ipc::Node server_node("tcp_disconnected", ipc::NodeType::kReceiver, ipc::ChannelType::kTcp);
+        EXPECT_TRUE(server_node.Remove());
+    }
+    ipc::Node client_node("tcp_disconnected", ipc::NodeType::kSender, ipc::ChannelType::kTcp);
+    const char* msg = "Hello, IPC!";
+    EXPECT_EQ(client_node.Send(msg, strlen(msg) + 1), SendStatus::kDisconnected);
+
+    // Receive returns once the receiver is removed
+    ipc::MapEndpoint("tcp_disconnected", "127.0.0.1:0");
+    ipc::Node server_node("tcp_disconnected", ipc::NodeType::kReceiver, ipc::ChannelType::kTcp);
+    std::thread remover([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        server_node.Remove();
+    });
+    EXPECT_FALSE(server_node.Receive());
+    remover.join();
+}
+
+TEST(TCP, loop)
+{
+    tcp_loop();
+}
+
+TEST(TCP, multiterminal)
+{
+    tcp_multiterminal();
+}
+
+TEST(TCP, disconnected)
+{
+    tcp_disconnected();
+}
+#endif // _WIN32
@@ -0,0 +1,135 @@
+#ifndef _WIN32
+#include <condition_variable>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ipc/uring/engine.h"
+
+void uring_batch(bool use_io_uring)
+{
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    // Receive everything the other end sends, as one byte stream
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::string received;
+    bool closed = false;
+    size_t sent = 0;
+    uring::Engine engine(2, use_io_uring);
+    ASSERT_TRUE(engine.ReceiveStream(sockets[1], [&](const void* data, ssize_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (size > 0)
+            received.append(static_cast<const char*>(data), size);
+        else
+            closed = true;
+        cond.notify_all();
+    }));
+    engine.Flush();
+
+    // Queue many sends with a header and a body each, and submit them together
+    const int count = 100;
+    std::string expected;
+    std::vector<std::string> bodies;
+    for (int i = 0; i < count; ++i) {
+        bodies.push_back("Hello, IPC - Message #" + std::to_string(i + 1) + std::string(i * 10, 'x'));
+        expected += "<" + bodies.back();
+    }
+    for (int i = 0; i < count; ++i) {
+        iovec iov[2] = { { const_cast<char*>("<"), 1 }, { bodies[i].data(), bodies[i].size() } };
+        ASSERT_TRUE(engine.SendV(sockets[0], iov, 2, [&](ssize_t result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            EXPECT_GT(result, 0);
+            sent += result;
+        }));
+    }
+    uring::EngineStats before = engine.Stats();
+    engine.Flush();
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ASSERT_TRUE(cond.wait_for(lock, std::chrono::seconds(10), [&] { return received.size() >= expected.size(); }));
+    }
+    EXPECT_EQ(received, expected);
+    // The queued sends go out in a single sendmsg(2), submitted with a single system call
+    if (engine.IoUring()) {
+        EXPECT_EQ(engine.Stats().submits - before.submits, 1u);
+        EXPECT_EQ(engine.Stats().operations - before.operations, 1u);
+    }
+
+    // The stream ends once the peer closes
+    close(sockets[0]);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ASSERT_TRUE(cond.wait_for(lock, std::chrono::seconds(10), [&] { return closed; }));
+    }
+    EXPECT_EQ(sent, expected.size());
+    close(sockets[1]);
+}
+
+void uring_cancel(bool use_io_uring)
+{
+    int sockets[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    // A plain receive completes with the bytes sent
+    char data[64];
+    ssize_t result = 0;
+    ssize_t receive_result = 0;
+    ssize_t stream_result = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    uring::Engine engine(1, use_io_uring);
+    ASSERT_TRUE(engine.Receive(sockets[1], data, sizeof(data), [&](ssize_t res) {
+        std::lock_guard<std::mutex> lock(mutex);
+        result = res;
+        cond.notify_all();
+    }));
+    engine.Flush();
+    const char* msg = "Hello, IPC!";
+    ASSERT_EQ(write(sockets[0], msg, strlen(msg) + 1), static_cast<ssize_t>(strlen(msg) + 1));
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ASSERT_TRUE(cond.wait_for(lock, std::chrono::seconds(10), [&] { return result != 0; }));
+    }
+    EXPECT_EQ(result, static_cast<ssize_t>(strlen(msg) + 1));
+    EXPECT_STREQ(data, msg);
+
+    // Cancel returns once the pending receives have completed
+    ASSERT_TRUE(engine.Receive(sockets[1], data, sizeof(data), [&](ssize_t res) { receive_result = res; }));
+    ASSERT_TRUE(engine.ReceiveStream(sockets[1], [&](const void*, ssize_t size) { stream_result = size; }));
+    engine.Flush();
+    engine.Cancel(sockets[1]);
+    EXPECT_EQ(receive_result, -ECANCELED);
+    EXPECT_EQ(stream_result, -ECANCELED);
+
+    // Operations still outstanding when the engine goes away are cancelled as well
+    {
+        uring::Engine scoped(1, use_io_uring);
+        ASSERT_TRUE(scoped.Receive(sockets[1], data, sizeof(data), [&](ssize_t res) { receive_result = res; }));
+        scoped.Flush();
+        receive_result = 0;
+    }
+    EXPECT_EQ(receive_result, -ECANCELED);
+
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+TEST(URING, batch)
+{
+    uring_batch(true);
+    uring_batch(false);
+}
+
+TEST(URING, cancel)
+{
+    uring_cancel(true);
+    uring_cancel(false);
+}
+#endif // _WIN32
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Payload of size bytes that differs with seed, so that a message is checked byte for byte
+inline std::vector<char> Pattern(size_t size, int seed)
+{
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i)
+        data[i] = static_cast<char>(i * 131 + seed);
+    return data;
+}
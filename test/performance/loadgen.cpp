@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+// Open-loop load generator: M sender processes offer load on a schedule of their own, independent of
+// how fast N receiver processes keep up, so queues build up and the saturation point becomes visible
+// Every message carries the time it was due, latency is measured from there to its receipt, which
+// includes the time a message waited behind a sender that fell behind its schedule
+
+namespace {
+
+struct Header {
+    uint64_t seq;
+    int64_t due_ns; // Steady clock, shared by all processes on the host
+    uint32_t sender;
+    uint32_t end; // Not counted: END_OF_SENDER or STOP
+};
+
+constexpr uint32_t END_OF_SENDER = 1; // Last message of a sender
+constexpr uint32_t STOP = 2;          // Sent by the main process if end markers went missing
+
+enum class Arrival {
+    kConstant, // Evenly spaced
+    kPoisson,  // Exponential gaps
+    kBursty    // Bursts of back-to-back messages, the bursts arrive as a Poisson process
+};
+
+struct Config {
+    ipc::ChannelType channel = ipc::ChannelType::kSharedMemory;
+    std::string channel_name = "shm";
+    int senders = 1;
+    int receivers = 1;
+    double rate = 10000; // Messages per second and sender, 0 sends as fast as possible
+    Arrival arrival = Arrival::kConstant;
+    std::string arrival_name = "constant";
+    size_t burst = 32;
+    std::string sizes = "fixed:64";
+    double duration = 5;
+    int port = 7300;
+    uint64_t seed = 1;
+    ipc::ChannelOptions options;
+};
+
+// Message sizes: fixed:<bytes>, uniform:<min>:<max> or histogram:<file> with "<bytes> <weight>" lines
+class SizeDistribution {
+public:
+    bool Parse(const std::string& spec)
+    {
+        if (spec.rfind("fixed:", 0) == 0) {
+            min_ = max_ = std::stoul(spec.substr(6));
+        } else if (spec.rfind("uniform:", 0) == 0) {
+            size_t colon = spec.find(':', 8);
+            if (colon == std::string::npos)
+                return false;
+            min_ = std::stoul(spec.substr(8, colon - 8));
+            max_ = std::stoul(spec.substr(colon + 1));
+        } else if (spec.rfind("histogram:", 0) == 0) {
+            std::ifstream file(spec.substr(10));
+            size_t size;
+            double weight;
+            std::vector<double> weights;
+            while (file >> size >> weight) {
+                sizes_.push_back(size);
+                weights.push_back(weight);
+            }
+            if (sizes_.empty())
+                return false;
+            pick_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+            min_ = *std::min_element(sizes_.begin(), sizes_.end());
+            max_ = *std::max_element(sizes_.begin(), sizes_.end());
+        } else {
+            return false;
+        }
+        return min_ <= max_;
+    }
+
+    // Every message holds at least the header
+    size_t operator()(std::mt19937_64& rng)
+    {
+        size_t size = min_;
+        if (!sizes_.empty())
+            size = sizes_[pick_(rng)];
+        else if (max_ > min_)
+            size = std::uniform_int_distribution<size_t>(min_, max_)(rng);
+        return std::max(size, sizeof(Header));
+    }
+    size_t Max() const { return std::max(max_, sizeof(Header)); }
+
+private:
+    size_t min_ = 0;
+    size_t max_ = 0;
+    std::vector<size_t> sizes_;
+    std::discrete_distribution<size_t> pick_;
+};
+
+// Latency histogram with 16 linear buckets per power of two, values within about 6%
+class Histogram {
+public:
+    void Record(uint64_t value)
+    {
+        ++counts_[Index(value)];
+        ++total_;
+        max_ = std::max(max_, value);
+    }
+
+    void Merge(const Histogram& other)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t Percentile(double p) const
+    {
+        if (total_ == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100 * total_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank && seen > 0)
+                return std::min(Value(i), max_);
+        }
+        return max_;
+    }
+    uint64_t Max() const { return max_; }
+
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr size_t BUCKETS = 64 * SUB_BUCKETS;
+
+    uint64_t counts_[BUCKETS] = {};
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+
+    static size_t Index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+    // Middle of the values of a bucket
+    static uint64_t Value(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+        int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+        uint64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t(1) << shift) >> 1);
+    }
+};
+
+// Written by every child to its pipe once it is done
+struct SenderReport {
+    uint64_t sent = 0;
+    uint64_t dropped = 0; // kDropped
+    uint64_t would_block = 0;
+    uint64_t timed_out = 0;
+    uint64_t errors = 0; // Any other failure
+    uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+struct ReceiverReport {
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+    double seconds = 0; // From the first to the last message
+    Histogram latency;
+};
+
+int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string ReceiverName(int receiver)
+{
+    return "ipc-loadgen-" + std::to_string(receiver);
+}
+
+bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* pos = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, pos, size);
+        if (written <= 0)
+            return false;
+        pos += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size)
+{
+    char* pos = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t got = read(fd, pos, size);
+        if (got <= 0)
+            return false;
+        pos += got;
+        size -= got;
+    }
+    return true;
+}
+
+// Wait until due, sleeping for long gaps and spinning for the last stretch
+void WaitUntil(int64_t due_ns)
+{
+    const int64_t spin_ns = 50000;
+    int64_t now = NowNs();
+    if (due_ns - now > spin_ns)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now - spin_ns));
+    while (NowNs() < due_ns)
+        std::this_thread::yield();
+}
+
+void RunReceiver(const Config& config, int receiver, int fd)
+{
+    ipc::Node node(ReceiverName(receiver), ipc::NodeType::kReceiver, config.channel, config.options);
+    char ready = 1;
+    WriteAll(fd, &ready, 1);
+
+    auto report = std::make_unique<ReceiverReport>();
+    ipc::Buffer message;
+    int64_t first = 0;
+    int64_t last = 0;
+    for (int ended = 0; ended < config.senders;) {
+        if (!node.Receive(message))
+            break;
+        int64_t now = NowNs();
+        Header header;
+        memcpy(&header, message.Data(), sizeof(header));
+        if (header.end == STOP)
+            break;
+        if (header.end) {
+            ++ended;
+            continue;
+        }
+        if (report->received++ == 0)
+            first = now;
+        last = now;
+        report->bytes += message.Size();
+        report->latency.Record(static_cast<uint64_t>(std::max<int64_t>(0, now - header.due_ns)));
+    }
+    report->seconds = (last - first) / 1e9;
+    WriteAll(fd, report.get(), sizeof(*report));
+}
+
+void RunSender(const Config& config, int sender, int fd)
+{
+    std::vector<std::unique_ptr<ipc::Node>> nodes;
+    for (int receiver = 0; receiver < config.receivers; ++receiver)
+        nodes.push_back(std::make_unique<ipc::Node>(ReceiverName(receiver), ipc::NodeType::kSender, config.channel, config.options));
+
+    std::mt19937_64 rng(config.seed * 1000003 + sender);
+    SizeDistribution sizes;
+    sizes.Parse(config.sizes);
+    std::exponential_distribution<double> gap(config.arrival == Arrival::kBursty ? config.rate / config.burst : config.rate);
+    std::vector<char> message(sizes.Max(), 'x');
+
+    SenderReport report;
+    const int64_t start = NowNs();
+    const int64_t end = start + static_cast<int64_t>(config.duration * 1e9);
+    int64_t due = start;
+    for (uint64_t seq = 0; due < end; ++seq) {
+        if (config.rate > 0)
+            WaitUntil(due);
+        else
+            due = NowNs();
+
+        Header header = { seq, due, static_cast<uint32_t>(sender), 0 };
+        size_t size = sizes(rng);
+        memcpy(message.data(), &header, sizeof(header));
+        switch (nodes[seq % nodes.size()]->Send(message.data(), size).Status()) {
+        case ipc::SendStatus::kOk:
+            ++report.sent;
+            report.bytes += size;
+            break;
+        case ipc::SendStatus::kDropped:
+            ++report.dropped;
+            break;
+        case ipc::SendStatus::kWouldBlock:
+            ++report.would_block;
+            break;
+        case ipc::SendStatus::kTimedOut:
+            ++report.timed_out;
+            break;
+        default:
+            ++report.errors;
+            break;
+        }
+
+        if (config.rate <= 0)
+            continue;
+        switch (config.arrival) {
+        case Arrival::kConstant:
+            due = start + static_cast<int64_t>((seq + 1) * 1e9 / config.rate);
+            break;
+        case Arrival::kPoisson:
+            due += static_cast<int64_t>(gap(rng) * 1e9);
+            break;
+        case Arrival::kBursty:
+            if ((seq + 1) % config.burst == 0)
+                due += static_cast<int64_t>(gap(rng) * 1e9);
+            break;
+        }
+    }
+    report.seconds = (NowNs() - start) / 1e9;
+
+    // Tell every receiver that this sender is done, whatever the backpressure policy
+    Header header = { 0, 0, static_cast<uint32_t>(sender), END_OF_SENDER };
+    for (auto& node : nodes) {
+        for (int attempt = 0; attempt < 10000 && !node->Send(&header, sizeof(header)); ++attempt)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    WriteAll(fd, &report, sizeof(report));
+}
+
+// Fork a child running body with the write end of a pipe, returns the read end
+int Spawn(std::vector<pid_t>& children, const std::function<void(int)>& body)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        body(fds[1]);
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+    children.push_back(pid);
+    return fds[0];
+}
+
+// How long a receiver may take to drain once all senders are done
+constexpr int DRAIN_TIMEOUT_MS = 5000;
+
+void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [--channel msgq|shm|tcp|hybrid] [--senders <m>] [--receivers <n>] [--rate <msg/s>]"
+              << " [--arrival constant|poisson|bursty] [--burst <n>] [--sizes <spec>] [--duration <s>]"
+              << " [--policy block|timeout|failfast|drop-newest|drop-oldest] [--capacity <bytes>] [--port <port>] [--seed <n>]" << std::endl;
+    std::cerr << "  --channel     Transport to load (default shm), tcp listens on 127.0.0.1 from --port on (default 7300)" << std::endl;
+    std::cerr << "  --senders     Number of sender processes (default 1)" << std::endl;
+    std::cerr << "  --receivers   Number of receiver processes, each sender spreads its messages over all (default 1)" << std::endl;
+    std::cerr << "  --rate        Messages per second of every sender, 0 sends as fast as possible (default 10000)" << std::endl;
+    std::cerr << "  --arrival     Schedule of the messages (default constant), bursty sends --burst messages at once (default 32)" << std::endl;
+    std::cerr << "  --sizes       fixed:<bytes>, uniform:<min>:<max> or histogram:<file> with \"<bytes> <weight>\" lines (default fixed:64)" << std::endl;
+    std::cerr << "  --duration    Seconds of load (default 5)" << std::endl;
+    std::cerr << "  --policy      Backpressure of the senders (default block), the others count failed sends as drops" << std::endl;
+    std::cerr << "  --capacity    Capacity of every channel in bytes (default of the transport)" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Config config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--channel" && value == "msgq") {
+            config.channel = ipc::ChannelType::kMessageQueue;
+        } else if (arg == "--channel" && value == "shm") {
+            config.channel = ipc::ChannelType::kSharedMemory;
+        } else if (arg == "--channel" && value == "tcp") {
+            config.channel = ipc::ChannelType::kTcp;
+        } else if (arg == "--channel" && value == "hybrid") {
+            config.channel = ipc::ChannelType::kHybrid;
+        } else if (arg == "--senders" && !value.empty()) {
+            config.senders = std::max(1, std::stoi(value));
+        } else if (arg == "--receivers" && !value.empty()) {
+            config.receivers = std::max(1, std::stoi(value));
+        } else if (arg == "--rate" && !value.empty()) {
+            config.rate = std::max(0.0, std::stod(value));
+        } else if (arg == "--arrival" && value == "constant") {
+            config.arrival = Arrival::kConstant;
+        } else if (arg == "--arrival" && value == "poisson") {
+            config.arrival = Arrival::kPoisson;
+        } else if (arg == "--arrival" && value == "bursty") {
+            config.arrival = Arrival::kBursty;
+        } else if (arg == "--burst" && !value.empty()) {
+            config.burst = std::max(1, std::stoi(value));
+        } else if (arg == "--sizes" && !value.empty()) {
+            config.sizes = value;
+        } else if (arg == "--duration" && !value.empty()) {
+            config.duration = std::stod(value);
+        } else if (arg == "--policy" && value == "block") {
+            config.options.backpressure = ipc::BackpressurePolicy::kBlock;
+        } else if (arg == "--policy" && value == "timeout") {
+            config.options.backpressure = ipc::BackpressurePolicy::kTimeout;
+        } else if (arg == "--policy" && value == "failfast") {
+            config.options.backpressure = ipc::BackpressurePolicy::kFailFast;
+        } else if (arg == "--policy" && value == "drop-newest") {
+            config.options.backpressure = ipc::BackpressurePolicy::kDropNewest;
+        } else if (arg == "--policy" && value == "drop-oldest") {
+            config.options.backpressure = ipc::BackpressurePolicy::kDropOldest;
+        } else if (arg == "--capacity" && !value.empty()) {
+            config.options.capacity_bytes = std::stoul(value);
+        } else if (arg == "--port" && !value.empty()) {
+            config.port = std::stoi(value);
+        } else if (arg == "--seed" && !value.empty()) {
+            config.seed = std::stoull(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        if (arg == "--channel")
+            config.channel_name = value;
+        if (arg == "--arrival")
+            config.arrival_name = value;
+        i++;
+    }
+
+    SizeDistribution sizes;
+    if (!sizes.Parse(config.sizes)) {
+        std::cerr << "Invalid size distribution " << config.sizes << std::endl;
+        return 1;
+    }
+    config.options.max_message_size = sizes.Max();
+    for (int receiver = 0; receiver < config.receivers; ++receiver)
+        ipc::MapEndpoint(ReceiverName(receiver), "127.0.0.1:" + std::to_string(config.port + receiver));
+
+    // Receivers first, senders only start once every receiver exists
+    std::vector<pid_t> children;
+    std::vector<int> receiver_fds;
+    for (int receiver = 0; receiver < config.receivers; ++receiver) {
+        int fd = Spawn(children, [&](int fd) { RunReceiver(config, receiver, fd); });
+        char ready;
+        if (fd < 0 || !ReadAll(fd, &ready, 1)) {
+            std::cerr << "Receiver " << receiver << " failed to start" << std::endl;
+            return 1;
+        }
+        receiver_fds.push_back(fd);
+    }
+    std::vector<int> sender_fds;
+    for (int sender = 0; sender < config.senders; ++sender) {
+        int fd = Spawn(children, [&](int fd) { RunSender(config, sender, fd); });
+        if (fd < 0) {
+            std::cerr << "Sender " << sender << " failed to start" << std::endl;
+            return 1;
+        }
+        sender_fds.push_back(fd);
+    }
+
+    SenderReport sent;
+    for (int fd : sender_fds) {
+        SenderReport report;
+        if (!ReadAll(fd, &report, sizeof(report))) {
+            std::cerr << "A sender exited without a report" << std::endl;
+            continue;
+        }
+        sent.sent += report.sent;
+        sent.dropped += report.dropped;
+        sent.would_block += report.would_block;
+        sent.timed_out += report.timed_out;
+        sent.errors += report.errors;
+        sent.bytes += report.bytes;
+        sent.seconds = std::max(sent.seconds, report.seconds);
+        close(fd);
+    }
+    auto received = std::make_unique<ReceiverReport>();
+    for (int receiver = 0; receiver < config.receivers; ++receiver) {
+        // kDropOldest may evict end markers, stop a receiver that is still waiting for them
+        const int fd = receiver_fds[receiver];
+        struct pollfd pending = { fd, POLLIN, 0 };
+        if (poll(&pending, 1, DRAIN_TIMEOUT_MS) == 0) {
+            ipc::ChannelOptions options = config.options;
+            options.backpressure = ipc::BackpressurePolicy::kBlock;
+            ipc::Node stopper(ReceiverName(receiver), ipc::NodeType::kSender, config.channel, options);
+            Header header = { 0, 0, 0, STOP };
+            stopper.Send(&header, sizeof(header));
+        }
+        auto report = std::make_unique<ReceiverReport>();
+        if (!ReadAll(fd, report.get(), sizeof(*report))) {
+            std::cerr << "A receiver exited without a report" << std::endl;
+            continue;
+        }
+        received->received += report->received;
+        received->bytes += report->bytes;
+        received->seconds = std::max(received->seconds, report->seconds);
+        received->latency.Merge(report->latency);
+        close(fd);
+    }
+    for (pid_t child : children)
+        waitpid(child, nullptr, 0);
+
+    const uint64_t failed = sent.dropped + sent.would_block + sent.timed_out + sent.errors;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Load Results (" << config.channel_name << ", " << config.senders << " senders x "
+              << (config.rate > 0 ? std::to_string(static_cast<uint64_t>(config.rate)) + " msg/s " + config.arrival_name : "unpaced")
+              << ", " << config.receivers << " receivers, sizes " << config.sizes << ", " << config.duration << " s):" << std::endl;
+    if (config.rate > 0)
+        std::cout << "  Offered:   " << config.rate * config.senders << " msg/s" << std::endl;
+    std::cout << "  Sent:      " << sent.sent / sent.seconds << " msg/s" << std::endl;
+    std::cout << "  Received:  " << received->received / std::max(received->seconds, 1e-9) << " msg/s, "
+              << received->bytes / std::max(received->seconds, 1e-9) / (1 << 20) << " MiB/s" << std::endl;
+    std::cout << "  Dropped:   " << failed << " (" << sent.dropped << " dropped, " << sent.would_block << " would block, "
+              << sent.timed_out << " timed out, " << sent.errors << " errors)" << std::endl;
+    std::cout << "  Lost:      " << (sent.sent > received->received ? sent.sent - received->received : 0)
+              << " sent but not received" << std::endl;
+    std::cout << "  Latency:   p50 " << received->latency.Percentile(50) << " ns, p90 " << received->latency.Percentile(90)
+              << " ns, p99 " << received->latency.Percentile(99) << " ns, p99.9 " << received->latency.Percentile(99.9)
+              << " ns, max " << received->latency.Max() << " ns" << std::endl;
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc/ipc.h"
+
+void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [--channel msgq|shm|tcp|hybrid] [--size <bytes>] [--count <n>] [--huge-pages none|transparent|explicit]"
+              << " [--senders <n>] [--shards <n>] [--small <bytes>] [--large <bytes>]"
+              << " [--coalesce <bytes>] [--blob <bytes>] [--integrity] [--shared]" << std::endl;
+    std::cerr << "  --channel     Transport to measure (default shm), tcp runs over 127.0.0.1" << std::endl;
+    std::cerr << "  --size        Message size in bytes (default 4096)" << std::endl;
+    std::cerr << "  --count       Number of messages (default 100000)" << std::endl;
+    std::cerr << "  --huge-pages  Page size preference of the transport memory (default none)" << std::endl;
+    std::cerr << "  --senders     Number of sender threads, each with its own Node (default 1)" << std::endl;
+    std::cerr << "  --shared      All sender threads send on one shared Node instead" << std::endl;
+    std::cerr << "  --shards      Number of queues backing the msgq channel (default 1)" << std::endl;
+    std::cerr << "  --small       Hybrid: largest message taking the queue path (default 0)" << std::endl;
+    std::cerr << "  --large       Hybrid: smallest message taking the segment path (default 262144)" << std::endl;
+    std::cerr << "                Compare the paths at a size by moving the thresholds around it" << std::endl;
+    std::cerr << "  --coalesce    Pack messages into frames of up to this many bytes (default 0, off)" << std::endl;
+    std::cerr << "  --blob        Send messages of this many bytes and more through the blob arena (default 0, off)" << std::endl;
+    std::cerr << "  --integrity   Check every message with a CRC32C" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    ipc::ChannelType channel = ipc::ChannelType::kSharedMemory;
+    ipc::ChannelOptions options;
+    size_t size = 4096;
+    int count = 100000;
+    int senders = 1;
+    bool shared = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--shared") {
+            shared = true;
+            continue;
+        } else if (arg == "--integrity") {
+            options.integrity = true;
+            continue;
+        } else if (arg == "--channel" && value == "msgq") {
+            channel = ipc::ChannelType::kMessageQueue;
+        } else if (arg == "--channel" && value == "shm") {
+            channel = ipc::ChannelType::kSharedMemory;
+        } else if (arg == "--channel" && value == "tcp") {
+            channel = ipc::ChannelType::kTcp;
+        } else if (arg == "--channel" && value == "hybrid") {
+            channel = ipc::ChannelType::kHybrid;
+        } else if (arg == "--small" && !value.empty()) {
+            options.small_message_size = std::stoul(value);
+        } else if (arg == "--large" && !value.empty()) {
+            options.large_message_size = std::stoul(value);
+        } else if (arg == "--coalesce" && !value.empty()) {
+            options.coalesce_bytes = std::stoul(value);
+        } else if (arg == "--blob" && !value.empty()) {
+            options.blob_threshold = std::stoul(value);
+        } else if (arg == "--size" && !value.empty()) {
+            size = std::stoul(value);
+        } else if (arg == "--count" && !value.empty()) {
+            count = std::stoi(value);
+        } else if (arg == "--senders" && !value.empty()) {
+            senders = std::max(1, std::stoi(value));
+        } else if (arg == "--shards" && !value.empty()) {
+            options.shards = std::stoul(value);
+        } else if (arg == "--huge-pages" && value == "none") {
+            options.huge_pages = ipc::HugePages::kNone;
+        } else if (arg == "--huge-pages" && value == "transparent") {
+            options.huge_pages = ipc::HugePages::kTransparent;
+        } else if (arg == "--huge-pages" && value == "explicit") {
+            options.huge_pages = ipc::HugePages::kExplicit;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+    // Frames of coalesced messages carry a 4-byte header per message
+    options.max_message_size = options.coalesce_bytes > 0 ? std::max(size + 4, options.coalesce_bytes) : size;
+    // Blobs only pass descriptors through the transport, which keeps its default message size
+    if (options.blob_threshold > 0)
+        options.max_message_size = 0;
+    // The checksum travels in an 8-byte trailer
+    if (options.integrity && options.max_message_size > 0)
+        options.max_message_size += 8;
+
+    // Received Buffers come from pool pages of the same kind as the transport memory
+    ipc::SetBufferPoolPages(options.huge_pages);
+    // The receiver lives in this process, one thread on each side of the channel
+    ipc::MapEndpoint("ipc-bandwidth", "127.0.0.1:0");
+    ipc::Node receiver("ipc-bandwidth", ipc::NodeType::kReceiver, channel, options);
+    if (receiver.Options().max_message_size < size) {
+        std::cerr << "Message size " << size << " exceeds the maximum of the channel "
+                  << receiver.Options().max_message_size << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<ipc::Node> shared_sender;
+    if (shared)
+        shared_sender = std::make_unique<ipc::Node>("ipc-bandwidth", ipc::NodeType::kSender, channel, options);
+    std::vector<std::thread> sender_threads;
+    for (int id = 0; id < senders; id++) {
+        sender_threads.emplace_back([&, id]() {
+            std::unique_ptr<ipc::Node> own;
+            if (!shared)
+                own = std::make_unique<ipc::Node>("ipc-bandwidth", ipc::NodeType::kSender, channel, options);
+            ipc::Node& sender = shared ? *shared_sender : *own;
+            std::vector<char> msg(size, 'x');
+            for (int i = id; i < count; i += senders)
+                sender.Send(msg.data(), msg.size());
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t received = 0;
+    for (int i = 0; i < count; i++) {
+        auto rec = receiver.Receive();
+        if (!rec) {
+            std::cerr << "Error receiving message" << std::endl;
+            break;
+        }
+        received += rec->Size();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& sender_thread : sender_threads)
+        sender_thread.join();
+
+    std::cout << std::fixed << std::setprecision(3);
+    const char* channel_name = channel == ipc::ChannelType::kMessageQueue ? "msgq"
+        : channel == ipc::ChannelType::kTcp                                 ? "tcp"
+        : channel == ipc::ChannelType::kHybrid                              ? "hybrid"
+                                                                            : "shm";
+    std::cout << "Bandwidth Results (" << channel_name << ", "
+              << size << " bytes x " << count << ", " << senders << (shared ? " senders on one Node, " : " senders, ") << receiver.Options().shards << " shards, "
+              << options.coalesce_bytes << " coalesce bytes, " << options.blob_threshold << " blob threshold" << (options.integrity ? ", integrity" : "") << "):" << std::endl;
+    ipc::ChannelStats stats = receiver.Stats();
+    std::cout << "  Page size: " << stats.page_size << " bytes" << std::endl;
+    std::cout << "  Wakeups:   " << stats.wakeups << " (" << stats.sleeps << " sleeps)" << std::endl;
+    std::cout << "  Time:      " << seconds << " s" << std::endl;
+    std::cout << "  Messages:  " << count / seconds << " msg/s" << std::endl;
+    std::cout << "  Bandwidth: " << received / seconds / (1 << 30) << " GiB/s" << std::endl;
+
+    return 0;
+}
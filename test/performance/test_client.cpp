@@ -21,13 +21,40 @@ int64_t current_timestamp()
         .count();
 }
 
-int main()
+void usage(const char* prog)
 {
+    std::cerr << "Usage: " << prog << " [--busy-poll] [--cpu <id>]" << std::endl;
+    std::cerr << "  --busy-poll  Receive replies by polling instead of blocking (run the server with it too)" << std::endl;
+    std::cerr << "  --cpu <id>   Pin the client thread to a CPU" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    ipc::ChannelOptions options;
+    int cpu = -1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--busy-poll") {
+            options.busy_poll = true;
+        } else if (arg == "--cpu" && i + 1 < argc) {
+            cpu = std::stoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cpu >= 0 && !ipc::PinThread(cpu)) {
+        std::cerr << "Failed to pin to CPU " << cpu << std::endl;
+        return 1;
+    }
+    const char* mode = options.busy_poll ? "busy-poll" : "blocking";
+
     // Initialize separate channels for sending and receiving
     ipc::Node sender("ipc-latency-request", ipc::NodeType::kSender);
-    ipc::Node receiver("ipc-latency-response", ipc::NodeType::kReceiver);
+    ipc::Node receiver("ipc-latency-response", ipc::NodeType::kReceiver, ipc::ChannelType::kUnknown, options);
 
     std::cout << "Connecting to IPC server..." << std::endl;
+    std::cout << "Receive mode: " << mode << (cpu >= 0 ? ", pinned to CPU " + std::to_string(cpu) : "") << std::endl;
     std::cout << "Sending on channel: ipc-latency-request" << std::endl;
     std::cout << "Receiving on channel: ipc-latency-response" << std::endl;
 
@@ -100,7 +127,7 @@ int main()
 
     // Print results
     std::cout << std::fixed << std::setprecision(3);
-    std::cout << "\nLatency Results (IPC channel, nanoseconds):" << std::endl;
+    std::cout << "\nLatency Results (IPC channel, " << mode << ", nanoseconds):" << std::endl;
     std::cout << "  Minimum: " << min_latency << " ns" << std::endl;
     std::cout << "  Maximum: " << max_latency << " ns" << std::endl;
     std::cout << "  Average: " << avg_latency << " ns" << std::endl;
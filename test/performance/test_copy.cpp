@@ -0,0 +1,98 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "utils/copy.h"
+
+// Compares memcpy with the streaming copy used for large payloads
+// Bandwidth is measured on a destination larger than the caches, the working set column is the time to read
+// a buffer of the size of a typical L2 cache after every copy, it grows with the lines the copy evicted from it
+
+using Clock = std::chrono::steady_clock;
+
+void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [--working-set <bytes>] [--total <bytes>]" << std::endl;
+    std::cerr << "  --working-set  Bytes read back after every copy (default 1048576)" << std::endl;
+    std::cerr << "  --total        Bytes copied per measurement (default 1073741824)" << std::endl;
+}
+
+// Sum one byte per cache line so that every line is loaded
+static uint64_t Touch(const std::vector<char>& buffer)
+{
+    const volatile char* data = buffer.data();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < buffer.size(); i += 64)
+        sum += static_cast<unsigned char>(data[i]);
+    return sum;
+}
+
+struct Measurement {
+    double gib_per_second;
+    double working_set_ns; // Per cache line of the working set
+};
+
+template <typename Copy>
+static Measurement Measure(Copy copy, size_t size, size_t total, std::vector<char>& src, std::vector<char>& dst,
+    std::vector<char>& working_set, uint64_t& sink)
+{
+    // Walk through a destination larger than the caches, like a consumer that keeps new messages coming
+    const size_t slots = dst.size() / size;
+    const size_t count = std::max<size_t>(1, total / size);
+    Clock::duration copying {}, touching {};
+    for (size_t i = 0; i < count; ++i) {
+        sink += Touch(working_set);
+        Clock::time_point start = Clock::now();
+        copy(dst.data() + (i % slots) * size, src.data(), size);
+        Clock::time_point copied = Clock::now();
+        sink += Touch(working_set);
+        touching += Clock::now() - copied;
+        copying += copied - start;
+    }
+    const double seconds = std::chrono::duration<double>(copying).count();
+    const double lines = static_cast<double>(count) * (working_set.size() / 64);
+    return { static_cast<double>(count) * size / seconds / (1 << 30),
+        std::chrono::duration<double, std::nano>(touching).count() / lines };
+}
+
+int main(int argc, char** argv)
+{
+    size_t working_set_size = 1024 * 1024;
+    size_t total = size_t(1) << 30;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--working-set" && !value.empty()) {
+            working_set_size = std::stoul(value);
+        } else if (arg == "--total" && !value.empty()) {
+            total = std::stoul(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    const size_t max_size = 64 * 1024 * 1024;
+    std::vector<char> src(max_size, 'x');
+    std::vector<char> dst(4 * max_size, 0);
+    std::vector<char> working_set(working_set_size, 1);
+    uint64_t sink = 0;
+
+    std::cout << "Copy Results (working set " << working_set_size << " bytes, streaming from "
+              << StreamCopyThreshold() << " bytes in the library):" << std::endl;
+    std::cout << std::setw(10) << "Size" << std::setw(16) << "memcpy GiB/s" << std::setw(16) << "stream GiB/s"
+              << std::setw(20) << "memcpy ns/line" << std::setw(20) << "stream ns/line" << std::endl;
+    for (size_t size = 64 * 1024; size <= max_size; size *= 4) {
+        Measurement plain = Measure([](void* d, const void* s, size_t n) { memcpy(d, s, n); }, size, total, src, dst,
+            working_set, sink);
+        Measurement stream = Measure(StreamCopy, size, total, src, dst, working_set, sink);
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << size << std::setw(16)
+                  << plain.gib_per_second << std::setw(16) << stream.gib_per_second << std::setw(20)
+                  << plain.working_set_ns << std::setw(20) << stream.working_set_ns << std::endl;
+    }
+    return sink == 0 ? 0 : 0;
+}
@@ -6,13 +6,31 @@
 
 #include "ipc/ipc.h"
 
-int main()
+int main(int argc, char** argv)
 {
+    ipc::ChannelOptions options;
+    int cpu = -1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--busy-poll") {
+            options.busy_poll = true;
+        } else if (arg == "--cpu" && i + 1 < argc) {
+            cpu = std::stoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--busy-poll] [--cpu <id>]" << std::endl;
+            return 1;
+        }
+    }
+    if (cpu >= 0 && !ipc::PinThread(cpu)) {
+        std::cerr << "Failed to pin to CPU " << cpu << std::endl;
+        return 1;
+    }
+
     // Create separate channels for receiving and sending
-    ipc::Node receiver("ipc-latency-request", ipc::NodeType::kReceiver);
+    ipc::Node receiver("ipc-latency-request", ipc::NodeType::kReceiver, ipc::ChannelType::kUnknown, options);
     ipc::Node sender("ipc-latency-response", ipc::NodeType::kSender);
 
-    std::cout << "IPC echo server is running" << std::endl;
+    std::cout << "IPC echo server is running" << (options.busy_poll ? " (busy-poll)" : "") << std::endl;
     std::cout << "Receiving on channel: ipc-latency-request" << std::endl;
     std::cout << "Sending on channel: ipc-latency-response" << std::endl;
 
@@ -3,8 +3,10 @@
 #include <cinttypes>
 #include <cstdint>
 #include <fstream>
+#include <thread>
 #include <type_traits>
 #ifdef _WIN32
+#include <intrin.h>
 #include <process.h>
 #include <windows.h>
 #else
@@ -55,4 +57,18 @@ inline TID GetThreadId()
     static const thread_local TID tid = syscall(SYS_gettid);
 #endif
     return tid;
+}
+
+// Hint to the CPU that the caller is spinning, between two probes of a busy-wait loop
+inline void CpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
 }
\ No newline at end of file
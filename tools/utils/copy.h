@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IPC_STREAM_COPY_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define IPC_TARGET_AVX2
+#define IPC_TARGET_AVX512
+#else
+#define IPC_TARGET_AVX2 __attribute__((target("avx2")))
+#define IPC_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+// Payloads from half the last level cache on are copied with non-temporal stores: a plain copy that large
+// evicts most of what the other processes keep in the shared cache, and the reader finds little of the
+// payload there anyway. Below it the payload is best left in the cache for the reader
+constexpr size_t STREAM_COPY_MIN_THRESHOLD = 1024 * 1024;
+constexpr size_t STREAM_COPY_DEFAULT_CACHE = 16 * 1024 * 1024; // When the cache size is unknown
+
+namespace copy_internal {
+
+#ifdef IPC_STREAM_COPY_X86
+// Far enough ahead to cover the memory latency at the store bandwidth
+constexpr size_t PREFETCH_DISTANCE = 1024;
+
+// The destination is aligned for the streaming stores, the source may be unaligned
+inline void SSE2(char* dst, const char* src, size_t size)
+{
+    for (; size >= 64; size -= 64, src += 64, dst += 64) {
+        _mm_prefetch(src + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+    }
+}
+
+IPC_TARGET_AVX2 inline void AVX2(char* dst, const char* src, size_t size)
+{
+    for (; size >= 128; size -= 128, src += 128, dst += 128) {
+        _mm_prefetch(src + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        _mm_prefetch(src + PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96));
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+    }
+    SSE2(dst, src, size);
+}
+
+IPC_TARGET_AVX512 inline void AVX512(char* dst, const char* src, size_t size)
+{
+    for (; size >= 256; size -= 256, src += 256, dst += 256) {
+        _mm_prefetch(src + PREFETCH_DISTANCE, _MM_HINT_NTA);
+        _mm_prefetch(src + PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+        _mm_prefetch(src + PREFETCH_DISTANCE + 128, _MM_HINT_NTA);
+        _mm_prefetch(src + PREFETCH_DISTANCE + 192, _MM_HINT_NTA);
+        const __m512i a = _mm512_loadu_si512(src);
+        const __m512i b = _mm512_loadu_si512(src + 64);
+        const __m512i c = _mm512_loadu_si512(src + 128);
+        const __m512i d = _mm512_loadu_si512(src + 192);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst), a);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 64), b);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 128), c);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 192), d);
+    }
+    SSE2(dst, src, size);
+}
+
+using Kernel = void (*)(char* dst, const char* src, size_t size);
+
+// Widest stores the CPU supports, SSE2 is part of x86-64
+inline Kernel SelectKernel()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    return SSE2;
+#else
+    if (__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    return SSE2;
+#endif
+}
+#endif // IPC_STREAM_COPY_X86
+
+} // namespace copy_internal
+
+// Copy with non-temporal stores that bypass the cache of the calling core, whatever the size
+// The stores are fenced, so publishing the destination afterwards with a release store is enough
+inline void StreamCopy(void* dst, const void* src, size_t size)
+{
+#ifdef IPC_STREAM_COPY_X86
+    static const copy_internal::Kernel kernel = copy_internal::SelectKernel();
+    char* out = static_cast<char*>(dst);
+    const char* in = static_cast<const char*>(src);
+    // Streaming stores need an aligned destination, the head and the tail go through the cache
+    const size_t head = std::min<size_t>((64 - reinterpret_cast<uintptr_t>(out) % 64) % 64, size);
+    memcpy(out, in, head);
+    const size_t body = (size - head) / 64 * 64;
+    kernel(out + head, in + head, body);
+    _mm_sfence();
+    memcpy(out + head + body, in + head + body, size - head - body);
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+inline size_t StreamCopyThreshold()
+{
+    static const size_t threshold = [] {
+        size_t cache = STREAM_COPY_DEFAULT_CACHE;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+        const long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size > 0)
+            cache = static_cast<size_t>(size);
+#endif
+        return std::max(STREAM_COPY_MIN_THRESHOLD, cache / 2);
+    }();
+    return threshold;
+}
+
+// Copy of a message payload into memory read by another process, streaming from StreamCopyThreshold()
+// bytes on and a plain memcpy below
+inline void CopyPayload(void* dst, const void* src, size_t size)
+{
+    if (size >= StreamCopyThreshold())
+        StreamCopy(dst, src, size);
+    else
+        memcpy(dst, src, size);
+}
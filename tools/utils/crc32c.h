@@ -0,0 +1,225 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IPC_CRC32C_X86 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define IPC_TARGET_SSE42
+#else
+#define IPC_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+// CRC32C (Castagnoli), as used by iSCSI, ext4 and SSE4.2 crc32
+// Crc32c() continues a checksum, pass the result of the previous call to checksum data in pieces
+// CopyCrc32c() checksums while copying, so the data is read only once
+
+namespace crc32c_internal {
+
+constexpr uint32_t POLY = 0x82F63B78; // Reflected
+
+// Slicing-by-8 tables, TABLES[k][b] advances the byte b by k more zero bytes
+constexpr std::array<std::array<uint32_t, 256>, 8> MakeTables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables {};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+        tables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; ++b) {
+        for (size_t k = 1; k < 8; ++k)
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+    }
+    return tables;
+}
+inline constexpr auto TABLES = MakeTables();
+
+inline uint64_t Load64(const char* src)
+{
+    uint64_t word;
+    memcpy(&word, src, sizeof(word));
+    return word;
+}
+
+// Slicing-by-8, on raw (not inverted) state, little endian
+template <bool COPY>
+inline uint32_t Software(uint32_t crc, char* dst, const char* src, size_t size)
+{
+    while (size >= 8) {
+        const uint64_t word = Load64(src);
+        if constexpr (COPY)
+            memcpy(dst, &word, sizeof(word));
+        const uint64_t mixed = word ^ crc;
+        crc = TABLES[7][mixed & 0xFF] ^ TABLES[6][(mixed >> 8) & 0xFF] ^ TABLES[5][(mixed >> 16) & 0xFF]
+            ^ TABLES[4][(mixed >> 24) & 0xFF] ^ TABLES[3][(mixed >> 32) & 0xFF] ^ TABLES[2][(mixed >> 40) & 0xFF]
+            ^ TABLES[1][(mixed >> 48) & 0xFF] ^ TABLES[0][mixed >> 56];
+        src += 8;
+        if constexpr (COPY)
+            dst += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        if constexpr (COPY)
+            *dst++ = *src;
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ static_cast<uint8_t>(*src++)) & 0xFF];
+        --size;
+    }
+    return crc;
+}
+
+#ifdef IPC_CRC32C_X86
+// The crc32 instruction has a latency of three cycles and a throughput of one, so the hardware path
+// checksums three independent streams and combines them. Shifting a checksum over the bytes of the
+// following streams is linear, it is done with a table per byte of the checksum
+constexpr size_t LONG_BLOCK = 8192;
+constexpr size_t SHORT_BLOCK = 256;
+constexpr size_t COPY_CHUNK = 3 * LONG_BLOCK;
+
+struct ShiftTables {
+    uint32_t long_shift[4][256];
+    uint32_t short_shift[4][256];
+
+    ShiftTables()
+    {
+        Fill(long_shift, LONG_BLOCK);
+        Fill(short_shift, SHORT_BLOCK);
+    }
+
+    // table[k][b] is the state b << 8k advanced by bytes zero bytes
+    static void Fill(uint32_t (&table)[4][256], size_t bytes)
+    {
+        uint32_t basis[32];
+        for (int bit = 0; bit < 32; ++bit) {
+            uint32_t crc = uint32_t(1) << bit;
+            for (size_t i = 0; i < bytes; ++i)
+                crc = (crc >> 8) ^ TABLES[0][crc & 0xFF];
+            basis[bit] = crc;
+        }
+        for (int k = 0; k < 4; ++k) {
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t crc = 0;
+                for (int bit = 0; bit < 8; ++bit) {
+                    if (b & (1u << bit))
+                        crc ^= basis[8 * k + bit];
+                }
+                table[k][b] = crc;
+            }
+        }
+    }
+};
+
+inline const ShiftTables& Shifts()
+{
+    static const ShiftTables tables;
+    return tables;
+}
+
+inline uint32_t Shift(const uint32_t (&table)[4][256], uint32_t crc)
+{
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+IPC_TARGET_SSE42 inline uint32_t Streams(uint32_t crc, const char*& src, size_t& size, size_t block,
+    const uint32_t (&shift)[4][256])
+{
+    while (size >= 3 * block) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < block; i += 8) {
+            crc0 = _mm_crc32_u64(crc0, Load64(src + i));
+            crc1 = _mm_crc32_u64(crc1, Load64(src + block + i));
+            crc2 = _mm_crc32_u64(crc2, Load64(src + 2 * block + i));
+        }
+        crc = Shift(shift, static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+        crc = Shift(shift, crc) ^ static_cast<uint32_t>(crc2);
+        src += 3 * block;
+        size -= 3 * block;
+    }
+    return crc;
+}
+
+IPC_TARGET_SSE42 inline uint32_t Hardware(uint32_t crc, const char* src, size_t size)
+{
+    // Align the source so that the streams load whole words
+    while (size > 0 && reinterpret_cast<uintptr_t>(src) % 8 != 0) {
+        crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*src++));
+        --size;
+    }
+    const ShiftTables& shifts = Shifts();
+    crc = Streams(crc, src, size, LONG_BLOCK, shifts.long_shift);
+    crc = Streams(crc, src, size, SHORT_BLOCK, shifts.short_shift);
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        crc64 = _mm_crc32_u64(crc64, Load64(src));
+        src += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (size > 0) {
+        crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*src++));
+        --size;
+    }
+    return crc;
+}
+
+inline bool HasHardware()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    static const bool supported = [] {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+    }();
+#else
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+#endif
+    return supported;
+}
+#endif // IPC_CRC32C_X86
+
+template <bool COPY>
+inline uint32_t Dispatch(uint32_t crc, char* dst, const char* src, size_t size)
+{
+    crc = ~crc;
+#ifdef IPC_CRC32C_X86
+    if (HasHardware()) {
+        if constexpr (!COPY)
+            return ~Hardware(crc, src, size);
+        // Storing from the checksum loop stalls on loads and stores 4 KiB apart, copying a chunk with
+        // memcpy and checksumming it while it is still in the L1 cache reads the source only once as well
+        for (size_t offset = 0; offset < size; offset += COPY_CHUNK) {
+            const size_t chunk = size - offset < COPY_CHUNK ? size - offset : COPY_CHUNK;
+            memcpy(dst + offset, src + offset, chunk);
+            crc = Hardware(crc, dst + offset, chunk);
+        }
+        return ~crc;
+    }
+#endif
+    return ~Software<COPY>(crc, dst, src, size);
+}
+
+} // namespace crc32c_internal
+
+inline uint32_t Crc32c(const void* data, size_t size, uint32_t crc = 0)
+{
+    return crc32c_internal::Dispatch<false>(crc, nullptr, static_cast<const char*>(data), size);
+}
+
+// Copy size bytes from src to dst and return the checksum of them
+inline uint32_t CopyCrc32c(void* dst, const void* src, size_t size, uint32_t crc = 0)
+{
+    return crc32c_internal::Dispatch<true>(crc, static_cast<char*>(dst), static_cast<const char*>(src), size);
+}
+
+// Portable implementation, for checking the hardware one
+inline uint32_t Crc32cSoftware(const void* data, size_t size, uint32_t crc = 0)
+{
+    return ~crc32c_internal::Software<false>(~crc, nullptr, static_cast<const char*>(data), size);
+}
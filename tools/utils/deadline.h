@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "ipc/ipc.h"
+
+// Deadlines cross process boundaries as nanoseconds of steady_clock, 0 is no deadline
+inline uint64_t DeadlineTicks(ipc::Deadline deadline)
+{
+    const auto ticks = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    return ticks > 0 ? static_cast<uint64_t>(ticks) : 1;
+}
+
+// Deadline of a message sent now with ChannelOptions::ttl, 0 if there is none
+inline uint64_t TtlTicks(std::chrono::microseconds ttl)
+{
+    return ttl.count() > 0 ? DeadlineTicks(std::chrono::steady_clock::now() + ttl) : 0;
+}
+
+// Only messages with a deadline read the clock
+inline bool Expired(uint64_t deadline)
+{
+    return deadline != 0 && DeadlineTicks(std::chrono::steady_clock::now()) > deadline;
+}
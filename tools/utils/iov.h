@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ipc/ipc.h"
+#include "utils/copy.h"
+
+// Total number of bytes described by a scatter/gather list
+inline size_t IovLength(const iovec* iov, size_t iovcnt)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+        total += iov[i].iov_len;
+    return total;
+}
+
+// Copy all segments back to back into dst, returns the number of bytes written
+// Payloads from StreamCopyThreshold() bytes on bypass the cache of the calling core
+inline size_t IovGather(void* dst, const iovec* iov, size_t iovcnt)
+{
+    char* pos = static_cast<char*>(dst);
+    for (size_t i = 0; i < iovcnt; ++i) {
+        CopyPayload(pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    return pos - static_cast<char*>(dst);
+}
+
+// Spread size bytes of src over the segments in order
+// Returns false (without copying anything) if the segments are too small
+inline bool IovScatter(const iovec* iov, size_t iovcnt, const void* src, size_t size)
+{
+    if (IovLength(iov, iovcnt) < size)
+        return false;
+
+    const char* pos = static_cast<const char*>(src);
+    for (size_t i = 0; i < iovcnt && size > 0; ++i) {
+        size_t len = iov[i].iov_len < size ? iov[i].iov_len : size;
+        memcpy(iov[i].iov_base, pos, len);
+        pos += len;
+        size -= len;
+    }
+    return true;
+}
+
+// iovec arrays up to this length get the trailer appended on the stack
+constexpr size_t INLINE_IOV = 8;
+
+// Send the segments followed by trailer_size bytes of trailer as one message through channel
+// Decorators put their metadata after the payload, so that receivers strip it by shrinking the message
+// A deadline is handed down with SendBefore, for decorators that sit on top of the one keeping it
+inline SendResult SendWithTrailer(Channel& channel, const iovec* iov, size_t iovcnt, const void* trailer, size_t trailer_size,
+    const Deadline* deadline = nullptr)
+{
+    iovec inline_iov[INLINE_IOV];
+    std::vector<iovec> heap_iov;
+    iovec* all = inline_iov;
+    if (iovcnt + 1 > INLINE_IOV) {
+        heap_iov.resize(iovcnt + 1);
+        all = heap_iov.data();
+    }
+    std::copy(iov, iov + iovcnt, all);
+    all[iovcnt] = { const_cast<void*>(trailer), trailer_size };
+    if (deadline)
+        return channel.SendBefore(*deadline, all, iovcnt + 1);
+    return channel.SendV(all, iovcnt + 1);
+}
+
+// Gather buffer of at least size bytes owned by the calling thread, shared by all channels it sends on
+// so that threads sending on the same Node need no lock, valid until the next call on the thread
+inline char* ThreadGatherBuffer(size_t size)
+{
+    static thread_local std::unique_ptr<char[]> buffer;
+    static thread_local size_t capacity = 0;
+    if (capacity < size) {
+        buffer.reset(new char[size]);
+        capacity = size;
+    }
+    return buffer.get();
+}
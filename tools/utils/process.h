@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+
+#include "common.h"
+
+// Start time of a process in clock ticks since boot, 0 if it does not exist or has already exited
+// Combined with the pid it identifies a process even if the pid has been reused
+inline unsigned long long ProcessStartTime(PID pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+    std::ifstream file(path);
+    std::string stat;
+    if (!std::getline(file, stat))
+        return 0;
+
+    // The command name in field 2 may contain spaces, fields are counted from the last ')'
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos)
+        return 0;
+    std::istringstream fields(stat.substr(pos + 1));
+    char state;
+    std::string skip;
+    fields >> state;
+    // Field 3 is the state, field 22 is the start time
+    for (int i = 4; i < 22; ++i)
+        fields >> skip;
+    unsigned long long start_time = 0;
+    fields >> start_time;
+    // Zombie and dead processes no longer own anything
+    if (state == 'Z' || state == 'X')
+        return 0;
+    return start_time;
+}
+
+#endif // _WIN32
\ No newline at end of file